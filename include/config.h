@@ -3,7 +3,58 @@
 
 // Configuration constants for the MQTT broker
 #define DEFAULT_PORT 1883 // Default MQTT port
+#define METRICS_PORT 9090 // Prometheus exporter port
 #define MAX_CONNECTIONS 100 // Maximum number of simultaneous connections
+#define LISTEN_BACKLOG 4096 // Pending connection queue for the listening socket
+#define TCP_DEFER_ACCEPT_SECONDS 0 // Wake up accept only once data arrives, 0 = off
+#define MAX_EPOLL_EVENTS 256 // Events handled per reactor wakeup
 #define KEEP_ALIVE_INTERVAL 60 // Keep alive interval in seconds
+#define TOPIC_CACHE_CAPACITY 1024 // Maximum number of cached topic -> subscribers matches
+#define TOPIC_BLOOM_SLOTS 65536 // Counter slots in the no-subscriber topic prefilter
+#define TOPIC_BLOOM_HASHES 4 // Hash probes per prefix in the topic prefilter
+#define OUTBOUND_QUEUE_MAX_BYTES (1024 * 1024) // Queued outbound bytes per connection
+#define OUTBOUND_QUEUE_MAX_MESSAGES 1000 // Queued outbound messages per connection
+#define FLOW_CONTROL_HIGH_WATERMARK (256 * 1024) // Subscriber backlog that pauses publishers
+#define FLOW_CONTROL_LOW_WATERMARK (64 * 1024) // Subscriber backlog that resumes publishers
+#define RECEIVE_MAXIMUM 64 // Inbound QoS > 0 publishes a client may have unacknowledged
+#define RATE_LIMIT_CLIENT_MESSAGES 0 // Messages per second per client, 0 = unlimited
+#define RATE_LIMIT_CLIENT_BYTES 0 // Bytes per second per client, 0 = unlimited
+#define RATE_LIMIT_USER_MESSAGES 0 // Messages per second per username, 0 = unlimited
+#define RATE_LIMIT_USER_BYTES 0 // Bytes per second per username, 0 = unlimited
+#define RATE_LIMIT_BURST_SECONDS 1.0 // Token bucket depth, in seconds worth of rate
+#define CONNECTION_RATE_LIMIT 0 // Accepted connections per second, 0 = unlimited
+#define CONNECTION_RATE_BURST 1000 // Connections accepted back to back before limiting
+#define WORKER_THREADS 2 // Threads for credential checks and ACL reloads
+#define AUTH_CACHE_CAPACITY 10000 // Recently verified credentials kept, 0 = no cache
+#define AUTH_CACHE_TTL_SECONDS 300 // How long a verified credential stays cached
+#define CLUSTER_PORT 0 // Inter-node link port, 0 = clustering off
+#define CLUSTER_HOST "127.0.0.1" // Address the cluster port binds to
+#define CLUSTER_LINK_MAX_BYTES 67108864 // Queued on one inter-node link before the peer counts as stalled
+#define MAX_PACKET_SIZE 0 // Largest packet accepted and advertised in CONNACK, 0 = protocol limit
+#define CUT_THROUGH_THRESHOLD 0 // PUBLISH at least this large is forwarded as it arrives, 0 = off
+#define ZEROCOPY_THRESHOLD 0 // Frames at least this large are sent with MSG_ZEROCOPY, 0 = off
+#define HEAVY_HITTERS_TOP_K 10 // Busiest topic prefixes and clients exported per window, 0 = off
+#define HEAVY_HITTERS_WINDOW_SECONDS 10 // Window the busiest topics and clients are ranked over
+#define HEAVY_HITTERS_TOPIC_DEPTH 2 // Topic levels kept when ranking topic prefixes
+#define HEAVY_HITTERS_SKETCH_WIDTH 1024 // Counters per count-min sketch row
+#define HEAVY_HITTERS_SKETCH_DEPTH 4 // Count-min sketch rows
+#define TRACE_SAMPLE_RATE 0 // Trace one in this many publishes, 0 = off
+#define TRACE_BUFFER_EVENTS 65536 // Trace events kept in memory, oldest overwritten
+#define TRACE_FILE "mqtt-trace.json" // Chrome trace written on SIGUSR1
+#define LOW_LATENCY_SPIN_US 50 // Low-latency mode: reactor busy-polls this long before blocking
+#define LOW_LATENCY_SOCKET_BUSY_POLL_US 50 // Low-latency mode: SO_BUSY_POLL on client sockets, 0 = off
+#define ARENA_REGION_BYTES (64 * 1024 * 1024) // Address space an arena maps at a time, committed as touched
+#define EXPIRY_WHEEL_SLOTS 4096 // Slots of the timing wheel that expires retained messages
+#define EXPIRY_WHEEL_TICK_MS 1000 // Time one slot of the expiry wheel covers
+#define EXPIRY_SWEEP_BUDGET 1024 // Expiry wheel entries visited per event loop turn
+#define WAL_COMMIT_DELAY_US 0 // Write-ahead log: wait this long for more publishes before a group commit
+#define WAL_SEGMENT_BYTES (64 * 1024 * 1024) // Write-ahead log segment size before rotating
+#define WAL_COMPACT_SEGMENTS 4 // Full segments that trigger a snapshot of the retained store
+#define TLS_SESSION_CACHE_SIZE 20480 // TLS sessions kept for resumption by session id, 0 = tickets only
+#define TLS_SESSION_TIMEOUT_SECONDS 7200 // How long a TLS session or ticket can be resumed
+#define ADMIN_PORT 0 // JSON introspection endpoint, 0 = off
+#define ADMIN_HOST "127.0.0.1" // Address the admin endpoint binds to, it has no authentication
+#define ADMIN_SNAPSHOT_BATCH 512 // Connections snapshotted per event loop turn
+#define ADMIN_SNAPSHOT_TIMEOUT_SECONDS 5 // Admin request gives up on a stuck event loop after this
 
 #endif // CONFIG_H
\ No newline at end of file
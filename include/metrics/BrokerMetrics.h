@@ -7,10 +7,23 @@
 #include <prometheus/histogram.h>
 #include <prometheus/registry.h>
 #include <prometheus/exposer.h>
+#include "MetricShards.h"
+#include <array>
 #include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace mqtt {
 
+// Heavy-hitter rankings exported with a bounded label set
+enum class TopTalkers {
+    TOPIC_MESSAGES,
+    TOPIC_BYTES,
+    CLIENT_MESSAGES,
+    CLIENT_BYTES
+};
+
 class BrokerMetrics {
 public:
     BrokerMetrics();
@@ -19,6 +32,8 @@ public:
     // Gauges
     void setActiveConnections(double value);
     void setActiveSubscriptions(double value);
+    void setTopicBloomFalsePositiveRate(double value);
+    void setFlowControlPausedClients(double value);
     
     // Counters
     void incrementTotalConnections();
@@ -27,10 +42,72 @@ public:
     void incrementBytesReceived(double bytes);
     void incrementBytesSent(double bytes);
     void incrementConnectionErrors();
+    void incrementTopicCacheHits();
+    void incrementTopicCacheMisses();
+    void incrementTopicCacheInvalidations();
+    void incrementTopicBloomRejects();
+    void incrementTopicBloomFalsePositives();
+    // Also per client id, which only identifies a session when it is not empty
+    void incrementMessagesDropped(const std::string& client_id, double count);
+    void incrementSlowConsumerDisconnects();
+    void incrementFlowControlPauses();
+    void incrementReceiveMaximumExceeded();
+    void incrementRateLimitThrottles();
+    void incrementRateLimitDisconnects();
+    void incrementConnectionsRejected();
+    void incrementAuthSuccesses();
+    void incrementAuthFailures();
+    void incrementAuthCacheHits();
+    void incrementAclPublishDenied();
+    void incrementAclSubscribeDenied();
+    void incrementClusterForwarded(double count);
+    void incrementClusterReceived();
+    void incrementSessionTakeovers();
+    void setClusterPeers(double value);
+    void incrementCutThroughMessages();
+    void incrementPacketsTooLarge();
+    void incrementTransmitCopiedBytes(double bytes);
+    void incrementTransmitZeroCopyBytes(double bytes);
+    void incrementZeroCopyCompletions(double count);
+    void incrementZeroCopyCopied(double count);
+    void incrementLoopIterations(double count);
+    void incrementLoopIdleSpins(double count);
+    void incrementLoopSpinHits(double count);
+    void incrementLoopBlockingWaits(double count);
+    void incrementLoopSpinSeconds(double seconds);
+    
+    // Per-listener series, labelled with the listener address. Returns the id for the calls below.
+    size_t addListener(const std::string& listener);
+    void incrementListenerConnections(size_t listener);
+    void setListenerActiveConnections(size_t listener, double value);
+    void incrementListenerBytesReceived(size_t listener, double bytes);
+    void incrementListenerBytesSent(size_t listener, double bytes);
+    
+    // Memory arena series, labelled with the arena name and NUMA node. Returns the id for setArenaBytes().
+    size_t addArena(const std::string& arena, int node);
+    void setArenaBytes(size_t arena, double mapped, double allocated);
+    
+    // One write-ahead log group commit, a failed one only counts as such
+    void observeWalCommit(double records, double bytes, double seconds, bool ok);
+    
+    // Messages reclaimed once their Message Expiry Interval ran out, bytes count topic and payload
+    void incrementRetainedExpired(double messages, double bytes);
+    void incrementQueuedExpired(double messages, double bytes);
+    
+    // TLS listeners: handshakes by outcome, and how many left the record layer to the kernel
+    void incrementTlsHandshakes(double full, double resumed, double failed);
+    void incrementKtlsConnections(double send, double receive);
+    
+    // Replace the ranked series of one dimension, rates are per second. Keys that left
+    // the ranking are removed, so each family holds at most the top-K series.
+    void setTopTalkers(TopTalkers kind, const std::vector<std::pair<std::string, double>>& rates);
+    
+    // Drop per-client series once the client is gone
+    void removeClientMetrics(const std::string& client_id);
     
     // Histograms
     void observeMessageSize(double size);
-    
+
 private:
     std::shared_ptr<prometheus::Registry> registry_;
     std::unique_ptr<prometheus::Exposer> exposer_;
@@ -42,26 +119,144 @@ private:
     prometheus::Family<prometheus::Gauge>* active_subscriptions_family_;
     prometheus::Gauge* active_subscriptions_;
     
+    prometheus::Family<prometheus::Gauge>* topic_bloom_fp_rate_family_;
+    prometheus::Gauge* topic_bloom_fp_rate_;
+    
+    prometheus::Family<prometheus::Gauge>* flow_control_paused_family_;
+    prometheus::Gauge* flow_control_paused_;
+    
     prometheus::Family<prometheus::Counter>* total_connections_family_;
     prometheus::Counter* total_connections_;
     
-    prometheus::Family<prometheus::Counter>* messages_published_family_;
-    prometheus::Counter* messages_published_;
+    prometheus::Family<prometheus::Counter>* connection_errors_family_;
+    prometheus::Counter* connection_errors_;
     
-    prometheus::Family<prometheus::Counter>* messages_received_family_;
-    prometheus::Counter* messages_received_;
+    prometheus::Family<prometheus::Counter>* topic_cache_hits_family_;
+    prometheus::Counter* topic_cache_hits_;
     
-    prometheus::Family<prometheus::Counter>* bytes_received_family_;
-    prometheus::Counter* bytes_received_;
+    prometheus::Family<prometheus::Counter>* topic_cache_misses_family_;
+    prometheus::Counter* topic_cache_misses_;
     
-    prometheus::Family<prometheus::Counter>* bytes_sent_family_;
-    prometheus::Counter* bytes_sent_;
+    prometheus::Family<prometheus::Counter>* topic_cache_invalidations_family_;
+    prometheus::Counter* topic_cache_invalidations_;
     
-    prometheus::Family<prometheus::Counter>* connection_errors_family_;
-    prometheus::Counter* connection_errors_;
+    prometheus::Family<prometheus::Counter>* topic_bloom_rejects_family_;
+    prometheus::Counter* topic_bloom_rejects_;
+    
+    prometheus::Family<prometheus::Counter>* topic_bloom_false_positives_family_;
+    prometheus::Counter* topic_bloom_false_positives_;
+    
+    prometheus::Family<prometheus::Counter>* messages_dropped_family_;
+    prometheus::Counter* messages_dropped_;
+    
+    prometheus::Family<prometheus::Counter>* client_messages_dropped_family_;
+    std::unordered_map<std::string, prometheus::Counter*> client_messages_dropped_;
+    
+    prometheus::Family<prometheus::Counter>* slow_consumer_disconnects_family_;
+    prometheus::Counter* slow_consumer_disconnects_;
+    
+    prometheus::Family<prometheus::Counter>* flow_control_pauses_family_;
+    prometheus::Counter* flow_control_pauses_;
+    
+    prometheus::Family<prometheus::Counter>* receive_maximum_exceeded_family_;
+    prometheus::Counter* receive_maximum_exceeded_;
+    
+    prometheus::Family<prometheus::Counter>* rate_limited_family_;
+    prometheus::Counter* rate_limit_throttles_;
+    prometheus::Counter* rate_limit_disconnects_;
+    
+    prometheus::Family<prometheus::Counter>* connections_rejected_family_;
+    prometheus::Counter* connections_rejected_;
+    
+    prometheus::Family<prometheus::Counter>* auth_family_;
+    prometheus::Counter* auth_successes_;
+    prometheus::Counter* auth_failures_;
+    prometheus::Counter* auth_cache_hits_;
+    
+    prometheus::Family<prometheus::Counter>* acl_denied_family_;
+    prometheus::Counter* acl_publish_denied_;
+    prometheus::Counter* acl_subscribe_denied_;
+    
+    prometheus::Family<prometheus::Gauge>* cluster_peers_family_;
+    prometheus::Gauge* cluster_peers_;
+    prometheus::Family<prometheus::Counter>* cluster_messages_family_;
+    prometheus::Counter* cluster_forwarded_;
+    prometheus::Counter* cluster_received_;
+    prometheus::Family<prometheus::Counter>* session_takeovers_family_;
+    prometheus::Counter* session_takeovers_;
+    
+    prometheus::Family<prometheus::Counter>* cut_through_family_;
+    prometheus::Counter* cut_through_messages_;
+    prometheus::Family<prometheus::Counter>* packets_too_large_family_;
+    prometheus::Counter* packets_too_large_;
+    
+    prometheus::Family<prometheus::Counter>* transmit_bytes_family_;
+    prometheus::Counter* transmit_copied_bytes_;
+    prometheus::Counter* transmit_zerocopy_bytes_;
+    prometheus::Family<prometheus::Counter>* zerocopy_completions_family_;
+    prometheus::Counter* zerocopy_completions_;
+    prometheus::Counter* zerocopy_copied_;
+    
+    prometheus::Family<prometheus::Counter>* loop_iterations_family_;
+    prometheus::Counter* loop_iterations_;
+    prometheus::Family<prometheus::Counter>* loop_polls_family_;
+    prometheus::Counter* loop_idle_spins_;
+    prometheus::Counter* loop_spin_hits_;
+    prometheus::Counter* loop_blocking_waits_;
+    prometheus::Family<prometheus::Counter>* loop_spin_seconds_family_;
+    prometheus::Counter* loop_spin_seconds_;
+    
+    struct ListenerSeries {
+        prometheus::Counter* connections;
+        prometheus::Gauge* active_connections;
+    };
+    prometheus::Family<prometheus::Counter>* listener_connections_family_;
+    prometheus::Family<prometheus::Gauge>* listener_active_connections_family_;
+    std::vector<ListenerSeries> listeners_;
+    
+    struct ArenaSeries {
+        prometheus::Gauge* mapped;
+        prometheus::Gauge* allocated;
+    };
+    prometheus::Family<prometheus::Gauge>* arena_mapped_family_;
+    prometheus::Family<prometheus::Gauge>* arena_allocated_family_;
+    std::vector<ArenaSeries> arenas_;
+    
+    prometheus::Family<prometheus::Counter>* wal_commits_family_;
+    prometheus::Counter* wal_commits_ok_;
+    prometheus::Counter* wal_commits_failed_;
+    prometheus::Family<prometheus::Counter>* wal_records_family_;
+    prometheus::Counter* wal_records_;
+    prometheus::Family<prometheus::Counter>* wal_bytes_family_;
+    prometheus::Counter* wal_bytes_;
+    prometheus::Family<prometheus::Histogram>* wal_commit_records_family_;
+    prometheus::Histogram* wal_commit_records_;
+    prometheus::Family<prometheus::Histogram>* wal_commit_seconds_family_;
+    prometheus::Histogram* wal_commit_seconds_;
+    
+    prometheus::Family<prometheus::Counter>* messages_expired_family_;
+    prometheus::Counter* retained_expired_;
+    prometheus::Counter* queued_expired_;
+    prometheus::Family<prometheus::Counter>* expired_bytes_family_;
+    prometheus::Counter* retained_expired_bytes_;
+    prometheus::Counter* queued_expired_bytes_;
+    
+    prometheus::Family<prometheus::Counter>* tls_handshakes_family_;
+    prometheus::Counter* tls_handshakes_full_;
+    prometheus::Counter* tls_handshakes_resumed_;
+    prometheus::Counter* tls_handshakes_failed_;
+    prometheus::Family<prometheus::Counter>* ktls_connections_family_;
+    prometheus::Counter* ktls_send_;
+    prometheus::Counter* ktls_receive_;
+    
+    struct TopTalkerSeries {
+        prometheus::Family<prometheus::Gauge>* family;
+        std::unordered_map<std::string, prometheus::Gauge*> gauges;  // Ranked key -> series
+    };
+    std::array<TopTalkerSeries, 4> top_talkers_;
     
-    prometheus::Family<prometheus::Histogram>* message_size_family_;
-    prometheus::Histogram* message_size_;
+    // Per-message counters and the message size histogram, merged at scrape time
+    std::shared_ptr<MetricShards> shards_;
 };
 
 } // namespace mqtt
@@ -0,0 +1,100 @@
+// include/metrics/MessageTracer.h
+#ifndef MESSAGE_TRACER_H
+#define MESSAGE_TRACER_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace mqtt {
+
+// Stages a sampled publish passes through, in order
+enum class TraceStage : uint8_t {
+    READ,     // Socket read that completed the PUBLISH
+    DECODE,   // Packet parsed
+    MATCH,    // Subscribers matched
+    ENQUEUE,  // Frame handed to one subscriber
+    WRITE     // Frame fully written to that subscriber's socket
+};
+
+// Samples one in N publishes and timestamps each stage into a fixed ring buffer,
+// oldest events overwritten. Recording is a few stores, only the event loop thread
+// records. A snapshot is turned into Chrome trace JSON (chrome://tracing, Perfetto)
+// on demand, off the event loop.
+class MessageTracer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Event {
+        uint32_t trace;
+        TraceStage stage;
+        int32_t track;      // Socket of the connection involved, -1 for none
+        int64_t time_ns;    // Since the tracer was created
+    };
+
+    // Publisher and topic of a sampled message, to name it in the trace
+    struct Message {
+        uint32_t trace;
+        std::string client_id;
+        std::string topic;
+    };
+
+    struct Snapshot {
+        std::vector<Event> events;
+        std::vector<Message> messages;
+    };
+
+    // sample_rate 0 disables tracing
+    MessageTracer(size_t sample_rate, size_t capacity);
+
+    bool isEnabled() const { return sampleRate_ > 0; }
+
+    // Trace id for one in sample_rate calls, 0 for the others
+    uint32_t sample() {
+        if (sampleRate_ == 0 || ++sinceSample_ < sampleRate_) {
+            return 0;
+        }
+        sinceSample_ = 0;
+        if (++nextTrace_ == 0) {
+            nextTrace_ = 1;
+        }
+        return nextTrace_;
+    }
+
+    void record(uint32_t trace, TraceStage stage, int track, Clock::time_point time = Clock::now()) {
+        Event& event = events_[next_];
+        event.trace = trace;
+        event.stage = stage;
+        event.track = track;
+        event.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(time - epoch_).count();
+        if (++next_ == events_.size()) {
+            next_ = 0;
+            wrapped_ = true;
+        }
+    }
+    void describe(uint32_t trace, const std::string& client_id, const std::string& topic);
+
+    // Buffered events, oldest first
+    Snapshot snapshot() const;
+
+    // Write a snapshot as Chrome trace JSON, returns false when the file can't be written
+    static bool writeChromeTrace(const Snapshot& snapshot, const std::string& path);
+
+private:
+    size_t sampleRate_;
+    size_t sinceSample_;
+    uint32_t nextTrace_;
+    Clock::time_point epoch_;
+
+    std::vector<Event> events_;
+    size_t next_;
+    bool wrapped_;
+
+    std::vector<Message> messages_;  // Ring as well, one slot per sampled message
+    size_t nextMessage_;
+};
+
+} // namespace mqtt
+
+#endif // MESSAGE_TRACER_H
@@ -0,0 +1,89 @@
+// include/metrics/MetricShards.h
+#ifndef METRIC_SHARDS_H
+#define METRIC_SHARDS_H
+
+#include <prometheus/collectable.h>
+#include <prometheus/metric_family.h>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace mqtt {
+
+// Counters touched once per message or per subscriber. Every thread that updates them gets
+// its own cache-line aligned shard, written without read-modify-write atomics, and the shards
+// are only summed when the registry is scraped.
+class MetricShards : public prometheus::Collectable {
+public:
+    enum Counter : size_t {
+        MESSAGES_PUBLISHED,
+        MESSAGES_RECEIVED,
+        BYTES_SENT,
+        BYTES_RECEIVED,
+        COUNTER_COUNT
+    };
+
+    static constexpr size_t MAX_LISTENERS = 64;
+
+    MetricShards();
+
+    void add(Counter counter, uint64_t value) {
+        bump(shard().counters[counter], value);
+    }
+    void addListenerBytesReceived(size_t listener, uint64_t bytes);
+    void addListenerBytesSent(size_t listener, uint64_t bytes);
+    void observeMessageSize(uint64_t size);
+
+    // Listener label for the per-listener byte series. Returns false once MAX_LISTENERS is reached.
+    bool addListener(size_t listener, const std::string& label);
+
+    std::vector<prometheus::MetricFamily> Collect() const override;
+
+private:
+    // Upper bounds of mqtt_message_size_bytes, the last bucket is +Inf
+    static constexpr std::array<uint64_t, 8> SIZE_BOUNDS = {10, 50, 100, 500, 1000, 5000, 10000, 50000};
+
+    using Slot = std::atomic<uint64_t>;
+
+    struct alignas(64) Shard {
+        std::array<Slot, COUNTER_COUNT> counters{};
+        std::array<Slot, SIZE_BOUNDS.size() + 1> size_buckets{};
+        Slot size_sum{0};
+        std::array<Slot, MAX_LISTENERS> listener_bytes_received{};
+        std::array<Slot, MAX_LISTENERS> listener_bytes_sent{};
+    };
+
+    // Only the owning thread writes a slot, so a relaxed load and store is enough
+    // and compiles to a plain add. Scrapes read with relaxed loads.
+    static void bump(Slot& slot, uint64_t value) {
+        slot.store(slot.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    Shard& shard() {
+        // One cached lookup per thread, keyed by instance id so several brokers in a process don't mix
+        thread_local uint64_t owner = 0;
+        thread_local Shard* cached = nullptr;
+        if (owner != id_) {
+            cached = &attach();
+            owner = id_;
+        }
+        return *cached;
+    }
+    Shard& attach();
+
+    const uint64_t id_;
+    mutable std::mutex mutex_;  // Guards the shard list and listener labels, never taken per message
+    std::vector<std::pair<std::thread::id, std::unique_ptr<Shard>>> shards_;
+    std::vector<std::string> listeners_;
+};
+
+} // namespace mqtt
+
+#endif // METRIC_SHARDS_H
@@ -0,0 +1,268 @@
+#include "AdminServer.h"
+#include <algorithm>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+namespace mqtt {
+
+namespace {
+
+constexpr size_t MAX_REQUEST_BYTES = 8192;  // Request line and headers, the body is ignored
+constexpr int REQUEST_TIMEOUT_SECONDS = 2;  // A stalled client holds the server at most this long
+
+std::string escapeJson(const std::string& text) {
+    std::string escaped;
+    escaped.reserve(text.size());
+    for (unsigned char c : text) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += static_cast<char>(c);
+        } else if (c < 0x20) {
+            char code[8];
+            std::snprintf(code, sizeof(code), "\\u%04x", c);
+            escaped += code;
+        } else {
+            escaped += static_cast<char>(c);
+        }
+    }
+    return escaped;
+}
+
+const char* statusText(int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 503: return "Service Unavailable";
+    }
+    return "Internal Server Error";
+}
+
+void writeAll(int socket, const std::string& data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = send(socket, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return;  // Client went away or timed out
+        }
+        written += static_cast<size_t>(n);
+    }
+}
+
+} // namespace
+
+std::string toJson(const BrokerInfo& info) {
+    std::ostringstream out;
+    out << "{\"connections\":" << info.connections
+        << ",\"subscription_filters\":" << info.subscription_filters
+        << ",\"subscriptions\":" << info.subscriptions
+        << ",\"retained_messages\":" << info.retained_messages
+        << ",\"retained_bytes\":" << info.retained_bytes
+        << ",\"topic_cache_entries\":" << info.topic_cache_entries
+        << ",\"paused_clients\":" << info.paused_clients
+        << ",\"cut_through_streams\":" << info.cut_through_streams
+        << ",\"cluster_peers\":" << info.cluster_peers
+        << ",\"uptime_seconds\":" << info.uptime_seconds
+        << ",\"loop_iterations\":" << info.loop_iterations
+        << ",\"loop_idle_spins\":" << info.loop_idle_spins
+        << ",\"loop_spin_seconds\":" << info.loop_spin_seconds
+        << ",\"arena_mapped_bytes\":" << info.arena_mapped_bytes
+        << ",\"arena_allocated_bytes\":" << info.arena_allocated_bytes << "}\n";
+    return out.str();
+}
+
+std::string toJson(const std::vector<ConnectionInfo>& connections, size_t total) {
+    std::ostringstream out;
+    out << "{\"total\":" << total << ",\"connections\":[";
+    bool first = true;
+    for (const ConnectionInfo& info : connections) {
+        out << (first ? "\n" : ",\n");
+        first = false;
+        out << "{\"client_id\":\"" << escapeJson(info.client_id)
+            << "\",\"username\":\"" << escapeJson(info.username)
+            << "\",\"address\":\"" << escapeJson(info.address)
+            << "\",\"listener\":\"" << escapeJson(info.listener)
+            << "\",\"keep_alive\":" << info.keep_alive
+            << ",\"connected_seconds\":" << info.connected_seconds
+            << ",\"bytes_in\":" << info.bytes_in
+            << ",\"bytes_out\":" << info.bytes_out
+            << ",\"messages_in\":" << info.messages_in
+            << ",\"messages_out\":" << info.messages_out
+            << ",\"queued_bytes\":" << info.queued_bytes
+            << ",\"queued_messages\":" << info.queued_messages
+            << ",\"dropped_messages\":" << info.dropped_messages
+            << ",\"inflight\":" << info.inflight
+            << ",\"zerocopy_inflight\":" << info.zerocopy_inflight
+            << ",\"inbound_buffer_bytes\":" << info.inbound_buffer_bytes
+            << ",\"subscriptions\":" << info.subscriptions
+            << ",\"tls\":\"" << info.tls
+            << "\",\"ktls\":\"" << info.ktls
+            << "\",\"state\":\"" << info.state << "\"}";
+    }
+    out << "\n]}\n";
+    return out.str();
+}
+
+std::string queryParameter(const std::string& query, const std::string& name) {
+    std::istringstream parameters(query);
+    std::string parameter;
+    while (std::getline(parameters, parameter, '&')) {
+        size_t equals = parameter.find('=');
+        if (parameter.compare(0, equals, name) == 0 && equals == name.size()) {
+            return parameter.substr(equals + 1);
+        }
+    }
+    return "";
+}
+
+bool sortConnections(std::vector<ConnectionInfo>& connections, const std::string& field) {
+    static const std::map<std::string, double (*)(const ConnectionInfo&)> fields = {
+        {"connected_seconds", [](const ConnectionInfo& c) { return c.connected_seconds; }},
+        {"bytes_in", [](const ConnectionInfo& c) { return static_cast<double>(c.bytes_in); }},
+        {"bytes_out", [](const ConnectionInfo& c) { return static_cast<double>(c.bytes_out); }},
+        {"messages_in", [](const ConnectionInfo& c) { return static_cast<double>(c.messages_in); }},
+        {"messages_out", [](const ConnectionInfo& c) { return static_cast<double>(c.messages_out); }},
+        {"queued_bytes", [](const ConnectionInfo& c) { return static_cast<double>(c.queued_bytes); }},
+        {"queued_messages", [](const ConnectionInfo& c) { return static_cast<double>(c.queued_messages); }},
+        {"dropped_messages", [](const ConnectionInfo& c) { return static_cast<double>(c.dropped_messages); }},
+        {"inflight", [](const ConnectionInfo& c) { return static_cast<double>(c.inflight); }},
+        {"zerocopy_inflight", [](const ConnectionInfo& c) { return static_cast<double>(c.zerocopy_inflight); }},
+        {"inbound_buffer_bytes", [](const ConnectionInfo& c) { return static_cast<double>(c.inbound_buffer_bytes); }},
+        {"subscriptions", [](const ConnectionInfo& c) { return static_cast<double>(c.subscriptions); }},
+    };
+    auto it = fields.find(field);
+    if (it == fields.end()) {
+        return false;
+    }
+    auto key = it->second;
+    std::stable_sort(connections.begin(), connections.end(),
+                     [key](const ConnectionInfo& a, const ConnectionInfo& b) { return key(a) > key(b); });
+    return true;
+}
+
+AdminServer::AdminServer(const std::string& host, int port, Handler handler)
+    : handler_(std::move(handler)), listenSocket_(-1), stopFd_(-1) {
+    struct addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    struct addrinfo* result = nullptr;
+    std::string service = std::to_string(port);
+    if (getaddrinfo(host.empty() ? nullptr : host.c_str(), service.c_str(), &hints, &result) != 0) {
+        throw std::runtime_error("Cannot resolve admin address " + host);
+    }
+    
+    listenSocket_ = socket(result->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenSocket_ < 0) {
+        std::string error = std::strerror(errno);
+        freeaddrinfo(result);
+        throw std::runtime_error("Failed to create admin socket: " + error);
+    }
+    int opt = 1;
+    setsockopt(listenSocket_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    int rc = bind(listenSocket_, result->ai_addr, result->ai_addrlen);
+    freeaddrinfo(result);
+    if (rc < 0 || listen(listenSocket_, 16) < 0) {
+        std::string error = std::strerror(errno);
+        close(listenSocket_);
+        throw std::runtime_error("Failed to bind admin port " + service + ": " + error);
+    }
+    
+    stopFd_ = eventfd(0, EFD_CLOEXEC);
+    thread_ = std::thread(&AdminServer::serve, this);
+}
+
+AdminServer::~AdminServer() {
+    uint64_t one = 1;
+    ssize_t written = write(stopFd_, &one, sizeof(one));
+    (void)written;
+    thread_.join();
+    close(listenSocket_);
+    close(stopFd_);
+}
+
+void AdminServer::serve() {
+    while (true) {
+        struct pollfd fds[2] = {{listenSocket_, POLLIN, 0}, {stopFd_, POLLIN, 0}};
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Admin server poll failed: " << std::strerror(errno) << std::endl;
+            return;
+        }
+        if (fds[1].revents) {
+            return;
+        }
+        
+        int socket = accept4(listenSocket_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (socket < 0) {
+            continue;
+        }
+        struct timeval timeout = {REQUEST_TIMEOUT_SECONDS, 0};
+        setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        handleRequest(socket);
+        close(socket);
+    }
+}
+
+void AdminServer::handleRequest(int socket) {
+    // Only the request line matters, read until the end of the headers
+    std::string request;
+    char buffer[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < MAX_REQUEST_BYTES) {
+        ssize_t n = recv(socket, buffer, sizeof(buffer), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        request.append(buffer, static_cast<size_t>(n));
+    }
+    
+    std::istringstream line(request.substr(0, request.find("\r\n")));
+    std::string method;
+    std::string target;
+    line >> method >> target;
+    
+    int status;
+    std::string body;
+    if (method.empty() || target.empty() || target[0] != '/') {
+        status = 400;
+        body = "{\"error\":\"bad request\"}\n";
+    } else if (method != "GET") {
+        status = 405;
+        body = "{\"error\":\"only GET is supported\"}\n";
+    } else {
+        size_t question = target.find('?');
+        std::string path = target.substr(0, question);
+        std::string query = question == std::string::npos ? "" : target.substr(question + 1);
+        status = handler_(path, query, body);
+    }
+    
+    std::string response = "HTTP/1.1 " + std::to_string(status) + " " + statusText(status) + "\r\n"
+                           "Content-Type: application/json\r\n"
+                           "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                           "Connection: close\r\n\r\n" + body;
+    writeAll(socket, response);
+}
+
+} // namespace mqtt
@@ -0,0 +1,90 @@
+#ifndef ADMIN_SERVER_H
+#define ADMIN_SERVER_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace mqtt {
+
+// State of one client connection as the admin endpoint reports it
+struct ConnectionInfo {
+    std::string client_id;
+    std::string username;
+    std::string address;
+    std::string listener;
+    uint16_t keep_alive = 0;
+    double connected_seconds = 0;
+    uint64_t bytes_in = 0;
+    uint64_t bytes_out = 0;
+    uint64_t messages_in = 0;
+    uint64_t messages_out = 0;
+    size_t queued_bytes = 0;      // Outbound queue not yet written to the socket
+    size_t queued_messages = 0;
+    uint64_t dropped_messages = 0;
+    size_t inflight = 0;          // Inbound QoS 1 publishes not yet acknowledged
+    size_t zerocopy_inflight = 0; // Sends the kernel still holds buffers for
+    size_t inbound_buffer_bytes = 0;
+    size_t subscriptions = 0;
+    std::string tls;              // Protocol version, empty for plain connections
+    std::string ktls;             // Record layer in the kernel: "send", "receive", "both" or "none"
+    std::string state;            // "reading", "backpressured", "throttled", "authenticating" or "connecting"
+};
+
+// Broker-wide totals
+struct BrokerInfo {
+    size_t connections = 0;
+    size_t subscription_filters = 0;  // Entries in the subscription table
+    size_t subscriptions = 0;         // Client subscriptions across all filters
+    size_t retained_messages = 0;
+    size_t retained_bytes = 0;        // Topics and payloads of the retained store
+    size_t topic_cache_entries = 0;
+    size_t paused_clients = 0;
+    size_t cut_through_streams = 0;
+    size_t cluster_peers = 0;
+    double uptime_seconds = 0;
+    uint64_t loop_iterations = 0;
+    uint64_t loop_idle_spins = 0;     // Low-latency mode polls that found nothing
+    double loop_spin_seconds = 0;
+    size_t arena_mapped_bytes = 0;     // Connection memory arena, 0 without one
+    size_t arena_allocated_bytes = 0;
+};
+
+std::string toJson(const BrokerInfo& info);
+std::string toJson(const std::vector<ConnectionInfo>& connections, size_t total);
+
+// Value of a query string parameter, empty when it is absent
+std::string queryParameter(const std::string& query, const std::string& name);
+// Largest first by a numeric field name as in the JSON, false when there is no such field
+bool sortConnections(std::vector<ConnectionInfo>& connections, const std::string& field);
+
+// Minimal HTTP/1.1 server for the admin endpoint. Serves one request per connection on a
+// thread of its own, so a slow scraper never touches the event loop; the handler collects
+// what it needs from the broker itself.
+class AdminServer {
+public:
+    // Gets the request path and query string, fills in the JSON body, returns the HTTP status
+    using Handler = std::function<int(const std::string& path, const std::string& query, std::string& body)>;
+    
+    // Throws std::runtime_error when the port can't be bound
+    AdminServer(const std::string& host, int port, Handler handler);
+    ~AdminServer();
+    
+    AdminServer(const AdminServer&) = delete;
+    AdminServer& operator=(const AdminServer&) = delete;
+
+private:
+    void serve();
+    void handleRequest(int socket);
+    
+    Handler handler_;
+    int listenSocket_;
+    int stopFd_;  // eventfd, wakes the server thread to exit
+    std::thread thread_;
+};
+
+} // namespace mqtt
+
+#endif // ADMIN_SERVER_H
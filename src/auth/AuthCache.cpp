@@ -0,0 +1,73 @@
+#include "AuthCache.h"
+#include <cstring>
+#include <openssl/evp.h>
+
+namespace mqtt {
+
+AuthCache::AuthCache(size_t capacity, std::chrono::seconds ttl) : capacity_(capacity), ttl_(ttl) {}
+
+size_t AuthCache::KeyHash::operator()(const Key& key) const {
+    // Already a cryptographic digest, any 8 bytes will do
+    size_t value;
+    std::memcpy(&value, key.data(), sizeof(value));
+    return value;
+}
+
+AuthCache::Key AuthCache::digest(const std::string& username, const std::string& password) {
+    Key key{};
+    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+    EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr);
+    EVP_DigestUpdate(ctx, username.data(), username.size());
+    EVP_DigestUpdate(ctx, "\0", 1);
+    EVP_DigestUpdate(ctx, password.data(), password.size());
+    EVP_DigestFinal_ex(ctx, key.data(), nullptr);
+    EVP_MD_CTX_free(ctx);
+    return key;
+}
+
+bool AuthCache::contains(const std::string& username, const std::string& password) {
+    if (capacity_ == 0) {
+        return false;
+    }
+    
+    auto it = index_.find(digest(username, password));
+    if (it == index_.end()) {
+        return false;
+    }
+    
+    if (it->second->expires <= std::chrono::steady_clock::now()) {
+        entries_.erase(it->second);
+        index_.erase(it);
+        return false;
+    }
+    
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return true;
+}
+
+void AuthCache::insert(const std::string& username, const std::string& password) {
+    if (capacity_ == 0) {
+        return;
+    }
+    
+    Key key = digest(username, password);
+    auto expires = std::chrono::steady_clock::now() + ttl_;
+    
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+        it->second->expires = expires;
+        entries_.splice(entries_.begin(), entries_, it->second);
+        return;
+    }
+    
+    // Evict least recently used entry
+    if (index_.size() >= capacity_) {
+        index_.erase(entries_.back().key);
+        entries_.pop_back();
+    }
+    
+    entries_.push_front(Entry{key, expires});
+    index_[key] = entries_.begin();
+}
+
+} // namespace mqtt
@@ -0,0 +1,44 @@
+#ifndef AUTH_CACHE_H
+#define AUTH_CACHE_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+namespace mqtt {
+
+// Bounded LRU of recently verified credentials, so reconnect storms don't
+// rehash every password. Only a SHA-256 digest of the credentials is kept.
+class AuthCache {
+public:
+    AuthCache(size_t capacity, std::chrono::seconds ttl);
+    
+    bool contains(const std::string& username, const std::string& password);
+    void insert(const std::string& username, const std::string& password);
+    
+private:
+    using Key = std::array<uint8_t, 32>;
+    
+    struct KeyHash {
+        size_t operator()(const Key& key) const;
+    };
+    
+    struct Entry {
+        Key key;
+        std::chrono::steady_clock::time_point expires;
+    };
+    
+    static Key digest(const std::string& username, const std::string& password);
+    
+    size_t capacity_;
+    std::chrono::seconds ttl_;
+    std::list<Entry> entries_;  // Most recently used first
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index_;
+};
+
+} // namespace mqtt
+
+#endif // AUTH_CACHE_H
@@ -0,0 +1,21 @@
+#ifndef AUTHENTICATOR_H
+#define AUTHENTICATOR_H
+
+#include <string>
+
+namespace mqtt {
+
+// Verifies CONNECT credentials. Implementations may be slow (password
+// hashing, remote lookups): they run on a worker thread and must be
+// safe to call concurrently.
+class Authenticator {
+public:
+    virtual ~Authenticator() = default;
+    
+    virtual bool authenticate(const std::string& client_id, const std::string& username,
+                              const std::string& password) = 0;
+};
+
+} // namespace mqtt
+
+#endif // AUTHENTICATOR_H
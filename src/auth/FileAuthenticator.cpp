@@ -0,0 +1,104 @@
+#include "FileAuthenticator.h"
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+
+namespace mqtt {
+
+namespace {
+
+std::vector<uint8_t> fromHex(const std::string& hex) {
+    if (hex.size() % 2 != 0) {
+        throw std::runtime_error("Odd length hex string");
+    }
+    std::vector<uint8_t> bytes;
+    bytes.reserve(hex.size() / 2);
+    for (size_t i = 0; i < hex.size(); i += 2) {
+        bytes.push_back(static_cast<uint8_t>(std::stoul(hex.substr(i, 2), nullptr, 16)));
+    }
+    return bytes;
+}
+
+std::vector<std::string> split(const std::string& line, char separator, size_t max_fields) {
+    std::vector<std::string> fields;
+    size_t start = 0;
+    while (fields.size() + 1 < max_fields) {
+        size_t end = line.find(separator, start);
+        if (end == std::string::npos) {
+            break;
+        }
+        fields.push_back(line.substr(start, end - start));
+        start = end + 1;
+    }
+    fields.push_back(line.substr(start));  // The last field keeps any separators
+    return fields;
+}
+
+} // namespace
+
+FileAuthenticator::FileAuthenticator(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error("Cannot open password file: " + path);
+    }
+    
+    std::string line;
+    size_t line_number = 0;
+    while (std::getline(file, line)) {
+        ++line_number;
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        
+        try {
+            auto fields = split(line, ':', 3);
+            Credential credential{};
+            if (fields.size() == 3 && fields[1] == "plain") {
+                credential.plain = true;
+                credential.hash.assign(fields[2].begin(), fields[2].end());
+            } else if (fields.size() == 3 && fields[1] == "pbkdf2") {
+                auto params = split(fields[2], ':', 3);
+                if (params.size() != 3) {
+                    throw std::runtime_error("expected iterations, salt and hash");
+                }
+                credential.plain = false;
+                credential.iterations = static_cast<unsigned>(std::stoul(params[0]));
+                credential.salt = fromHex(params[1]);
+                credential.hash = fromHex(params[2]);
+            } else {
+                throw std::runtime_error("unknown entry format");
+            }
+            users_[fields[0]] = std::move(credential);
+        } catch (const std::exception& e) {
+            std::cerr << path << ":" << line_number << ": ignoring entry, " << e.what() << std::endl;
+        }
+    }
+}
+
+bool FileAuthenticator::authenticate(const std::string& /*client_id*/, const std::string& username,
+                                     const std::string& password) {
+    auto it = users_.find(username);
+    if (it == users_.end()) {
+        return false;
+    }
+    const Credential& credential = it->second;
+    
+    if (credential.plain) {
+        return credential.hash.size() == password.size() &&
+               CRYPTO_memcmp(credential.hash.data(), password.data(), password.size()) == 0;
+    }
+    
+    std::vector<uint8_t> derived(credential.hash.size());
+    if (PKCS5_PBKDF2_HMAC(password.data(), static_cast<int>(password.size()),
+                          credential.salt.data(), static_cast<int>(credential.salt.size()),
+                          static_cast<int>(credential.iterations), EVP_sha256(),
+                          static_cast<int>(derived.size()), derived.data()) != 1) {
+        return false;
+    }
+    return CRYPTO_memcmp(derived.data(), credential.hash.data(), derived.size()) == 0;
+}
+
+} // namespace mqtt
@@ -0,0 +1,38 @@
+#ifndef FILE_AUTHENTICATOR_H
+#define FILE_AUTHENTICATOR_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Authenticator.h"
+
+namespace mqtt {
+
+// Password file authenticator, one user per line:
+//   username:pbkdf2:<iterations>:<salt hex>:<sha256 hash hex>
+//   username:plain:<password>          (local testing only)
+// Blank lines and lines starting with '#' are ignored.
+class FileAuthenticator : public Authenticator {
+public:
+    explicit FileAuthenticator(const std::string& path);
+    
+    bool authenticate(const std::string& client_id, const std::string& username,
+                      const std::string& password) override;
+    
+    size_t size() const { return users_.size(); }
+    
+private:
+    struct Credential {
+        bool plain;
+        unsigned iterations;
+        std::vector<uint8_t> salt;
+        std::vector<uint8_t> hash;  // Or the password itself when plain
+    };
+    
+    std::unordered_map<std::string, Credential> users_;
+};
+
+} // namespace mqtt
+
+#endif // FILE_AUTHENTICATOR_H
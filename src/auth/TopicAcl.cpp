@@ -0,0 +1,225 @@
+#include "TopicAcl.h"
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace mqtt {
+
+namespace {
+
+std::atomic<uint64_t> nextGeneration{1};
+
+std::vector<std::string> splitLevels(const std::string& topic) {
+    std::vector<std::string> levels;
+    size_t start = 0;
+    while (true) {
+        size_t end = topic.find('/', start);
+        if (end == std::string::npos) {
+            levels.push_back(topic.substr(start));
+            return levels;
+        }
+        levels.push_back(topic.substr(start, end - start));
+        start = end + 1;
+    }
+}
+
+uint8_t parseAccess(const std::string& word) {
+    if (word == "read") {
+        return ACL_READ;
+    }
+    if (word == "write") {
+        return ACL_WRITE;
+    }
+    if (word == "readwrite") {
+        return ACL_READWRITE;
+    }
+    return 0;
+}
+
+} // namespace
+
+TopicAcl::TopicAcl() : generation_(nextGeneration++), rules_(0) {}
+
+std::shared_ptr<const TopicAcl> TopicAcl::load(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error("Cannot open ACL file: " + path);
+    }
+    
+    std::shared_ptr<TopicAcl> acl(new TopicAcl());
+    Node* scope = &acl->everyone_;
+    
+    std::string line;
+    size_t line_number = 0;
+    while (std::getline(file, line)) {
+        ++line_number;
+        std::istringstream words(line);
+        std::string keyword;
+        if (!(words >> keyword) || keyword[0] == '#') {
+            continue;
+        }
+        
+        std::string argument;
+        std::getline(words >> std::ws, argument);
+        while (!argument.empty() && (argument.back() == ' ' || argument.back() == '\r')) {
+            argument.pop_back();
+        }
+        if (argument.empty()) {
+            throw std::runtime_error(path + ":" + std::to_string(line_number) + ": missing argument");
+        }
+        
+        if (keyword == "user") {
+            scope = &acl->users_[argument];
+        } else if (keyword == "client") {
+            scope = &acl->clients_[argument];
+        } else if (keyword == "topic" || keyword == "pattern") {
+            // Optional access word, topics never contain spaces before a filter
+            uint8_t access = ACL_READWRITE;
+            size_t space = argument.find(' ');
+            if (space != std::string::npos && parseAccess(argument.substr(0, space)) != 0) {
+                access = parseAccess(argument.substr(0, space));
+                argument = argument.substr(space + 1);
+                argument.erase(0, argument.find_first_not_of(' '));
+            }
+            
+            try {
+                bool pattern = keyword == "pattern";
+                acl->addRule(pattern ? acl->everyone_ : *scope, argument, access, pattern);
+            } catch (const std::exception& e) {
+                throw std::runtime_error(path + ":" + std::to_string(line_number) + ": " + e.what());
+            }
+        } else {
+            throw std::runtime_error(path + ":" + std::to_string(line_number) + ": unknown keyword " + keyword);
+        }
+    }
+    
+    return acl;
+}
+
+void TopicAcl::addRule(Node& root, const std::string& filter, uint8_t access, bool pattern) {
+    std::vector<std::string> levels = splitLevels(filter);
+    Node* node = &root;
+    
+    for (size_t i = 0; i < levels.size(); ++i) {
+        const std::string& level = levels[i];
+        
+        if (level == "#") {
+            if (i + 1 != levels.size()) {
+                throw std::runtime_error("'#' must be the last level in " + filter);
+            }
+            node->multi_level |= access;
+            ++rules_;
+            return;
+        }
+        if (level.find_first_of("+#") != std::string::npos && level != "+") {
+            throw std::runtime_error("wildcards must occupy a whole level in " + filter);
+        }
+        
+        if (level == "+") {
+            if (!node->single_level) {
+                node->single_level = std::make_unique<Node>();
+            }
+            node = node->single_level.get();
+        } else if (pattern && (level.find("%u") != std::string::npos || level.find("%c") != std::string::npos)) {
+            auto it = node->templates.begin();
+            while (it != node->templates.end() && it->first != level) {
+                ++it;
+            }
+            if (it == node->templates.end()) {
+                node->templates.emplace_back(level, std::make_unique<Node>());
+                it = node->templates.end() - 1;
+            }
+            node = it->second.get();
+        } else {
+            auto& child = node->children[level];
+            if (!child) {
+                child = std::make_unique<Node>();
+            }
+            node = child.get();
+        }
+    }
+    
+    node->access |= access;
+    ++rules_;
+}
+
+bool TopicAcl::substitute(const std::string& level_template, const Subject& subject, std::string& out) {
+    out.clear();
+    for (size_t i = 0; i < level_template.size(); ++i) {
+        if (level_template[i] == '%' && i + 1 < level_template.size() &&
+            (level_template[i + 1] == 'u' || level_template[i + 1] == 'c')) {
+            const std::string& value = level_template[i + 1] == 'u' ? subject.username : subject.client_id;
+            // Identities that are empty or could act as wildcards never match a pattern
+            if (value.empty() || value.find_first_of("/+#") != std::string::npos) {
+                return false;
+            }
+            out += value;
+            ++i;
+        } else {
+            out += level_template[i];
+        }
+    }
+    return true;
+}
+
+uint8_t TopicAcl::collect(const Node& node, const std::vector<std::string>& levels, size_t index,
+                          const Subject& subject, uint8_t wanted, bool is_filter) {
+    // Wildcards at the first level never match topics starting with '$'
+    bool system_topic = index == 0 && !levels[0].empty() && levels[0][0] == '$';
+    
+    uint8_t granted = system_topic ? 0 : node.multi_level;
+    if (index == levels.size()) {
+        return granted | node.access;
+    }
+    
+    const std::string& level = levels[index];
+    if (is_filter && level == "#") {
+        return granted;  // Only covered by a '#' rule
+    }
+    
+    if (!is_filter || level != "+") {
+        auto it = node.children.find(level);
+        if (it != node.children.end()) {
+            granted |= collect(*it->second, levels, index + 1, subject, wanted, is_filter);
+        }
+        
+        std::string substituted;
+        for (const auto& [level_template, child] : node.templates) {
+            if ((granted & wanted) == wanted) {
+                break;
+            }
+            if (substitute(level_template, subject, substituted) && substituted == level) {
+                granted |= collect(*child, levels, index + 1, subject, wanted, is_filter);
+            }
+        }
+    }
+    
+    if (node.single_level && !system_topic && (granted & wanted) != wanted) {
+        granted |= collect(*node.single_level, levels, index + 1, subject, wanted, is_filter);
+    }
+    
+    return granted;
+}
+
+bool TopicAcl::allows(const std::string& username, const std::string& client_id,
+                      const std::string& topic, AclAccess access, bool is_filter) const {
+    std::vector<std::string> levels = splitLevels(topic);
+    Subject subject{username, client_id};
+    
+    if ((collect(everyone_, levels, 0, subject, access, is_filter) & access) == access) {
+        return true;
+    }
+    
+    auto user = users_.find(username);
+    if (!username.empty() && user != users_.end() &&
+        (collect(user->second, levels, 0, subject, access, is_filter) & access) == access) {
+        return true;
+    }
+    
+    auto client = clients_.find(client_id);
+    return client != clients_.end() &&
+           (collect(client->second, levels, 0, subject, access, is_filter) & access) == access;
+}
+
+} // namespace mqtt
@@ -0,0 +1,72 @@
+#ifndef TOPIC_ACL_H
+#define TOPIC_ACL_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace mqtt {
+
+enum AclAccess : uint8_t {
+    ACL_READ = 1,   // Subscribe
+    ACL_WRITE = 2,  // Publish
+    ACL_READWRITE = ACL_READ | ACL_WRITE
+};
+
+// Topic access rules compiled into one trie per scope, so a check walks the
+// topic levels once instead of matching every rule. Rule file syntax:
+//   topic [read|write|readwrite] <filter>    rule for the current scope
+//   user <username>                          following topic rules apply to this user
+//   client <client id>                       following topic rules apply to this client
+//   pattern [read|write|readwrite] <filter>  rule for everyone, %u and %c in a
+//                                            level are replaced by username and client id
+// Topic rules before the first user or client line apply to everyone.
+// Anything not granted is denied.
+class TopicAcl {
+public:
+    // Throws on unreadable files and malformed rules
+    static std::shared_ptr<const TopicAcl> load(const std::string& path);
+    
+    // Checks a PUBLISH topic, or a SUBSCRIBE filter which must be covered by a
+    // rule with the same or wider wildcards
+    bool allows(const std::string& username, const std::string& client_id,
+                const std::string& topic, AclAccess access, bool is_filter = false) const;
+    
+    // Changes with every load, to invalidate decisions cached by sessions
+    uint64_t getGeneration() const { return generation_; }
+    size_t getRuleCount() const { return rules_; }
+    
+private:
+    struct Node {
+        uint8_t access = 0;       // Rules ending at this level
+        uint8_t multi_level = 0;  // Rules ending with '#' below this level
+        std::unordered_map<std::string, std::unique_ptr<Node>> children;
+        std::unique_ptr<Node> single_level;  // '+'
+        std::vector<std::pair<std::string, std::unique_ptr<Node>>> templates;  // Levels with %u or %c
+    };
+    
+    struct Subject {
+        const std::string& username;
+        const std::string& client_id;
+    };
+    
+    TopicAcl();
+    
+    void addRule(Node& root, const std::string& filter, uint8_t access, bool pattern);
+    static uint8_t collect(const Node& node, const std::vector<std::string>& levels, size_t index,
+                           const Subject& subject, uint8_t wanted, bool is_filter);
+    static bool substitute(const std::string& level_template, const Subject& subject, std::string& out);
+    
+    Node everyone_;
+    std::unordered_map<std::string, Node> users_;
+    std::unordered_map<std::string, Node> clients_;
+    uint64_t generation_;
+    size_t rules_;
+};
+
+} // namespace mqtt
+
+#endif // TOPIC_ACL_H
@@ -0,0 +1,238 @@
+#include "BrokerConfig.h"
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+namespace mqtt {
+
+namespace {
+
+void readSize(const char* name, size_t& value) {
+    const char* env = std::getenv(name);
+    if (env == nullptr || *env == '\0') {
+        return;
+    }
+    try {
+        value = static_cast<size_t>(std::stoull(env));
+    } catch (const std::exception&) {
+        std::cerr << "Ignoring invalid value for " << name << ": " << env << std::endl;
+    }
+}
+
+void readDouble(const char* name, double& value) {
+    const char* env = std::getenv(name);
+    if (env == nullptr || *env == '\0') {
+        return;
+    }
+    try {
+        value = std::stod(env);
+    } catch (const std::exception&) {
+        std::cerr << "Ignoring invalid value for " << name << ": " << env << std::endl;
+    }
+}
+
+void readInt(const char* name, int& value) {
+    size_t parsed = static_cast<size_t>(value);
+    readSize(name, parsed);
+    value = static_cast<int>(parsed);
+}
+
+void readList(const char* name, std::vector<std::string>& values) {
+    const char* env = std::getenv(name);
+    if (env == nullptr) {
+        return;
+    }
+    std::stringstream list(env);
+    std::string value;
+    while (std::getline(list, value, ',')) {
+        if (!value.empty()) {
+            values.push_back(value);
+        }
+    }
+}
+
+void readBool(const char* name, bool& value) {
+    const char* env = std::getenv(name);
+    if (env == nullptr || *env == '\0') {
+        return;
+    }
+    std::string text(env);
+    value = text == "1" || text == "true" || text == "yes" || text == "on";
+}
+
+// "2", "2,3" or "0-3,8"
+void readCpuList(const char* name, std::vector<int>& cpus) {
+    std::vector<std::string> ranges;
+    readList(name, ranges);
+    for (const auto& range : ranges) {
+        try {
+            size_t dash = range.find('-');
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        } catch (const std::exception&) {
+            std::cerr << "Ignoring invalid CPU range in " << name << ": " << range << std::endl;
+        }
+    }
+}
+
+} // namespace
+
+OutboundLimits BrokerConfig::outboundLimits() const {
+    return OutboundLimits{outbound_max_bytes, outbound_max_messages, overflow_policy};
+}
+
+BrokerConfig BrokerConfig::fromEnvironment() {
+    BrokerConfig config;
+    
+    readInt("MQTT_PORT", config.port);
+    readInt("MQTT_METRICS_PORT", config.metrics_port);
+    readInt("MQTT_ADMIN_PORT", config.admin_port);
+    if (const char* admin_host = std::getenv("MQTT_ADMIN_HOST")) {
+        config.admin_host = admin_host;
+    }
+    readList("MQTT_LISTENERS", config.listeners);
+    readInt("MQTT_LISTEN_BACKLOG", config.listen_backlog);
+    readInt("MQTT_TCP_DEFER_ACCEPT", config.tcp_defer_accept);
+    
+    readSize("MQTT_OUTBOUND_MAX_BYTES", config.outbound_max_bytes);
+    readSize("MQTT_OUTBOUND_MAX_MESSAGES", config.outbound_max_messages);
+    
+    readBool("MQTT_FLOW_CONTROL", config.flow_control);
+    readSize("MQTT_FLOW_HIGH_WATERMARK", config.flow_high_watermark);
+    readSize("MQTT_FLOW_LOW_WATERMARK", config.flow_low_watermark);
+    size_t receive_maximum = config.receive_maximum;
+    readSize("MQTT_RECEIVE_MAXIMUM", receive_maximum);
+    if (receive_maximum >= 1 && receive_maximum <= 65535) {
+        config.receive_maximum = static_cast<uint16_t>(receive_maximum);
+    }
+    
+    readDouble("MQTT_RATE_LIMIT_CLIENT_MESSAGES", config.client_rate_limit.messages_per_sec);
+    readDouble("MQTT_RATE_LIMIT_CLIENT_BYTES", config.client_rate_limit.bytes_per_sec);
+    readDouble("MQTT_RATE_LIMIT_USER_MESSAGES", config.user_rate_limit.messages_per_sec);
+    readDouble("MQTT_RATE_LIMIT_USER_BYTES", config.user_rate_limit.bytes_per_sec);
+    readDouble("MQTT_RATE_LIMIT_BURST_SECONDS", config.client_rate_limit.burst_seconds);
+    config.user_rate_limit.burst_seconds = config.client_rate_limit.burst_seconds;
+    if (const char* action = std::getenv("MQTT_RATE_LIMIT_ACTION")) {
+        config.rate_limit_disconnect = std::string(action) == "disconnect";
+    }
+    readDouble("MQTT_CONNECTION_RATE_LIMIT", config.connection_rate_limit);
+    readDouble("MQTT_CONNECTION_RATE_BURST", config.connection_rate_burst);
+    
+    if (const char* auth_file = std::getenv("MQTT_AUTH_FILE")) {
+        config.auth_file = auth_file;
+    }
+    if (const char* acl_file = std::getenv("MQTT_ACL_FILE")) {
+        config.acl_file = acl_file;
+    }
+    readSize("MQTT_WORKER_THREADS", config.worker_threads);
+    readSize("MQTT_AUTH_CACHE_CAPACITY", config.auth_cache_capacity);
+    readSize("MQTT_AUTH_CACHE_TTL", config.auth_cache_ttl);
+    
+    readInt("MQTT_CLUSTER_PORT", config.cluster_port);
+    if (const char* cluster_host = std::getenv("MQTT_CLUSTER_HOST")) {
+        config.cluster_host = cluster_host;
+    }
+    readList("MQTT_CLUSTER_PEERS", config.cluster_peers);
+    if (const char* cluster_secret = std::getenv("MQTT_CLUSTER_SECRET")) {
+        config.cluster_secret = cluster_secret;
+    }
+    readSize("MQTT_CLUSTER_LINK_MAX_BYTES", config.cluster_link_max_bytes);
+    if (const char* node_id = std::getenv("MQTT_NODE_ID")) {
+        config.node_id = node_id;
+    }
+    
+    readSize("MQTT_MAX_PACKET_SIZE", config.max_packet_size);
+    readSize("MQTT_CUT_THROUGH_THRESHOLD", config.cut_through_threshold);
+    readSize("MQTT_ZEROCOPY_THRESHOLD", config.zerocopy_threshold);
+    
+    readSize("MQTT_HEAVY_HITTERS_TOP_K", config.heavy_hitters_top_k);
+    readSize("MQTT_HEAVY_HITTERS_WINDOW", config.heavy_hitters_window);
+    readSize("MQTT_HEAVY_HITTERS_TOPIC_DEPTH", config.heavy_hitters_topic_depth);
+    if (config.heavy_hitters_window == 0) {
+        config.heavy_hitters_window = 1;
+    }
+    if (config.heavy_hitters_topic_depth == 0) {
+        config.heavy_hitters_topic_depth = 1;
+    }
+    
+    readSize("MQTT_TRACE_SAMPLE_RATE", config.trace_sample_rate);
+    readSize("MQTT_TRACE_BUFFER_EVENTS", config.trace_buffer_events);
+    if (const char* trace_file = std::getenv("MQTT_TRACE_FILE")) {
+        config.trace_file = trace_file;
+    }
+    
+    readBool("MQTT_LOW_LATENCY", config.low_latency);
+    readSize("MQTT_SPIN_US", config.spin_us);
+    readInt("MQTT_SOCKET_BUSY_POLL_US", config.socket_busy_poll_us);
+    readCpuList("MQTT_CPU_AFFINITY", config.cpu_affinity);
+    
+    readBool("MQTT_MEMORY_ARENA", config.memory_arena);
+    readInt("MQTT_NUMA_NODE", config.numa_node);
+    if (const char* huge_pages = std::getenv("MQTT_HUGE_PAGES")) {
+        try {
+            config.huge_pages = parseHugePages(huge_pages);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+        }
+    }
+    
+    if (const char* wal_dir = std::getenv("MQTT_WAL_DIR")) {
+        config.wal_dir = wal_dir;
+    }
+    if (const char* durability = std::getenv("MQTT_WAL_DURABILITY")) {
+        try {
+            config.wal_durability = parseWalDurability(durability);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+        }
+    }
+    readSize("MQTT_WAL_COMMIT_DELAY_US", config.wal_commit_delay_us);
+    readSize("MQTT_WAL_SEGMENT_BYTES", config.wal_segment_bytes);
+    readSize("MQTT_WAL_COMPACT_SEGMENTS", config.wal_compact_segments);
+    
+    if (const char* cert_file = std::getenv("MQTT_TLS_CERT_FILE")) {
+        config.tls_cert_file = cert_file;
+    }
+    if (const char* key_file = std::getenv("MQTT_TLS_KEY_FILE")) {
+        config.tls_key_file = key_file;
+    }
+    readBool("MQTT_TLS_KTLS", config.tls_ktls);
+    readSize("MQTT_TLS_SESSION_CACHE", config.tls_session_cache);
+    readSize("MQTT_TLS_SESSION_TIMEOUT", config.tls_session_timeout);
+    
+    if (const char* capture_file = std::getenv("MQTT_CAPTURE_FILE")) {
+        config.capture_file = capture_file;
+    }
+    
+    if (const char* policy = std::getenv("MQTT_OVERFLOW_POLICY")) {
+        try {
+            config.overflow_policy = parseOverflowPolicy(policy);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+        }
+    }
+    
+    return config;
+}
+
+OverflowPolicy parseOverflowPolicy(const std::string& name) {
+    if (name == "drop-oldest") {
+        return OverflowPolicy::DROP_OLDEST;
+    }
+    if (name == "drop-newest") {
+        return OverflowPolicy::DROP_NEWEST;
+    }
+    if (name == "drop-qos0") {
+        return OverflowPolicy::DROP_QOS0;
+    }
+    if (name == "disconnect") {
+        return OverflowPolicy::DISCONNECT;
+    }
+    throw std::invalid_argument("Unknown overflow policy: " + name);
+}
+
+} // namespace mqtt
@@ -0,0 +1,124 @@
+#ifndef BROKER_CONFIG_H
+#define BROKER_CONFIG_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "config.h"
+#include "../connection/Connection.h"
+#include "RateLimiter.h"
+#include "../memory/NumaArena.h"
+#include "../storage/WriteAheadLog.h"
+
+namespace mqtt {
+
+// Runtime settings, defaults come from config.h
+struct BrokerConfig {
+    // Listener
+    int port = DEFAULT_PORT;
+    int metrics_port = METRICS_PORT;
+    int admin_port = ADMIN_PORT;  // Per-connection JSON snapshots, see AdminServer
+    std::string admin_host = ADMIN_HOST;
+    // "tcp://host:port", "tls://host:port" or "unix:///path/to/socket", defaults to tcp://0.0.0.0:<port>
+    std::vector<std::string> listeners;
+    int listen_backlog = LISTEN_BACKLOG;
+    int tcp_defer_accept = TCP_DEFER_ACCEPT_SECONDS;
+    
+    // Outbound queue limits per connection
+    size_t outbound_max_bytes = OUTBOUND_QUEUE_MAX_BYTES;
+    size_t outbound_max_messages = OUTBOUND_QUEUE_MAX_MESSAGES;
+    OverflowPolicy overflow_policy = OverflowPolicy::DROP_OLDEST;
+    
+    OutboundLimits outboundLimits() const;
+    
+    // Backpressure from subscribers to publishers (opt-in)
+    bool flow_control = false;
+    size_t flow_high_watermark = FLOW_CONTROL_HIGH_WATERMARK;
+    size_t flow_low_watermark = FLOW_CONTROL_LOW_WATERMARK;
+    uint16_t receive_maximum = RECEIVE_MAXIMUM;
+    
+    // Admission control
+    RateLimit client_rate_limit = {RATE_LIMIT_CLIENT_MESSAGES, RATE_LIMIT_CLIENT_BYTES, RATE_LIMIT_BURST_SECONDS};
+    RateLimit user_rate_limit = {RATE_LIMIT_USER_MESSAGES, RATE_LIMIT_USER_BYTES, RATE_LIMIT_BURST_SECONDS};
+    bool rate_limit_disconnect = false;  // Disconnect instead of throttling
+    double connection_rate_limit = CONNECTION_RATE_LIMIT;
+    double connection_rate_burst = CONNECTION_RATE_BURST;
+    
+    // Authentication and authorization, disabled without a password or ACL file
+    std::string auth_file;
+    std::string acl_file;
+    size_t worker_threads = WORKER_THREADS;
+    size_t auth_cache_capacity = AUTH_CACHE_CAPACITY;
+    size_t auth_cache_ttl = AUTH_CACHE_TTL_SECONDS;
+    
+    // Clustering, off unless a cluster port is set
+    std::string node_id;  // Defaults to hostname:port
+    int cluster_port = CLUSTER_PORT;
+    std::string cluster_host = CLUSTER_HOST;
+    std::vector<std::string> cluster_peers;  // "host:port" of other nodes' cluster ports
+    // Shared by all nodes, links prove they know it. Without one, links are only accepted
+    // from the peers' addresses.
+    std::string cluster_secret;
+    size_t cluster_link_max_bytes = CLUSTER_LINK_MAX_BYTES;  // Must hold a full retained replay
+    
+    // Large messages: packets above the maximum are refused, large PUBLISH payloads are
+    // relayed to subscribers while still arriving instead of being buffered whole
+    size_t max_packet_size = MAX_PACKET_SIZE;
+    size_t cut_through_threshold = CUT_THROUGH_THRESHOLD;
+    
+    // Zero-copy transmit for large fan-out payloads, TCP listeners only
+    size_t zerocopy_threshold = ZEROCOPY_THRESHOLD;
+    
+    // Busiest topic prefixes and publishing clients, ranked by messages and bytes per window
+    size_t heavy_hitters_top_k = HEAVY_HITTERS_TOP_K;
+    size_t heavy_hitters_window = HEAVY_HITTERS_WINDOW_SECONDS;
+    size_t heavy_hitters_topic_depth = HEAVY_HITTERS_TOPIC_DEPTH;
+    
+    // Sampled per-message tracing, dumped as Chrome trace JSON on request
+    size_t trace_sample_rate = TRACE_SAMPLE_RATE;
+    size_t trace_buffer_events = TRACE_BUFFER_EVENTS;
+    std::string trace_file = TRACE_FILE;
+    
+    // Low-latency mode: the reactor spins on non-blocking polls before sleeping in the kernel,
+    // client sockets get SO_BUSY_POLL and TCP_NODELAY. Trades CPU for forwarding latency.
+    bool low_latency = false;
+    size_t spin_us = LOW_LATENCY_SPIN_US;
+    int socket_busy_poll_us = LOW_LATENCY_SOCKET_BUSY_POLL_US;
+    // Cores the event loop thread is pinned to, empty = not pinned
+    std::vector<int> cpu_affinity;
+    
+    // Connection buffers and queues from an arena bound to the event loop's NUMA node
+    bool memory_arena = false;
+    int numa_node = -1;  // -1 = node of the CPU the event loop runs on
+    HugePages huge_pages = HugePages::TRANSPARENT;
+    
+    // Write-ahead log, off unless a directory is set. Retained messages are logged and survive
+    // restarts, a retained QoS 1 publish is acknowledged once durable as the durability mode defines.
+    std::string wal_dir;
+    WalDurability wal_durability = WalDurability::FSYNC;
+    size_t wal_commit_delay_us = WAL_COMMIT_DELAY_US;
+    size_t wal_segment_bytes = WAL_SEGMENT_BYTES;
+    size_t wal_compact_segments = WAL_COMPACT_SEGMENTS;
+    
+    // TLS listeners: certificate chain and key in PEM. After the handshake the kernel takes
+    // over the record layer (kTLS) where it supports the cipher, so reads and writes stay
+    // plain socket calls; elsewhere they go through OpenSSL.
+    std::string tls_cert_file;
+    std::string tls_key_file;
+    bool tls_ktls = true;
+    size_t tls_session_cache = TLS_SESSION_CACHE_SIZE;
+    size_t tls_session_timeout = TLS_SESSION_TIMEOUT_SECONDS;
+    
+    // Inbound traffic capture for mqtt-replay, off unless a file is set
+    std::string capture_file;
+    
+    // Override defaults with MQTT_* environment variables
+    static BrokerConfig fromEnvironment();
+};
+
+// "drop-oldest", "drop-newest", "drop-qos0" or "disconnect"
+OverflowPolicy parseOverflowPolicy(const std::string& name);
+
+} // namespace mqtt
+
+#endif // BROKER_CONFIG_H
@@ -0,0 +1,64 @@
+#include "ExpiryWheel.h"
+#include <algorithm>
+
+namespace mqtt {
+
+ExpiryWheel::ExpiryWheel(size_t slots, std::chrono::milliseconds tick)
+    : slots_(std::max<size_t>(slots, 1)), tick_(std::max(tick, std::chrono::milliseconds(1))),
+      origin_(SteadyClock::now()), current_(0), position_(0), size_(0) {}
+
+size_t ExpiryWheel::slotFor(SteadyClock::time_point deadline) const {
+    // A deadline already passed goes into the slot being worked through
+    uint64_t tick = deadline > origin_ ? static_cast<uint64_t>((deadline - origin_) / tick_) : 0;
+    return static_cast<size_t>(std::max(tick, current_) % slots_.size());
+}
+
+void ExpiryWheel::schedule(const std::string& key, SteadyClock::time_point deadline) {
+    slots_[slotFor(deadline)].push_back(Entry{key, deadline});
+    ++size_;
+}
+
+size_t ExpiryWheel::advance(SteadyClock::time_point now, size_t budget, const Expire& expire) {
+    uint64_t now_tick = static_cast<uint64_t>((now - origin_) / tick_);
+    if (size_ == 0) {
+        current_ = std::max(current_, now_tick);
+        position_ = 0;
+        return 0;
+    }
+    
+    // A slot is worked through once its tick is over, everything of this turn in it is then due
+    size_t visited = 0;
+    while (current_ < now_tick && visited < budget) {
+        std::vector<Entry>& slot = slots_[current_ % slots_.size()];
+        while (position_ < slot.size() && visited < budget) {
+            ++visited;
+            if (slot[position_].deadline > now) {
+                ++position_;  // A later turn of the wheel
+                continue;
+            }
+            Entry entry = std::move(slot[position_]);
+            if (position_ + 1 < slot.size()) {
+                slot[position_] = std::move(slot.back());
+            }
+            slot.pop_back();
+            --size_;
+            expire(entry.key, entry.deadline);  // May schedule again
+        }
+        if (position_ < slot.size()) {
+            break;  // Out of budget, resume here
+        }
+        ++current_;
+        position_ = 0;
+        ++visited;  // Empty slots are cheap but not free
+    }
+    return visited;
+}
+
+SteadyClock::time_point ExpiryWheel::nextDeadline() const {
+    if (size_ == 0) {
+        return SteadyClock::time_point::max();
+    }
+    return origin_ + tick_ * static_cast<int64_t>(current_ + 1);
+}
+
+} // namespace mqtt
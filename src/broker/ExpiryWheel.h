@@ -0,0 +1,55 @@
+#ifndef EXPIRY_WHEEL_H
+#define EXPIRY_WHEEL_H
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+#include "RateLimiter.h"
+
+namespace mqtt {
+
+// Hashed timing wheel of message deadlines, keyed by topic. Each tick visits one
+// slot and hands back the entries that are due; entries further out than one turn
+// of the wheel stay in their slot for a later turn. advance() works through at most
+// a budget of entries per call and resumes where it stopped, so a burst of expiries
+// is spread over several event loop iterations instead of stalling one.
+//
+// Entries are never removed early: the owner checks on expiry whether the deadline
+// still applies, so rescheduling a key costs nothing up front.
+class ExpiryWheel {
+public:
+    using Expire = std::function<void(const std::string& key, SteadyClock::time_point deadline)>;
+    
+    ExpiryWheel(size_t slots, std::chrono::milliseconds tick);
+    
+    void schedule(const std::string& key, SteadyClock::time_point deadline);
+    
+    // Calls expire for due entries, at most budget of them. Returns the number visited.
+    size_t advance(SteadyClock::time_point now, size_t budget, const Expire& expire);
+    
+    // When advance() next has work, time_point::max() when the wheel is empty
+    SteadyClock::time_point nextDeadline() const;
+    
+    size_t size() const { return size_; }
+
+private:
+    struct Entry {
+        std::string key;
+        SteadyClock::time_point deadline;
+    };
+    
+    size_t slotFor(SteadyClock::time_point deadline) const;
+    
+    std::vector<std::vector<Entry>> slots_;
+    std::chrono::milliseconds tick_;
+    SteadyClock::time_point origin_;
+    uint64_t current_;   // Tick whose slot is being worked through
+    size_t position_;    // Entries of that slot already visited
+    size_t size_;
+};
+
+} // namespace mqtt
+
+#endif // EXPIRY_WHEEL_H
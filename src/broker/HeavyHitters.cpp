@@ -0,0 +1,122 @@
+#include "HeavyHitters.h"
+#include <algorithm>
+#include <limits>
+
+namespace mqtt {
+
+namespace {
+
+constexpr uint64_t FNV_OFFSET = 14695981039346656037ULL;
+constexpr uint64_t FNV_PRIME = 1099511628211ULL;
+
+uint64_t fnv(std::string_view key) {
+    uint64_t hash = FNV_OFFSET;
+    for (char c : key) {
+        hash = (hash ^ static_cast<uint8_t>(c)) * FNV_PRIME;
+    }
+    return hash;
+}
+
+// Second hash for double hashing, derived from the first
+inline uint64_t remix(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash | 1;
+}
+
+size_t roundUpPowerOfTwo(size_t value) {
+    size_t result = 64;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+} // namespace
+
+HeavyHitters::HeavyHitters(size_t top_k, size_t width, unsigned depth)
+    : mask_(roundUpPowerOfTwo(width) - 1), depth_(std::clamp(depth, 1u, MAX_DEPTH)), topK_(top_k), minimum_(0) {
+    counters_.assign((mask_ + 1) * depth_, 0);
+    candidates_.reserve(topK_);
+}
+
+uint64_t HeavyHitters::estimate(uint64_t hash, uint64_t weight) {
+    // Conservative update: only counters at the current minimum can be exact, so only
+    // those are raised. Same estimate as a plain update with much less overcounting.
+    uint64_t step = remix(hash);
+    size_t slots[MAX_DEPTH];
+    uint64_t lowest = std::numeric_limits<uint64_t>::max();
+    for (unsigned row = 0; row < depth_; ++row) {
+        slots[row] = row * (mask_ + 1) + ((hash + row * step) & mask_);
+        lowest = std::min(lowest, counters_[slots[row]]);
+    }
+    
+    uint64_t raised = lowest + weight;
+    for (unsigned row = 0; row < depth_; ++row) {
+        uint64_t& counter = counters_[slots[row]];
+        if (counter < raised) {
+            counter = raised;
+        }
+    }
+    return raised;
+}
+
+void HeavyHitters::add(std::string_view key, uint64_t weight) {
+    if (topK_ == 0) {
+        return;
+    }
+    uint64_t hash = fnv(key);
+    uint64_t weightEstimate = estimate(hash, weight);
+    
+    for (size_t i = 0; i < candidates_.size(); ++i) {
+        Candidate& candidate = candidates_[i];
+        if (candidate.hash == hash && candidate.key == key) {
+            candidate.weight = weightEstimate;
+            if (i == minimum_) {
+                updateMinimum();
+            }
+            return;
+        }
+    }
+    
+    if (candidates_.size() < topK_) {
+        candidates_.push_back(Candidate{std::string(key), hash, weightEstimate});
+        updateMinimum();
+    } else if (weightEstimate > candidates_[minimum_].weight) {
+        Candidate& evicted = candidates_[minimum_];
+        evicted.key.assign(key.data(), key.size());
+        evicted.hash = hash;
+        evicted.weight = weightEstimate;
+        updateMinimum();
+    }
+}
+
+void HeavyHitters::updateMinimum() {
+    minimum_ = 0;
+    for (size_t i = 1; i < candidates_.size(); ++i) {
+        if (candidates_[i].weight < candidates_[minimum_].weight) {
+            minimum_ = i;
+        }
+    }
+}
+
+std::vector<HeavyHitters::Entry> HeavyHitters::top() const {
+    std::vector<Entry> entries;
+    entries.reserve(candidates_.size());
+    for (const Candidate& candidate : candidates_) {
+        entries.push_back(Entry{candidate.key, candidate.weight});
+    }
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.weight > b.weight;
+    });
+    return entries;
+}
+
+void HeavyHitters::clear() {
+    std::fill(counters_.begin(), counters_.end(), 0);
+    candidates_.clear();
+    minimum_ = 0;
+}
+
+} // namespace mqtt
@@ -0,0 +1,56 @@
+#ifndef HEAVY_HITTERS_H
+#define HEAVY_HITTERS_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mqtt {
+
+// Streaming top-K over an unbounded key space (topic prefixes, client ids).
+// A count-min sketch estimates every key's weight in fixed memory; the K keys
+// with the largest estimates are kept by name. Updating costs one hash, a few
+// counter increments and a scan of the K candidates, without allocating unless
+// a new key enters the top-K.
+class HeavyHitters {
+public:
+    struct Entry {
+        std::string key;
+        uint64_t weight;
+    };
+    
+    static constexpr unsigned MAX_DEPTH = 16;
+    
+    HeavyHitters(size_t top_k, size_t width, unsigned depth);
+    
+    void add(std::string_view key, uint64_t weight);
+    
+    // Current top-K, heaviest first. Weights are over-estimates by at most
+    // total weight * e / width with probability 1 - e^-depth.
+    std::vector<Entry> top() const;
+    
+    // Start a new window
+    void clear();
+
+private:
+    struct Candidate {
+        std::string key;
+        uint64_t hash;
+        uint64_t weight;
+    };
+    
+    uint64_t estimate(uint64_t hash, uint64_t weight);
+    void updateMinimum();
+    
+    std::vector<uint64_t> counters_;  // depth rows of width counters
+    size_t mask_;
+    unsigned depth_;
+    size_t topK_;
+    std::vector<Candidate> candidates_;
+    size_t minimum_;  // Index of the lightest candidate, replaced first
+};
+
+} // namespace mqtt
+
+#endif // HEAVY_HITTERS_H
@@ -0,0 +1,54 @@
+#include "LocalClient.h"
+#include "MqttBroker.h"
+
+namespace mqtt {
+
+LocalClient::LocalClient(MqttBroker& broker, const std::string& client_id, MessageHandler handler)
+    : broker_(broker), clientId_(client_id),
+      connection_(std::make_shared<Connection>(std::move(handler))), disconnected_(false) {
+    connection_->setClientId(client_id);
+    
+    auto connection = connection_;
+    broker_.post([&broker = broker_, connection]() {
+        broker.attachLocalClient(connection);
+    });
+}
+
+LocalClient::~LocalClient() {
+    disconnect();
+}
+
+void LocalClient::subscribe(const std::string& filter) {
+    auto connection = connection_;
+    broker_.post([&broker = broker_, connection, filter]() {
+        broker.localSubscribe(connection, filter);
+    });
+}
+
+void LocalClient::unsubscribe(const std::string& filter) {
+    auto connection = connection_;
+    broker_.post([&broker = broker_, connection, filter]() {
+        broker.localUnsubscribe(connection, filter);
+    });
+}
+
+void LocalClient::publish(const std::string& topic, std::vector<uint8_t> payload, uint8_t qos, bool retain) {
+    auto connection = connection_;
+    broker_.post([&broker = broker_, connection, topic, payload = std::move(payload), qos, retain]() {
+        broker.localPublish(connection, topic, payload, static_cast<QoSLevel>(qos), retain);
+    });
+}
+
+void LocalClient::disconnect() {
+    if (disconnected_) {
+        return;
+    }
+    disconnected_ = true;
+    
+    auto connection = connection_;
+    broker_.post([&broker = broker_, connection]() {
+        broker.detachLocalClient(connection);
+    });
+}
+
+} // namespace mqtt
@@ -0,0 +1,46 @@
+#ifndef LOCAL_CLIENT_H
+#define LOCAL_CLIENT_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "../connection/Connection.h"
+
+namespace mqtt {
+
+class MqttBroker;
+
+// Client living in the broker's process. Publishes go straight to the routing
+// core and matching messages reach the handler without any MQTT framing.
+// Topics, filters and the ACL are checked as for network clients, by client id;
+// what is refused is dropped and logged, there is no reason code to return.
+// Methods may be called from any thread; they are queued to the event loop,
+// which also runs the handler, so the handler must not block.
+// The broker must outlive its local clients.
+class LocalClient {
+public:
+    using MessageHandler = LocalDelivery;
+    
+    LocalClient(MqttBroker& broker, const std::string& client_id, MessageHandler handler);
+    ~LocalClient();  // Disconnects
+    
+    LocalClient(const LocalClient&) = delete;
+    LocalClient& operator=(const LocalClient&) = delete;
+    
+    void subscribe(const std::string& filter);
+    void unsubscribe(const std::string& filter);
+    void publish(const std::string& topic, std::vector<uint8_t> payload, uint8_t qos = 0, bool retain = false);
+    void disconnect();
+    
+    const std::string& getClientId() const { return clientId_; }
+
+private:
+    MqttBroker& broker_;
+    std::string clientId_;
+    std::shared_ptr<Connection> connection_;
+    bool disconnected_;
+};
+
+} // namespace mqtt
+
+#endif // LOCAL_CLIENT_H
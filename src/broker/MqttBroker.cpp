@@ -1,155 +1,1398 @@
 #include "MqttBroker.h"
+#include "TopicMatcher.h"
+#include "../auth/FileAuthenticator.h"
+#include "../protocol/ControlFrames.h"
+#include "../protocol/Utf8Validator.h"
 #include "config.h"
 #include <iostream>
 #include <cstring>
+#include <cerrno>
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/un.h>
+#include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
-#include <sys/select.h>
 #include <algorithm>
+#include <cstdlib>
+#include <future>
+#include <unordered_set>
 
 namespace mqtt {
 
-MqttBroker::MqttBroker() : serverSocket(-1), running(false), metrics_(std::make_unique<BrokerMetrics>()) {}
+namespace {
+
+// "ip:port" of an accepted peer, "[ip]:port" for IPv6
+std::string formatAddress(const struct sockaddr_storage& address) {
+    char host[INET6_ADDRSTRLEN] = {};
+    if (address.ss_family == AF_INET) {
+        const auto& ipv4 = reinterpret_cast<const struct sockaddr_in&>(address);
+        inet_ntop(AF_INET, &ipv4.sin_addr, host, sizeof(host));
+        return std::string(host) + ":" + std::to_string(ntohs(ipv4.sin_port));
+    }
+    if (address.ss_family == AF_INET6) {
+        const auto& ipv6 = reinterpret_cast<const struct sockaddr_in6&>(address);
+        inet_ntop(AF_INET6, &ipv6.sin6_addr, host, sizeof(host));
+        return "[" + std::string(host) + "]:" + std::to_string(ntohs(ipv6.sin6_port));
+    }
+    return "unix";
+}
+
+// A Message Expiry Interval as a deadline, the default time_point (never) for none
+SteadyClock::time_point expiryDeadline(uint32_t interval, SteadyClock::time_point now) {
+    return interval ? now + std::chrono::seconds(interval) : SteadyClock::time_point();
+}
+
+bool hasExpired(SteadyClock::time_point deadline, SteadyClock::time_point now) {
+    return deadline != SteadyClock::time_point() && deadline <= now;
+}
+
+// Interval left until the deadline, sent along with the message. Rounded up, a message
+// not yet expired must not go out with 0, which would read as no expiry at all.
+uint32_t remainingExpiry(SteadyClock::time_point deadline, SteadyClock::time_point now) {
+    if (deadline == SteadyClock::time_point()) {
+        return 0;
+    }
+    int64_t left = std::chrono::ceil<std::chrono::seconds>(deadline - now).count();
+    return static_cast<uint32_t>(std::clamp<int64_t>(left, 1, UINT32_MAX));
+}
+
+// The write-ahead log keeps deadlines as Unix time in milliseconds, steady time
+// does not carry over a restart
+uint64_t toUnixMillis(SteadyClock::time_point deadline) {
+    if (deadline == SteadyClock::time_point()) {
+        return 0;
+    }
+    auto unix_time = std::chrono::system_clock::now() + (deadline - SteadyClock::now());
+    return static_cast<uint64_t>(std::max<int64_t>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(unix_time.time_since_epoch()).count(), 1));
+}
+
+SteadyClock::time_point fromUnixMillis(uint64_t ms) {
+    if (ms == 0) {
+        return SteadyClock::time_point();
+    }
+    auto unix_time = std::chrono::system_clock::time_point(std::chrono::milliseconds(ms));
+    auto steady = SteadyClock::now() + std::chrono::duration_cast<SteadyClock::duration>(
+        unix_time - std::chrono::system_clock::now());
+    return std::max(steady, SteadyClock::time_point() + SteadyClock::duration(1));
+}
+
+} // namespace
+
+MqttBroker::MqttBroker(const BrokerConfig& config)
+    : config_(config), arenaMetricsId_(0), epollFd_(-1), spareFd_(-1), wakeFd_(-1), running(false), stopRequested_(false),
+      metrics_(std::make_unique<BrokerMetrics>()),
+      retainedBytes_(0), expiryWheel_(EXPIRY_WHEEL_SLOTS, std::chrono::milliseconds(EXPIRY_WHEEL_TICK_MS)),
+      topicCache_(TOPIC_CACHE_CAPACITY), topicBloom_(TOPIC_BLOOM_SLOTS, TOPIC_BLOOM_HASHES),
+      hotTopicMessages_(config.heavy_hitters_top_k, HEAVY_HITTERS_SKETCH_WIDTH, HEAVY_HITTERS_SKETCH_DEPTH),
+      hotTopicBytes_(config.heavy_hitters_top_k, HEAVY_HITTERS_SKETCH_WIDTH, HEAVY_HITTERS_SKETCH_DEPTH),
+      topClientMessages_(config.heavy_hitters_top_k, HEAVY_HITTERS_SKETCH_WIDTH, HEAVY_HITTERS_SKETCH_DEPTH),
+      topClientBytes_(config.heavy_hitters_top_k, HEAVY_HITTERS_SKETCH_WIDTH, HEAVY_HITTERS_SKETCH_DEPTH),
+      topTalkersWindowStart_(SteadyClock::now()),
+      rateLimiter_(config.client_rate_limit, config.user_rate_limit),
+      acceptBucket_(config.connection_rate_limit, config.connection_rate_burst),
+      authCache_(config.auth_cache_capacity, std::chrono::seconds(config.auth_cache_ttl)),
+      aclReloadRequested_(false),
+      tracer_(config.trace_sample_rate, config.trace_buffer_events), activeTrace_(0),
+      traceDumpRequested_(false), startedAt_(SteadyClock::now()), busyPollWarned_(false) {
+    // Created up front so tasks can be posted before start()
+    wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    
+    if (!config_.auth_file.empty()) {
+        auto authenticator = std::make_unique<FileAuthenticator>(config_.auth_file);
+        std::cout << "Loaded " << authenticator->size() << " users from " << config_.auth_file << std::endl;
+        authenticator_ = std::move(authenticator);
+    }
+    if (!config_.acl_file.empty()) {
+        acl_ = TopicAcl::load(config_.acl_file);
+        std::cout << "Loaded " << acl_->getRuleCount() << " ACL rules from " << config_.acl_file << std::endl;
+    }
+    
+    if (config_.cluster_port > 0) {
+        if (config_.node_id.empty()) {
+            char hostname[256] = {};
+            gethostname(hostname, sizeof(hostname) - 1);
+            config_.node_id = std::string(hostname) + ":" + std::to_string(config_.port);
+        }
+        
+        Cluster::Handlers handlers;
+        handlers.onPublish = [this](const std::string& topic, const std::vector<uint8_t>& payload, uint8_t qos, bool retain,
+                                    uint32_t message_expiry) {
+            handleClusterPublish(topic, payload, qos, retain, message_expiry);
+        };
+        handlers.onRetained = [this](const std::string& topic, const std::vector<uint8_t>& payload, uint8_t qos,
+                                     uint32_t message_expiry) {
+            storeRetained(topic, payload, qos, expiryDeadline(message_expiry, SteadyClock::now()));
+        };
+        handlers.onClientConnected = [this](const std::string& client_id) {
+            takeOverClientId(client_id, nullptr);
+        };
+        handlers.onPeerJoined = [this](const std::string& node_id) {
+            auto now = SteadyClock::now();
+            for (auto it = retainedMessages.begin(); it != retainedMessages.end();) {
+                if (retainedExpired(it, now)) {
+                    continue;
+                }
+                cluster_->sendRetained(node_id, it->first, it->second.payload, it->second.qos,
+                                       remainingExpiry(it->second.expires_at, now));
+                ++it;
+            }
+            metrics_->setClusterPeers(cluster_->getPeerCount());
+        };
+        Cluster::Options options;
+        options.node_id = config_.node_id;
+        options.host = config_.cluster_host;
+        options.port = config_.cluster_port;
+        options.peers = config_.cluster_peers;
+        options.secret = config_.cluster_secret;
+        options.link_max_bytes = config_.cluster_link_max_bytes;
+        cluster_ = std::make_unique<Cluster>(options, handlers);
+    }
+}
 
 MqttBroker::~MqttBroker() {
     stop();
 }
 
-void MqttBroker::start() {
-    // Create TCP socket
-    serverSocket = socket(AF_INET, SOCK_STREAM, 0);
+bool MqttBroker::start() {
+    // Reconnect storms need far more descriptors than the default soft limit
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    spareFd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
     
-    // Set socket options to reuse address
-    int opt = 1;
-    setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    // Reactor, listening sockets are tagged with their Listener and the wakeup fd with itself
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event event;
+    std::memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = &wakeFd_;
+    if (epollFd_ < 0 || wakeFd_ < 0 || epoll_ctl(epollFd_, EPOLL_CTL_ADD, wakeFd_, &event) < 0) {
+        std::cerr << "Failed to set up the event loop: " << std::strerror(errno) << std::endl;
+        return false;
+    }
     
-    // Bind socket to port 1883
-    struct sockaddr_in serverAddr;
-    std::memset(&serverAddr, 0, sizeof(serverAddr));
-    serverAddr.sin_family = AF_INET;
-    serverAddr.sin_addr.s_addr = INADDR_ANY;
-    serverAddr.sin_port = htons(DEFAULT_PORT);
+    // Every configured listener or none, a broker missing one of its ports fails loudly
+    std::vector<std::string> uris = config_.listeners;
+    if (uris.empty()) {
+        uris.push_back("tcp://0.0.0.0:" + std::to_string(config_.port));
+    }
+    for (const auto& uri : uris) {
+        if (!openListener(uri)) {
+            return false;
+        }
+    }
     
-    bind(serverSocket, (struct sockaddr*)&serverAddr, sizeof(serverAddr));
+    // Inter-node links live in their own epoll set, nested in ours
+    if (cluster_ && !cluster_->start()) {
+        std::cerr << "Clustering disabled" << std::endl;
+        cluster_.reset();
+    }
+    if (cluster_) {
+        event.data.ptr = cluster_.get();
+        epoll_ctl(epollFd_, EPOLL_CTL_ADD, cluster_->getEventFd(), &event);
+    }
     
-    // Start listening
-    listen(serverSocket, MAX_CONNECTIONS);
+    if (!config_.capture_file.empty()) {
+        try {
+            capture_ = std::make_unique<CaptureWriter>(config_.capture_file);
+            std::cout << "Capturing inbound traffic to " << config_.capture_file << std::endl;
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+        }
+    }
+    
+    if (!config_.wal_dir.empty()) {
+        openWriteAheadLog();
+    }
+    
+    if (authenticator_ || acl_ || tracer_.isEnabled()) {
+        workers_ = std::make_unique<WorkerPool>(config_.worker_threads);
+    }
     
     running = true;
     
     // Start Prometheus metrics exporter
-    metrics_->startExporter("0.0.0.0:9090");
+    metrics_->startExporter("0.0.0.0:" + std::to_string(config_.metrics_port));
+    
+    if (config_.admin_port > 0) {
+        try {
+            admin_ = std::make_unique<AdminServer>(config_.admin_host, config_.admin_port,
+                [this](const std::string& path, const std::string& query, std::string& body) {
+                    return handleAdminRequest(path, query, body);
+                });
+            std::cout << "Admin endpoint on " << config_.admin_host << ":" << config_.admin_port << std::endl;
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+        }
+    }
+    
+    std::cout << "MQTT Broker started with " << listeners_.size() << " listeners" << std::endl;
+    if (config_.low_latency) {
+        std::cout << "Low-latency mode: spinning " << config_.spin_us << "us before blocking" << std::endl;
+    }
+    std::cout << "Text validation: UTF-8 " << Utf8::implementation() << ", topics " << TopicMatcher::scanImplementation() << std::endl;
+    return true;
+}
+
+bool MqttBroker::openListener(const std::string& uri) {
+    auto listener = std::make_unique<Listener>();
+    listener->uri = uri;
     
-    std::cout << "MQTT Broker started on port " << DEFAULT_PORT << std::endl;
+    if (uri.rfind("unix://", 0) == 0) {
+        // Co-located clients skip the TCP stack
+        listener->unix_socket = true;
+        listener->path = uri.substr(7);
+        struct sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (listener->path.empty() || listener->path.size() >= sizeof(addr.sun_path)) {
+            std::cerr << "Invalid unix socket path in listener " << uri << std::endl;
+            return false;
+        }
+        std::strncpy(addr.sun_path, listener->path.c_str(), sizeof(addr.sun_path) - 1);
+        
+        unlink(listener->path.c_str());  // Left behind by a previous run
+        listener->socket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listener->socket < 0) {
+            std::cerr << "Failed to create a socket for " << uri << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        if (bind(listener->socket, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            std::cerr << "Failed to bind " << uri << ": " << std::strerror(errno) << std::endl;
+            close(listener->socket);
+            return false;
+        }
+    } else if (uri.rfind("tcp://", 0) == 0 || uri.rfind("tls://", 0) == 0) {
+        listener->tls = uri.rfind("tls://", 0) == 0;
+        if (listener->tls && !tlsContext_) {
+            if (config_.tls_cert_file.empty() || config_.tls_key_file.empty()) {
+                std::cerr << "Listener " << uri << " needs MQTT_TLS_CERT_FILE and MQTT_TLS_KEY_FILE" << std::endl;
+                return false;
+            }
+            TlsContext::Options options;
+            options.cert_file = config_.tls_cert_file;
+            options.key_file = config_.tls_key_file;
+            options.ktls = config_.tls_ktls;
+            options.session_cache = config_.tls_session_cache;
+            options.session_timeout = config_.tls_session_timeout;
+            try {
+                tlsContext_ = std::make_unique<TlsContext>(options);
+            } catch (const std::exception& e) {
+                std::cerr << e.what() << std::endl;
+                return false;
+            }
+        }
+        
+        std::string address = uri.substr(6);
+        size_t colon = address.rfind(':');
+        if (colon == std::string::npos) {
+            std::cerr << "Missing port in listener " << uri << std::endl;
+            return false;
+        }
+        std::string host = address.substr(0, colon);
+        std::string port = address.substr(colon + 1);
+        if (host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+            host = host.substr(1, host.size() - 2);  // IPv6 literal
+        }
+        
+        struct addrinfo hints;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        struct addrinfo* result = nullptr;
+        if (getaddrinfo(host.empty() || host == "*" ? nullptr : host.c_str(), port.c_str(), &hints, &result) != 0) {
+            std::cerr << "Cannot resolve listener " << uri << std::endl;
+            return false;
+        }
+        
+        listener->socket = socket(result->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listener->socket < 0) {
+            std::cerr << "Failed to create a socket for " << uri << ": " << std::strerror(errno) << std::endl;
+            freeaddrinfo(result);
+            return false;
+        }
+        
+        // Set socket options to reuse address
+        int opt = 1;
+        setsockopt(listener->socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        
+        // Only wake up for connections that already sent their CONNECT
+        if (config_.tcp_defer_accept > 0) {
+            int seconds = config_.tcp_defer_accept;
+            setsockopt(listener->socket, IPPROTO_TCP, TCP_DEFER_ACCEPT, &seconds, sizeof(seconds));
+        }
+        
+        int rc = bind(listener->socket, result->ai_addr, result->ai_addrlen);
+        freeaddrinfo(result);
+        if (rc < 0) {
+            std::cerr << "Failed to bind " << uri << ": " << std::strerror(errno) << std::endl;
+            close(listener->socket);
+            return false;
+        }
+    } else {
+        std::cerr << "Unsupported listener " << uri << ", expected tcp://, tls:// or unix://" << std::endl;
+        return false;
+    }
+    
+    // Start listening, a deep backlog absorbs reconnect bursts instead of dropping SYNs
+    struct epoll_event event;
+    std::memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = listener.get();
+    if (listen(listener->socket, config_.listen_backlog) < 0 ||
+        epoll_ctl(epollFd_, EPOLL_CTL_ADD, listener->socket, &event) < 0) {
+        std::cerr << "Failed to listen on " << uri << ": " << std::strerror(errno) << std::endl;
+        close(listener->socket);
+        if (listener->unix_socket) {
+            unlink(listener->path.c_str());
+        }
+        return false;
+    }
+    
+    listener->index = listeners_.size();
+    listener->metrics_id = metrics_->addListener(uri);
+    std::cout << "Listening on " << uri << std::endl;
+    listeners_.push_back(std::move(listener));
+    return true;
+}
+
+MqttBroker::Listener* MqttBroker::findListener(const void* tag) {
+    // A handful of listeners, cheaper than any lookup structure
+    for (auto& listener : listeners_) {
+        if (listener.get() == tag) {
+            return listener.get();
+        }
+    }
+    return nullptr;
 }
 
 void MqttBroker::stop() {
+    if (wakeFd_ < 0) {
+        return;  // Already stopped, main() and the destructor both call this
+    }
     running = false;
     
+    // Nothing may post completions once the loop is gone
+    admin_.reset();
+    workers_.reset();
+    wal_.reset();
+    cluster_.reset();
+    if (capture_) {
+        std::cout << "Captured " << capture_->getRecords() << " records to " << config_.capture_file << std::endl;
+        capture_.reset();
+    }
+    
     // Close all client connections
     for (auto& client : clients) {
         client->disconnect();
     }
     clients.clear();
+    pausedClients_.clear();
+    closingClients_.clear();
     
-    // Close server socket
-    if (serverSocket >= 0) {
-        close(serverSocket);
-        serverSocket = -1;
+    // Close listening sockets
+    for (auto& listener : listeners_) {
+        close(listener->socket);
+        if (listener->unix_socket) {
+            unlink(listener->path.c_str());
+        }
+    }
+    listeners_.clear();
+    if (epollFd_ >= 0) {
+        close(epollFd_);
+        epollFd_ = -1;
+    }
+    if (spareFd_ >= 0) {
+        close(spareFd_);
+        spareFd_ = -1;
+    }
+    if (wakeFd_ >= 0) {
+        close(wakeFd_);
+        wakeFd_ = -1;
     }
     
     std::cout << "MQTT Broker stopped." << std::endl;
 }
 
 void MqttBroker::run() {
+    std::vector<struct epoll_event> events(MAX_EPOLL_EVENTS);
+    pinEventLoop();
+    createArena();
+    
     while (running) {
-        fd_set readfds;
-        FD_ZERO(&readfds);
-        FD_SET(serverSocket, &readfds);
-        
-        int maxFd = serverSocket;
-        
-        // Add all client sockets to the set
-        for (auto& client : clients) {
-            int clientFd = client->getSocket();
-            if (clientFd > 0) {
-                FD_SET(clientFd, &readfds);
-                if (clientFd > maxFd) {
-                    maxFd = clientFd;
-                }
-            }
+        ++loopStats_.iterations;
+        SteadyClock::time_point wakeup = servicePausedClients();
+        
+        // Frames queued for other nodes during the last iteration go out in one batch
+        if (cluster_) {
+            wakeup = std::min(wakeup, cluster_->maintain(SteadyClock::now()));
+            cluster_->flush();
         }
         
-        // Wait for activity with timeout
-        struct timeval timeout;
-        timeout.tv_sec = 1;
-        timeout.tv_usec = 0;
+        // Retained messages past their expiry, a bounded batch per iteration
+        wakeup = std::min(wakeup, expireRetained(SteadyClock::now()));
         
-        int activity = select(maxFd + 1, &readfds, nullptr, nullptr, &timeout);
+        int count = waitForEvents(events, wakeup);
         
-        if (activity < 0) {
-            std::cerr << "Select error" << std::endl;
+        if (count < 0) {
+            if (errno != EINTR) {
+                std::cerr << "Epoll error: " << std::strerror(errno) << std::endl;
+            }
             continue;
         }
         
-        // Check for new connections
-        if (FD_ISSET(serverSocket, &readfds)) {
-            acceptNewConnection();
-        }
-        
-        // Check for data from existing clients
-        for (auto it = clients.begin(); it != clients.end();) {
-            auto client = *it;
-            int clientFd = client->getSocket();
+        for (int i = 0; i < count; ++i) {
+            // Check for new connections
+            if (Listener* listener = findListener(events[i].data.ptr)) {
+                acceptNewConnections(*listener);
+                continue;
+            }
+            if (events[i].data.ptr == &wakeFd_) {
+                runPostedTasks();
+                continue;
+            }
+            if (cluster_ && events[i].data.ptr == cluster_.get()) {
+                cluster_->processEvents();
+                metrics_->setClusterPeers(cluster_->getPeerCount());
+                continue;
+            }
+            
+            // Still owned by clients, disconnected ones are only released below
+            auto client = static_cast<Connection*>(events[i].data.ptr)->shared_from_this();
+            if (!client->isConnected()) {
+                continue;
+            }
             
-            if (FD_ISSET(clientFd, &readfds)) {
+            // Zero-copy completions arrive on the error queue and raise EPOLLERR
+            if ((events[i].events & EPOLLERR) && client->isZeroCopyEnabled()) {
+                client->reapZeroCopyCompletions();
+            }
+            
+            // Check for data from the client and drain its outbound queue
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
                 handleClientData(client);
-                
-                // Check if client disconnected
-                if (!client->isConnected()) {
-                    std::cout << "Client disconnected, " << clientFd << ". Cleaning up subscriptions." << std::endl;
-                    cleanupClientSubscriptions(client);
-                    it = clients.erase(it);
-                    
-                    // Update metrics
-                    metrics_->setActiveConnections(clients.size());
-                    metrics_->setActiveSubscriptions(getTotalSubscriptions());
-                    continue;
+            }
+            if (client->isConnected() && (events[i].events & EPOLLOUT)) {
+                client->flush();
+            }
+            
+            if (client->isConnected()) {
+                updateInterest(*client);
+            } else {
+                closingClients_.push_back(client);
+            }
+        }
+        
+        removeDisconnectedClients();
+        exportTransmitStats();
+        exportLoopStats();
+        exportTopTalkers();
+    }
+}
+
+void MqttBroker::pinEventLoop() {
+    if (config_.cpu_affinity.empty()) {
+        return;
+    }
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int cpu : config_.cpu_affinity) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &cpus);
+        }
+    }
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (rc != 0) {
+        std::cerr << "Failed to pin the event loop: " << std::strerror(rc) << std::endl;
+        return;
+    }
+    std::cout << "Event loop pinned to " << CPU_COUNT(&cpus) << " CPUs" << std::endl;
+}
+
+void MqttBroker::createArena() {
+    if (!config_.memory_arena || arena_) {
+        return;
+    }
+    // After pinning, so the arena lands on the node the event loop runs on
+    arena_ = std::make_unique<NumaArena>(config_.numa_node, config_.huge_pages, ARENA_REGION_BYTES);
+    arenaMetricsId_ = metrics_->addArena("event_loop", arena_->getNode());
+    std::cout << "Connection memory from an arena on NUMA node " << arena_->getNode()
+              << (arena_->isBound() ? "" : " (unbound, single node)") << std::endl;
+}
+
+int MqttBroker::waitForEvents(std::vector<struct epoll_event>& events, SteadyClock::time_point wakeup) {
+    int capacity = static_cast<int>(events.size());
+    
+    // Low-latency mode: poll without sleeping for a bounded time first, an event arriving
+    // meanwhile is picked up without the cost of a wakeup from the kernel
+    if (config_.low_latency && config_.spin_us > 0) {
+        auto start = SteadyClock::now();
+        auto deadline = std::min(wakeup, start + std::chrono::microseconds(config_.spin_us));
+        auto now = start;
+        do {
+            int count = epoll_wait(epollFd_, events.data(), capacity, 0);
+            if (count != 0) {
+                loopStats_.spin_time += SteadyClock::now() - start;
+                if (count > 0) {
+                    ++loopStats_.spin_hits;
                 }
+                return count;
+            }
+            ++loopStats_.idle_spins;
+            now = SteadyClock::now();
+        } while (now < deadline);
+        loopStats_.spin_time += now - start;
+    }
+    
+    // Wait for activity, at most until the next throttled client may resume
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+        wakeup - SteadyClock::now() + std::chrono::microseconds(999));
+    int timeoutMs = static_cast<int>(std::max<int64_t>(0, wait.count()));
+    ++loopStats_.blocking_waits;
+    return epoll_wait(epollFd_, events.data(), capacity, timeoutMs);
+}
+
+void MqttBroker::exportLoopStats() {
+    const LoopStats& now = loopStats_;
+    LoopStats& last = exportedLoopStats_;
+    metrics_->incrementLoopIterations(static_cast<double>(now.iterations - last.iterations));
+    if (now.idle_spins != last.idle_spins) {
+        metrics_->incrementLoopIdleSpins(static_cast<double>(now.idle_spins - last.idle_spins));
+    }
+    if (now.spin_time != last.spin_time) {
+        metrics_->incrementLoopSpinSeconds(std::chrono::duration<double>(now.spin_time - last.spin_time).count());
+    }
+    if (now.spin_hits != last.spin_hits) {
+        metrics_->incrementLoopSpinHits(static_cast<double>(now.spin_hits - last.spin_hits));
+    }
+    if (now.blocking_waits != last.blocking_waits) {
+        metrics_->incrementLoopBlockingWaits(static_cast<double>(now.blocking_waits - last.blocking_waits));
+    }
+    last = now;
+    
+    if (arena_) {
+        metrics_->setArenaBytes(arenaMetricsId_, static_cast<double>(arena_->getMappedBytes()),
+                                static_cast<double>(arena_->getAllocatedBytes()));
+    }
+}
+
+void MqttBroker::trackTopTalkers(const std::string& topic, size_t bytes, const Connection* publisher) {
+    if (config_.heavy_hitters_top_k == 0) {
+        return;
+    }
+    
+    // Ranked by the first levels only, so per-device topics add up under their common prefix
+    size_t end = 0;
+    for (size_t levels = 0; levels < config_.heavy_hitters_topic_depth; ++levels) {
+        end = topic.find('/', end);
+        if (end == std::string::npos) {
+            end = topic.size();
+            break;
+        }
+        if (levels + 1 < config_.heavy_hitters_topic_depth) {
+            ++end;
+        }
+    }
+    std::string_view prefix(topic.data(), end);
+    hotTopicMessages_.add(prefix, 1);
+    hotTopicBytes_.add(prefix, bytes);
+    
+    if (publisher) {
+        topClientMessages_.add(publisher->getClientId(), 1);
+        topClientBytes_.add(publisher->getClientId(), bytes);
+    }
+}
+
+void MqttBroker::exportTopTalkers() {
+    if (config_.heavy_hitters_top_k == 0) {
+        return;
+    }
+    auto now = SteadyClock::now();
+    std::chrono::duration<double> elapsed = now - topTalkersWindowStart_;
+    if (elapsed < std::chrono::seconds(config_.heavy_hitters_window)) {
+        return;
+    }
+    
+    auto publish = [&](TopTalkers kind, HeavyHitters& ranking) {
+        std::vector<std::pair<std::string, double>> rates;
+        for (HeavyHitters::Entry& entry : ranking.top()) {
+            rates.emplace_back(std::move(entry.key), static_cast<double>(entry.weight) / elapsed.count());
+        }
+        metrics_->setTopTalkers(kind, rates);
+        ranking.clear();
+    };
+    publish(TopTalkers::TOPIC_MESSAGES, hotTopicMessages_);
+    publish(TopTalkers::TOPIC_BYTES, hotTopicBytes_);
+    publish(TopTalkers::CLIENT_MESSAGES, topClientMessages_);
+    publish(TopTalkers::CLIENT_BYTES, topClientBytes_);
+    topTalkersWindowStart_ = now;
+}
+
+void MqttBroker::exportTransmitStats() {
+    const TransmitStats& now = transmitStats_;
+    TransmitStats& last = exportedStats_;
+    if (now.copied_bytes != last.copied_bytes) {
+        metrics_->incrementTransmitCopiedBytes(static_cast<double>(now.copied_bytes - last.copied_bytes));
+    }
+    if (now.zerocopy_bytes != last.zerocopy_bytes) {
+        metrics_->incrementTransmitZeroCopyBytes(static_cast<double>(now.zerocopy_bytes - last.zerocopy_bytes));
+    }
+    // Completions the kernel copied anyway are reported separately, e.g. everything over loopback
+    uint64_t completions = now.zerocopy_completions - last.zerocopy_completions;
+    uint64_t copied = now.zerocopy_copied - last.zerocopy_copied;
+    if (completions > 0) {
+        metrics_->incrementZeroCopyCompletions(static_cast<double>(completions - copied));
+        metrics_->incrementZeroCopyCopied(static_cast<double>(copied));
+    }
+    if (now.expired_messages != last.expired_messages) {
+        metrics_->incrementQueuedExpired(static_cast<double>(now.expired_messages - last.expired_messages),
+                                         static_cast<double>(now.expired_bytes - last.expired_bytes));
+    }
+    if (now.tls_handshakes != last.tls_handshakes || now.tls_failed != last.tls_failed) {
+        uint64_t resumed = now.tls_resumed - last.tls_resumed;
+        metrics_->incrementTlsHandshakes(static_cast<double>(now.tls_handshakes - last.tls_handshakes - resumed),
+                                         static_cast<double>(resumed),
+                                         static_cast<double>(now.tls_failed - last.tls_failed));
+        metrics_->incrementKtlsConnections(static_cast<double>(now.ktls_send - last.ktls_send),
+                                           static_cast<double>(now.ktls_receive - last.ktls_receive));
+    }
+    last = now;
+}
+
+void MqttBroker::post(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(postedMutex_);
+        postedTasks_.push_back(std::move(task));
+    }
+    uint64_t one = 1;
+    if (write(wakeFd_, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        std::cerr << "Failed to wake event loop: " << std::strerror(errno) << std::endl;
+    }
+}
+
+void MqttBroker::runPostedTasks() {
+    uint64_t count;
+    if (read(wakeFd_, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        std::cerr << "Failed to read wakeup counter: " << std::strerror(errno) << std::endl;
+    }
+    
+    if (aclReloadRequested_.exchange(false)) {
+        reloadAcl();
+    }
+    if (traceDumpRequested_.exchange(false)) {
+        dumpTrace();
+    }
+    if (stopRequested_.exchange(false)) {
+        running = false;
+        return;
+    }
+    
+    std::vector<std::function<void()>> tasks;
+    {
+        std::lock_guard<std::mutex> lock(postedMutex_);
+        tasks.swap(postedTasks_);
+    }
+    for (auto& task : tasks) {
+        task();
+    }
+}
+
+void MqttBroker::requestAclReload() {
+    // Only an atomic store and a write(), so this can run in a signal handler
+    aclReloadRequested_ = true;
+    uint64_t one = 1;
+    if (wakeFd_ >= 0) {
+        ssize_t written = write(wakeFd_, &one, sizeof(one));
+        (void)written;
+    }
+}
+
+void MqttBroker::requestTraceDump() {
+    // Same as requestAclReload(), picked up by runPostedTasks()
+    traceDumpRequested_ = true;
+    uint64_t one = 1;
+    if (wakeFd_ >= 0) {
+        ssize_t written = write(wakeFd_, &one, sizeof(one));
+        (void)written;
+    }
+}
+
+void MqttBroker::requestStop() {
+    // Same as requestAclReload(), run() leaves its loop in runPostedTasks()
+    stopRequested_ = true;
+    uint64_t one = 1;
+    if (wakeFd_ >= 0) {
+        ssize_t written = write(wakeFd_, &one, sizeof(one));
+        (void)written;
+    }
+}
+
+void MqttBroker::dumpTrace() {
+    if (!tracer_.isEnabled() || !workers_) {
+        std::cerr << "Tracing is off, set MQTT_TRACE_SAMPLE_RATE to sample publishes" << std::endl;
+        return;
+    }
+    
+    // Copy the ring on the loop, format and write it on a worker
+    auto snapshot = std::make_shared<MessageTracer::Snapshot>(tracer_.snapshot());
+    std::string path = config_.trace_file;
+    workers_->submit([snapshot, path]() {
+        if (MessageTracer::writeChromeTrace(*snapshot, path)) {
+            std::cout << "Wrote " << snapshot->events.size() << " trace events to " << path << std::endl;
+        } else {
+            std::cerr << "Failed to write trace to " << path << std::endl;
+        }
+    });
+}
+
+void MqttBroker::reloadAcl() {
+    if (config_.acl_file.empty() || !workers_) {
+        return;
+    }
+    
+    // Parse and compile on a worker, swap on the loop; sessions notice the new generation
+    std::string path = config_.acl_file;
+    workers_->submit([this, path]() {
+        try {
+            std::shared_ptr<const TopicAcl> acl = TopicAcl::load(path);
+            post([this, acl]() {
+                acl_ = acl;
+                std::cout << "Reloaded " << acl_->getRuleCount() << " ACL rules from " << config_.acl_file << std::endl;
+                revokeSubscriptions();
+            });
+        } catch (const std::exception& e) {
+            std::cerr << "ACL reload failed, keeping previous rules: " << e.what() << std::endl;
+        }
+    });
+}
+
+// Subscriptions were authorized when they were made. MQTT has no way to tell a client one
+// was taken away, so it just stops receiving what the new rules don't let it read.
+void MqttBroker::revokeSubscriptions() {
+    std::vector<std::pair<std::string, std::shared_ptr<Connection>>> revoked;
+    for (const auto& [filter, subscribers] : subscriptions) {
+        for (const auto& subscriber : subscribers) {
+            if (!acl_->allows(subscriber->getUsername(), subscriber->getClientId(), filter, ACL_READ, true)) {
+                revoked.emplace_back(filter, subscriber);
             }
+        }
+    }
+    
+    for (const auto& [filter, subscriber] : revoked) {
+        std::cerr << "Subscription to " << filter << " revoked for " << subscriber->getClientId() << std::endl;
+        removeSubscription(filter, subscriber);
+    }
+    if (!revoked.empty()) {
+        metrics_->setActiveSubscriptions(getTotalSubscriptions());
+    }
+}
+
+struct MqttBroker::ConnectionSnapshot {
+    std::vector<std::shared_ptr<Connection>> clients;  // Copied on the first turn, described in batches
+    size_t next = 0;
+    std::vector<ConnectionInfo> connections;
+    std::promise<void> done;
+};
+
+int MqttBroker::handleAdminRequest(const std::string& path, const std::string& query, std::string& body) {
+    // Runs on the admin thread, nothing here touches broker state directly
+    auto timeout = std::chrono::seconds(ADMIN_SNAPSHOT_TIMEOUT_SECONDS);
+    auto unanswered = [&body]() {
+        body = "{\"error\":\"event loop did not answer in time\"}\n";
+        return 503;
+    };
+    
+    if (path == "/broker") {
+        auto info = std::make_shared<std::promise<BrokerInfo>>();
+        std::future<BrokerInfo> result = info->get_future();
+        post([this, info]() { info->set_value(describeBroker()); });
+        if (result.wait_for(timeout) != std::future_status::ready) {
+            return unanswered();
+        }
+        body = toJson(result.get());
+        return 200;
+    }
+    
+    if (path == "/connections") {
+        // ?sort=<field> lists the largest first, ?limit=N keeps the first N
+        std::string sort = queryParameter(query, "sort");
+        std::vector<ConnectionInfo> none;
+        if (!sort.empty() && !sortConnections(none, sort)) {
+            body = "{\"error\":\"cannot sort by " + sort + "\"}\n";
+            return 400;
+        }
+        size_t limit = std::strtoull(queryParameter(query, "limit").c_str(), nullptr, 10);
+        
+        auto snapshot = std::make_shared<ConnectionSnapshot>();
+        std::future<void> result = snapshot->done.get_future();
+        post([this, snapshot]() {
+            snapshot->clients.assign(clients.begin(), clients.end());
+            snapshotConnections(snapshot);
+        });
+        if (result.wait_for(timeout) != std::future_status::ready) {
+            return unanswered();
+        }
+        
+        // Complete, the loop no longer touches the snapshot
+        std::vector<ConnectionInfo>& connections = snapshot->connections;
+        size_t total = connections.size();
+        if (!sort.empty()) {
+            sortConnections(connections, sort);
+        }
+        if (limit > 0 && limit < connections.size()) {
+            connections.erase(connections.begin() + static_cast<std::ptrdiff_t>(limit), connections.end());
+        }
+        body = toJson(connections, total);
+        return 200;
+    }
+    
+    body = "{\"error\":\"not found\",\"endpoints\":[\"/broker\",\"/connections\"]}\n";
+    return 404;
+}
+
+void MqttBroker::snapshotConnections(std::shared_ptr<ConnectionSnapshot> snapshot) {
+    auto now = SteadyClock::now();
+    size_t end = std::min(snapshot->next + ADMIN_SNAPSHOT_BATCH, snapshot->clients.size());
+    for (; snapshot->next < end; ++snapshot->next) {
+        std::shared_ptr<Connection>& client = snapshot->clients[snapshot->next];
+        if (client->isConnected()) {
+            snapshot->connections.push_back(describeConnection(*client, now));
+        }
+        client.reset();
+    }
+    
+    // The rest on a later turn, clients are served in between
+    if (snapshot->next < snapshot->clients.size()) {
+        post([this, snapshot]() { snapshotConnections(snapshot); });
+        return;
+    }
+    snapshot->done.set_value();
+}
+
+ConnectionInfo MqttBroker::describeConnection(const Connection& client, SteadyClock::time_point now) const {
+    ConnectionInfo info;
+    info.client_id = client.getClientId();
+    info.username = client.getUsername();
+    info.address = client.isLocal() ? "local" : client.getAddress();
+    info.listener = client.getListener() >= 0 ? listeners_[client.getListener()]->uri : "local";
+    info.keep_alive = client.getKeepAlive();
+    info.connected_seconds = std::chrono::duration<double>(now - client.getConnectedSince()).count();
+    info.bytes_in = client.getBytesReceived();
+    info.bytes_out = client.getBytesSent();
+    info.messages_in = client.getMessagesReceived();
+    info.messages_out = client.getMessagesSent();
+    info.queued_bytes = client.getQueuedBytes();
+    info.queued_messages = client.getQueuedMessages();
+    info.dropped_messages = client.getDroppedMessages();
+    if (const TlsSession* tls = client.getTls()) {
+        info.tls = tls->isEstablished() ? tls->getVersion() : "handshake";
+        bool send = tls->kernelSend();
+        bool receive = tls->kernelReceive();
+        info.ktls = send && receive ? "both" : send ? "send" : receive ? "receive" : "none";
+    }
+    info.inflight = client.getInboundInflight();
+    info.zerocopy_inflight = client.getZeroCopyInflight();
+    info.inbound_buffer_bytes = client.getInboundBufferBytes();
+    info.subscriptions = client.getSubscriptionCount();
+    if (client.isAuthPending()) {
+        info.state = "authenticating";
+    } else if (!client.isEstablished()) {
+        info.state = "connecting";
+    } else if (client.isBackpressured()) {
+        info.state = "backpressured";
+    } else if (client.isThrottled()) {
+        info.state = "throttled";
+    } else {
+        info.state = "reading";
+    }
+    return info;
+}
+
+BrokerInfo MqttBroker::describeBroker() const {
+    BrokerInfo info;
+    info.connections = clients.size();
+    info.subscription_filters = subscriptions.size();
+    info.subscriptions = getTotalSubscriptions();
+    info.retained_messages = retainedMessages.size();
+    info.retained_bytes = retainedBytes_;
+    info.topic_cache_entries = topicCache_.size();
+    info.paused_clients = pausedClients_.size();
+    info.cut_through_streams = streams_.size();
+    info.cluster_peers = cluster_ ? cluster_->getPeerCount() : 0;
+    info.uptime_seconds = std::chrono::duration<double>(SteadyClock::now() - startedAt_).count();
+    info.loop_iterations = loopStats_.iterations;
+    info.loop_idle_spins = loopStats_.idle_spins;
+    info.loop_spin_seconds = std::chrono::duration<double>(loopStats_.spin_time).count();
+    if (arena_) {
+        info.arena_mapped_bytes = arena_->getMappedBytes();
+        info.arena_allocated_bytes = arena_->getAllocatedBytes();
+    }
+    return info;
+}
+
+void MqttBroker::storeRetained(const std::string& topic, const std::vector<uint8_t>& payload, uint8_t qos,
+                               SteadyClock::time_point expires_at) {
+    auto [it, inserted] = retainedMessages.try_emplace(topic);
+    if (inserted) {
+        retainedBytes_ += topic.size();
+    } else {
+        retainedBytes_ -= it->second.payload.size();
+    }
+    RetainedMessage& retained = it->second;
+    retained.payload = payload;
+    retained.qos = qos;
+    retained.expires_at = expires_at;
+    retainedBytes_ += payload.size();
+    
+    // A later deadline is picked up when the earlier entry comes due. An earlier one
+    // adds a second entry and leaves the old one stale until it fires and is skipped
+    bool scheduled = retained.scheduled != SteadyClock::time_point();
+    if (expires_at != SteadyClock::time_point() && (!scheduled || expires_at < retained.scheduled)) {
+        retained.scheduled = expires_at;
+        expiryWheel_.schedule(topic, expires_at);
+    }
+}
+
+// Erases the message and moves it to the next one when it has expired
+bool MqttBroker::retainedExpired(std::map<std::string, RetainedMessage>::iterator& it, SteadyClock::time_point now) {
+    if (!hasExpired(it->second.expires_at, now)) {
+        return false;
+    }
+    size_t bytes = it->first.size() + it->second.payload.size();
+    retainedBytes_ -= bytes;
+    metrics_->incrementRetainedExpired(1, static_cast<double>(bytes));
+    it = retainedMessages.erase(it);
+    return true;
+}
+
+// Reclaims retained messages nobody asked for since they expired, returns when
+// the wheel next has work
+SteadyClock::time_point MqttBroker::expireRetained(SteadyClock::time_point now) {
+    expiryWheel_.advance(now, EXPIRY_SWEEP_BUDGET, [this, now](const std::string& topic, SteadyClock::time_point deadline) {
+        auto it = retainedMessages.find(topic);
+        if (it == retainedMessages.end() || it->second.scheduled != deadline) {
+            return;  // Already gone, or superseded by an earlier entry
+        }
+        RetainedMessage& retained = it->second;
+        retained.scheduled = SteadyClock::time_point();
+        if (retainedExpired(it, now) || retained.expires_at == SteadyClock::time_point()) {
+            return;
+        }
+        // Republished with a later deadline since this entry was made
+        retained.scheduled = retained.expires_at;
+        expiryWheel_.schedule(topic, retained.expires_at);
+    });
+    return expiryWheel_.nextDeadline();
+}
+
+void MqttBroker::openWriteAheadLog() {
+    WriteAheadLog::Options options;
+    options.directory = config_.wal_dir;
+    options.durability = config_.wal_durability;
+    options.commit_delay = std::chrono::microseconds(config_.wal_commit_delay_us);
+    options.segment_bytes = config_.wal_segment_bytes;
+    options.compact_segments = config_.wal_compact_segments;
+    
+    try {
+        wal_ = std::make_unique<WriteAheadLog>(options, [this](const WriteAheadLog::Commit& commit) {
+            post([this, commit]() { completeWalCommit(commit); });
+        });
+        
+        // Replaying the logged retained messages rebuilds the retained store
+        auto begin = SteadyClock::now();
+        size_t records = wal_->recover([this](const WriteAheadLog::Record& record) {
+            if (record.retain) {
+                storeRetained(record.topic, record.payload, record.qos, fromUnixMillis(record.expires_at));
+            }
+        });
+        // What expired while the broker was down is dropped before anyone sees it
+        auto now = SteadyClock::now();
+        for (auto it = retainedMessages.begin(); it != retainedMessages.end();) {
+            if (!retainedExpired(it, now)) {
+                ++it;
+            }
+        }
+        double ms = std::chrono::duration<double, std::milli>(SteadyClock::now() - begin).count();
+        std::cout << "Write-ahead log in " << config_.wal_dir << ": replayed " << records << " records, "
+                  << retainedMessages.size() << " retained messages, in " << ms << " ms" << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << ", running without a write-ahead log" << std::endl;
+        wal_.reset();
+    }
+}
+
+bool MqttBroker::persistPublish(std::shared_ptr<Connection> client, const std::string& topic,
+                                const std::vector<uint8_t>& payload, QoSLevel qos, bool retain, uint16_t packet_id,
+                                SteadyClock::time_point expires_at) {
+    // Only retained messages are logged. Sessions are not persistent, so after a restart there is
+    // nobody to redeliver any other publish to, and holding its PUBACK for the disk bought nothing.
+    if (!wal_ || !retain) {
+        return false;
+    }
+    uint64_t lsn = wal_->append(topic, payload, static_cast<uint8_t>(qos), retain, toUnixMillis(expires_at));
+    // Local clients have no acknowledgement to wait for
+    if (qos != QoSLevel::AT_LEAST_ONCE || wal_->getDurability() == WalDurability::ASYNC || client->isLocal()) {
+        return false;
+    }
+    
+    // Stays in flight until the commit, a client can't outrun the disk
+    durableAcks_.push_back(DurableAck{lsn, client, packet_id});
+    return true;
+}
+
+void MqttBroker::completeWalCommit(const WriteAheadLog::Commit& commit) {
+    metrics_->observeWalCommit(static_cast<double>(commit.records), static_cast<double>(commit.bytes),
+                               std::chrono::duration<double>(commit.duration).count(), commit.ok);
+    
+    // The whole group is acknowledged at once
+    while (!durableAcks_.empty() && durableAcks_.front().lsn <= commit.lsn) {
+        DurableAck ack = std::move(durableAcks_.front());
+        durableAcks_.pop_front();
+        auto client = ack.client.lock();
+        if (!client || !client->isConnected()) {
+            continue;
+        }
+        if (commit.ok) {
+            acknowledgePublish(client, ack.packet_id);
+        } else {
+            client->removeInboundInflight();
+            client->send(ControlFrames::puback(ack.packet_id, 0x80));  // Unspecified error
+        }
+        if (client->isConnected()) {
+            updateInterest(*client);
+        } else {
+            closingClients_.push_back(client);
+        }
+    }
+    
+    // Compaction: a copy of the retained store replaces the segments that built it
+    if (wal_ && wal_->wantsSnapshot()) {
+        auto now = SteadyClock::now();
+        std::vector<WriteAheadLog::Record> retained;
+        retained.reserve(retainedMessages.size());
+        for (auto it = retainedMessages.begin(); it != retainedMessages.end();) {
+            if (retainedExpired(it, now)) {
+                continue;
+            }
+            WriteAheadLog::Record record;
+            record.topic = it->first;
+            record.payload = it->second.payload;
+            record.qos = it->second.qos;
+            record.retain = true;
+            record.expires_at = toUnixMillis(it->second.expires_at);
+            retained.push_back(std::move(record));
             ++it;
         }
+        wal_->snapshot(std::move(retained));
     }
 }
 
-void MqttBroker::acceptNewConnection() {
-    struct sockaddr_in clientAddr;
-    socklen_t clientLen = sizeof(clientAddr);
+bool MqttBroker::authorizePublish(Connection& client, const std::string& topic) {
+    if (!acl_) {
+        return true;
+    }
     
-    int clientSocket = accept(serverSocket, (struct sockaddr*)&clientAddr, &clientLen);
-    if (clientSocket < 0) {
-        std::cerr << "Failed to accept connection" << std::endl;
+    bool allowed;
+    if (client.cachedPublishDecision(topic, acl_->getGeneration(), allowed)) {
+        return allowed;
+    }
+    allowed = acl_->allows(client.getUsername(), client.getClientId(), topic, ACL_WRITE);
+    client.cachePublishDecision(topic, acl_->getGeneration(), allowed);
+    return allowed;
+}
+
+void MqttBroker::updateInterest(Connection& client) {
+    // Paused clients are left unread so TCP backpressure reaches them
+    uint32_t wanted = (client.isReadPaused() ? 0u : static_cast<uint32_t>(EPOLLIN)) |
+                      (client.hasPendingOutput() ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+    if (wanted == client.getWatchedEvents() || client.getSocket() < 0) {
         return;
     }
     
-    std::cout << "New connection accepted from " 
-              << inet_ntoa(clientAddr.sin_addr) << ":" 
-              << ntohs(clientAddr.sin_port) << std::endl;
+    struct epoll_event event;
+    std::memset(&event, 0, sizeof(event));
+    event.events = wanted;
+    event.data.ptr = &client;
+    epoll_ctl(epollFd_, EPOLL_CTL_MOD, client.getSocket(), &event);
+    client.setWatchedEvents(wanted);
+}
+
+void MqttBroker::removeDisconnectedClients() {
+    bool removed = false;
     
-    auto client = std::make_shared<Connection>(clientSocket);
-    clients.push_back(client);
+    // Aborted streams may close more clients while this runs
+    for (size_t i = 0; i < closingClients_.size(); ++i) {
+        auto client = closingClients_[i];
+        
+        // A client can be queued more than once
+        if (clients.erase(client) == 0) {
+            continue;
+        }
+        abortPublishStream(client.get());
+        if (capture_) {
+            capture_->close(client.get(), SteadyClock::now());
+        }
+        
+        if (client->wasSlowConsumer()) {
+            std::cout << "Disconnected slow consumer " << client->getClientId() << std::endl;
+            metrics_->incrementSlowConsumerDisconnects();
+        } else {
+            std::cout << "Client disconnected, " << client->getClientId() << ". Cleaning up subscriptions." << std::endl;
+        }
+        
+        cleanupClientSubscriptions(client);
+        rateLimiter_.removeClient(client.get(), client->getUsername());
+        // The per-client series stay with a session that took the client id over
+        bool taken_over = false;
+        auto owner = clientsById_.find(client->getClientId());
+        if (owner != clientsById_.end()) {
+            auto current = owner->second.lock();
+            if (current == client) {
+                clientsById_.erase(owner);
+            } else {
+                taken_over = current != nullptr;
+            }
+        }
+        client->disconnect();  // Closes the socket if only the connected flag was cleared
+        if (!taken_over) {
+            metrics_->removeClientMetrics(client->getClientId());
+        }
+        if (client->getListener() >= 0) {
+            Listener& listener = *listeners_[client->getListener()];
+            --listener.active;
+            metrics_->setListenerActiveConnections(listener.metrics_id, listener.active);
+        }
+        removed = true;
+    }
+    closingClients_.clear();
     
-    // Update metrics
-    metrics_->incrementTotalConnections();
-    metrics_->setActiveConnections(clients.size());
+    if (removed) {
+        // Update metrics
+        metrics_->setActiveConnections(clients.size());
+        metrics_->setActiveSubscriptions(getTotalSubscriptions());
+    }
+}
+
+void MqttBroker::holdClient(std::shared_ptr<Connection> client) {
+    pausedClients_.push_back(client);
+}
+
+SteadyClock::time_point MqttBroker::servicePausedClients() {
+    auto now = SteadyClock::now();
+    auto wakeup = now + std::chrono::seconds(1);
+    size_t backpressured = 0;
+    
+    // Handlers below may pause clients again, which re-adds them
+    std::vector<std::shared_ptr<Connection>> paused;
+    paused.swap(pausedClients_);
+    
+    for (auto& client : paused) {
+        if (!client->isConnected() || !client->isReadPaused()) {
+            continue;  // Gone, or a duplicate entry already resumed
+        }
+        
+        if (client->isThrottled() && client->getThrottleDeadline() <= now) {
+            client->clearThrottle();
+        }
+        
+        if (client->isBackpressured() && client->congestionCleared(config_.flow_low_watermark)) {
+            // Subscribers caught up, hand the withheld credits back
+            client->resumeReading();
+            for (uint16_t packet_id : client->takeDeferredAcks()) {
+                client->removeInboundInflight();
+                client->send(ControlFrames::puback(packet_id, 0));
+            }
+        }
+        
+        if (client->isReadPaused()) {
+            if (client->isBackpressured()) {
+                ++backpressured;
+            }
+            if (client->isThrottled()) {
+                wakeup = std::min(wakeup, client->getThrottleDeadline());
+            }
+            pausedClients_.push_back(client);
+            continue;
+        }
+        
+        // Packets buffered before the pause won't trigger another read event
+        processInbound(client);
+        if (client->isConnected()) {
+            updateInterest(*client);
+        } else {
+            closingClients_.push_back(client);
+        }
+    }
+    
+    if (config_.flow_control) {
+        metrics_->setFlowControlPausedClients(backpressured);
+    }
+    removeDisconnectedClients();
+    return wakeup;
+}
+
+bool MqttBroker::admitTraffic(std::shared_ptr<Connection> client, size_t bytes) {
+    if (!rateLimiter_.isEnabled()) {
+        return true;
+    }
+    
+    auto now = SteadyClock::now();
+    auto wait = rateLimiter_.charge(client.get(), client->getUsername(), bytes, now);
+    if (wait == SteadyClock::duration::zero()) {
+        return true;
+    }
+    
+    if (config_.rate_limit_disconnect) {
+        std::cerr << "Rate limit exceeded by " << client->getClientId() << ", disconnecting" << std::endl;
+        metrics_->incrementRateLimitDisconnects();
+        client->send(ControlFrames::disconnect(0x96));  // Message rate too high
+        client->disconnect();
+        return false;
+    }
+    
+    // Let this packet through, but don't read any more until the debt is paid
+    if (!client->isThrottled()) {
+        metrics_->incrementRateLimitThrottles();
+        holdClient(client);
+    }
+    client->throttleUntil(now + wait);
+    return true;
+}
+
+void MqttBroker::acceptNewConnections(Listener& listener) {
+    size_t accepted = 0;
+    
+    // Drain the whole accept queue in one wakeup
+    while (running) {
+        struct sockaddr_storage clientAddr;
+        socklen_t clientLen = sizeof(clientAddr);
+        
+        int clientSocket = accept4(listener.socket, (struct sockaddr*)&clientAddr, &clientLen,
+                                   SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (clientSocket < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno == EMFILE || errno == ENFILE) {
+                // Out of descriptors: accept and close with the spare one, or the
+                // pending connection keeps the listener readable forever
+                metrics_->incrementConnectionErrors();
+                if (spareFd_ >= 0) {
+                    close(spareFd_);
+                    int shed = accept(listener.socket, nullptr, nullptr);
+                    if (shed >= 0) {
+                        close(shed);
+                    }
+                    spareFd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
+                    continue;
+                }
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                std::cerr << "Failed to accept connection: " << std::strerror(errno) << std::endl;
+            }
+            break;
+        }
+        
+        // Connection rate limit, shed the excess before it costs anything
+        if (!acceptBucket_.consume(1, SteadyClock::now())) {
+            close(clientSocket);
+            metrics_->incrementConnectionsRejected();
+            continue;
+        }
+        
+        // Buffers and queues come from the arena when there is one. The connection itself stays
+        // on the heap: workers hold weak references to it, and dropping the last one frees the
+        // control block on their thread, where the arena must not be touched.
+        std::pmr::memory_resource* memory = arena_ ? arena_.get() : std::pmr::get_default_resource();
+        auto client = std::make_shared<Connection>(clientSocket, config_.outboundLimits(), memory);
+        client->setListener(static_cast<int>(listener.index));
+        client->setAddress(formatAddress(clientAddr));
+        client->setTransmitStats(&transmitStats_);
+        if (tracer_.isEnabled()) {
+            client->setTracer(&tracer_);
+        }
+        if (listener.tls) {
+            std::unique_ptr<TlsSession> session = tlsContext_->accept(clientSocket);
+            if (!session) {
+                client->disconnect();
+                metrics_->incrementConnectionErrors();
+                continue;
+            }
+            client->startTls(std::move(session));
+        }
+        // kTLS sockets refuse MSG_ZEROCOPY, and userspace TLS copies into records anyway
+        if (config_.zerocopy_threshold > 0 && !listener.unix_socket && !listener.tls) {
+            client->enableZeroCopy(config_.zerocopy_threshold);
+        }
+        if (config_.low_latency && !listener.unix_socket) {
+            // Small frames go out at once, and reads poll the device queue instead of waiting for an interrupt
+            int one = 1;
+            setsockopt(clientSocket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            if (config_.socket_busy_poll_us > 0 &&
+                setsockopt(clientSocket, SOL_SOCKET, SO_BUSY_POLL, &config_.socket_busy_poll_us,
+                           sizeof(config_.socket_busy_poll_us)) < 0 && !busyPollWarned_) {
+                std::cerr << "SO_BUSY_POLL not set: " << std::strerror(errno) << std::endl;
+                busyPollWarned_ = true;
+            }
+        }
+        
+        struct epoll_event event;
+        std::memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.ptr = client.get();
+        epoll_ctl(epollFd_, EPOLL_CTL_ADD, clientSocket, &event);
+        client->setWatchedEvents(EPOLLIN);
+        
+        clients.insert(client);
+        metrics_->incrementTotalConnections();
+        metrics_->incrementListenerConnections(listener.metrics_id);
+        ++listener.active;
+        ++accepted;
+        
+        // With deferred accept the CONNECT is usually already here, handle it now
+        if (config_.tcp_defer_accept > 0) {
+            handleClientData(client);
+            if (client->isConnected()) {
+                updateInterest(*client);
+            } else {
+                closingClients_.push_back(client);
+            }
+        }
+    }
+    
+    if (accepted > 0) {
+        // Update metrics
+        metrics_->setActiveConnections(clients.size());
+        metrics_->setListenerActiveConnections(listener.metrics_id, listener.active);
+    }
 }
 
 void MqttBroker::handleClientData(std::shared_ptr<Connection> client) {
-    std::vector<uint8_t> buffer = client->receive();
+    size_t bytesRead = client->receive();
+    
+    if (bytesRead > 0) {
+        if (tracer_.isEnabled() || capture_) {
+            client->setReceiveTime(SteadyClock::now());
+        }
+        
+        // Track bytes received
+        metrics_->incrementBytesReceived(bytesRead);
+        metrics_->incrementListenerBytesReceived(listeners_[client->getListener()]->metrics_id, bytesRead);
+        processInbound(client);
+    }
     
-    if (buffer.empty()) {
+    if (client->isPeerClosed() && client->isConnected()) {
         // Client disconnected
         if (!client->hasReceivedData()) {
             // Port probe or connection without MQTT handshake - suppress noisy logging
@@ -158,50 +1401,108 @@ void MqttBroker::handleClientData(std::shared_ptr<Connection> client) {
             std::cout << "Client disconnected ungracefully" << std::endl;
         }
         client->disconnect();
-        return;
     }
+}
+
+void MqttBroker::processInbound(std::shared_ptr<Connection> client) {
+    std::vector<uint8_t> frame;
     
-    // Track bytes received
-    metrics_->incrementBytesReceived(buffer.size());
-    
-    try {
-        MqttPacket packet = MqttPacket::parse(buffer);
-        PacketType type = packet.get_packet_type();
-        
-        switch (type) {
-            case PacketType::CONNECT:
-                handleConnect(client, packet);
+    // Handle every complete packet that arrived, unless the client got paused meanwhile
+    while (client->isConnected() && !client->isReadPaused()) {
+        try {
+            // Payload of a PUBLISH being cut through, relay whatever arrived
+            auto stream = streams_.find(client.get());
+            if (stream != streams_.end()) {
+                if (!relayPublishStream(client, stream->second)) {
+                    break;
+                }
+                continue;
+            }
+            
+            uint8_t type_flags;
+            uint32_t remaining;
+            size_t header_length;
+            if (!client->peekFrameHeader(type_flags, remaining, header_length)) {
                 break;
-                
-            case PacketType::PUBLISH:
-                handlePublish(client, packet);
+            }
+            size_t packet_size = header_length + remaining;
+            
+            // CONNECT first and only once. Nothing else is handled before it was accepted, so
+            // every packet carries verified credentials, and a second one can't replace them.
+            bool is_connect = static_cast<PacketType>(type_flags >> 4) == PacketType::CONNECT;
+            if (is_connect == client->isEstablished()) {
+                std::cerr << (is_connect ? "Second CONNECT from " : "Packet before CONNECT from ")
+                          << client->getAddress() << std::endl;
+                client->send(ControlFrames::disconnect(0x82));  // Protocol Error
+                client->disconnect();
                 break;
-                
-            case PacketType::SUBSCRIBE:
-                handleSubscribe(client, packet);
+            }
+            
+            // Refused from the fixed header, before any of it is buffered
+            if (config_.max_packet_size > 0 && packet_size > config_.max_packet_size) {
+                std::cerr << "Packet of " << packet_size << " bytes from " << client->getClientId()
+                          << " exceeds the maximum packet size" << std::endl;
+                metrics_->incrementPacketsTooLarge();
+                client->send(ControlFrames::disconnect(0x95));  // Packet too large
+                client->disconnect();
                 break;
-                
-            case PacketType::UNSUBSCRIBE:
-                handleUnsubscribe(client, packet);
+            }
+            
+            // Large PUBLISH, forwarded once the topic is known instead of after the whole payload
+            if (config_.cut_through_threshold > 0 && packet_size >= config_.cut_through_threshold &&
+                static_cast<PacketType>(type_flags >> 4) == PacketType::PUBLISH) {
+                if (!beginPublishStream(client)) {
+                    break;
+                }
+                continue;
+            }
+            
+            if (!client->nextFrame(frame)) {
                 break;
+            }
+            if (capture_) {
+                capture_->record(client.get(), Capture::RecordType::FRAME, frame.data(), frame.size(),
+                                 client->getReceiveTime());
+            }
+            
+            MqttPacket packet = MqttPacket::parse(frame);
+            PacketType type = packet.get_packet_type();
+            
+            switch (type) {
+                case PacketType::CONNECT:
+                    handleConnect(client, packet);
+                    break;
                 
-            case PacketType::PINGREQ:
-                handlePingreq(client);
-                break;
+                case PacketType::PUBLISH:
+                    handlePublish(client, packet);
+                    break;
                 
-            case PacketType::DISCONNECT:
-                handleDisconnect(client);
-                break;
+                case PacketType::SUBSCRIBE:
+                    handleSubscribe(client, packet);
+                    break;
                 
-            default:
-                std::cout << "Unsupported packet type: " << static_cast<int>(type) << std::endl;
-                break;
-        }
+                case PacketType::UNSUBSCRIBE:
+                    handleUnsubscribe(client, packet);
+                    break;
+                
+                case PacketType::PINGREQ:
+                    handlePingreq(client);
+                    break;
+                
+                case PacketType::DISCONNECT:
+                    handleDisconnect(client);
+                    break;
+                
+                default:
+                    std::cout << "Unsupported packet type: " << static_cast<int>(type) << std::endl;
+                    break;
+            }
         
-    } catch (const std::exception& e) {
-        std::cerr << "Error parsing packet: " << e.what() << std::endl;
-        metrics_->incrementConnectionErrors();
-        client->disconnect();
+        } catch (const std::exception& e) {
+            std::cerr << "Error parsing packet: " << e.what() << std::endl;
+            metrics_->incrementConnectionErrors();
+            client->disconnect();
+        }
     }
 }
 
@@ -215,28 +1516,110 @@ void MqttBroker::handleConnect(std::shared_ptr<Connection> client, const MqttPac
         std::cout << "Protocol: " << connect.protocol_name << " v" 
                   << static_cast<int>(connect.protocol_version) << std::endl;
         
+        client->setClientId(connect.client_id);
+        client->setUsername(connect.username);
+        client->setKeepAlive(connect.keep_alive);
+        
         // TODO: Validate protocol version (should be 5 for MQTT 5.0)
         // TODO: Check client_id, handle clean session, etc.
         
-        // Send CONNACK - successful connection
-        MqttPacket connack = PacketFactory::create_connack(0, 0);  // session_present=0, reason_code=0 (success)
-        std::vector<uint8_t> response = connack.serialize();
-        client->send(response);
+        if (!authenticator_) {
+            completeConnect(client);
+            return;
+        }
+        
+        // Verified recently, skip the expensive hash
+        if (authCache_.contains(connect.username, connect.password)) {
+            metrics_->incrementAuthCacheHits();
+            completeConnect(client);
+            return;
+        }
         
+        // Verify on a worker, nothing else is read from this client until the result is posted back
+        client->setAuthPending(true);
+        std::weak_ptr<Connection> pending = client;
+        Authenticator* authenticator = authenticator_.get();
+        workers_->submit([this, pending, authenticator, connect]() {
+            bool authenticated = authenticator->authenticate(connect.client_id, connect.username, connect.password);
+            post([this, pending, connect, authenticated]() {
+                if (auto client = pending.lock()) {
+                    finishAuthentication(client, connect.username, connect.password, authenticated);
+                }
+            });
+        });
+    
     } catch (const std::exception& e) {
         std::cerr << "Error handling CONNECT: " << e.what() << std::endl;
         
         // Send CONNACK with error
-        MqttPacket connack = PacketFactory::create_connack(0, 0x80);  // Unspecified error
-        std::vector<uint8_t> response = connack.serialize();
-        client->send(response);
+        ControlFrames::Connack connack(0, 0x80);  // Unspecified error
+        client->send(connack.data(), connack.size());
+        client->disconnect();
+    }
+}
+
+void MqttBroker::completeConnect(std::shared_ptr<Connection> client) {
+    client->setEstablished();
+    rateLimiter_.addClient(client.get(), client->getUsername());
+    
+    // One session per client id, here and on the other nodes
+    if (!client->getClientId().empty()) {
+        takeOverClientId(client->getClientId(), client.get());
+        clientsById_[client->getClientId()] = client;
+        if (cluster_) {
+            cluster_->clientConnected(client->getClientId());
+        }
+    }
+    
+    // Send CONNACK - successful connection
+    ControlFrames::Connack connack(0, 0);  // session_present=0, reason_code=0 (success)
+    
+    // Advertise Receive Maximum when inbound QoS > 0 is flow controlled
+    if (config_.flow_control) {
+        connack.propertyUint16(0x21, config_.receive_maximum);  // Receive Maximum
+    }
+    if (config_.max_packet_size > 0) {
+        connack.propertyUint32(0x27, static_cast<uint32_t>(std::min<size_t>(config_.max_packet_size, UINT32_MAX)));  // Maximum Packet Size
+    }
+    client->send(connack.data(), connack.size());
+}
+
+void MqttBroker::finishAuthentication(std::shared_ptr<Connection> client, const std::string& username,
+                                      const std::string& password, bool authenticated) {
+    if (!client->isConnected()) {
+        return;  // Went away while being verified
+    }
+    client->setAuthPending(false);
+    
+    if (authenticated) {
+        metrics_->incrementAuthSuccesses();
+        authCache_.insert(username, password);
+        completeConnect(client);
+        
+        // Packets pipelined behind the CONNECT are already buffered
+        processInbound(client);
+    } else {
+        std::cerr << "Authentication failed for " << client->getClientId() << std::endl;
+        metrics_->incrementAuthFailures();
+        ControlFrames::Connack connack(0, 0x86);  // Bad User Name or Password
+        client->send(connack.data(), connack.size());
         client->disconnect();
     }
+    
+    if (client->isConnected()) {
+        updateInterest(*client);
+    } else {
+        closingClients_.push_back(client);
+    }
 }
 
 void MqttBroker::handlePublish(std::shared_ptr<Connection> client, const MqttPacket& packet) {
     std::cout << "Handling PUBLISH packet" << std::endl;
     
+    if (!admitTraffic(client, packet.get_remaining_length())) {
+        return;
+    }
+    
     try {
         // Parse PUBLISH packet
         PublishPacket publish = PublishPacket::parse(packet);
@@ -244,56 +1627,453 @@ void MqttBroker::handlePublish(std::shared_ptr<Connection> client, const MqttPac
         std::cout << "Topic: " << publish.topic_name << std::endl;
         std::cout << "Message: " << std::string(publish.message.begin(), publish.message.end()) << std::endl;
         
-        // Track metrics
-        metrics_->incrementMessagesReceived();
-        metrics_->observeMessageSize(publish.message.size());
+        if (!checkTopicName(client, publish.topic_name)) {
+            return;
+        }
         
-        // Handle retained messages
-        if (packet.get_retain_flag()) {
-            retainedMessages[publish.topic_name] = {publish.message, static_cast<uint8_t>(packet.get_qos())}; // Store retained message, overwrite existing
-            std::cout << "Stored retained message for topic: " << publish.topic_name << std::endl;
+        // More unacknowledged QoS 1 publishes than we advertised
+        if (config_.flow_control && packet.get_qos() == QoSLevel::AT_LEAST_ONCE &&
+            client->getInboundInflight() >= config_.receive_maximum) {
+            std::cerr << "Receive Maximum exceeded by " << client->getClientId() << std::endl;
+            metrics_->incrementReceiveMaximumExceeded();
+            client->send(ControlFrames::disconnect(0x93));  // Receive Maximum exceeded
+            client->disconnect();
+            return;
         }
         
-        // Forward message to all subscribers
-        if (subscriptions.find(publish.topic_name) != subscriptions.end()) { // has subscribers
-            for (auto& subscriber : subscriptions[publish.topic_name]) {
-                if (subscriber->isConnected()) { // send to all connected subscribers
-
-                    MqttPacket forward = PacketFactory::create_publish(
-                        publish.topic_name, 
-                        publish.message, 
-                        packet.get_qos(), 
-                        false,  // Don't forward retain flag
-                        0
-                    );
-                    std::vector<uint8_t> data = forward.serialize();
-                    subscriber->send(data);
-                    
-                    // Track bytes sent and messages published
-                    metrics_->incrementBytesSent(data.size());
-                    metrics_->incrementMessagesPublished();
-                    
-                    std::cout << "Forwarded message to subscribers" << std::endl;
-                }
+        // Not authorized, QoS 0 is dropped silently
+        if (!authorizePublish(*client, publish.topic_name)) {
+            std::cerr << "Publish to " << publish.topic_name << " denied for " << client->getClientId() << std::endl;
+            metrics_->incrementAclPublishDenied();
+            if (packet.get_qos() == QoSLevel::AT_LEAST_ONCE) {
+                client->send(ControlFrames::puback(publish.packet_identifier, 0x87));  // Not authorized
             }
+            return;
         }
-        
-        // Send PUBACK if QoS > 0
         if (packet.get_qos() == QoSLevel::AT_LEAST_ONCE) {
-            MqttPacket puback = PacketFactory::create_puback(publish.packet_identifier, 0);
-            std::vector<uint8_t> response = puback.serialize();
-            client->send(response);
-            std::cout << "Sent PUBACK" << std::endl;
+            client->addInboundInflight();  // Until acknowledgePublish()
         }
         
+        // Sampled publishes are timestamped through matching and every subscriber's queue
+        uint32_t trace = tracer_.sample();
+        if (trace) {
+            tracer_.record(trace, TraceStage::READ, client->getSocket(), client->getReceiveTime());
+            tracer_.record(trace, TraceStage::DECODE, client->getSocket());
+            tracer_.describe(trace, client->getClientId(), publish.topic_name);
+        }
+        
+        client->countMessageReceived();
+        activeTrace_ = trace;
+        std::vector<std::weak_ptr<Connection>> congested = routeMessage(
+            publish.topic_name, publish.message, packet.get_qos(), packet.get_retain_flag(), client.get(),
+            publish.message_expiry);
+        activeTrace_ = 0;
+        
+        // Subscribers fell behind, stop reading from this publisher until they drain
+        if (!congested.empty()) {
+            pausePublisher(client, std::move(congested));
+        }
+        
+        // Logged publishes are acknowledged once their group commit completes
+        bool durable = persistPublish(client, publish.topic_name, publish.message, packet.get_qos(),
+                                      packet.get_retain_flag(), publish.packet_identifier,
+                                      expiryDeadline(publish.message_expiry, SteadyClock::now()));
+        if (packet.get_qos() == QoSLevel::AT_LEAST_ONCE && !durable) {
+            acknowledgePublish(client, publish.packet_identifier);
+        }
+    
     } catch (const std::exception& e) {
         std::cerr << "Error handling PUBLISH: " << e.what() << std::endl;
+        client->send(ControlFrames::disconnect(0x81));  // Malformed Packet
+        client->disconnect();
+    }
+}
+
+bool MqttBroker::checkTopicName(std::shared_ptr<Connection> client, const std::string& topic) {
+    // Wildcards and NUL are only allowed in filters, a topic name carrying them is a protocol error
+    TopicMatcher::scan(topic, topicLevels_);
+    if (TopicMatcher::isValidTopicName(topic, topicLevels_)) {
+        return true;
+    }
+    std::cerr << "Invalid topic name from " << client->getClientId() << std::endl;
+    client->send(ControlFrames::disconnect(0x90));  // Topic Name invalid
+    client->disconnect();
+    return false;
+}
+
+void MqttBroker::acknowledgePublish(std::shared_ptr<Connection> client, uint16_t packet_id) {
+    // Withheld while subscribers hold the publisher back, so it runs out of Receive Maximum
+    // credits. Only backpressure releases them again: a throttled or authenticating client
+    // gets its acknowledgements right away.
+    if (client->isBackpressured()) {
+        client->deferAck(packet_id);
+    } else {
+        client->removeInboundInflight();
+        client->send(ControlFrames::puback(packet_id, 0));
+    }
+}
+
+void MqttBroker::pausePublisher(std::shared_ptr<Connection> client, std::vector<std::weak_ptr<Connection>> congested) {
+    if (!client->isBackpressured()) {
+        metrics_->incrementFlowControlPauses();
+        holdClient(client);
+    }
+    client->pauseReading(std::move(congested));
+}
+
+void MqttBroker::recordBytesSent(const Connection& subscriber, size_t bytes) {
+    metrics_->incrementBytesSent(bytes);
+    metrics_->incrementListenerBytesSent(listeners_[subscriber.getListener()]->metrics_id, bytes);
+}
+
+bool MqttBroker::recordDelivery(const Connection& subscriber, const SendResult& result, size_t bytes) {
+    if (result.dropped > 0) {
+        metrics_->incrementMessagesDropped(subscriber.getClientId(), result.dropped);
+    }
+    if (!result.accepted) {
+        return false;
+    }
+    recordBytesSent(subscriber, bytes);
+    metrics_->incrementMessagesPublished();
+    return true;
+}
+
+bool MqttBroker::beginPublishStream(std::shared_ptr<Connection> client) {
+    size_t available;
+    const uint8_t* data = client->peekInbound(available);
+    PublishHeader header;
+    if (!PublishHeader::parse(data, available, header)) {
+        return false;  // Topic or properties still incomplete
+    }
+    if (capture_) {
+        capture_->record(client.get(), Capture::RecordType::DATA, data, header.header_length, client->getReceiveTime());
+    }
+    client->consumeInbound(header.header_length);
+    
+    PublishStream stream;
+    stream.topic = header.topic_name;
+    stream.qos = header.qos;
+    stream.retain = header.retain;
+    stream.packet_id = header.packet_identifier;
+    stream.message_expiry = header.message_expiry;
+    stream.expires_at = expiryDeadline(header.message_expiry, SteadyClock::now());
+    stream.remaining = header.payload_length;
+    
+    if (!checkTopicName(client, stream.topic)) {
+        return false;
+    }
+    
+    if (!admitTraffic(client, header.header_length + header.payload_length)) {
+        return false;
+    }
+    
+    if (config_.flow_control && stream.qos == QoSLevel::AT_LEAST_ONCE &&
+        client->getInboundInflight() >= config_.receive_maximum) {
+        std::cerr << "Receive Maximum exceeded by " << client->getClientId() << std::endl;
+        metrics_->incrementReceiveMaximumExceeded();
+        client->send(ControlFrames::disconnect(0x93));  // Receive Maximum exceeded
+        client->disconnect();
+        return false;
+    }
+    
+    // Not authorized, the payload is still read off the socket but goes nowhere
+    stream.authorized = authorizePublish(*client, stream.topic);
+    if (!stream.authorized) {
+        std::cerr << "Publish to " << stream.topic << " denied for " << client->getClientId() << std::endl;
+        metrics_->incrementAclPublishDenied();
+        if (stream.qos == QoSLevel::AT_LEAST_ONCE) {
+            client->send(ControlFrames::puback(stream.packet_id, 0x87));  // Not authorized
+        }
+        streams_[client.get()] = std::move(stream);
+        return true;
+    }
+    
+    if (stream.qos == QoSLevel::AT_LEAST_ONCE) {
+        client->addInboundInflight();  // Until finishPublishStream() acknowledges it
+    }
+    metrics_->incrementMessagesReceived();
+    metrics_->incrementCutThroughMessages();
+    client->countMessageReceived();
+    metrics_->observeMessageSize(header.payload_length);
+    trackTopTalkers(header.topic_name, header.payload_length, client.get());
+    
+    // Same frame as deliverLocal() would build, the payload follows in pieces
+    auto frameHeader = std::make_shared<const std::vector<uint8_t>>(
+        PacketFactory::create_publish_header(stream.topic, header.payload_length, stream.qos, false, 0,
+                                             stream.message_expiry));
+    for (auto& subscriber : matchSubscribers(stream.topic)) {
+        if (!subscriber->isConnected()) {
+            continue;
+        }
+        
+        // One open stream per subscriber, a second one waits for the whole message
+        if (subscriber->isLocal() || !subscriber->beginStream(frameHeader)) {
+            stream.deferred.push_back(subscriber);
+            continue;
+        }
+        stream.subscribers.push_back(subscriber);
+        recordBytesSent(*subscriber, frameHeader->size());
+        metrics_->incrementMessagesPublished();
+        if (!subscriber->isConnected()) {
+            closingClients_.push_back(subscriber);
+        } else if (subscriber != client) {
+            updateInterest(*subscriber);
+        }
+    }
+    
+    stream.collect = stream.retain || !stream.deferred.empty() || (cluster_ && cluster_->getPeerCount() > 0);
+    if (stream.collect) {
+        stream.payload.reserve(header.payload_length);
+    }
+    streams_[client.get()] = std::move(stream);
+    return true;
+}
+
+bool MqttBroker::relayPublishStream(std::shared_ptr<Connection> client, PublishStream& stream) {
+    size_t available;
+    const uint8_t* data = client->peekInbound(available);
+    size_t length = std::min(available, stream.remaining);
+    if (length == 0 && stream.remaining > 0) {
+        return false;  // Wait for more of the payload
+    }
+    
+    if (capture_ && length > 0) {
+        capture_->record(client.get(), Capture::RecordType::DATA, data, length, client->getReceiveTime());
+    }
+    stream.remaining -= length;
+    bool last = stream.remaining == 0;
+    if (stream.authorized) {
+        if (stream.collect) {
+            stream.payload.insert(stream.payload.end(), data, data + length);
+        }
+        
+        // One copy of the piece, shared by the subscribers' queues
+        auto chunk = std::make_shared<const std::vector<uint8_t>>(data, data + length);
+        std::vector<std::weak_ptr<Connection>> congested;
+        for (auto& weak : stream.subscribers) {
+            auto subscriber = weak.lock();
+            if (!subscriber || !subscriber->isConnected()) {
+                continue;
+            }
+            subscriber->streamChunk(chunk, last);
+            recordBytesSent(*subscriber, length);
+            if (config_.flow_control && subscriber->getQueuedBytes() > config_.flow_high_watermark) {
+                congested.push_back(subscriber);
+            }
+            if (!subscriber->isConnected()) {
+                closingClients_.push_back(subscriber);
+            } else if (subscriber != client) {
+                updateInterest(*subscriber);
+            }
+        }
+        
+        // Bounds what the broker holds to the flow control watermarks, however large the payload
+        if (!congested.empty()) {
+            pausePublisher(client, std::move(congested));
+        }
+    }
+    client->consumeInbound(length);
+    
+    if (last) {
+        auto it = streams_.find(client.get());
+        PublishStream finished = std::move(it->second);
+        streams_.erase(it);
+        finishPublishStream(client, std::move(finished));
+    }
+    return true;
+}
+
+void MqttBroker::finishPublishStream(std::shared_ptr<Connection> client, PublishStream stream) {
+    if (!stream.authorized) {
+        return;
+    }
+    
+    // A payload slower to arrive than its expiry interval is only acknowledged
+    auto now = SteadyClock::now();
+    if (hasExpired(stream.expires_at, now)) {
+        if (stream.qos == QoSLevel::AT_LEAST_ONCE) {
+            acknowledgePublish(client, stream.packet_id);
+        }
+        return;
+    }
+    uint32_t expiry = remainingExpiry(stream.expires_at, now);
+    
+    if (stream.retain) {
+        storeRetained(stream.topic, stream.payload, static_cast<uint8_t>(stream.qos), stream.expires_at);
+    }
+    
+    // Subscribers that could not take it piecewise get the whole message, queued behind their open stream
+    std::shared_ptr<const std::vector<uint8_t>> frame;
+    for (auto& weak : stream.deferred) {
+        auto subscriber = weak.lock();
+        if (!subscriber || !subscriber->isConnected()) {
+            continue;
+        }
+        if (subscriber->isLocal()) {
+            subscriber->deliverLocal(stream.topic, stream.payload, static_cast<uint8_t>(stream.qos), false);
+            metrics_->incrementMessagesPublished();
+            continue;
+        }
+        
+        if (!frame) {
+            MqttPacket forward = PacketFactory::create_publish(stream.topic, stream.payload, stream.qos, false, 0, expiry);
+            frame = std::make_shared<const std::vector<uint8_t>>(forward.serialize());
+        }
+        SendResult result = subscriber->sendMessage(frame, static_cast<uint8_t>(stream.qos), 0, stream.expires_at);
+        recordDelivery(*subscriber, result, frame->size());
+        if (!subscriber->isConnected()) {
+            closingClients_.push_back(subscriber);
+        } else if (subscriber != client) {
+            updateInterest(*subscriber);
+        }
+    }
+    
+    if (cluster_ && stream.collect) {
+        size_t forwarded = cluster_->publish(stream.topic, stream.payload, static_cast<uint8_t>(stream.qos), stream.retain,
+                                             expiry);
+        metrics_->incrementClusterForwarded(forwarded);
+    }
+    
+    bool durable = persistPublish(client, stream.topic, stream.payload, stream.qos, stream.retain, stream.packet_id,
+                                  stream.expires_at);
+    if (stream.qos == QoSLevel::AT_LEAST_ONCE && !durable) {
+        acknowledgePublish(client, stream.packet_id);
+    }
+}
+
+void MqttBroker::abortPublishStream(const Connection* client) {
+    auto it = streams_.find(client);
+    if (it == streams_.end()) {
+        return;
+    }
+    
+    // The publisher left mid-payload. The frame can't be completed, so subscribers that
+    // already got part of it are closed before they read the next packet as payload.
+    for (auto& weak : it->second.subscribers) {
+        auto subscriber = weak.lock();
+        if (subscriber && subscriber->isConnected()) {
+            std::cerr << "Closing " << subscriber->getClientId() << ", cut-through message was truncated" << std::endl;
+            subscriber->disconnect();
+            closingClients_.push_back(subscriber);
+        }
+    }
+    streams_.erase(it);
+}
+
+std::vector<std::weak_ptr<Connection>> MqttBroker::routeMessage(const std::string& topic, const std::vector<uint8_t>& message,
+                                                                QoSLevel qos, bool retain, const Connection* publisher,
+                                                                uint32_t message_expiry) {
+    // Track metrics
+    metrics_->incrementMessagesReceived();
+    metrics_->observeMessageSize(message.size());
+    trackTopTalkers(topic, message.size(), publisher);
+    
+    // Handle retained messages
+    if (retain) {
+        // Store retained message, overwrite existing
+        storeRetained(topic, message, static_cast<uint8_t>(qos), expiryDeadline(message_expiry, SteadyClock::now()));
+        std::cout << "Stored retained message for topic: " << topic << std::endl;
+    }
+    
+    // Forward message to all matching subscribers, then to nodes with matching subscribers
+    std::vector<std::weak_ptr<Connection>> congested = deliverLocal(topic, message, qos, publisher, message_expiry);
+    if (cluster_) {
+        size_t forwarded = cluster_->publish(topic, message, static_cast<uint8_t>(qos), retain, message_expiry);
+        metrics_->incrementClusterForwarded(forwarded);
+    }
+    return congested;
+}
+
+void MqttBroker::handleClusterPublish(const std::string& topic, const std::vector<uint8_t>& message,
+                                      uint8_t qos, bool retain, uint32_t message_expiry) {
+    // Already authorized and counted by the origin node, only deliver here
+    metrics_->incrementClusterReceived();
+    if (retain) {
+        storeRetained(topic, message, qos, expiryDeadline(message_expiry, SteadyClock::now()));
+    }
+    deliverLocal(topic, message, static_cast<QoSLevel>(qos), nullptr, message_expiry);
+}
+
+std::vector<std::weak_ptr<Connection>> MqttBroker::deliverLocal(const std::string& topic, const std::vector<uint8_t>& message,
+                                                                QoSLevel qos, const Connection* publisher,
+                                                                uint32_t message_expiry) {
+    // Serialized once and shared by the subscribers' queues
+    std::shared_ptr<const std::vector<uint8_t>> frame;
+    SteadyClock::time_point deadline;  // Queued copies are dropped once it passes
+    std::vector<std::weak_ptr<Connection>> congested;
+    const TopicMatchCache::Subscribers& subscribers = matchSubscribers(topic);
+    if (activeTrace_) {
+        tracer_.record(activeTrace_, TraceStage::MATCH, -1);
+    }
+    for (auto& subscriber : subscribers) {
+        if (subscriber->isConnected()) { // send to all connected subscribers
+            
+            // In-process subscribers take the payload directly
+            if (subscriber->isLocal()) {
+                if (activeTrace_) {
+                    tracer_.record(activeTrace_, TraceStage::ENQUEUE, -1);
+                }
+                subscriber->deliverLocal(topic, message, static_cast<uint8_t>(qos), false);
+                metrics_->incrementMessagesPublished();
+                continue;
+            }
+            
+            if (!frame) {
+                MqttPacket forward = PacketFactory::create_publish(
+                    topic, 
+                    message, 
+                    qos, 
+                    false,  // Don't forward retain flag
+                    0,
+                    message_expiry
+                );
+                frame = std::make_shared<const std::vector<uint8_t>>(forward.serialize());
+                deadline = expiryDeadline(message_expiry, SteadyClock::now());
+            }
+            
+            SendResult result = subscriber->sendMessage(frame, static_cast<uint8_t>(qos), activeTrace_, deadline);
+            bool delivered = recordDelivery(*subscriber, result, frame->size());
+            if (config_.flow_control && subscriber->getQueuedBytes() > config_.flow_high_watermark) {
+                congested.push_back(subscriber);
+            }
+            if (!subscriber->isConnected()) {
+                closingClients_.push_back(subscriber);
+            } else if (subscriber.get() != publisher) {
+                updateInterest(*subscriber);
+            }
+            
+            if (delivered) {
+                std::cout << "Forwarded message to subscribers" << std::endl;
+            }
+        }
+    }
+    return congested;
+}
+
+void MqttBroker::takeOverClientId(const std::string& client_id, const Connection* keep) {
+    auto it = clientsById_.find(client_id);
+    if (it == clientsById_.end()) {
+        return;
+    }
+    
+    auto previous = it->second.lock();
+    if (previous && previous.get() != keep && previous->isConnected()) {
+        std::cout << "Session taken over for client " << client_id << std::endl;
+        metrics_->incrementSessionTakeovers();
+        previous->send(ControlFrames::disconnect(0x8E));  // Session taken over
+        previous->disconnect();
+        closingClients_.push_back(previous);
     }
+    clientsById_.erase(it);
 }
 
 void MqttBroker::handleSubscribe(std::shared_ptr<Connection> client, const MqttPacket& packet) {
     std::cout << "Handling SUBSCRIBE packet" << std::endl;
     
+    if (!admitTraffic(client, packet.get_remaining_length())) {
+        return;
+    }
+    
     try {
         SubscribePacket subscribe = SubscribePacket::parse(packet);
         
@@ -302,22 +2082,51 @@ void MqttBroker::handleSubscribe(std::shared_ptr<Connection> client, const MqttP
         for (const auto& [topic, qos] : subscribe.topic_filters) {
             std::cout << "Subscribe to topic: " << topic << " (QoS " << static_cast<int>(qos) << ")" << std::endl;
             
+            TopicMatcher::scan(topic, topicLevels_);
+            if (!TopicMatcher::isValidFilter(topic, topicLevels_)) {
+                std::cerr << "Invalid topic filter " << topic << " from " << client->getClientId() << std::endl;
+                reason_codes.push_back(0x8F);  // Topic Filter invalid
+                continue;
+            }
+            
+            if (acl_ && !acl_->allows(client->getUsername(), client->getClientId(), topic, ACL_READ, true)) {
+                std::cerr << "Subscription to " << topic << " denied for " << client->getClientId() << std::endl;
+                metrics_->incrementAclSubscribeDenied();
+                reason_codes.push_back(0x87);  // Not authorized
+                continue;
+            }
+            
             // Add client to subscription list
-            subscriptions[topic].push_back(client);
+            addSubscription(topic, client);
             
-            // Send retained message if exists
-            if (retainedMessages.find(topic) != retainedMessages.end()) {
-                const auto& [message, retain_qos] = retainedMessages[topic];
-                MqttPacket retained = PacketFactory::create_publish(
-                    topic,
-                    message,
-                    static_cast<QoSLevel>(retain_qos),
-                    true,                                   // Retain flag
-                    0                                       // Packet ID not needed for QoS 0
-                );
-                std::vector<uint8_t> data = retained.serialize();
-                client->send(data);
-                std::cout << "Sent retained message for topic: " << topic << std::endl;
+            // Send retained messages matching the filter, expired ones are reclaimed on the way.
+            // They are application messages, a large retained store is held to the outbound limits.
+            auto now = SteadyClock::now();
+            for (auto it = retainedMessages.begin(); it != retainedMessages.end() && client->isConnected();) {
+                if (retainedExpired(it, now)) {
+                    continue;
+                }
+                const auto& [retained_topic, retained_message] = *it;
+                if (TopicMatcher::matches(topic, retained_topic)) {
+                    MqttPacket retained = PacketFactory::create_publish(
+                        retained_topic,
+                        retained_message.payload,
+                        static_cast<QoSLevel>(retained_message.qos),
+                        true,                                   // Retain flag
+                        0,                                      // Packet ID not needed for QoS 0
+                        remainingExpiry(retained_message.expires_at, now)  // What is left of the interval
+                    );
+                    auto frame = std::make_shared<const std::vector<uint8_t>>(retained.serialize());
+                    SendResult result = client->sendMessage(frame, retained_message.qos, 0, retained_message.expires_at);
+                    if (result.dropped > 0) {
+                        metrics_->incrementMessagesDropped(client->getClientId(), result.dropped);
+                    }
+                    if (result.accepted) {
+                        recordBytesSent(*client, frame->size());
+                        std::cout << "Sent retained message for topic: " << retained_topic << std::endl;
+                    }
+                }
+                ++it;
             }
             
             // Success - granted QoS
@@ -325,15 +2134,13 @@ void MqttBroker::handleSubscribe(std::shared_ptr<Connection> client, const MqttP
         }
         
         // Send SUBACK
-        MqttPacket suback = PacketFactory::create_suback(subscribe.packet_identifier, reason_codes);
-        std::vector<uint8_t> response = suback.serialize();
-        client->send(response);
+        sendSubscriptionAck(client, PacketType::SUBACK, subscribe.packet_identifier, reason_codes);
         
         // Update subscription metrics
         metrics_->setActiveSubscriptions(getTotalSubscriptions());
         
         std::cout << "Sent SUBACK" << std::endl;
-        
+    
     } catch (const std::exception& e) {
         std::cerr << "Error handling SUBSCRIBE: " << e.what() << std::endl;
     }
@@ -352,18 +2159,7 @@ void MqttBroker::handleUnsubscribe(std::shared_ptr<Connection> client, const Mqt
             std::cout << "Unsubscribe from topic: " << topic << std::endl;
             
             // Remove client from subscription list
-            if (subscriptions.find(topic) != subscriptions.end()) {
-                auto& subscribers = subscriptions[topic];
-                subscribers.erase(
-                    std::remove(subscribers.begin(), subscribers.end(), client),
-                    subscribers.end()
-                );
-                
-                // Clean up empty subscription lists
-                if (subscribers.empty()) {
-                    subscriptions.erase(topic);
-                }
-                
+            if (removeSubscription(topic, client)) {
                 reason_codes.push_back(0);  // Success
             } else {
                 reason_codes.push_back(0x11);  // No subscription existed
@@ -371,15 +2167,13 @@ void MqttBroker::handleUnsubscribe(std::shared_ptr<Connection> client, const Mqt
         }
         
         // Send UNSUBACK
-        MqttPacket unsuback = PacketFactory::create_unsuback(unsubscribe.packet_identifier, reason_codes);
-        std::vector<uint8_t> response = unsuback.serialize();
-        client->send(response);
+        sendSubscriptionAck(client, PacketType::UNSUBACK, unsubscribe.packet_identifier, reason_codes);
         
         // Update subscription metrics
         metrics_->setActiveSubscriptions(getTotalSubscriptions());
         
         std::cout << "Sent UNSUBACK" << std::endl;
-        
+    
     } catch (const std::exception& e) {
         std::cerr << "Error handling UNSUBSCRIBE: " << e.what() << std::endl;
     }
@@ -387,13 +2181,24 @@ void MqttBroker::handleUnsubscribe(std::shared_ptr<Connection> client, const Mqt
 
 void MqttBroker::handlePingreq(std::shared_ptr<Connection> client) {
     
-    MqttPacket pingresp = PacketFactory::create_pingresp();
-    std::vector<uint8_t> response = pingresp.serialize();
-    client->send(response);
+    client->send(ControlFrames::PINGRESP);
     
     std::cout << "Sent PINGRESP" << std::endl;
 }
 
+void MqttBroker::sendSubscriptionAck(std::shared_ptr<Connection> client, PacketType type, uint16_t packet_id,
+                                     const std::vector<uint8_t>& reason_codes) {
+    // Encoded on the stack, only unusually long filter lists take the allocating path
+    ControlFrames::StackFrame<256> frame;
+    if (ControlFrames::subscriptionAck(type, packet_id, reason_codes.data(), reason_codes.size(), frame)) {
+        client->send(frame.data(), frame.size());
+        return;
+    }
+    MqttPacket ack = type == PacketType::SUBACK ? PacketFactory::create_suback(packet_id, reason_codes)
+                                                : PacketFactory::create_unsuback(packet_id, reason_codes);
+    client->send(ack.serialize());
+}
+
 void MqttBroker::handleDisconnect(std::shared_ptr<Connection> client) {
     std::cout << "Handling DISCONNECT packet (graceful disconnect)" << std::endl;
     cleanupClientSubscriptions(client);
@@ -401,22 +2206,204 @@ void MqttBroker::handleDisconnect(std::shared_ptr<Connection> client) {
 }
 
 void MqttBroker::cleanupClientSubscriptions(std::shared_ptr<Connection> client) {
-    // Remove client from all subscriptions
+    // Remove client from all subscriptions. Cached matches of the filters it held
+    // reference it, the rest of the cache stays warm through reconnect storms.
     for (auto& [topic, subscribers] : subscriptions) { 
-        subscribers.erase(
-            std::remove(subscribers.begin(), subscribers.end(), client),
-            subscribers.end()
-        );
+        auto it = std::remove(subscribers.begin(), subscribers.end(), client);
+        if (it != subscribers.end()) {
+            subscribers.erase(it, subscribers.end());
+            invalidateTopicCache(topic);
+        }
     }
+    client->removeSubscriptionCount(client->getSubscriptionCount());
     
     // Clean up empty subscription lists
     for (auto it = subscriptions.begin(); it != subscriptions.end();) {
         if (it->second.empty()) {
+            topicBloom_.removeFilter(it->first);
+            if (cluster_) {
+                cluster_->removeLocalFilter(it->first);
+            }
             it = subscriptions.erase(it);
         } else {
             ++it;
         }
     }
+    metrics_->setTopicBloomFalsePositiveRate(topicBloom_.estimatedFalsePositiveRate());
+}
+
+const TopicMatchCache::Subscribers& MqttBroker::matchSubscribers(const std::string& topic) {
+    static const TopicMatchCache::Subscribers noSubscribers;
+    
+    // Topics no filter can match are rejected before touching the index
+    if (!topicBloom_.mayMatch(topic)) {
+        metrics_->incrementTopicBloomRejects();
+        return noSubscribers;
+    }
+    
+    // Hot topics skip matching entirely
+    if (const auto* cached = topicCache_.lookup(topic)) {
+        metrics_->incrementTopicCacheHits();
+        if (cached->empty()) {
+            metrics_->incrementTopicBloomFalsePositives();
+        }
+        return *cached;
+    }
+    metrics_->incrementTopicCacheMisses();
+    
+    // Split once, every filter is then compared level by level against the offsets
+    TopicMatcher::scan(topic, topicLevels_);
+    matchScratch_.clear();
+    std::unordered_set<Connection*> seen;
+    for (const auto& [filter, subscribers] : subscriptions) {
+        if (!TopicMatcher::matches(filter, topic, topicLevels_)) {
+            continue;
+        }
+        // Overlapping filters deliver a single copy
+        for (const auto& subscriber : subscribers) {
+            if (seen.insert(subscriber.get()).second) {
+                matchScratch_.push_back(subscriber);
+            }
+        }
+    }
+    
+    if (matchScratch_.empty()) {
+        metrics_->incrementTopicBloomFalsePositives();
+    }
+    
+    topicCache_.store(topic, matchScratch_);
+    return matchScratch_;
+}
+
+void MqttBroker::addSubscription(const std::string& filter, std::shared_ptr<Connection> client) {
+    auto& subscribers = subscriptions[filter];
+    if (subscribers.empty()) {
+        // First subscriber for this filter
+        topicBloom_.addFilter(filter);
+        metrics_->setTopicBloomFalsePositiveRate(topicBloom_.estimatedFalsePositiveRate());
+        if (cluster_) {
+            cluster_->addLocalFilter(filter);
+        }
+    }
+    subscribers.push_back(client);
+    client->addSubscriptionCount(1);
+    invalidateTopicCache(filter);
+}
+
+bool MqttBroker::removeSubscription(const std::string& filter, std::shared_ptr<Connection> client) {
+    auto it = subscriptions.find(filter);
+    if (it == subscriptions.end()) {
+        return false;
+    }
+    
+    auto& subscribers = it->second;
+    auto removed = std::remove(subscribers.begin(), subscribers.end(), client);
+    client->removeSubscriptionCount(static_cast<size_t>(subscribers.end() - removed));
+    subscribers.erase(removed, subscribers.end());
+    
+    // Clean up empty subscription lists
+    if (subscribers.empty()) {
+        removeSubscriptionFilter(filter);
+    }
+    invalidateTopicCache(filter);
+    return true;
+}
+
+void MqttBroker::attachLocalClient(std::shared_ptr<Connection> client) {
+    client->setEstablished();  // In-process, nothing to authenticate
+    clients.insert(client);
+    if (!client->getClientId().empty()) {
+        takeOverClientId(client->getClientId(), client.get());
+        clientsById_[client->getClientId()] = client;
+    }
+    metrics_->incrementTotalConnections();
+    metrics_->setActiveConnections(clients.size());
+}
+
+void MqttBroker::detachLocalClient(std::shared_ptr<Connection> client) {
+    client->disconnect();
+    closingClients_.push_back(client);
+}
+
+// Local clients are held to the same rules as network ones, only there is nobody to
+// send a reason code to
+void MqttBroker::localSubscribe(std::shared_ptr<Connection> client, const std::string& filter) {
+    if (!client->isConnected()) {
+        return;
+    }
+    
+    TopicMatcher::scan(filter, topicLevels_);
+    if (!TopicMatcher::isValidFilter(filter, topicLevels_)) {
+        std::cerr << "Invalid topic filter " << filter << " from local client " << client->getClientId() << std::endl;
+        return;
+    }
+    if (acl_ && !acl_->allows(client->getUsername(), client->getClientId(), filter, ACL_READ, true)) {
+        std::cerr << "Subscription to " << filter << " denied for local client " << client->getClientId() << std::endl;
+        metrics_->incrementAclSubscribeDenied();
+        return;
+    }
+    
+    addSubscription(filter, client);
+    auto now = SteadyClock::now();
+    for (auto it = retainedMessages.begin(); it != retainedMessages.end();) {
+        if (retainedExpired(it, now)) {
+            continue;
+        }
+        if (TopicMatcher::matches(filter, it->first)) {
+            client->deliverLocal(it->first, it->second.payload, it->second.qos, true);
+        }
+        ++it;
+    }
+    metrics_->setActiveSubscriptions(getTotalSubscriptions());
+}
+
+void MqttBroker::localUnsubscribe(std::shared_ptr<Connection> client, const std::string& filter) {
+    if (removeSubscription(filter, client)) {
+        metrics_->setActiveSubscriptions(getTotalSubscriptions());
+    }
+}
+
+void MqttBroker::localPublish(std::shared_ptr<Connection> client, const std::string& topic,
+                              const std::vector<uint8_t>& payload, QoSLevel qos, bool retain) {
+    if (!client->isConnected()) {
+        return;
+    }
+    
+    TopicMatcher::scan(topic, topicLevels_);
+    if (!TopicMatcher::isValidTopicName(topic, topicLevels_)) {
+        std::cerr << "Invalid topic name from local client " << client->getClientId() << std::endl;
+        return;
+    }
+    if (!authorizePublish(*client, topic)) {
+        std::cerr << "Publish to " << topic << " denied for local client " << client->getClientId() << std::endl;
+        metrics_->incrementAclPublishDenied();
+        return;
+    }
+    
+    client->countMessageReceived();
+    routeMessage(topic, payload, qos, retain, client.get());
+    persistPublish(client, topic, payload, qos, retain, 0, SteadyClock::time_point());
+}
+
+void MqttBroker::removeSubscriptionFilter(const std::string& filter) {
+    subscriptions.erase(filter);
+    topicBloom_.removeFilter(filter);
+    if (cluster_) {
+        cluster_->removeLocalFilter(filter);
+    }
+    metrics_->setTopicBloomFalsePositiveRate(topicBloom_.estimatedFalsePositiveRate());
+}
+
+void MqttBroker::invalidateTopicCache(const std::string& filter) {
+    if (TopicMatcher::hasWildcards(filter)) {
+        // A wildcard filter can match any cached topic, drop the ones it does
+        if (topicCache_.invalidateMatching(filter) > 0) {
+            metrics_->incrementTopicCacheInvalidations();
+        }
+    } else if (topicCache_.invalidate(filter)) {
+        // A plain filter only matches the identical topic
+        metrics_->incrementTopicCacheInvalidations();
+    }
 }
 
 size_t MqttBroker::getTotalSubscriptions() const {
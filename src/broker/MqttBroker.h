@@ -2,32 +2,147 @@
 #define MQTT_BROKER_H
 
 #include <vector>
+#include <deque>
 #include <memory>
 #include <map>
+#include <mutex>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <sys/epoll.h>
 #include "../connection/Connection.h"
+#include "BrokerConfig.h"
+#include "TopicMatchCache.h"
+#include "TopicBloomFilter.h"
+#include "HeavyHitters.h"
+#include "TopicMatcher.h"
+#include "RateLimiter.h"
+#include "ExpiryWheel.h"
+#include "WorkerPool.h"
+#include "../auth/Authenticator.h"
+#include "../auth/AuthCache.h"
+#include "../auth/TopicAcl.h"
+#include "../cluster/Cluster.h"
+#include "../capture/CaptureFile.h"
+#include "../admin/AdminServer.h"
+#include "../memory/NumaArena.h"
+#include "../storage/WriteAheadLog.h"
+#include "../tls/TlsContext.h"
+#include <atomic>
 #include "../protocol/MqttPacket.h"
 #include "../../include/metrics/BrokerMetrics.h"
+#include "../../include/metrics/MessageTracer.h"
 
 namespace mqtt {
 
 class MqttBroker {
 public:
-    MqttBroker();
+    explicit MqttBroker(const BrokerConfig& config = BrokerConfig());
     ~MqttBroker();
     
-    void start();
+    bool start();  // False when the event loop or one of the listeners can't be set up
     void stop();
-    void run();  // Main event loop
+    void run();  // Main event loop, returns once stopped or requestStop() is called
     
+    // Run a task on the event loop thread, callable from any thread
+    void post(std::function<void()> task);
+    
+    // Reload the ACL file off the event loop, async-signal-safe
+    void requestAclReload();
+    
+    // Write the sampled message traces to the trace file, async-signal-safe
+    void requestTraceDump();
+    
+    // Make run() return, async-signal-safe; the caller then calls stop()
+    void requestStop();
+
 private:
-    int serverSocket;
+    friend class LocalClient;
+    
+    // A listening socket, all of them share the reactor and the routing core
+    struct Listener {
+        std::string uri;
+        int socket = -1;
+        bool unix_socket = false;
+        bool tls = false;
+        std::string path;        // Socket file, removed on stop
+        size_t index = 0;        // Position in listeners_, recorded on connections
+        size_t metrics_id = 0;
+        size_t active = 0;       // Connected clients accepted here
+    };
+    
+    // A large PUBLISH whose payload is relayed to subscribers as it arrives
+    struct PublishStream {
+        std::string topic;
+        QoSLevel qos = QoSLevel::AT_MOST_ONCE;
+        bool retain = false;
+        uint16_t packet_id = 0;
+        uint32_t message_expiry = 0;          // Message Expiry Interval, 0 = none
+        SteadyClock::time_point expires_at;   // Deadline of message_expiry
+        bool authorized = false;  // Denied publishes are read and discarded
+        size_t remaining = 0;     // Payload bytes still to arrive
+        std::vector<std::weak_ptr<Connection>> subscribers;  // Receiving the frame piece by piece
+        std::vector<std::weak_ptr<Connection>> deferred;     // In-process or mid-stream, get the whole message at the end
+        bool collect = false;  // Payload kept for retained storage, the WAL, other nodes or deferred subscribers
+        std::vector<uint8_t> payload;
+    };
+    
+    // expires_at is the default time_point for messages that never expire. scheduled is
+    // the deadline of the topic's live entry in the expiry wheel; entries for other
+    // deadlines are stale and skipped when they fire.
+    struct RetainedMessage {
+        std::vector<uint8_t> payload;
+        uint8_t qos = 0;
+        SteadyClock::time_point expires_at;
+        SteadyClock::time_point scheduled;
+    };
+    
+    BrokerConfig config_;
+    // Connection buffers and queues, when enabled. Declared first so it outlives every
+    // member that may still hold a connection.
+    std::unique_ptr<NumaArena> arena_;
+    size_t arenaMetricsId_;
+    std::vector<std::unique_ptr<Listener>> listeners_;
+    std::unique_ptr<TlsContext> tlsContext_;  // Shared by the tls:// listeners, loaded with the first
+    int epollFd_;
+    int spareFd_;  // Reserved descriptor to shed connections when out of file descriptors
+    int wakeFd_;   // eventfd signalled by post()
     bool running;
-    std::vector<std::shared_ptr<Connection>> clients;
+    std::atomic<bool> stopRequested_;
+    std::unordered_set<std::shared_ptr<Connection>> clients;
     std::unique_ptr<BrokerMetrics> metrics_;
     
-    void acceptNewConnection();
+    bool openListener(const std::string& uri);
+    Listener* findListener(const void* tag);
+    void acceptNewConnections(Listener& listener);
     size_t getTotalSubscriptions() const;
     void handleClientData(std::shared_ptr<Connection> client);
+    void processInbound(std::shared_ptr<Connection> client);
+    void updateInterest(Connection& client);
+    void removeDisconnectedClients();
+    void exportTransmitStats();
+    void pinEventLoop();
+    void createArena();
+    int waitForEvents(std::vector<struct epoll_event>& events, SteadyClock::time_point wakeup);
+    void exportLoopStats();
+    void trackTopTalkers(const std::string& topic, size_t bytes, const Connection* publisher);
+    void exportTopTalkers();
+    void holdClient(std::shared_ptr<Connection> client);
+    SteadyClock::time_point servicePausedClients();
+    bool admitTraffic(std::shared_ptr<Connection> client, size_t bytes);
+    void runPostedTasks();
+    void reloadAcl();
+    void revokeSubscriptions();  // Drops the subscriptions the current ACL no longer allows
+    void dumpTrace();
+    void storeRetained(const std::string& topic, const std::vector<uint8_t>& payload, uint8_t qos,
+                       SteadyClock::time_point expires_at = {});
+    bool retainedExpired(std::map<std::string, RetainedMessage>::iterator& it, SteadyClock::time_point now);
+    SteadyClock::time_point expireRetained(SteadyClock::time_point now);
+    void openWriteAheadLog();
+    bool persistPublish(std::shared_ptr<Connection> client, const std::string& topic, const std::vector<uint8_t>& payload,
+                        QoSLevel qos, bool retain, uint16_t packet_id, SteadyClock::time_point expires_at);
+    void completeWalCommit(const WriteAheadLog::Commit& commit);
+    bool authorizePublish(Connection& client, const std::string& topic);
     
     // MQTT packet handlers
     void handleConnect(std::shared_ptr<Connection> client, const MqttPacket& packet);
@@ -36,13 +151,133 @@ private:
     void handleUnsubscribe(std::shared_ptr<Connection> client, const MqttPacket& packet);
     void handlePingreq(std::shared_ptr<Connection> client);
     void handleDisconnect(std::shared_ptr<Connection> client);
+    void sendSubscriptionAck(std::shared_ptr<Connection> client, PacketType type, uint16_t packet_id,
+                             const std::vector<uint8_t>& reason_codes);
+    bool checkTopicName(std::shared_ptr<Connection> client, const std::string& topic);
+    bool beginPublishStream(std::shared_ptr<Connection> client);
+    bool relayPublishStream(std::shared_ptr<Connection> client, PublishStream& stream);
+    void finishPublishStream(std::shared_ptr<Connection> client, PublishStream stream);
+    void abortPublishStream(const Connection* client);
+    void acknowledgePublish(std::shared_ptr<Connection> client, uint16_t packet_id);
+    void pausePublisher(std::shared_ptr<Connection> client, std::vector<std::weak_ptr<Connection>> congested);
+    void recordBytesSent(const Connection& subscriber, size_t bytes);
+    // Counts an application message handed to sendMessage(), true if the subscriber took it
+    bool recordDelivery(const Connection& subscriber, const SendResult& result, size_t bytes);
+    void handleClusterPublish(const std::string& topic, const std::vector<uint8_t>& message, uint8_t qos, bool retain,
+                              uint32_t message_expiry);
+    void completeConnect(std::shared_ptr<Connection> client);
+    void finishAuthentication(std::shared_ptr<Connection> client, const std::string& username,
+                              const std::string& password, bool authenticated);
     
     // Helper methods
+    // message_expiry is the Message Expiry Interval in seconds, 0 = none
+    std::vector<std::weak_ptr<Connection>> routeMessage(const std::string& topic, const std::vector<uint8_t>& message,
+                                                        QoSLevel qos, bool retain, const Connection* publisher,
+                                                        uint32_t message_expiry = 0);
+    std::vector<std::weak_ptr<Connection>> deliverLocal(const std::string& topic, const std::vector<uint8_t>& message,
+                                                        QoSLevel qos, const Connection* publisher,
+                                                        uint32_t message_expiry = 0);
+    void takeOverClientId(const std::string& client_id, const Connection* keep);
     void cleanupClientSubscriptions(std::shared_ptr<Connection> client);
+    const TopicMatchCache::Subscribers& matchSubscribers(const std::string& topic);
+    void invalidateTopicCache(const std::string& filter);
+    void addSubscription(const std::string& filter, std::shared_ptr<Connection> client);
+    bool removeSubscription(const std::string& filter, std::shared_ptr<Connection> client);
+    
+    // Admin endpoint. Requests arrive on the admin server's thread, state is read on the
+    // event loop through post(), connections a batch per turn so a large broker keeps serving.
+    struct ConnectionSnapshot;
+    int handleAdminRequest(const std::string& path, const std::string& query, std::string& body);
+    void snapshotConnections(std::shared_ptr<ConnectionSnapshot> snapshot);
+    ConnectionInfo describeConnection(const Connection& client, SteadyClock::time_point now) const;
+    BrokerInfo describeBroker() const;
+    
+    // In-process clients, see LocalClient
+    void attachLocalClient(std::shared_ptr<Connection> client);
+    void detachLocalClient(std::shared_ptr<Connection> client);
+    void localSubscribe(std::shared_ptr<Connection> client, const std::string& filter);
+    void localUnsubscribe(std::shared_ptr<Connection> client, const std::string& filter);
+    void localPublish(std::shared_ptr<Connection> client, const std::string& topic,
+                      const std::vector<uint8_t>& payload, QoSLevel qos, bool retain);
+    void removeSubscriptionFilter(const std::string& filter);
     
     // Topic management
     std::map<std::string, std::vector<std::shared_ptr<Connection>>> subscriptions;  // topic -> clients
-    std::map<std::string, std::pair<std::vector<uint8_t>, uint8_t>> retainedMessages;  // topic -> (message, qos)
+    std::map<std::string, RetainedMessage> retainedMessages;  // topic -> message
+    size_t retainedBytes_;  // Topics and payloads in retainedMessages
+    ExpiryWheel expiryWheel_;  // Retained messages with an expiry, reclaimed a budget per loop iteration
+    TopicMatchCache topicCache_;  // topic -> matched subscribers, for hot topics
+    TopicMatchCache::Subscribers matchScratch_;
+    TopicMatcher::TopicLevels topicLevels_;  // Scratch for scanning topics and filters
+    TopicBloomFilter topicBloom_;  // Fast reject for topics without subscribers
+    
+    // Busiest topic prefixes and publishers in the current window, see exportTopTalkers()
+    HeavyHitters hotTopicMessages_;
+    HeavyHitters hotTopicBytes_;
+    HeavyHitters topClientMessages_;
+    HeavyHitters topClientBytes_;
+    SteadyClock::time_point topTalkersWindowStart_;
+    
+    // Admission control
+    RateLimiter rateLimiter_;
+    TokenBucket acceptBucket_;
+    
+    std::vector<std::shared_ptr<Connection>> pausedClients_;   // Not being read, flow control or rate limit
+    std::vector<std::shared_ptr<Connection>> closingClients_;  // Disconnected, awaiting cleanup
+    std::unordered_map<const Connection*, PublishStream> streams_;  // Publisher -> PUBLISH being cut through
+    
+    // Authentication, verified on worker threads
+    std::unique_ptr<Authenticator> authenticator_;
+    std::unique_ptr<WorkerPool> workers_;
+    AuthCache authCache_;
+    
+    // Authorization, replaced as a whole on reload
+    std::shared_ptr<const TopicAcl> acl_;
+    std::atomic<bool> aclReloadRequested_;
+    
+    // Other broker nodes, when clustering is enabled
+    std::unique_ptr<Cluster> cluster_;
+    std::unordered_map<std::string, std::weak_ptr<Connection>> clientsById_;
+    
+    // Publishes logged for durability, when a WAL directory is set. PUBACKs wait here,
+    // oldest first, until the group commit holding their publish completes.
+    struct DurableAck {
+        uint64_t lsn;
+        std::weak_ptr<Connection> client;
+        uint16_t packet_id;
+    };
+    std::unique_ptr<WriteAheadLog> wal_;
+    std::deque<DurableAck> durableAcks_;
+    
+    // Inbound frames recorded for mqtt-replay, when capturing
+    std::unique_ptr<CaptureWriter> capture_;
+    
+    // Sampled publishes, see MessageTracer
+    MessageTracer tracer_;
+    uint32_t activeTrace_;  // Trace of the publish being routed, 0 = none
+    std::atomic<bool> traceDumpRequested_;
+    
+    std::unique_ptr<AdminServer> admin_;
+    SteadyClock::time_point startedAt_;
+    
+    // Written by every client connection, exported once per loop iteration
+    TransmitStats transmitStats_;
+    TransmitStats exportedStats_;
+    
+    // Reactor activity, exported once per loop iteration as well
+    struct LoopStats {
+        uint64_t iterations = 0;
+        uint64_t idle_spins = 0;      // Non-blocking polls that found nothing
+        uint64_t spin_hits = 0;       // Non-blocking polls that found events
+        uint64_t blocking_waits = 0;  // Polls allowed to sleep in the kernel
+        std::chrono::nanoseconds spin_time{0};
+    };
+    LoopStats loopStats_;
+    LoopStats exportedLoopStats_;
+    bool busyPollWarned_;  // SO_BUSY_POLL needs CAP_NET_ADMIN above the sysctl default, say so once
+    
+    std::mutex postedMutex_;
+    std::vector<std::function<void()>> postedTasks_;
 };
 
 } // namespace mqtt
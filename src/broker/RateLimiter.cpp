@@ -0,0 +1,115 @@
+#include "RateLimiter.h"
+#include <algorithm>
+
+namespace mqtt {
+
+namespace {
+
+bool isLimited(const RateLimit& limit) {
+    return limit.messages_per_sec > 0 || limit.bytes_per_sec > 0;
+}
+
+} // namespace
+
+// ============================================================================
+// TokenBucket Implementation
+// ============================================================================
+
+TokenBucket::TokenBucket(double rate, double burst)
+    : rate_(rate), burst_(std::max(burst, 1.0)), tokens_(burst_), last_(SteadyClock::now()) {}
+
+void TokenBucket::refill(SteadyClock::time_point now) {
+    if (now <= last_) {
+        return;
+    }
+    double elapsed = std::chrono::duration<double>(now - last_).count();
+    tokens_ = std::min(burst_, tokens_ + elapsed * rate_);
+    last_ = now;
+}
+
+bool TokenBucket::consume(double tokens, SteadyClock::time_point now) {
+    if (isUnlimited()) {
+        return true;
+    }
+    refill(now);
+    tokens_ -= tokens;
+    return tokens_ >= 0;
+}
+
+SteadyClock::duration TokenBucket::debtDuration() const {
+    if (isUnlimited() || tokens_ >= 0) {
+        return SteadyClock::duration::zero();
+    }
+    return std::chrono::duration_cast<SteadyClock::duration>(
+        std::chrono::duration<double>(-tokens_ / rate_));
+}
+
+// ============================================================================
+// RateLimiter Implementation
+// ============================================================================
+
+RateLimiter::Buckets::Buckets(const RateLimit& limit)
+    : messages(limit.messages_per_sec, limit.messages_per_sec * limit.burst_seconds),
+      bytes(limit.bytes_per_sec, limit.bytes_per_sec * limit.burst_seconds),
+      refs(0) {}
+
+SteadyClock::duration RateLimiter::Buckets::charge(size_t size, SteadyClock::time_point now) {
+    messages.consume(1, now);
+    bytes.consume(static_cast<double>(size), now);
+    return std::max(messages.debtDuration(), bytes.debtDuration());
+}
+
+RateLimiter::RateLimiter(const RateLimit& client_limit, const RateLimit& user_limit)
+    : client_limit_(client_limit), user_limit_(user_limit),
+      enabled_(isLimited(client_limit) || isLimited(user_limit)),
+      user_enabled_(isLimited(user_limit)) {}
+
+void RateLimiter::addClient(const Connection* client, const std::string& username) {
+    if (!enabled_) {
+        return;
+    }
+    if (!clients_.emplace(client, Buckets(client_limit_)).second) {
+        return;  // Already registered
+    }
+    
+    // Anonymous clients are only limited individually
+    if (user_enabled_ && !username.empty()) {
+        auto it = users_.emplace(username, Buckets(user_limit_)).first;
+        ++it->second.refs;
+    }
+}
+
+void RateLimiter::removeClient(const Connection* client, const std::string& username) {
+    if (!enabled_ || clients_.erase(client) == 0) {
+        return;
+    }
+    
+    auto it = users_.find(username);
+    if (it != users_.end() && --it->second.refs == 0) {
+        users_.erase(it);
+    }
+}
+
+SteadyClock::duration RateLimiter::charge(const Connection* client, const std::string& username,
+                                          size_t bytes, SteadyClock::time_point now) {
+    SteadyClock::duration wait = SteadyClock::duration::zero();
+    if (!enabled_) {
+        return wait;
+    }
+    
+    auto client_it = clients_.find(client);
+    if (client_it != clients_.end()) {
+        wait = client_it->second.charge(bytes, now);
+    }
+    
+    if (user_enabled_ && !username.empty()) {
+        auto user_it = users_.find(username);
+        if (user_it != users_.end()) {
+            wait = std::max(wait, user_it->second.charge(bytes, now));
+        }
+    }
+    
+    return wait;
+}
+
+} // namespace mqtt
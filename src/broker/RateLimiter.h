@@ -0,0 +1,77 @@
+#ifndef RATE_LIMITER_H
+#define RATE_LIMITER_H
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+
+namespace mqtt {
+
+class Connection;
+
+using SteadyClock = std::chrono::steady_clock;
+
+// Classic token bucket. The balance may go negative so a sender that overdraws
+// is held back for exactly as long as it takes to pay the debt.
+class TokenBucket {
+public:
+    TokenBucket(double rate, double burst);
+    
+    // Returns false if the bucket is overdrawn after taking the tokens
+    bool consume(double tokens, SteadyClock::time_point now);
+    // Time until the balance is non-negative again
+    SteadyClock::duration debtDuration() const;
+    
+    bool isUnlimited() const { return rate_ <= 0; }
+    
+private:
+    void refill(SteadyClock::time_point now);
+    
+    double rate_;      // Tokens per second, 0 = unlimited
+    double burst_;
+    double tokens_;
+    SteadyClock::time_point last_;
+};
+
+struct RateLimit {
+    double messages_per_sec;  // 0 = unlimited
+    double bytes_per_sec;     // 0 = unlimited
+    double burst_seconds;     // Bucket depth in seconds worth of rate
+};
+
+// Per-client and per-username message and byte budgets
+class RateLimiter {
+public:
+    RateLimiter(const RateLimit& client_limit, const RateLimit& user_limit);
+    
+    void addClient(const Connection* client, const std::string& username);
+    void removeClient(const Connection* client, const std::string& username);
+    
+    // Charge one message of the given size. Returns how long the sender has to
+    // wait to be within all its limits again, zero if it still is.
+    SteadyClock::duration charge(const Connection* client, const std::string& username,
+                                 size_t bytes, SteadyClock::time_point now);
+    
+    bool isEnabled() const { return enabled_; }
+    
+private:
+    struct Buckets {
+        TokenBucket messages;
+        TokenBucket bytes;
+        size_t refs;
+        
+        explicit Buckets(const RateLimit& limit);
+        SteadyClock::duration charge(size_t size, SteadyClock::time_point now);
+    };
+    
+    RateLimit client_limit_;
+    RateLimit user_limit_;
+    bool enabled_;
+    bool user_enabled_;
+    std::unordered_map<const Connection*, Buckets> clients_;
+    std::unordered_map<std::string, Buckets> users_;
+};
+
+} // namespace mqtt
+
+#endif // RATE_LIMITER_H
@@ -0,0 +1,121 @@
+#include "TopicBloomFilter.h"
+#include <cmath>
+
+namespace mqtt {
+
+namespace {
+
+constexpr uint64_t FNV_OFFSET = 14695981039346656037ULL;
+constexpr uint64_t FNV_PRIME = 1099511628211ULL;
+
+inline uint64_t fnvStep(uint64_t hash, char c) {
+    return (hash ^ static_cast<uint8_t>(c)) * FNV_PRIME;
+}
+
+// Second hash for double hashing, derived from the first
+inline uint64_t remix(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash | 1;
+}
+
+size_t roundUpPowerOfTwo(size_t value) {
+    size_t result = 64;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+} // namespace
+
+TopicBloomFilter::TopicBloomFilter(size_t slots, unsigned hashes)
+    : counters_(roundUpPowerOfTwo(slots), 0), mask_(counters_.size() - 1),
+      hashes_(hashes == 0 ? 1 : hashes), occupied_(0), rootWildcards_(0) {}
+
+void TopicBloomFilter::addFilter(const std::string& filter) {
+    update(filter, 1);
+}
+
+void TopicBloomFilter::removeFilter(const std::string& filter) {
+    update(filter, -1);
+}
+
+void TopicBloomFilter::update(const std::string& filter, int delta) {
+    // Literal prefix ends at the separator before the first wildcard level
+    size_t end = filter.size();
+    for (size_t i = 0; i < filter.size(); ++i) {
+        if ((filter[i] == '+' || filter[i] == '#') && (i == 0 || filter[i - 1] == '/')) {
+            end = i == 0 ? 0 : i - 1;
+            break;
+        }
+    }
+    
+    if (end == 0 && filter.size() > 0 && (filter[0] == '+' || filter[0] == '#')) {
+        if (delta > 0) {
+            ++rootWildcards_;
+        } else if (rootWildcards_ > 0) {
+            --rootWildcards_;
+        }
+        return;
+    }
+    
+    uint64_t hash = FNV_OFFSET;
+    for (size_t i = 0; i < end; ++i) {
+        hash = fnvStep(hash, filter[i]);
+    }
+    
+    uint64_t step = remix(hash);
+    for (unsigned i = 0; i < hashes_; ++i) {
+        uint8_t& counter = counters_[(hash + i * step) & mask_];
+        if (counter == UINT8_MAX) {
+            continue;  // Saturated counters are sticky
+        }
+        if (delta > 0) {
+            if (counter++ == 0) {
+                ++occupied_;
+            }
+        } else if (counter > 0) {
+            if (--counter == 0) {
+                --occupied_;
+            }
+        }
+    }
+}
+
+bool TopicBloomFilter::contains(uint64_t hash) const {
+    uint64_t step = remix(hash);
+    for (unsigned i = 0; i < hashes_; ++i) {
+        if (counters_[(hash + i * step) & mask_] == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool TopicBloomFilter::mayMatch(const std::string& topic) const {
+    if (rootWildcards_ > 0) {
+        return true;
+    }
+    if (occupied_ == 0) {
+        return false;
+    }
+    
+    // Probe every level prefix in a single pass over the topic
+    uint64_t hash = FNV_OFFSET;
+    for (char c : topic) {
+        if (c == '/' && contains(hash)) {
+            return true;
+        }
+        hash = fnvStep(hash, c);
+    }
+    return contains(hash);
+}
+
+double TopicBloomFilter::estimatedFalsePositiveRate() const {
+    double fill = static_cast<double>(occupied_) / static_cast<double>(counters_.size());
+    return std::pow(fill, static_cast<double>(hashes_));
+}
+
+} // namespace mqtt
@@ -0,0 +1,40 @@
+#ifndef TOPIC_BLOOM_FILTER_H
+#define TOPIC_BLOOM_FILTER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace mqtt {
+
+// Counting Bloom filter over the literal prefixes of subscribed filters.
+// A filter contributes the levels before its first wildcard ("a/b/+/c" -> "a/b",
+// "a/b" -> "a/b"); a topic may have subscribers only if one of its level
+// prefixes is present. Counters make removal incremental when filters go away.
+class TopicBloomFilter {
+public:
+    TopicBloomFilter(size_t slots, unsigned hashes);
+    
+    void addFilter(const std::string& filter);
+    void removeFilter(const std::string& filter);
+    
+    // False means no subscribed filter can match the topic
+    bool mayMatch(const std::string& topic) const;
+    
+    // Expected false-positive rate for a single prefix probe at the current fill
+    double estimatedFalsePositiveRate() const;
+    
+private:
+    void update(const std::string& filter, int delta);
+    bool contains(uint64_t hash) const;
+    
+    std::vector<uint8_t> counters_;
+    size_t mask_;
+    unsigned hashes_;
+    size_t occupied_;        // Non-zero counters
+    size_t rootWildcards_;   // Filters starting with '+' or '#', these match (almost) anything
+};
+
+} // namespace mqtt
+
+#endif // TOPIC_BLOOM_FILTER_H
@@ -0,0 +1,67 @@
+#include "TopicMatchCache.h"
+#include "TopicMatcher.h"
+
+namespace mqtt {
+
+TopicMatchCache::TopicMatchCache(size_t capacity) : capacity_(capacity) {}
+
+const TopicMatchCache::Subscribers* TopicMatchCache::lookup(const std::string& topic) {
+    auto it = index_.find(topic);
+    if (it == index_.end()) {
+        return nullptr;
+    }
+    
+    // Move to front (most recently used)
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return &it->second->subscribers;
+}
+
+void TopicMatchCache::store(const std::string& topic, Subscribers subscribers) {
+    if (capacity_ == 0) {
+        return;
+    }
+    
+    auto it = index_.find(topic);
+    if (it != index_.end()) {
+        it->second->subscribers = std::move(subscribers);
+        entries_.splice(entries_.begin(), entries_, it->second);
+        return;
+    }
+    
+    // Evict least recently used entry
+    if (index_.size() >= capacity_) {
+        index_.erase(entries_.back().topic);
+        entries_.pop_back();
+    }
+    
+    entries_.push_front(Entry{topic, std::move(subscribers)});
+    index_[topic] = entries_.begin();
+}
+
+bool TopicMatchCache::invalidate(const std::string& topic) {
+    auto it = index_.find(topic);
+    if (it == index_.end()) {
+        return false;
+    }
+    
+    entries_.erase(it->second);
+    index_.erase(it);
+    return true;
+}
+
+size_t TopicMatchCache::invalidateMatching(const std::string& filter) {
+    // Bounded by the capacity, and only wildcard filter changes pay for it
+    size_t removed = 0;
+    for (auto it = entries_.begin(); it != entries_.end();) {
+        if (TopicMatcher::matches(filter, it->topic)) {
+            index_.erase(it->topic);
+            it = entries_.erase(it);
+            ++removed;
+        } else {
+            ++it;
+        }
+    }
+    return removed;
+}
+
+} // namespace mqtt
@@ -0,0 +1,47 @@
+#ifndef TOPIC_MATCH_CACHE_H
+#define TOPIC_MATCH_CACHE_H
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "../connection/Connection.h"
+
+namespace mqtt {
+
+// Bounded LRU cache from a published topic to its matched subscriber set.
+// Entries hold their subscribers alive, so every change to a filter drops
+// the entries it matches right away rather than waiting for a lookup.
+class TopicMatchCache {
+public:
+    using Subscribers = std::vector<std::shared_ptr<Connection>>;
+    
+    explicit TopicMatchCache(size_t capacity);
+    
+    // Returns nullptr on miss
+    const Subscribers* lookup(const std::string& topic);
+    void store(const std::string& topic, Subscribers subscribers);
+    
+    // Targeted invalidation, returns true if an entry was removed
+    bool invalidate(const std::string& topic);
+    // Drops every entry whose topic a wildcard filter matches, returns how many
+    size_t invalidateMatching(const std::string& filter);
+    
+    size_t size() const { return index_.size(); }
+    
+private:
+    struct Entry {
+        std::string topic;
+        Subscribers subscribers;
+    };
+    
+    size_t capacity_;
+    std::list<Entry> entries_;  // Most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+};
+
+} // namespace mqtt
+
+#endif // TOPIC_MATCH_CACHE_H
@@ -0,0 +1,247 @@
+#include "TopicMatcher.h"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MQTT_TOPIC_X86 1
+#endif
+
+namespace mqtt {
+
+namespace TopicMatcher {
+
+namespace {
+
+// Filler for the last partial block, none of the characters looked for
+constexpr char PADDING = ' ';
+
+void scanScalar(const char* data, size_t length, TopicLevels& levels) {
+    for (size_t i = 0; i < length; ++i) {
+        switch (data[i]) {
+            case '/':
+                levels.separators.push_back(static_cast<uint32_t>(i));
+                break;
+            case '+':
+                levels.single_wildcard = true;
+                break;
+            case '#':
+                levels.multi_wildcard = true;
+                break;
+            case '\0':
+                levels.nul = true;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// Record the separators flagged in a block's bitmask, lowest offset first
+inline void pushSeparators(uint32_t mask, size_t base, TopicLevels& levels) {
+    while (mask != 0) {
+        levels.separators.push_back(static_cast<uint32_t>(base + __builtin_ctz(mask)));
+        mask &= mask - 1;
+    }
+}
+
+#ifdef MQTT_TOPIC_X86
+
+// One compare per character class and block. Separators are extracted as they are
+// found, the other classes are only accumulated and tested once at the end.
+__attribute__((target("sse2")))
+void scanSse2(const char* data, size_t length, TopicLevels& levels) {
+    const __m128i slash = _mm_set1_epi8('/');
+    const __m128i plus = _mm_set1_epi8('+');
+    const __m128i hash = _mm_set1_epi8('#');
+    const __m128i zero = _mm_setzero_si128();
+    __m128i singles = _mm_setzero_si128();
+    __m128i multis = _mm_setzero_si128();
+    __m128i nuls = _mm_setzero_si128();
+    
+    auto process = [&](__m128i input, size_t base) __attribute__((target("sse2"))) {
+        pushSeparators(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(input, slash))), base, levels);
+        singles = _mm_or_si128(singles, _mm_cmpeq_epi8(input, plus));
+        multis = _mm_or_si128(multis, _mm_cmpeq_epi8(input, hash));
+        nuls = _mm_or_si128(nuls, _mm_cmpeq_epi8(input, zero));
+    };
+    
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        process(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)), i);
+    }
+    if (i < length) {
+        alignas(16) char tail[16];
+        std::memset(tail, PADDING, sizeof(tail));
+        std::memcpy(tail, data + i, length - i);
+        process(_mm_load_si128(reinterpret_cast<const __m128i*>(tail)), i);
+    }
+    
+    levels.single_wildcard = _mm_movemask_epi8(singles) != 0;
+    levels.multi_wildcard = _mm_movemask_epi8(multis) != 0;
+    levels.nul = _mm_movemask_epi8(nuls) != 0;
+}
+
+__attribute__((target("avx2")))
+void scanAvx2(const char* data, size_t length, TopicLevels& levels) {
+    const __m256i slash = _mm256_set1_epi8('/');
+    const __m256i plus = _mm256_set1_epi8('+');
+    const __m256i hash = _mm256_set1_epi8('#');
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i singles = _mm256_setzero_si256();
+    __m256i multis = _mm256_setzero_si256();
+    __m256i nuls = _mm256_setzero_si256();
+    
+    auto process = [&](__m256i input, size_t base) __attribute__((target("avx2"))) {
+        pushSeparators(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(input, slash))), base, levels);
+        singles = _mm256_or_si256(singles, _mm256_cmpeq_epi8(input, plus));
+        multis = _mm256_or_si256(multis, _mm256_cmpeq_epi8(input, hash));
+        nuls = _mm256_or_si256(nuls, _mm256_cmpeq_epi8(input, zero));
+    };
+    
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        process(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i)), i);
+    }
+    if (i < length) {
+        alignas(32) char tail[32];
+        std::memset(tail, PADDING, sizeof(tail));
+        std::memcpy(tail, data + i, length - i);
+        process(_mm256_load_si256(reinterpret_cast<const __m256i*>(tail)), i);
+    }
+    
+    levels.single_wildcard = !_mm256_testz_si256(singles, singles);
+    levels.multi_wildcard = !_mm256_testz_si256(multis, multis);
+    levels.nul = !_mm256_testz_si256(nuls, nuls);
+}
+
+#endif // MQTT_TOPIC_X86
+
+} // namespace
+
+std::vector<ScanImplementation> scanImplementations() {
+    std::vector<ScanImplementation> available;
+#ifdef MQTT_TOPIC_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        available.push_back({scanAvx2, "avx2"});
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        available.push_back({scanSse2, "sse2"});
+    }
+#endif
+    available.push_back({scanScalar, "scalar"});
+    return available;
+}
+
+namespace {
+
+const ScanImplementation selected = scanImplementations().front();
+
+// Bounds of a topic level, from the scanned separators
+inline void levelBounds(const TopicLevels& levels, size_t length, size_t level, size_t& start, size_t& end) {
+    start = level == 0 ? 0 : levels.separators[level - 1] + 1;
+    end = level < levels.separators.size() ? levels.separators[level] : length;
+}
+
+} // namespace
+
+void scan(const std::string& topic, TopicLevels& levels) {
+    levels.separators.clear();
+    levels.single_wildcard = false;
+    levels.multi_wildcard = false;
+    levels.nul = false;
+    selected.scan(topic.data(), topic.size(), levels);
+}
+
+bool isValidTopicName(const std::string& topic, const TopicLevels& levels) {
+    return !topic.empty() && !levels.single_wildcard && !levels.multi_wildcard && !levels.nul;
+}
+
+bool isValidFilter(const std::string& filter, const TopicLevels& levels) {
+    if (filter.empty() || levels.nul) {
+        return false;
+    }
+    if (!levels.single_wildcard && !levels.multi_wildcard) {
+        return true;
+    }
+    
+    // A level holding a wildcard must be nothing but that wildcard
+    for (size_t level = 0; level < levels.count(); ++level) {
+        size_t start;
+        size_t end;
+        levelBounds(levels, filter.size(), level, start, end);
+        const char* text = filter.data() + start;
+        size_t length = end - start;
+        if (std::memchr(text, '+', length) == nullptr && std::memchr(text, '#', length) == nullptr) {
+            continue;
+        }
+        if (length != 1 || (text[0] == '#' && level + 1 != levels.count())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool hasWildcards(const std::string& filter) {
+    return filter.find_first_of("+#") != std::string::npos;
+}
+
+bool matches(const std::string& filter, const std::string& topic) {
+    thread_local TopicLevels levels;
+    scan(topic, levels);
+    return matches(filter, topic, levels);
+}
+
+bool matches(const std::string& filter, const std::string& topic, const TopicLevels& levels) {
+    if (filter == topic) {
+        return true;
+    }
+    
+    // Wildcards at the first level never match topics starting with '$'
+    if (!topic.empty() && topic[0] == '$' && !filter.empty() && (filter[0] == '+' || filter[0] == '#')) {
+        return false;
+    }
+    
+    size_t f = 0;
+    size_t level = 0;
+    while (true) {
+        size_t filterEnd = filter.find('/', f);
+        if (filterEnd == std::string::npos) {
+            filterEnd = filter.size();
+        }
+        size_t filterLength = filterEnd - f;
+        
+        if (filterLength == 1 && filter[f] == '#') {
+            return true;  // Matches the parent level and everything below it
+        }
+        
+        // Anything but '+' must equal the topic level, which the scan already delimited
+        if (filterLength != 1 || filter[f] != '+') {
+            size_t start;
+            size_t end;
+            levelBounds(levels, topic.size(), level, start, end);
+            if (end - start != filterLength || topic.compare(start, filterLength, filter, f, filterLength) != 0) {
+                return false;
+            }
+        }
+        
+        bool lastTopicLevel = level + 1 >= levels.count();
+        if (filterEnd >= filter.size()) {
+            return lastTopicLevel;
+        }
+        f = filterEnd + 1;
+        if (lastTopicLevel) {
+            // "a/#" also matches "a"
+            return filter.compare(f, std::string::npos, "#") == 0;
+        }
+        ++level;
+    }
+}
+
+const char* scanImplementation() {
+    return selected.name;
+}
+
+} // namespace TopicMatcher
+
+} // namespace mqtt
@@ -0,0 +1,50 @@
+#ifndef TOPIC_MATCHER_H
+#define TOPIC_MATCHER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace mqtt {
+
+// MQTT topic filter matching ('+' single level, '#' multi level)
+namespace TopicMatcher {
+    // Level structure of a topic or filter, found in a single vectorized pass
+    struct TopicLevels {
+        std::vector<uint32_t> separators;  // Offsets of the '/' between levels
+        bool single_wildcard = false;      // Contains '+'
+        bool multi_wildcard = false;       // Contains '#'
+        bool nul = false;                  // Contains U+0000
+        
+        size_t count() const { return separators.size() + 1; }
+    };
+    
+    // Fills levels for topic, reusing its storage
+    void scan(const std::string& topic, TopicLevels& levels);
+    
+    // PUBLISH topic names: not empty, no wildcards, no NUL
+    bool isValidTopicName(const std::string& topic, const TopicLevels& levels);
+    // Subscription filters: '+' and '#' only as whole levels, '#' only last
+    bool isValidFilter(const std::string& filter, const TopicLevels& levels);
+    
+    bool hasWildcards(const std::string& filter);
+    bool matches(const std::string& filter, const std::string& topic);
+    // Same, with the topic already scanned, for matching one topic against many filters
+    bool matches(const std::string& filter, const std::string& topic, const TopicLevels& levels);
+    
+    // "avx2", "sse2" or "scalar"
+    const char* scanImplementation();
+    
+    // Appends to levels, which must start out empty as scan() leaves it
+    struct ScanImplementation {
+        void (*scan)(const char* data, size_t length, TopicLevels& levels);
+        const char* name;
+    };
+    
+    // Every scan the CPU can run, best first, scalar last; scan() uses the first
+    std::vector<ScanImplementation> scanImplementations();
+}
+
+} // namespace mqtt
+
+#endif // TOPIC_MATCHER_H
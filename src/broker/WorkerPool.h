@@ -0,0 +1,36 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mqtt {
+
+// Fixed set of threads for work that must not run on the event loop
+class WorkerPool {
+public:
+    explicit WorkerPool(size_t threads);
+    ~WorkerPool();  // Drops queued tasks and joins the threads
+    
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+    
+    void submit(std::function<void()> task);
+    
+private:
+    void workerLoop();
+    
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::function<void()>> tasks_;
+    bool stopping_;
+};
+
+} // namespace mqtt
+
+#endif // WORKER_POOL_H
@@ -0,0 +1,304 @@
+#include "CaptureFile.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace mqtt {
+
+namespace {
+
+constexpr size_t BATCH_BYTES = 256 * 1024;  // Handed to the writer thread once this full
+constexpr auto BATCH_INTERVAL = std::chrono::seconds(1);  // Or once this old, for quiet brokers
+constexpr size_t MAX_PENDING_BYTES = 64 * 1024 * 1024;  // Writer backlog that stops the capture
+
+// Owner-only from the start, the file holds whatever clients sent
+std::FILE* createPrivate(const std::string& path) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return nullptr;
+    }
+    std::FILE* file = ::fdopen(fd, "wb");
+    if (!file) {
+        int saved = errno;
+        ::close(fd);
+        errno = saved;
+    }
+    return file;
+}
+
+bool skipVarint(const uint8_t* data, size_t length, size_t& index, size_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 28 && index < length; shift += 7) {
+        uint8_t byte = data[index++];
+        value |= static_cast<size_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool skipField(const uint8_t* data, size_t length, size_t& index) {
+    if (index + 2 > length) {
+        return false;
+    }
+    size_t size = (static_cast<size_t>(data[index]) << 8) | data[index + 1];
+    index += 2 + size;
+    return index <= length;
+}
+
+// Finds the password of a CONNECT frame; false for other packets, frames without
+// a password and anything malformed, which the broker rejects anyway
+bool findPassword(const uint8_t* data, size_t length, size_t& offset, size_t& size) {
+    size_t index = 1;
+    size_t remaining;
+    if (length == 0 || (data[0] >> 4) != 1 || !skipVarint(data, length, index, remaining) ||
+        !skipField(data, length, index) || index + 4 > length) {
+        return false;
+    }
+    uint8_t version = data[index];
+    uint8_t flags = data[index + 1];
+    index += 4;  // Version, flags, keep alive
+    size_t properties;
+    if ((flags & 0x40) == 0) {
+        return false;
+    }
+    if (version >= 5) {
+        if (!skipVarint(data, length, index, properties)) {
+            return false;
+        }
+        index += properties;
+    }
+    if (!skipField(data, length, index)) {  // Client id
+        return false;
+    }
+    if (flags & 0x04) {
+        if (version >= 5) {
+            if (!skipVarint(data, length, index, properties)) {
+                return false;
+            }
+            index += properties;
+        }
+        if (!skipField(data, length, index) || !skipField(data, length, index)) {  // Will topic and payload
+            return false;
+        }
+    }
+    if ((flags & 0x80) && !skipField(data, length, index)) {  // User name
+        return false;
+    }
+    if (index + 2 > length) {
+        return false;
+    }
+    size = (static_cast<size_t>(data[index]) << 8) | data[index + 1];
+    offset = index + 2;
+    return offset + size <= length;
+}
+
+} // namespace
+
+CaptureWriter::CaptureWriter(const std::string& path)
+    : file_(createPrivate(path)), nextConnection_(0), started_(false), records_(0), failed_(false),
+      lastHandOff_(Clock::now()), pendingBytes_(0), stopping_(false), writeFailed_(false) {
+    if (!file_) {
+        throw std::runtime_error("Cannot create capture file " + path + ": " + std::strerror(errno));
+    }
+    batch_.reserve(BATCH_BYTES + 64 * 1024);
+    batch_.insert(batch_.end(), Capture::MAGIC, Capture::MAGIC + sizeof(Capture::MAGIC));
+    thread_ = std::thread(&CaptureWriter::writerLoop, this);
+}
+
+CaptureWriter::~CaptureWriter() {
+    if (!failed_) {
+        handOff();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+    std::fclose(file_);
+}
+
+void CaptureWriter::writeVarint(uint64_t value) {
+    while (value >= 0x80) {
+        batch_.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    batch_.push_back(static_cast<uint8_t>(value));
+}
+
+void CaptureWriter::writeHeader(Capture::RecordType type, uint32_t connection, Clock::time_point time) {
+    // Deltas keep timestamps to a byte or two; records of a paused client may carry
+    // an older read time, they are stamped with the previous record's time instead
+    if (!started_) {
+        last_ = time;
+        started_ = true;
+    }
+    uint64_t delta = 0;
+    if (time > last_) {
+        delta = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(time - last_).count());
+        last_ += std::chrono::microseconds(delta);
+    }
+    batch_.push_back(static_cast<uint8_t>(type));
+    writeVarint(connection);
+    writeVarint(delta);
+    ++records_;
+}
+
+void CaptureWriter::record(const void* connection, Capture::RecordType type, const uint8_t* data, size_t length,
+                           Clock::time_point time) {
+    if (failed_) {
+        return;
+    }
+    
+    auto it = connections_.find(connection);
+    if (it == connections_.end()) {
+        it = connections_.emplace(connection, nextConnection_++).first;
+        writeHeader(Capture::RecordType::OPEN, it->second, time);
+    }
+    writeHeader(type, it->second, time);
+    writeVarint(length);
+    size_t start = batch_.size();
+    batch_.insert(batch_.end(), data, data + length);
+    size_t offset;
+    size_t size;
+    if (type == Capture::RecordType::FRAME && findPassword(data, length, offset, size)) {
+        std::fill_n(batch_.begin() + start + offset, size, 0);
+    }
+    
+    if (batch_.size() >= BATCH_BYTES || time - lastHandOff_ >= BATCH_INTERVAL) {
+        lastHandOff_ = time;
+        handOff();
+    }
+}
+
+void CaptureWriter::close(const void* connection, Clock::time_point time) {
+    auto it = connections_.find(connection);
+    if (it == connections_.end()) {
+        return;  // Never sent anything
+    }
+    if (!failed_) {
+        writeHeader(Capture::RecordType::CLOSE, it->second, time);
+    }
+    connections_.erase(it);
+}
+
+void CaptureWriter::handOff() {
+    if (batch_.empty()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (writeFailed_ || pendingBytes_ + batch_.size() > MAX_PENDING_BYTES) {
+            // A capture with holes would replay wrong, stop instead
+            failed_ = true;
+        } else {
+            pendingBytes_ += batch_.size();
+            pending_.push_back(std::move(batch_));
+        }
+    }
+    if (failed_) {
+        std::cerr << "Traffic capture stopped, the capture file can't keep up" << std::endl;
+        return;
+    }
+    cv_.notify_one();
+    batch_ = std::vector<uint8_t>();
+    batch_.reserve(BATCH_BYTES + 64 * 1024);
+}
+
+void CaptureWriter::writerLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        cv_.wait(lock, [this]() { return stopping_ || !pending_.empty(); });
+        if (pending_.empty()) {
+            return;  // Stopping, everything written
+        }
+        std::vector<uint8_t> batch = std::move(pending_.front());
+        pending_.pop_front();
+        lock.unlock();
+        
+        bool ok = std::fwrite(batch.data(), 1, batch.size(), file_) == batch.size() && std::fflush(file_) == 0;
+        
+        lock.lock();
+        pendingBytes_ -= batch.size();
+        if (!ok) {
+            writeFailed_ = true;
+        }
+    }
+}
+
+CaptureReader::CaptureReader(const std::string& path)
+    : file_(std::fopen(path.c_str(), "rb")), time_us_(0) {
+    if (!file_) {
+        throw std::runtime_error("Cannot open capture file " + path + ": " + std::strerror(errno));
+    }
+    char magic[sizeof(Capture::MAGIC)];
+    if (std::fread(magic, 1, sizeof(magic), file_) != sizeof(magic) ||
+        std::memcmp(magic, Capture::MAGIC, sizeof(magic)) != 0) {
+        std::fclose(file_);
+        throw std::runtime_error(path + " is not a capture file");
+    }
+}
+
+CaptureReader::~CaptureReader() {
+    std::fclose(file_);
+}
+
+bool CaptureReader::readVarint(uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = std::fgetc(file_);
+        if (c == EOF) {
+            return false;
+        }
+        value |= static_cast<uint64_t>(c & 0x7F) << shift;
+        if ((c & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CaptureReader::next(Capture::Record& record) {
+    int type = std::fgetc(file_);
+    if (type == EOF) {
+        return false;
+    }
+    
+    uint64_t connection;
+    uint64_t delta;
+    if (!readVarint(connection) || !readVarint(delta)) {
+        throw std::runtime_error("Truncated capture record");
+    }
+    time_us_ += delta;
+    record.type = static_cast<Capture::RecordType>(type);
+    record.connection = static_cast<uint32_t>(connection);
+    record.time_us = time_us_;
+    record.bytes.clear();
+    
+    switch (record.type) {
+        case Capture::RecordType::OPEN:
+        case Capture::RecordType::CLOSE:
+            return true;
+        case Capture::RecordType::FRAME:
+        case Capture::RecordType::DATA: {
+            uint64_t length;
+            if (!readVarint(length)) {
+                throw std::runtime_error("Truncated capture record");
+            }
+            record.bytes.resize(length);
+            if (std::fread(record.bytes.data(), 1, length, file_) != length) {
+                throw std::runtime_error("Truncated capture record");
+            }
+            return true;
+        }
+    }
+    throw std::runtime_error("Unknown capture record type " + std::to_string(type));
+}
+
+} // namespace mqtt
@@ -0,0 +1,114 @@
+#ifndef CAPTURE_FILE_H
+#define CAPTURE_FILE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace mqtt {
+
+// Inbound traffic capture, replayed by tools/replay (mqtt-replay).
+//
+// File layout: the 8 byte magic "MQTTCAP1", then records of
+//   type (1 byte), connection (varint), microseconds since the previous record (varint)
+// followed for FRAME and DATA by a varint length and that many bytes. FRAME is one
+// complete MQTT packet as the client sent it; DATA is part of a packet that was
+// relayed piece by piece (cut-through), the pieces of a connection concatenate
+// to the packet. Connections are numbered in order of their first record.
+// CONNECT passwords are stored as zero bytes of the same length, and the file is
+// created readable by its owner only.
+namespace Capture {
+    constexpr char MAGIC[8] = {'M', 'Q', 'T', 'T', 'C', 'A', 'P', '1'};
+
+    enum class RecordType : uint8_t {
+        OPEN = 1,   // First record of a connection
+        FRAME = 2,
+        DATA = 3,
+        CLOSE = 4
+    };
+
+    struct Record {
+        RecordType type;
+        uint32_t connection;
+        uint64_t time_us;  // Since the first record of the capture
+        std::vector<uint8_t> bytes;
+    };
+}
+
+// Appends records to an in-memory batch on the event loop; a thread of its own
+// writes full batches, so the loop never waits for the disk.
+class CaptureWriter {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Throws std::runtime_error when the file can't be created
+    explicit CaptureWriter(const std::string& path);
+    ~CaptureWriter();  // Writes what is left and closes the file
+
+    CaptureWriter(const CaptureWriter&) = delete;
+    CaptureWriter& operator=(const CaptureWriter&) = delete;
+
+    // connection identifies the client for the lifetime of its connection
+    void record(const void* connection, Capture::RecordType type, const uint8_t* data, size_t length,
+                Clock::time_point time);
+    void close(const void* connection, Clock::time_point time);
+
+    uint64_t getRecords() const { return records_; }
+    bool isFailed() const { return failed_; }
+
+private:
+    void writeHeader(Capture::RecordType type, uint32_t connection, Clock::time_point time);
+    void writeVarint(uint64_t value);
+    void handOff();
+    void writerLoop();
+
+    std::FILE* file_;
+    std::unordered_map<const void*, uint32_t> connections_;
+    uint32_t nextConnection_;
+    bool started_;
+    Clock::time_point last_;
+    uint64_t records_;
+    bool failed_;  // Writer fell too far behind or the disk failed, capture stopped
+
+    std::vector<uint8_t> batch_;
+    Clock::time_point lastHandOff_;
+
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::vector<uint8_t>> pending_;
+    size_t pendingBytes_;
+    bool stopping_;
+    bool writeFailed_;
+};
+
+// Reads a capture written by CaptureWriter, records in file order
+class CaptureReader {
+public:
+    // Throws std::runtime_error when the file can't be opened or isn't a capture
+    explicit CaptureReader(const std::string& path);
+    ~CaptureReader();
+
+    CaptureReader(const CaptureReader&) = delete;
+    CaptureReader& operator=(const CaptureReader&) = delete;
+
+    // False at the end of the file, throws std::runtime_error on a truncated record
+    bool next(Capture::Record& record);
+
+private:
+    bool readVarint(uint64_t& value);
+
+    std::FILE* file_;
+    uint64_t time_us_;
+};
+
+} // namespace mqtt
+
+#endif // CAPTURE_FILE_H
@@ -0,0 +1,601 @@
+#include "Cluster.h"
+#include "../broker/TopicMatcher.h"
+#include "../protocol/MqttPacket.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+namespace mqtt {
+
+namespace {
+
+constexpr int MAX_LINK_EVENTS = 64;
+constexpr auto REDIAL_INTERVAL = std::chrono::seconds(1);
+constexpr uint8_t FLAG_EXPIRY = 0x08;  // PUBLISH and RETAINED flags, a 4 byte expiry interval follows
+
+void setNoDelay(int socket) {
+    int opt = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+}
+
+// "host:port" to an IPv4 address, names are resolved synchronously
+bool resolve(const std::string& address, struct sockaddr_in& resolved) {
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos) {
+        return false;
+    }
+    struct addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* result = nullptr;
+    if (getaddrinfo(address.substr(0, colon).c_str(), address.substr(colon + 1).c_str(), &hints, &result) != 0 ||
+        result == nullptr) {
+        return false;
+    }
+    std::memcpy(&resolved, result->ai_addr, sizeof(resolved));
+    freeaddrinfo(result);
+    return true;
+}
+
+} // namespace
+
+Cluster::Cluster(const Options& options, Handlers handlers)
+    : options_(options),
+      // Links queue without a message count, only their bytes are bounded (see send())
+      linkLimits_{options.link_max_bytes, SIZE_MAX, OverflowPolicy::DISCONNECT},
+      handlers_(std::move(handlers)), listenSocket_(-1), epollFd_(-1) {
+    for (const auto& address : options_.peers) {
+        DialTarget target;
+        target.address = address;
+        target.next_attempt = SteadyClock::now();
+        targets_.push_back(target);
+    }
+}
+
+Cluster::~Cluster() {
+    for (auto& peer : peers_) {
+        peer->link->disconnect();
+    }
+    if (listenSocket_ >= 0) {
+        close(listenSocket_);
+    }
+    if (epollFd_ >= 0) {
+        close(epollFd_);
+    }
+}
+
+bool Cluster::start() {
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(options_.port));
+    if (inet_pton(AF_INET, options_.host.c_str(), &addr.sin_addr) != 1) {
+        std::cerr << "Invalid cluster address " << options_.host << std::endl;
+        return false;
+    }
+    
+    listenSocket_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int opt = 1;
+    setsockopt(listenSocket_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (bind(listenSocket_, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        std::cerr << "Failed to bind cluster port " << options_.host << ":" << options_.port << ": "
+                  << std::strerror(errno) << std::endl;
+        close(listenSocket_);
+        listenSocket_ = -1;
+        return false;
+    }
+    listen(listenSocket_, 64);
+    
+    // Without a secret the peers' addresses are all there is to go by
+    if (options_.secret.empty()) {
+        for (const auto& target : targets_) {
+            struct sockaddr_in peer;
+            if (resolve(target.address, peer)) {
+                trustedAddresses_.insert(peer.sin_addr.s_addr);
+            }
+        }
+    }
+    
+    // The listener is tagged with a null pointer, links with their Peer
+    struct epoll_event event;
+    std::memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;
+    epoll_ctl(epollFd_, EPOLL_CTL_ADD, listenSocket_, &event);
+    
+    std::cout << "Cluster node " << options_.node_id << " listening on " << options_.host << ":" << options_.port
+              << " with " << targets_.size() << " configured peers"
+              << (options_.secret.empty() ? ", links authenticated by address" : "") << std::endl;
+    return true;
+}
+
+void Cluster::processEvents() {
+    struct epoll_event events[MAX_LINK_EVENTS];
+    int count = epoll_wait(epollFd_, events, MAX_LINK_EVENTS, 0);
+    
+    for (int i = 0; i < count; ++i) {
+        if (events[i].data.ptr == nullptr) {
+            acceptLinks();
+        } else {
+            handleLink(*static_cast<Peer*>(events[i].data.ptr), events[i].events);
+        }
+    }
+    
+    removeClosedPeers();
+}
+
+SteadyClock::time_point Cluster::maintain(SteadyClock::time_point now) {
+    auto next = now + REDIAL_INTERVAL;
+    
+    for (auto& target : targets_) {
+        if (target.peer != nullptr || target.node_id == options_.node_id) {
+            continue;  // Linked, or the address turned out to be this node
+        }
+        
+        // The peer may have dialed us first
+        bool linked = !target.node_id.empty() &&
+                      std::any_of(peers_.begin(), peers_.end(), [&](const std::unique_ptr<Peer>& peer) {
+                          return peer->ready && peer->node_id == target.node_id;
+                      });
+        if (linked) {
+            continue;
+        }
+        
+        if (target.next_attempt <= now) {
+            target.next_attempt = now + REDIAL_INTERVAL;
+            dial(target);
+        }
+        next = std::min(next, target.next_attempt);
+    }
+    
+    return next;
+}
+
+void Cluster::flush() {
+    for (auto& peer : peers_) {
+        if (!peer->connecting && peer->link->hasPendingOutput()) {
+            peer->link->flush();
+            updateInterest(*peer);
+        }
+    }
+    removeClosedPeers();
+}
+
+void Cluster::acceptLinks() {
+    while (true) {
+        struct sockaddr_in addr;
+        socklen_t length = sizeof(addr);
+        int socket = accept4(listenSocket_, (struct sockaddr*)&addr, &length, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (socket < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                std::cerr << "Failed to accept cluster link: " << std::strerror(errno) << std::endl;
+            }
+            return;
+        }
+        if (options_.secret.empty() && trustedAddresses_.count(addr.sin_addr.s_addr) == 0) {
+            char text[INET_ADDRSTRLEN] = {};
+            inet_ntop(AF_INET, &addr.sin_addr, text, sizeof(text));
+            std::cerr << "Refused cluster link from " << text << ", not a configured peer" << std::endl;
+            close(socket);
+            continue;
+        }
+        setNoDelay(socket);
+        
+        auto peer = std::make_unique<Peer>();
+        peer->link = std::make_shared<Connection>(socket, linkLimits_);
+        sendHello(*peer);
+        addPeer(std::move(peer), EPOLLIN | EPOLLOUT);
+    }
+}
+
+void Cluster::dial(DialTarget& target) {
+    if (target.address.rfind(':') == std::string::npos) {
+        std::cerr << "Invalid cluster peer address: " << target.address << std::endl;
+        target.next_attempt = SteadyClock::time_point::max();
+        return;
+    }
+    
+    // Peers are normally numeric addresses
+    struct sockaddr_in addr;
+    if (!resolve(target.address, addr)) {
+        std::cerr << "Cannot resolve cluster peer " << target.address << std::endl;
+        return;
+    }
+    
+    int socket = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int rc = connect(socket, (struct sockaddr*)&addr, sizeof(addr));
+    if (rc < 0 && errno != EINPROGRESS) {
+        close(socket);
+        return;
+    }
+    setNoDelay(socket);
+    
+    auto peer = std::make_unique<Peer>();
+    peer->link = std::make_shared<Connection>(socket, linkLimits_);
+    peer->address = target.address;
+    peer->node_id = target.node_id;
+    peer->connecting = true;
+    target.peer = peer.get();
+    addPeer(std::move(peer), EPOLLOUT);
+}
+
+void Cluster::addPeer(std::unique_ptr<Peer> peer, uint32_t events) {
+    struct epoll_event event;
+    std::memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.ptr = peer.get();
+    epoll_ctl(epollFd_, EPOLL_CTL_ADD, peer->link->getSocket(), &event);
+    peer->watched = events;
+    peers_.push_back(std::move(peer));
+}
+
+void Cluster::sendHello(Peer& peer) {
+    std::vector<uint8_t> body;
+    MqttPacket::write_utf8_string(body, options_.node_id);
+    RAND_bytes(peer.nonce.data(), static_cast<int>(peer.nonce.size()));
+    body.insert(body.end(), peer.nonce.begin(), peer.nonce.end());
+    send(peer, makeFrame(HELLO, body));
+}
+
+void Cluster::send(Peer& peer, std::shared_ptr<const std::vector<uint8_t>> frame) {
+    if (!peer.link->isConnected()) {
+        return;
+    }
+    peer.link->queue(std::move(frame));
+    
+    // Dropped rather than buffered without end. The filters and retained messages are
+    // sent again once the link is back, what is lost are the publishes in between.
+    if (linkLimits_.max_bytes > 0 && peer.link->getQueuedBytes() > linkLimits_.max_bytes) {
+        std::cerr << "Cluster link to " << (peer.node_id.empty() ? peer.address : peer.node_id) << " stalled with "
+                  << peer.link->getQueuedBytes() << " bytes queued, dropping it" << std::endl;
+        peer.link->disconnect();
+    }
+}
+
+void Cluster::handleLink(Peer& peer, uint32_t events) {
+    if (!peer.link->isConnected()) {
+        return;
+    }
+    
+    if (peer.connecting) {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        getsockopt(peer.link->getSocket(), SOL_SOCKET, SO_ERROR, &error, &length);
+        if (error != 0 || (events & (EPOLLERR | EPOLLHUP))) {
+            peer.link->disconnect();  // Peer not up yet, retried by maintain()
+            return;
+        }
+        peer.connecting = false;
+        sendHello(peer);
+        events = EPOLLOUT;
+    }
+    
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        peer.link->receive();
+        
+        std::vector<uint8_t> frame;
+        try {
+            while (peer.link->isConnected() && peer.link->nextFrame(frame)) {
+                handleFrame(peer, frame);
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Dropping cluster link to " << peer.node_id << ": " << e.what() << std::endl;
+            peer.link->disconnect();
+        }
+        
+        if (peer.link->isPeerClosed()) {
+            peer.link->disconnect();
+        }
+    }
+    
+    if (peer.link->isConnected() && (events & EPOLLOUT)) {
+        peer.link->flush();
+    }
+    updateInterest(peer);
+}
+
+void Cluster::handleFrame(Peer& peer, const std::vector<uint8_t>& frame) {
+    size_t index = 1;
+    MqttPacket::read_variable_byte_integer(frame, index);
+    uint8_t opcode = frame[0];
+    
+    if (opcode == HELLO) {
+        handleHello(peer, frame, index);
+        return;
+    }
+    if (opcode == AUTH) {
+        handleAuth(peer, frame, index);
+        return;
+    }
+    if (!peer.ready) {
+        return;  // Duplicate link being closed, or a peer still authenticating
+    }
+    
+    switch (opcode) {
+        case FILTER_ADD: {
+            std::string filter = MqttPacket::read_utf8_string(frame, index);
+            auto& set = TopicMatcher::hasWildcards(filter) ? peer.wildcards : peer.filters;
+            if (set.insert(filter).second) {
+                peer.bloom.addFilter(filter);
+            }
+            break;
+        }
+        case FILTER_REMOVE: {
+            std::string filter = MqttPacket::read_utf8_string(frame, index);
+            auto& set = TopicMatcher::hasWildcards(filter) ? peer.wildcards : peer.filters;
+            if (set.erase(filter) > 0) {
+                peer.bloom.removeFilter(filter);
+            }
+            break;
+        }
+        case PUBLISH: {
+            uint8_t flags = MqttPacket::read_byte(frame, index);
+            uint32_t expiry = (flags & FLAG_EXPIRY) ? MqttPacket::read_uint32(frame, index) : 0;
+            std::string topic = MqttPacket::read_utf8_string(frame, index);
+            std::vector<uint8_t> payload(frame.begin() + index, frame.end());
+            handlers_.onPublish(topic, payload, flags & 0x03, (flags & 0x04) != 0, expiry);
+            break;
+        }
+        case RETAINED: {
+            uint8_t flags = MqttPacket::read_byte(frame, index);
+            uint32_t expiry = (flags & FLAG_EXPIRY) ? MqttPacket::read_uint32(frame, index) : 0;
+            std::string topic = MqttPacket::read_utf8_string(frame, index);
+            std::vector<uint8_t> payload(frame.begin() + index, frame.end());
+            handlers_.onRetained(topic, payload, flags & 0x03, expiry);
+            break;
+        }
+        case CLIENT_CONNECTED:
+            handlers_.onClientConnected(MqttPacket::read_utf8_string(frame, index));
+            break;
+        default:
+            throw std::runtime_error("Unknown cluster opcode " + std::to_string(opcode));
+    }
+}
+
+void Cluster::handleHello(Peer& peer, const std::vector<uint8_t>& frame, size_t index) {
+    if (peer.hello) {
+        throw std::runtime_error("Repeated HELLO");
+    }
+    std::string node_id = MqttPacket::read_utf8_string(frame, index);
+    if (frame.size() - index != NONCE_BYTES) {
+        throw std::runtime_error("Malformed HELLO");
+    }
+    peer.hello = true;
+    peer.node_id = node_id;
+    for (auto& target : targets_) {
+        if (target.peer == &peer) {
+            target.node_id = node_id;
+        }
+    }
+    
+    // Dialed ourselves. Also never answer a challenge for our own id, a proof of it could
+    // be reflected back at us.
+    if (node_id == options_.node_id) {
+        peer.link->disconnect();
+        return;
+    }
+    
+    if (options_.secret.empty()) {
+        linkUp(peer);  // Accepted from a configured peer's address, or dialed by us
+        return;
+    }
+    send(peer, makeFrame(AUTH, proof(frame.data() + index, options_.node_id)));
+}
+
+void Cluster::handleAuth(Peer& peer, const std::vector<uint8_t>& frame, size_t index) {
+    if (options_.secret.empty() || !peer.hello || peer.ready) {
+        throw std::runtime_error("Unexpected AUTH");
+    }
+    std::vector<uint8_t> expected = proof(peer.nonce.data(), peer.node_id);
+    if (frame.size() - index != expected.size() ||
+        CRYPTO_memcmp(frame.data() + index, expected.data(), expected.size()) != 0) {
+        std::cerr << "Cluster link from " << peer.node_id << " failed authentication" << std::endl;
+        peer.link->disconnect();
+        return;
+    }
+    linkUp(peer);
+}
+
+void Cluster::linkUp(Peer& peer) {
+    const std::string& node_id = peer.node_id;
+    
+    // Both nodes may dial each other. Keep the link dialed by the smaller node id,
+    // both sides reach the same decision without further messages.
+    const std::string& preferred_dialer = std::min(options_.node_id, node_id);
+    auto dialer = [&](const Peer& p) { return p.address.empty() ? node_id : options_.node_id; };
+    for (auto& other : peers_) {
+        if (other.get() == &peer || !other->ready || other->node_id != node_id) {
+            continue;
+        }
+        if (dialer(*other) == preferred_dialer && dialer(peer) != preferred_dialer) {
+            peer.link->disconnect();
+            return;
+        }
+        other->link->disconnect();  // Superseded by the new link
+        other->ready = false;
+    }
+    
+    peer.ready = true;
+    std::cout << "Cluster link up with " << node_id << std::endl;
+    
+    // Full subscription summary, incremental updates follow
+    for (const auto& filter : localFilters_) {
+        send(peer, makeStringFrame(FILTER_ADD, filter));
+    }
+    handlers_.onPeerJoined(node_id);
+}
+
+void Cluster::updateInterest(Peer& peer) {
+    if (!peer.link->isConnected()) {
+        return;
+    }
+    uint32_t wanted = peer.connecting ? static_cast<uint32_t>(EPOLLOUT)
+                                      : static_cast<uint32_t>(EPOLLIN) |
+                                        (peer.link->hasPendingOutput() ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+    if (wanted == peer.watched) {
+        return;
+    }
+    
+    struct epoll_event event;
+    std::memset(&event, 0, sizeof(event));
+    event.events = wanted;
+    event.data.ptr = &peer;
+    epoll_ctl(epollFd_, EPOLL_CTL_MOD, peer.link->getSocket(), &event);
+    peer.watched = wanted;
+}
+
+void Cluster::removeClosedPeers() {
+    for (auto it = peers_.begin(); it != peers_.end();) {
+        Peer& peer = **it;
+        if (peer.link->isConnected()) {
+            ++it;
+            continue;
+        }
+        
+        if (peer.ready) {
+            std::cout << "Cluster link down with " << peer.node_id << std::endl;
+        }
+        for (auto& target : targets_) {
+            if (target.peer == &peer) {
+                target.peer = nullptr;
+            }
+        }
+        peer.link->disconnect();  // Closing the socket also removes it from epoll
+        it = peers_.erase(it);
+    }
+}
+
+bool Cluster::wants(const Peer& peer, const std::string& topic) const {
+    if (!peer.bloom.mayMatch(topic)) {
+        return false;
+    }
+    if (peer.filters.count(topic) > 0) {
+        return true;
+    }
+    return std::any_of(peer.wildcards.begin(), peer.wildcards.end(), [&](const std::string& filter) {
+        return TopicMatcher::matches(filter, topic);
+    });
+}
+
+void Cluster::broadcast(const std::shared_ptr<const std::vector<uint8_t>>& frame) {
+    for (auto& peer : peers_) {
+        if (peer->ready) {
+            send(*peer, frame);
+        }
+    }
+}
+
+void Cluster::addLocalFilter(const std::string& filter) {
+    if (localFilters_.insert(filter).second) {
+        broadcast(makeStringFrame(FILTER_ADD, filter));
+    }
+}
+
+void Cluster::removeLocalFilter(const std::string& filter) {
+    if (localFilters_.erase(filter) > 0) {
+        broadcast(makeStringFrame(FILTER_REMOVE, filter));
+    }
+}
+
+size_t Cluster::publish(const std::string& topic, const std::vector<uint8_t>& payload, uint8_t qos, bool retain,
+                        uint32_t message_expiry) {
+    std::shared_ptr<const std::vector<uint8_t>> frame;
+    size_t forwarded = 0;
+    
+    for (auto& peer : peers_) {
+        // Retained messages are replicated everywhere, for future subscribers
+        if (!peer->ready || (!retain && !wants(*peer, topic))) {
+            continue;
+        }
+        
+        if (!frame) {
+            std::vector<uint8_t> body;
+            MqttPacket::write_byte(body, static_cast<uint8_t>((qos & 0x03) | (retain ? 0x04 : 0) |
+                                                              (message_expiry ? FLAG_EXPIRY : 0)));
+            if (message_expiry) {
+                MqttPacket::write_uint32(body, message_expiry);
+            }
+            MqttPacket::write_utf8_string(body, topic);
+            body.insert(body.end(), payload.begin(), payload.end());
+            frame = makeFrame(PUBLISH, body);
+        }
+        send(*peer, frame);
+        ++forwarded;
+    }
+    
+    return forwarded;
+}
+
+void Cluster::sendRetained(const std::string& node_id, const std::string& topic,
+                           const std::vector<uint8_t>& payload, uint8_t qos, uint32_t message_expiry) {
+    for (auto& peer : peers_) {
+        if (peer->ready && peer->node_id == node_id) {
+            std::vector<uint8_t> body;
+            MqttPacket::write_byte(body, static_cast<uint8_t>((qos & 0x03) | (message_expiry ? FLAG_EXPIRY : 0)));
+            if (message_expiry) {
+                MqttPacket::write_uint32(body, message_expiry);
+            }
+            MqttPacket::write_utf8_string(body, topic);
+            body.insert(body.end(), payload.begin(), payload.end());
+            send(*peer, makeFrame(RETAINED, body));
+        }
+    }
+}
+
+void Cluster::clientConnected(const std::string& client_id) {
+    broadcast(makeStringFrame(CLIENT_CONNECTED, client_id));
+}
+
+size_t Cluster::getPeerCount() const {
+    return std::count_if(peers_.begin(), peers_.end(), [](const std::unique_ptr<Peer>& peer) {
+        return peer->ready;
+    });
+}
+
+std::shared_ptr<const std::vector<uint8_t>> Cluster::makeFrame(Opcode opcode, const std::vector<uint8_t>& body) {
+    std::vector<uint8_t> frame;
+    frame.reserve(body.size() + 5);
+    MqttPacket::write_byte(frame, opcode);
+    MqttPacket::write_variable_byte_integer(frame, static_cast<uint32_t>(body.size()));
+    frame.insert(frame.end(), body.begin(), body.end());
+    return std::make_shared<const std::vector<uint8_t>>(std::move(frame));
+}
+
+std::shared_ptr<const std::vector<uint8_t>> Cluster::makeStringFrame(Opcode opcode, const std::string& value) {
+    std::vector<uint8_t> body;
+    MqttPacket::write_utf8_string(body, value);
+    return makeFrame(opcode, body);
+}
+
+std::vector<uint8_t> Cluster::proof(const uint8_t* nonce, const std::string& node_id) const {
+    std::vector<uint8_t> message(nonce, nonce + NONCE_BYTES);
+    message.insert(message.end(), node_id.begin(), node_id.end());
+    std::vector<uint8_t> digest(EVP_MAX_MD_SIZE);
+    unsigned int length = 0;
+    HMAC(EVP_sha256(), options_.secret.data(), static_cast<int>(options_.secret.size()), message.data(), message.size(),
+         digest.data(), &length);
+    digest.resize(length);
+    return digest;
+}
+
+} // namespace mqtt
@@ -0,0 +1,166 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "../connection/Connection.h"
+#include "../broker/RateLimiter.h"
+#include "../broker/TopicBloomFilter.h"
+
+namespace mqtt {
+
+// Full mesh of broker nodes over TCP. Each node tells its peers which topic
+// filters it has local subscribers for (the full set when a link comes up,
+// then incremental changes), and a publish is only forwarded to peers with a
+// matching filter. Retained messages go to every peer. Forwarded messages
+// are delivered locally by the receiving node and never forwarded again.
+//
+// A message with an expiry carries the seconds it has left when forwarded, so the
+// receiving node expires it at the same time as this one.
+//
+// Sessions are not replicated: subscriptions and unacknowledged messages stay on the
+// node the client is connected to. The only client state shared is the client id, so
+// connecting on another node takes it over and closes the previous connection.
+//
+// Forwarded messages are delivered without further authorization, so only nodes of
+// the cluster may link up. With a shared secret both ends of a link prove they know it:
+// HELLO carries a random challenge, and AUTH answers the peer's with an HMAC-SHA256
+// over it and the sender's node id. Without one, links are only accepted from the
+// addresses of the configured peers.
+//
+// Frames reuse the MQTT fixed header layout: an opcode byte and a remaining
+// length, so links share Connection's framing and batched writes. Frames are
+// queued during a loop iteration and written by flush(). A link whose queue grows
+// past its limit belongs to a stalled peer and is dropped; it resynchronizes when
+// it comes back up.
+class Cluster {
+public:
+    struct Options {
+        std::string node_id;
+        std::string host;                // Address the cluster port binds to
+        int port = 0;
+        std::vector<std::string> peers;  // "host:port" addresses of other nodes' cluster ports
+        std::string secret;              // Shared by every node, empty = trust the peers' addresses
+        size_t link_max_bytes = 0;       // Queued on one link before its peer counts as stalled
+    };
+    
+    struct Handlers {
+        // A peer forwarded a publish for local subscribers, message_expiry 0 = none
+        std::function<void(const std::string& topic, const std::vector<uint8_t>& payload, uint8_t qos, bool retain,
+                           uint32_t message_expiry)> onPublish;
+        // Retained state replicated when a link comes up, store only
+        std::function<void(const std::string& topic, const std::vector<uint8_t>& payload, uint8_t qos,
+                           uint32_t message_expiry)> onRetained;
+        // A client connected on another node and takes over the client id, its session
+        // state on this node is dropped rather than handed over
+        std::function<void(const std::string& client_id)> onClientConnected;
+        // A link came up, the broker replays its retained messages with sendRetained()
+        std::function<void(const std::string& node_id)> onPeerJoined;
+    };
+    
+    Cluster(const Options& options, Handlers handlers);
+    ~Cluster();
+    
+    Cluster(const Cluster&) = delete;
+    Cluster& operator=(const Cluster&) = delete;
+    
+    // Returns false when the cluster port can't be opened
+    bool start();
+    
+    // Readable whenever a link or the listener has events, for the broker's epoll set
+    int getEventFd() const { return epollFd_; }
+    void processEvents();
+    
+    // Redial lost peers, returns when it next wants to be called
+    SteadyClock::time_point maintain(SteadyClock::time_point now);
+    // Write frames queued since the last call
+    void flush();
+    
+    // Local subscription summary, called when a filter gains its first or loses its last subscriber
+    void addLocalFilter(const std::string& filter);
+    void removeLocalFilter(const std::string& filter);
+    
+    // Returns the number of peers the message was forwarded to
+    size_t publish(const std::string& topic, const std::vector<uint8_t>& payload, uint8_t qos, bool retain,
+                   uint32_t message_expiry = 0);
+    void sendRetained(const std::string& node_id, const std::string& topic,
+                      const std::vector<uint8_t>& payload, uint8_t qos, uint32_t message_expiry = 0);
+    void clientConnected(const std::string& client_id);
+    
+    size_t getPeerCount() const;
+
+private:
+    enum Opcode : uint8_t {
+        HELLO = 0x10,
+        FILTER_ADD = 0x20,
+        FILTER_REMOVE = 0x30,
+        PUBLISH = 0x40,
+        RETAINED = 0x50,
+        CLIENT_CONNECTED = 0x60,
+        AUTH = 0x70
+    };
+    
+    static constexpr size_t NONCE_BYTES = 16;
+    
+    struct Peer {
+        std::shared_ptr<Connection> link;
+        std::string address;      // Dialed "host:port", empty for accepted links
+        std::string node_id;      // Known once HELLO arrived
+        bool connecting = false;  // Non-blocking connect in progress
+        bool hello = false;       // HELLO received, AUTH expected when there is a secret
+        bool ready = false;       // Authenticated and not a duplicate link
+        std::array<uint8_t, NONCE_BYTES> nonce{};  // Challenge sent in our HELLO
+        uint32_t watched = 0;
+        std::unordered_set<std::string> filters;    // Literal filters of the peer
+        std::unordered_set<std::string> wildcards;  // Filters with '+' or '#'
+        TopicBloomFilter bloom{4096, 4};
+    };
+    
+    struct DialTarget {
+        std::string address;
+        std::string node_id;  // Learned from HELLO, to skip redialing a node we already reach
+        Peer* peer = nullptr;
+        SteadyClock::time_point next_attempt;
+    };
+    
+    void acceptLinks();
+    void dial(DialTarget& target);
+    void addPeer(std::unique_ptr<Peer> peer, uint32_t events);
+    void sendHello(Peer& peer);
+    void handleLink(Peer& peer, uint32_t events);
+    void handleFrame(Peer& peer, const std::vector<uint8_t>& frame);
+    void handleHello(Peer& peer, const std::vector<uint8_t>& frame, size_t index);
+    void handleAuth(Peer& peer, const std::vector<uint8_t>& frame, size_t index);
+    void linkUp(Peer& peer);
+    // Queues a frame, dropping the link once the peer stopped keeping up
+    void send(Peer& peer, std::shared_ptr<const std::vector<uint8_t>> frame);
+    void updateInterest(Peer& peer);
+    void closePeer(Peer& peer);
+    void removeClosedPeers();
+    bool wants(const Peer& peer, const std::string& topic) const;
+    void broadcast(const std::shared_ptr<const std::vector<uint8_t>>& frame);
+    
+    static std::shared_ptr<const std::vector<uint8_t>> makeFrame(Opcode opcode, const std::vector<uint8_t>& body);
+    static std::shared_ptr<const std::vector<uint8_t>> makeStringFrame(Opcode opcode, const std::string& value);
+    // HMAC-SHA256 of a challenge and the node id answering it
+    std::vector<uint8_t> proof(const uint8_t* nonce, const std::string& node_id) const;
+    
+    Options options_;
+    OutboundLimits linkLimits_;
+    Handlers handlers_;
+    int listenSocket_;
+    int epollFd_;
+    std::vector<std::unique_ptr<Peer>> peers_;
+    std::vector<DialTarget> targets_;
+    std::unordered_set<std::string> localFilters_;
+    std::unordered_set<uint32_t> trustedAddresses_;  // IPv4 addresses of the configured peers
+};
+
+} // namespace mqtt
+
+#endif // CLUSTER_H
@@ -1,52 +1,783 @@
 #include "Connection.h"
+#include "../../include/metrics/MessageTracer.h"
+#include "../tls/TlsContext.h"
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include <algorithm>
+#include <cerrno>
 #include <iostream>
 #include <cstring>
+#include <stdexcept>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
 
 namespace mqtt {
 
-Connection::Connection(int socket) : socket_(socket), connected_(true), has_received_data_(false) {}
+namespace {
+
+constexpr size_t MAX_IOV_BATCH = 64;  // Frames handed to a single sendmsg()
+constexpr size_t READ_CHUNK = 16384;
+constexpr int MAX_READS_PER_EVENT = 16;  // Bound the time spent on one busy client
+constexpr size_t MAX_ACL_DECISIONS = 256;  // Cached authorization decisions per session
+constexpr size_t TLS_RECORD_BYTES = 16384;  // Largest TLS record payload, small frames are packed up to it
+
+inline bool wouldBlock(int err) {
+    return err == EAGAIN || err == EWOULDBLOCK;
+}
+
+} // namespace
+
+Connection::Connection(int socket, const OutboundLimits& limits, std::pmr::memory_resource* memory)
+    : socket_(socket), connected_(true), has_received_data_(false), peer_closed_(false),
+      watched_events_(0), listener_(-1), keep_alive_(0), connected_since_(std::chrono::steady_clock::now()),
+      bytes_received_(0), bytes_sent_(0), messages_received_(0), messages_sent_(0), subscription_count_(0),
+      inbound_(memory), inbound_offset_(0), limits_(limits), outbound_(memory),
+      front_offset_(0), outbound_bytes_(0), outbound_messages_(0), reply_bytes_(0), expiring_messages_(0), dropped_messages_(0),
+      slow_consumer_(false), read_paused_(false), inbound_inflight_(0), throttled_(false), auth_pending_(false),
+      established_(false), acl_generation_(0), zerocopy_threshold_(0), zerocopy_next_id_(0), zerocopy_inflight_(memory),
+      stats_(nullptr), tracer_(nullptr), streaming_(false), held_(memory), tls_wants_write_(false) {}
+
+Connection::Connection(LocalDelivery delivery)
+    : Connection(-1, OutboundLimits{0, 0, OverflowPolicy::DROP_NEWEST}) {
+    local_delivery_ = std::move(delivery);
+}
 
 Connection::~Connection() {
     disconnect();
 }
 
 void Connection::disconnect() {
-    if (connected_ && socket_ >= 0) {
+    if (tls_) {
+        tls_->shutdown();
+        tls_.reset();
+        tls_wants_write_ = false;
+    }
+    if (socket_ >= 0) {
         close(socket_);
         socket_ = -1;
-        connected_ = false;
     }
+    connected_ = false;
+    
+    // Release queued data right away. In-flight zero-copy buffers go too, the peer is gone.
+    outbound_.clear();
+    held_.clear();
+    streaming_ = false;
+    zerocopy_inflight_.clear();
+    front_offset_ = 0;
+    outbound_bytes_ = 0;
+    outbound_messages_ = 0;
+    reply_bytes_ = 0;
+}
+
+size_t Connection::receive() {
+    // Read into a shared scratch buffer so idle connections don't keep a full chunk reserved
+    thread_local uint8_t chunk[READ_CHUNK];
+    size_t total = 0;
+    
+    if (tls_ && !tls_->isEstablished() && !advanceHandshake()) {
+        return 0;
+    }
+    
+    // Compact consumed data before appending
+    if (inbound_offset_ > 0) {
+        inbound_.erase(inbound_.begin(), inbound_.begin() + inbound_offset_);
+        inbound_offset_ = 0;
+    }
+    
+    for (int i = 0; i < MAX_READS_PER_EVENT; ++i) {
+        ssize_t bytesRead = readSocket(chunk, sizeof(chunk));
+        
+        if (bytesRead < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytesRead < 0 && wouldBlock(errno)) {
+            break;  // Drained
+        }
+        if (bytesRead <= 0) {
+            // Connection closed or error
+            peer_closed_ = true;
+            break;
+        }
+        
+        has_received_data_ = true;
+        inbound_.insert(inbound_.end(), chunk, chunk + bytesRead);
+        total += bytesRead;
+        bytes_received_ += bytesRead;
+        if (static_cast<size_t>(bytesRead) < sizeof(chunk)) {
+            break;
+        }
+    }
+    
+    return total;
 }
 
-std::vector<uint8_t> Connection::receive() {
-    std::vector<uint8_t> buffer(4096);
+bool Connection::peekFrameHeader(uint8_t& type_flags, uint32_t& remaining, size_t& header_length) const {
+    const uint8_t* data = inbound_.data() + inbound_offset_;
+    size_t available = inbound_.size() - inbound_offset_;
+    if (available < 2) {
+        return false;
+    }
     
-    ssize_t bytesRead = recv(socket_, buffer.data(), buffer.size(), 0);
+    // Fixed header: type/flags byte, then a 1-4 byte remaining length
+    remaining = 0;
+    uint32_t multiplier = 1;
+    size_t index = 1;
+    while (true) {
+        if (index >= available) {
+            return false;
+        }
+        if (index > 4) {
+            throw std::runtime_error("Malformed remaining length");
+        }
+        uint8_t encoded = data[index++];
+        remaining += (encoded & 0x7F) * multiplier;
+        multiplier *= 128;
+        if ((encoded & 0x80) == 0) {
+            break;
+        }
+    }
     
-    if (bytesRead <= 0) {
-        // Connection closed or error
-        connected_ = false;
-        return std::vector<uint8_t>();
+    type_flags = data[0];
+    header_length = index;
+    return true;
+}
+
+bool Connection::nextFrame(std::vector<uint8_t>& frame) {
+    uint8_t type_flags;
+    uint32_t remaining;
+    size_t header_length;
+    if (!peekFrameHeader(type_flags, remaining, header_length)) {
+        return false;
+    }
+    
+    size_t available;
+    const uint8_t* data = peekInbound(available);
+    if (available < header_length + remaining) {
+        return false;
     }
     
-    has_received_data_ = true;
-    buffer.resize(bytesRead);
-    return buffer;
+    frame.assign(data, data + header_length + remaining);
+    consumeInbound(header_length + remaining);
+    return true;
+}
+
+void Connection::consumeInbound(size_t bytes) {
+    inbound_offset_ += bytes;
+    
+    // Everything consumed, give large bursts back
+    if (inbound_offset_ == inbound_.size()) {
+        inbound_.clear();
+        inbound_offset_ = 0;
+        if (inbound_.capacity() > 4 * READ_CHUNK) {
+            inbound_.shrink_to_fit();
+        }
+    }
 }
 
-void Connection::send(const std::vector<uint8_t>& data) {
+void Connection::send(const uint8_t* data, size_t length) {
     if (!connected_ || socket_ < 0) {
         return;
     }
     
-    ssize_t bytesSent = ::send(socket_, data.data(), data.size(), 0);
+    size_t written = 0;
+    if (canWriteDirect()) {
+        ssize_t bytesSent = writeSocket(data, length);
+        if (bytesSent < 0 && !wouldBlock(errno)) {
+            std::cerr << "Failed to send data" << std::endl;
+            connected_ = false;
+            return;
+        }
+        written = bytesSent < 0 ? 0 : static_cast<size_t>(bytesSent);
+        countCopied(written);
+        if (written == length) {
+            return;
+        }
+    }
+    
+    // Never dropped, so bounded on their own instead of by the message policy
+    size_t rest = length - written;
+    if (reply_bytes_ > 0 && reply_bytes_ + rest > limits_.max_bytes) {
+        slow_consumer_ = true;
+        disconnect();
+        return;
+    }
+    
+    // Queue whatever the socket did not take, the only case that allocates
+    enqueue(std::make_shared<const std::vector<uint8_t>>(data + written, data + length), 0, true);
+    (streaming_ ? held_ : outbound_).back().reply = true;
+    reply_bytes_ += rest;
+}
+
+SendResult Connection::sendMessage(std::shared_ptr<const std::vector<uint8_t>> frame, uint8_t qos, uint32_t trace,
+                                   std::chrono::steady_clock::time_point expires_at) {
+    SendResult result;
+    if (!connected_ || socket_ < 0) {
+        return result;
+    }
+    if (trace && tracer_) {
+        tracer_->record(trace, TraceStage::ENQUEUE, socket_);
+    }
+    
+    // Make room with expired messages before any live one is dropped
+    if (expiring_messages_ > 0 && !fitsLimits(frame->size())) {
+        purgeExpired(std::chrono::steady_clock::now());
+    }
+    
+    while (!fitsLimits(frame->size())) {
+        switch (limits_.policy) {
+            case OverflowPolicy::DROP_OLDEST:
+                if (evictOldest(false)) {
+                    ++result.dropped;
+                    continue;
+                }
+                ++dropped_messages_;
+                ++result.dropped;
+                return result;
+            
+            case OverflowPolicy::DROP_NEWEST:
+                ++dropped_messages_;
+                ++result.dropped;
+                return result;
+            
+            case OverflowPolicy::DROP_QOS0:
+                if (qos == 0) {
+                    ++dropped_messages_;
+                    ++result.dropped;
+                    return result;
+                }
+                if (evictOldest(true)) {
+                    ++result.dropped;
+                    continue;
+                }
+                // Only QoS > 0 left, which is never dropped
+                slow_consumer_ = true;
+                disconnect();
+                return result;
+            
+            case OverflowPolicy::DISCONNECT:
+                slow_consumer_ = true;
+                disconnect();
+                return result;
+        }
+    }
+    
+    ++messages_sent_;
+    result.accepted = true;
     
-    if (bytesSent < 0) {
-        std::cerr << "Failed to send data" << std::endl;
-        connected_ = false;
+    // Large frames go through flush(), which owns the zero-copy path
+    if (wantsZeroCopy(frame)) {
+        enqueue(std::move(frame), qos, false, trace, expires_at);
+        flush();
+        return result;
+    }
+    
+    if (canWriteDirect()) {
+        ssize_t bytesSent = writeSocket(frame->data(), frame->size());
+        if (bytesSent < 0 && !wouldBlock(errno)) {
+            std::cerr << "Failed to send data" << std::endl;
+            connected_ = false;
+            return result;
+        }
+        size_t written = bytesSent < 0 ? 0 : static_cast<size_t>(bytesSent);
+        countCopied(written);
+        if (written == frame->size()) {
+            traceWritten(trace);
+            return result;
+        }
+        enqueue(std::move(frame), qos, false, trace, expires_at);
+        front_offset_ = written;
+        outbound_bytes_ -= written;
+        return result;
+    }
+    
+    enqueue(std::move(frame), qos, false, trace, expires_at);
+    return result;
+}
+
+bool Connection::enableZeroCopy(size_t threshold) {
+    int one = 1;
+    if (threshold == 0 || socket_ < 0 || setsockopt(socket_, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0) {
+        return false;
+    }
+    zerocopy_threshold_ = threshold;
+    return true;
+}
+
+void Connection::reapZeroCopyCompletions() {
+    while (socket_ >= 0) {
+        char control[128];
+        struct msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        
+        if (recvmsg(socket_, &msg, MSG_ERRQUEUE) < 0) {
+            return;  // Drained, EAGAIN
+        }
+        
+        for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != nullptr; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+            struct sock_extended_err err;
+            std::memcpy(&err, CMSG_DATA(cm), sizeof(err));
+            if (err.ee_errno != 0 || err.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            
+            // Calls err.ee_info..err.ee_data (inclusive, wrapping) are done with their buffers
+            uint32_t first = err.ee_info;
+            uint32_t count = err.ee_data - first + 1;
+            size_t released = 0;
+            for (auto it = zerocopy_inflight_.begin(); it != zerocopy_inflight_.end();) {
+                if (it->id - first < count) {
+                    it = zerocopy_inflight_.erase(it);
+                    ++released;
+                } else {
+                    ++it;
+                }
+            }
+            
+            if (stats_) {
+                stats_->zerocopy_completions += released;
+                if (err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                    stats_->zerocopy_copied += released;
+                }
+            }
+        }
+    }
+}
+
+void Connection::queue(std::shared_ptr<const std::vector<uint8_t>> frame) {
+    if (connected_ && socket_ >= 0) {
+        enqueue(std::move(frame), 0, true);
+    }
+}
+
+void Connection::enqueue(std::shared_ptr<const std::vector<uint8_t>> frame, uint8_t qos, bool control, uint32_t trace,
+                         std::chrono::steady_clock::time_point expires_at) {
+    outbound_bytes_ += frame->size();
+    if (!control) {
+        ++outbound_messages_;
+    }
+    if (expires_at != std::chrono::steady_clock::time_point()) {
+        ++expiring_messages_;
+    }
+    // Behind an open streamed frame, released once its last piece is queued
+    auto& frames = streaming_ ? held_ : outbound_;
+    frames.push_back(OutboundFrame{std::move(frame), qos, control, trace, expires_at});
+}
+
+void Connection::traceWritten(uint32_t trace) {
+    if (trace && tracer_) {
+        tracer_->record(trace, TraceStage::WRITE, socket_);
+    }
+}
+
+bool Connection::beginStream(std::shared_ptr<const std::vector<uint8_t>> header) {
+    if (streaming_ || !connected_ || socket_ < 0) {
+        return false;
+    }
+    streaming_ = true;
+    ++messages_sent_;
+    streamChunk(std::move(header), false);
+    return true;
+}
+
+void Connection::streamChunk(std::shared_ptr<const std::vector<uint8_t>> chunk, bool last) {
+    if (!connected_ || !streaming_) {
+        return;
+    }
+    
+    // Pieces are control frames to the queue, they can't be evicted without corrupting the stream
+    if (!chunk->empty()) {
+        outbound_bytes_ += chunk->size();
+        outbound_.push_back(OutboundFrame{std::move(chunk), 0, true, 0, {}});
+    }
+    if (last) {
+        streaming_ = false;
+        while (!held_.empty()) {
+            outbound_.push_back(std::move(held_.front()));
+            held_.pop_front();
+        }
+    }
+    flush();
+}
+
+bool Connection::fitsLimits(size_t frame_size) const {
+    // A single message is always accepted so large payloads still get through
+    if (outbound_messages_ == 0) {
+        return true;
+    }
+    return outbound_messages_ + 1 <= limits_.max_messages &&
+           outbound_bytes_ + frame_size <= limits_.max_bytes;
+}
+
+bool Connection::evictOldest(bool qos0_only) {
+    // Never cut a frame that is partially on the wire
+    return evictFrom(outbound_, qos0_only, frontPinned()) || evictFrom(held_, qos0_only, false);
+}
+
+bool Connection::evictFrom(std::pmr::deque<OutboundFrame>& frames, bool qos0_only, bool keep_front) {
+    for (auto it = frames.begin(); it != frames.end(); ++it) {
+        if (it == frames.begin() && keep_front) {
+            continue;
+        }
+        if (it->control || (qos0_only && it->qos != 0)) {
+            continue;
+        }
+        
+        outbound_bytes_ -= it->data->size();
+        --outbound_messages_;
+        ++dropped_messages_;
+        if (it->expires_at != std::chrono::steady_clock::time_point()) {
+            --expiring_messages_;
+        }
+        frames.erase(it);
+        return true;
+    }
+    return false;
+}
+
+void Connection::purgeExpired(std::chrono::steady_clock::time_point now) {
+    // Never cut a frame that is partially on the wire
+    purgeExpiredFrom(outbound_, now, frontPinned());
+    purgeExpiredFrom(held_, now, false);
+}
+
+void Connection::purgeExpiredFrom(std::pmr::deque<OutboundFrame>& frames, std::chrono::steady_clock::time_point now,
+                                  bool keep_front) {
+    auto expired = [now](const OutboundFrame& frame) {
+        return frame.expires_at != std::chrono::steady_clock::time_point() && frame.expires_at <= now;
+    };
+    auto first = frames.begin() + (keep_front && !frames.empty() ? 1 : 0);
+    for (auto it = first; it != frames.end(); ++it) {
+        if (expired(*it)) {
+            discardExpired(*it);
+        }
+    }
+    frames.erase(std::remove_if(first, frames.end(), expired), frames.end());
+}
+
+void Connection::discardExpired(const OutboundFrame& frame) {
+    outbound_bytes_ -= frame.data->size();
+    --outbound_messages_;
+    --expiring_messages_;
+    if (stats_) {
+        ++stats_->expired_messages;
+        stats_->expired_bytes += frame.data->size();
+    }
+}
+
+void Connection::pauseReading(std::vector<std::weak_ptr<Connection>> congested) {
+    read_paused_ = true;
+    for (auto& subscriber : congested) {
+        congested_subscribers_.push_back(std::move(subscriber));
+    }
+}
+
+void Connection::resumeReading() {
+    read_paused_ = false;
+    congested_subscribers_.clear();
+}
+
+bool Connection::congestionCleared(size_t low_watermark) const {
+    for (const auto& weak : congested_subscribers_) {
+        auto subscriber = weak.lock();
+        if (subscriber && subscriber->isConnected() && subscriber->getQueuedBytes() > low_watermark) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Connection::throttleUntil(std::chrono::steady_clock::time_point deadline) {
+    if (!throttled_ || deadline > throttle_deadline_) {
+        throttle_deadline_ = deadline;
+    }
+    throttled_ = true;
+}
+
+std::vector<uint16_t> Connection::takeDeferredAcks() {
+    std::vector<uint16_t> acks;
+    acks.swap(deferred_acks_);
+    return acks;
+}
+
+bool Connection::cachedPublishDecision(const std::string& topic, uint64_t generation, bool& allowed) const {
+    if (generation != acl_generation_) {
+        return false;
+    }
+    auto it = acl_decisions_.find(topic);
+    if (it == acl_decisions_.end()) {
+        return false;
+    }
+    allowed = it->second;
+    return true;
+}
+
+void Connection::cachePublishDecision(const std::string& topic, uint64_t generation, bool allowed) {
+    // Start over on reload or when a client cycles through too many topics
+    if (generation != acl_generation_ || acl_decisions_.size() >= MAX_ACL_DECISIONS) {
+        acl_decisions_.clear();
+        acl_generation_ = generation;
+    }
+    acl_decisions_[topic] = allowed;
+}
+
+void Connection::flush() {
+    if (tls_) {
+        if (!tls_->isEstablished() && (!connected_ || !advanceHandshake())) {
+            return;
+        }
+        if (!tls_->kernelSend()) {
+            flushTls();
+            return;
+        }
+    }
+    
+    // Messages that expired while queued are dropped as they reach the front
+    auto now = expiring_messages_ > 0 ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+    auto expired = [now](const OutboundFrame& frame) {
+        return frame.expires_at != std::chrono::steady_clock::time_point() && frame.expires_at <= now;
+    };
+    
+    while (connected_ && !outbound_.empty()) {
+        if (!frontPinned() && expired(outbound_.front())) {
+            discardExpired(outbound_.front());
+            outbound_.pop_front();
+            continue;
+        }
+        
+        struct iovec iov[MAX_IOV_BATCH];
+        size_t count = 0;
+        size_t batchBytes = 0;
+        bool zerocopy = false;
+        for (auto it = outbound_.begin(); it != outbound_.end() && count < MAX_IOV_BATCH; ++it) {
+            if (count > 0 && expired(*it)) {
+                break;
+            }
+            // Zero-copy frames are sent on their own, so each completion maps to one buffer
+            bool large = !it->control && wantsZeroCopy(it->data);
+            if (large && count > 0) {
+                break;
+            }
+            size_t offset = count == 0 ? front_offset_ : 0;
+            iov[count].iov_base = const_cast<uint8_t*>(it->data->data() + offset);
+            iov[count].iov_len = it->data->size() - offset;
+            batchBytes += iov[count].iov_len;
+            ++count;
+            if (large) {
+                zerocopy = true;
+                break;
+            }
+        }
+        
+        struct msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        
+        ssize_t bytesSent = sendmsg(socket_, &msg, MSG_NOSIGNAL | (zerocopy ? MSG_ZEROCOPY : 0));
+        if (bytesSent < 0 && zerocopy && errno == ENOBUFS) {
+            // Out of lockable memory for pinned pages, copy this one
+            zerocopy = false;
+            bytesSent = sendmsg(socket_, &msg, MSG_NOSIGNAL);
+        }
+        if (bytesSent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (!wouldBlock(errno)) {
+                std::cerr << "Failed to send data" << std::endl;
+                connected_ = false;
+            }
+            return;
+        }
+        
+        if (zerocopy) {
+            zerocopy_inflight_.push_back(ZeroCopySend{zerocopy_next_id_++, outbound_.front().data});
+            if (stats_) {
+                stats_->zerocopy_bytes += static_cast<size_t>(bytesSent);
+            }
+            bytes_sent_ += static_cast<size_t>(bytesSent);
+        } else {
+            countCopied(static_cast<size_t>(bytesSent));
+        }
+        
+        popWritten(static_cast<size_t>(bytesSent));
+        
+        // Socket buffer is full
+        if (static_cast<size_t>(bytesSent) < batchBytes) {
+            return;
+        }
+    }
+}
+
+// Pops the frames the write completed, returns how many
+size_t Connection::popWritten(size_t bytes) {
+    size_t popped = 0;
+    outbound_bytes_ -= bytes;
+    while (bytes > 0) {
+        OutboundFrame& front = outbound_.front();
+        size_t left = front.data->size() - front_offset_;
+        if (bytes < left) {
+            front_offset_ += bytes;
+            if (front.reply) {
+                reply_bytes_ -= bytes;
+            }
+            break;
+        }
+        bytes -= left;
+        front_offset_ = 0;
+        if (!front.control) {
+            --outbound_messages_;
+        }
+        if (front.reply) {
+            reply_bytes_ -= left;
+        }
+        if (front.expires_at != std::chrono::steady_clock::time_point()) {
+            --expiring_messages_;
+        }
+        traceWritten(front.trace);
+        outbound_.pop_front();
+        ++popped;
+    }
+    return popped;
+}
+
+// Userspace TLS: no writev, so small frames are packed into one record instead of
+// paying for a record and a syscall each
+void Connection::flushTls() {
+    thread_local uint8_t scratch[TLS_RECORD_BYTES];
+    auto now = expiring_messages_ > 0 ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+    auto expired = [now](const OutboundFrame& frame) {
+        return frame.expires_at != std::chrono::steady_clock::time_point() && frame.expires_at <= now;
+    };
+    
+    while (connected_ && !outbound_.empty()) {
+        if (!frontPinned() && expired(outbound_.front())) {
+            discardExpired(outbound_.front());
+            outbound_.pop_front();
+            continue;
+        }
+        
+        const OutboundFrame& front = outbound_.front();
+        const uint8_t* data = front.data->data() + front_offset_;
+        size_t length = front.data->size() - front_offset_;
+        size_t frames = 1;
+        if (length < TLS_RECORD_BYTES && outbound_.size() > 1) {
+            std::memcpy(scratch, data, length);
+            for (auto it = outbound_.begin() + 1; it != outbound_.end(); ++it) {
+                if (expired(*it) || length + it->data->size() > TLS_RECORD_BYTES) {
+                    break;
+                }
+                std::memcpy(scratch + length, it->data->data(), it->data->size());
+                length += it->data->size();
+                ++frames;
+            }
+            data = scratch;
+        }
+        
+        ssize_t bytesSent = tls_->write(data, length);
+        if (bytesSent < 0 && !wouldBlock(errno)) {
+            std::cerr << "Failed to send data" << std::endl;
+            connected_ = false;
+            return;
+        }
+        size_t written = bytesSent < 0 ? 0 : static_cast<size_t>(bytesSent);
+        countCopied(written);
+        frames -= popWritten(written);
+        
+        // The retry has to offer the same bytes, so what is left of the packed
+        // frames becomes one frame nothing can drop
+        if (tls_->isWriteBlocked() && frames > 1) {
+            mergeFront(frames);
+        }
+        if (written < length) {
+            return;
+        }
+    }
+}
+
+void Connection::mergeFront(size_t frames) {
+    auto merged = std::make_shared<std::vector<uint8_t>>();
+    for (size_t i = 0; i < frames; ++i) {
+        OutboundFrame& front = outbound_.front();
+        merged->insert(merged->end(), front.data->begin() + front_offset_, front.data->end());
+        if (front.reply) {
+            reply_bytes_ -= front.data->size() - front_offset_;  // Handed to TLS as well
+        }
+        front_offset_ = 0;
+        if (!front.control) {
+            --outbound_messages_;
+        }
+        if (front.expires_at != std::chrono::steady_clock::time_point()) {
+            --expiring_messages_;
+        }
+        traceWritten(front.trace);  // Handed to TLS, only the socket still has to take it
+        outbound_.pop_front();
+    }
+    outbound_.push_front(OutboundFrame{std::move(merged), 0, true, 0, {}});
+}
+
+void Connection::startTls(std::unique_ptr<TlsSession> session) {
+    tls_ = std::move(session);
+}
+
+// Drives the handshake on socket events, true once MQTT traffic can flow
+bool Connection::advanceHandshake() {
+    TlsSession::Handshake state = tls_->handshake();
+    tls_wants_write_ = state == TlsSession::Handshake::WANT_WRITE;
+    if (state == TlsSession::Handshake::DONE) {
+        if (stats_) {
+            ++stats_->tls_handshakes;
+            stats_->tls_resumed += tls_->wasResumed() ? 1 : 0;
+            stats_->ktls_send += tls_->kernelSend() ? 1 : 0;
+            stats_->ktls_receive += tls_->kernelReceive() ? 1 : 0;
+        }
+        return true;
+    }
+    if (state == TlsSession::Handshake::FAILED) {
+        std::cerr << "TLS handshake with " << address_ << " failed: " << tls_->getError() << std::endl;
+        if (stats_) {
+            ++stats_->tls_failed;
+        }
+        peer_closed_ = true;
+    }
+    return false;
+}
+
+bool Connection::canWriteDirect() const {
+    return outbound_.empty() && !streaming_ && (!tls_ || tls_->isEstablished());
+}
+
+// Partly written, or the bytes a blocked TLS write has to be retried with
+bool Connection::frontPinned() const {
+    return front_offset_ > 0 || (tls_ && tls_->isWriteBlocked());
+}
+
+ssize_t Connection::readSocket(uint8_t* data, size_t length) {
+    if (tls_ && !tls_->kernelReceive()) {
+        return tls_->read(data, length);
+    }
+    return recv(socket_, data, length, 0);
+}
+
+ssize_t Connection::writeSocket(const uint8_t* data, size_t length) {
+    if (tls_ && !tls_->kernelSend()) {
+        return tls_->write(data, length);
     }
+    return ::send(socket_, data, length, MSG_NOSIGNAL);
 }
 
-} // namespace mqtt
\ No newline at end of file
+} // namespace mqtt
@@ -1,30 +1,324 @@
 #ifndef CONNECTION_H
 #define CONNECTION_H
 
+#include <algorithm>
+#include <array>
 #include <vector>
+#include <deque>
+#include <memory>
+#include <string>
 #include <cstdint>
+#include <chrono>
+#include <functional>
+#include <memory_resource>
+#include <unordered_map>
+#include <sys/types.h>
 
 namespace mqtt {
 
-class Connection {
+class MessageTracer;
+class TlsSession;
+
+// What to do when a message does not fit in the outbound queue
+enum class OverflowPolicy {
+    DROP_OLDEST,   // Evict the oldest queued messages
+    DROP_NEWEST,   // Discard the message being queued
+    DROP_QOS0,     // Only ever drop QoS 0 messages, disconnect if that is not enough
+    DISCONNECT     // Disconnect the slow consumer
+};
+
+struct OutboundLimits {
+    size_t max_bytes;
+    size_t max_messages;
+    OverflowPolicy policy;
+};
+
+// What sendMessage() did with an application message
+struct SendResult {
+    bool accepted = false;  // Written or queued
+    size_t dropped = 0;     // Messages dropped to honour the limits, this one included unless accepted
+};
+
+// Bytes written per transmit path, shared by the connections of a broker
+struct TransmitStats {
+    uint64_t copied_bytes = 0;
+    uint64_t zerocopy_bytes = 0;
+    uint64_t zerocopy_completions = 0;
+    uint64_t zerocopy_copied = 0;  // Completions where the kernel fell back to copying
+    uint64_t expired_messages = 0;  // Queued messages dropped once past their Message Expiry Interval
+    uint64_t expired_bytes = 0;
+    uint64_t tls_handshakes = 0;  // Completed, resumed ones included
+    uint64_t tls_resumed = 0;
+    uint64_t tls_failed = 0;
+    uint64_t ktls_send = 0;       // Handshakes that left encryption to the kernel
+    uint64_t ktls_receive = 0;    // Handshakes that left decryption to the kernel
+};
+
+// In-process delivery, the payload is handed over as is without MQTT framing
+using LocalDelivery = std::function<void(const std::string& topic, const std::vector<uint8_t>& payload,
+                                         uint8_t qos, bool retained)>;
+
+class Connection : public std::enable_shared_from_this<Connection> {
 public:
-    Connection(int socket);
+    // The socket must already be non-blocking. Buffers and queues are allocated from memory,
+    // which must outlive the connection and is only used on the thread that owns it.
+    Connection(int socket, const OutboundLimits& limits,
+               std::pmr::memory_resource* memory = std::pmr::get_default_resource());
+    // In-process client without a socket, messages go to the callback
+    explicit Connection(LocalDelivery delivery);
     ~Connection();
     
+    bool isLocal() const { return static_cast<bool>(local_delivery_); }
+    void deliverLocal(const std::string& topic, const std::vector<uint8_t>& payload, uint8_t qos, bool retained) {
+        local_delivery_(topic, payload, qos, retained);
+    }
+    
     void disconnect();
-    std::vector<uint8_t> receive();
-    void send(const std::vector<uint8_t>& data);
+    
+    // Read what the socket has into the inbound buffer, returns bytes read.
+    // Marks the peer closed once it hung up or the socket failed.
+    size_t receive();
+    // Extract the next complete MQTT packet from the inbound buffer
+    bool nextFrame(std::vector<uint8_t>& frame);
+    // Fixed header of the next packet, false until all of it has arrived
+    bool peekFrameHeader(uint8_t& type_flags, uint32_t& remaining, size_t& header_length) const;
+    // Unconsumed inbound bytes, for packets handled piece by piece
+    const uint8_t* peekInbound(size_t& available) const {
+        available = inbound_.size() - inbound_offset_;
+        return inbound_.data() + inbound_offset_;
+    }
+    void consumeInbound(size_t bytes);
+    bool isPeerClosed() const { return peer_closed_; }
+    
+    // Control packets, never dropped. Written straight from the caller's buffer,
+    // only the part the socket does not take right away is copied. What stays queued
+    // counts against the outbound byte limit on its own, a client that keeps sending
+    // requests without reading the replies is disconnected as a slow consumer.
+    void send(const uint8_t* data, size_t length);
+    void send(const std::vector<uint8_t>& data) { send(data.data(), data.size()); }
+    template <size_t N>
+    void send(const std::array<uint8_t, N>& frame) { send(frame.data(), N); }
+    // Application messages, subject to the outbound limits.
+    // Reports whether the message was taken and how many were dropped to honour them.
+    // A non-zero trace records when the frame is queued and when its last byte is written.
+    // A message with an expiry time is dropped instead of written once it has passed.
+    SendResult sendMessage(std::shared_ptr<const std::vector<uint8_t>> frame, uint8_t qos, uint32_t trace = 0,
+                           std::chrono::steady_clock::time_point expires_at = {});
+    // Send application frames of at least threshold bytes with MSG_ZEROCOPY, so the
+    // kernel reads the shared fan-out buffer instead of copying it. Returns false
+    // when the socket does not support it.
+    bool enableZeroCopy(size_t threshold);
+    // Release buffers the kernel is done with, call when the socket reports EPOLLERR
+    void reapZeroCopyCompletions();
+    bool isZeroCopyEnabled() const { return zerocopy_threshold_ > 0; }
+    size_t getZeroCopyInflight() const { return zerocopy_inflight_.size(); }
+    void setTransmitStats(TransmitStats* stats) { stats_ = stats; }
+    void setTracer(MessageTracer* tracer) { tracer_ = tracer; }
+    
+    // Encrypt the connection. The handshake runs on the socket events before any MQTT
+    // traffic; after it the kernel does the record layer when kTLS took over, otherwise
+    // every read and write goes through the session.
+    void startTls(std::unique_ptr<TlsSession> session);
+    const TlsSession* getTls() const { return tls_.get(); }
+    
+    // Cut-through: a frame written piece by piece as its payload arrives. Everything else sent
+    // meanwhile is held back until the last piece, so nothing lands inside the frame.
+    // Returns false when another streamed frame is still open.
+    bool beginStream(std::shared_ptr<const std::vector<uint8_t>> header);
+    void streamChunk(std::shared_ptr<const std::vector<uint8_t>> chunk, bool last);
+    bool isStreaming() const { return streaming_; }
+    
+    // Append without writing, for links that batch frames until the next flush()
+    void queue(std::shared_ptr<const std::vector<uint8_t>> frame);
+    // Write as much queued data as the socket accepts
+    void flush();
     
     int getSocket() const { return socket_; }
     bool isConnected() const { return connected_; }
     bool hasReceivedData() const { return has_received_data_; }
+    bool hasPendingOutput() const { return !outbound_.empty() || tls_wants_write_; }
+    size_t getQueuedBytes() const { return outbound_bytes_; }
+    size_t getQueuedMessages() const { return outbound_messages_; }
+    uint64_t getDroppedMessages() const { return dropped_messages_; }
+    bool wasSlowConsumer() const { return slow_consumer_; }
+    
+    // Inbound flow control: stop reading until the congested subscribers drain
+    void pauseReading(std::vector<std::weak_ptr<Connection>> congested);
+    void resumeReading();
+    bool isReadPaused() const { return read_paused_ || throttled_ || auth_pending_; }
+    bool isBackpressured() const { return read_paused_; }
+    bool congestionCleared(size_t low_watermark) const;
+    
+    // Rate limiting: stop reading until the deadline
+    void throttleUntil(std::chrono::steady_clock::time_point deadline);
+    void clearThrottle() { throttled_ = false; }
+    bool isThrottled() const { return throttled_; }
+    std::chrono::steady_clock::time_point getThrottleDeadline() const { return throttle_deadline_; }
+    
+    // Credentials are being verified off the event loop, hold later packets
+    void setAuthPending(bool pending) { auth_pending_ = pending; }
+    bool isAuthPending() const { return auth_pending_; }
+    // CONNECT accepted and CONNACK sent, the only state in which other packets are handled
+    void setEstablished() { established_ = true; }
+    bool isEstablished() const { return established_; }
+    
+    // Publish authorization decisions for recently used topics, valid for one ACL generation.
+    // Returns false when the topic has no decision cached.
+    bool cachedPublishDecision(const std::string& topic, uint64_t generation, bool& allowed) const;
+    void cachePublishDecision(const std::string& topic, uint64_t generation, bool allowed);
+    
+    // QoS 1 acknowledgements withheld while subscribers hold the publisher back
+    void deferAck(uint16_t packet_id) { deferred_acks_.push_back(packet_id); }
+    std::vector<uint16_t> takeDeferredAcks();
     
+    // QoS 1 publishes accepted from this client whose PUBACK has not been sent, whether
+    // still being routed, withheld or waiting for the write-ahead log. Counted against
+    // the Receive Maximum the broker advertised.
+    void addInboundInflight() { ++inbound_inflight_; }
+    void removeInboundInflight() { --inbound_inflight_; }
+    size_t getInboundInflight() const { return inbound_inflight_; }
+    
+    // Events the reactor currently watches for, maintained by the broker
+    uint32_t getWatchedEvents() const { return watched_events_; }
+    void setWatchedEvents(uint32_t events) { watched_events_ = events; }
+    
+    const std::string& getClientId() const { return client_id_; }
+    void setClientId(const std::string& client_id) { client_id_ = client_id; }
+    const std::string& getUsername() const { return username_; }
+    void setUsername(const std::string& username) { username_ = username; }
+    
+    // Index of the broker listener that accepted the connection, -1 for other connections
+    int getListener() const { return listener_; }
+    void setListener(int listener) { listener_ = listener; }
+    
+    // Peer address ("ip:port", "unix") and negotiated keep-alive, for the admin endpoint
+    const std::string& getAddress() const { return address_; }
+    void setAddress(const std::string& address) { address_ = address; }
+    uint16_t getKeepAlive() const { return keep_alive_; }
+    void setKeepAlive(uint16_t seconds) { keep_alive_ = seconds; }
+    std::chrono::steady_clock::time_point getConnectedSince() const { return connected_since_; }
+    
+    // Lifetime traffic. Messages are PUBLISH packets, received ones counted by the broker
+    // once routed, sent ones once queued.
+    uint64_t getBytesReceived() const { return bytes_received_; }
+    uint64_t getBytesSent() const { return bytes_sent_; }
+    uint64_t getMessagesReceived() const { return messages_received_; }
+    uint64_t getMessagesSent() const { return messages_sent_; }
+    void countMessageReceived() { ++messages_received_; }
+    // Memory held by the inbound buffer, grows with the largest packet read
+    size_t getInboundBufferBytes() const { return inbound_.capacity(); }
+    
+    // Subscriptions of this client, maintained by the broker
+    size_t getSubscriptionCount() const { return subscription_count_; }
+    void addSubscriptionCount(size_t count) { subscription_count_ += count; }
+    void removeSubscriptionCount(size_t count) { subscription_count_ -= std::min(count, subscription_count_); }
+    
+    // Last socket read, kept while tracing so sampled publishes know when they arrived
+    std::chrono::steady_clock::time_point getReceiveTime() const { return receive_time_; }
+    void setReceiveTime(std::chrono::steady_clock::time_point time) { receive_time_ = time; }
+
 private:
+    struct OutboundFrame {
+        std::shared_ptr<const std::vector<uint8_t>> data;
+        uint8_t qos;
+        bool control;
+        uint32_t trace;  // Sampled message, 0 = not traced
+        std::chrono::steady_clock::time_point expires_at;  // Not written after this, zero = never
+        bool reply = false;  // Queued by send(), counted in reply_bytes_
+    };
+    
+    struct ZeroCopySend {
+        uint32_t id;  // Kernel sequence number of the sendmsg() call
+        std::shared_ptr<const std::vector<uint8_t>> data;  // Pinned until the completion arrives
+    };
+    
+    void enqueue(std::shared_ptr<const std::vector<uint8_t>> frame, uint8_t qos, bool control, uint32_t trace = 0,
+                 std::chrono::steady_clock::time_point expires_at = {});
+    void traceWritten(uint32_t trace);
+    bool wantsZeroCopy(const std::shared_ptr<const std::vector<uint8_t>>& frame) const {
+        return zerocopy_threshold_ > 0 && frame->size() >= zerocopy_threshold_;
+    }
+    void countCopied(size_t bytes) {
+        bytes_sent_ += bytes;
+        if (stats_) {
+            stats_->copied_bytes += bytes;
+        }
+    }
+    bool canWriteDirect() const;
+    bool frontPinned() const;
+    ssize_t readSocket(uint8_t* data, size_t length);
+    ssize_t writeSocket(const uint8_t* data, size_t length);
+    bool advanceHandshake();
+    void flushTls();
+    size_t popWritten(size_t bytes);
+    void mergeFront(size_t frames);
+    bool fitsLimits(size_t frame_size) const;
+    bool evictOldest(bool qos0_only);
+    bool evictFrom(std::pmr::deque<OutboundFrame>& frames, bool qos0_only, bool keep_front);
+    void purgeExpired(std::chrono::steady_clock::time_point now);
+    void purgeExpiredFrom(std::pmr::deque<OutboundFrame>& frames, std::chrono::steady_clock::time_point now,
+                          bool keep_front);
+    void discardExpired(const OutboundFrame& frame);
+    
     int socket_;
     bool connected_;
     bool has_received_data_;
+    bool peer_closed_;
+    uint32_t watched_events_;
+    std::string client_id_;
+    std::string username_;
+    int listener_;
+    std::string address_;
+    uint16_t keep_alive_;
+    std::chrono::steady_clock::time_point connected_since_;
+    
+    uint64_t bytes_received_;
+    uint64_t bytes_sent_;
+    uint64_t messages_received_;
+    uint64_t messages_sent_;
+    size_t subscription_count_;
+    
+    std::pmr::vector<uint8_t> inbound_;
+    size_t inbound_offset_;        // Start of unconsumed inbound data
+    
+    OutboundLimits limits_;
+    std::pmr::deque<OutboundFrame> outbound_;
+    size_t front_offset_;          // Bytes of the front frame already written
+    size_t outbound_bytes_;        // Unwritten bytes in the queue
+    size_t outbound_messages_;     // Queued application messages
+    size_t reply_bytes_;           // Unwritten bytes of control packets queued by send()
+    size_t expiring_messages_;     // Queued messages with an expiry time, 0 skips the checks
+    uint64_t dropped_messages_;
+    bool slow_consumer_;
+    
+    bool read_paused_;
+    std::vector<std::weak_ptr<Connection>> congested_subscribers_;
+    std::vector<uint16_t> deferred_acks_;
+    size_t inbound_inflight_;
+    bool throttled_;
+    std::chrono::steady_clock::time_point throttle_deadline_;
+    bool auth_pending_;
+    bool established_;
+    
+    uint64_t acl_generation_;
+    std::unordered_map<std::string, bool> acl_decisions_;
+    
+    LocalDelivery local_delivery_;
+    
+    size_t zerocopy_threshold_;    // 0 = disabled
+    uint32_t zerocopy_next_id_;
+    std::pmr::deque<ZeroCopySend> zerocopy_inflight_;
+    TransmitStats* stats_;
+    MessageTracer* tracer_;
+    std::chrono::steady_clock::time_point receive_time_;
+    
+    bool streaming_;
+    std::pmr::deque<OutboundFrame> held_;  // Queued behind the open streamed frame
+    
+    std::unique_ptr<TlsSession> tls_;
+    bool tls_wants_write_;  // Handshake waits for the socket to take more
 };
 
 } // namespace mqtt
 
-#endif // CONNECTION_H
\ No newline at end of file
+#endif // CONNECTION_H
@@ -3,29 +3,51 @@
 #include "broker/MqttBroker.h"
 
 mqtt::MqttBroker* brokerInstance = nullptr;
+volatile sig_atomic_t stopSignal = 0;
 
 void signalHandler(int signum) {
-    std::cout << "\nInterrupt signal (" << signum << ") received." << std::endl;
+    // run() returns and main() stops the broker, nothing else is safe in here
+    stopSignal = signum;
     if (brokerInstance) {
-        brokerInstance->stop(); // Gracefully stop the broker, disconnect clients
+        brokerInstance->requestStop();
+    }
+}
+
+void reloadHandler(int) {
+    if (brokerInstance) {
+        brokerInstance->requestAclReload();
+    }
+}
+
+void traceHandler(int) {
+    if (brokerInstance) {
+        brokerInstance->requestTraceDump();
     }
-    exit(signum);
 }
 
 int main() {
-    mqtt::MqttBroker broker;
+    mqtt::MqttBroker broker(mqtt::BrokerConfig::fromEnvironment());
     brokerInstance = &broker;
     
     // Register signal handler for graceful shutdown
     signal(SIGINT, signalHandler);
     signal(SIGTERM, signalHandler);
+    signal(SIGHUP, reloadHandler);  // Reload ACLs
+    signal(SIGUSR1, traceHandler);  // Write sampled message traces
+    signal(SIGPIPE, SIG_IGN);       // OpenSSL writes TLS records with write(), not send(MSG_NOSIGNAL)
 
-    broker.start();
+    if (!broker.start()) {
+        std::cerr << "MQTT Broker failed to start" << std::endl;
+        return 1;
+    }
 
     std::cout << "MQTT Broker is running... Press Ctrl+C to stop." << std::endl;
 
     broker.run();
 
-    broker.stop();
-    return 0;
+    if (stopSignal != 0) {
+        std::cout << "\nInterrupt signal (" << stopSignal << ") received." << std::endl;
+    }
+    broker.stop(); // Gracefully stop the broker, disconnect clients
+    return stopSignal;
 }
\ No newline at end of file
@@ -0,0 +1,171 @@
+#include "NumaArena.h"
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+
+#ifndef MAP_HUGETLB
+#define MAP_HUGETLB 0x40000
+#endif
+
+namespace mqtt {
+
+namespace {
+
+constexpr size_t PAGE_BYTES = 4096;
+constexpr size_t HUGE_PAGE_BYTES = 2 * 1024 * 1024;
+constexpr size_t MAX_POOLED_BLOCK = 1024 * 1024;  // Larger blocks come straight from Regions
+
+size_t roundUp(size_t bytes, size_t multiple) {
+    return (bytes + multiple - 1) / multiple * multiple;
+}
+
+// "0" on a single-node machine, "0-1" on a dual-socket one
+bool hasSeveralNodes() {
+    std::ifstream online("/sys/devices/system/node/online");
+    std::string nodes;
+    return online >> nodes && nodes != "0";
+}
+
+int currentNode() {
+    unsigned cpu = 0;
+    unsigned node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) {
+        return 0;
+    }
+    return static_cast<int>(node);
+}
+
+} // namespace
+
+HugePages parseHugePages(const std::string& name) {
+    if (name == "off") {
+        return HugePages::OFF;
+    }
+    if (name == "transparent") {
+        return HugePages::TRANSPARENT;
+    }
+    if (name == "explicit") {
+        return HugePages::EXPLICIT;
+    }
+    throw std::invalid_argument("Unknown huge page mode: " + name);
+}
+
+NumaArena::NumaArena(int node, HugePages huge_pages, size_t region_bytes)
+    : node_(node < 0 ? currentNode() : node), bound_(false),
+      pool_(std::pmr::pool_options{0, std::min(MAX_POOLED_BLOCK, region_bytes / 8)}, &regions_),
+      allocated_bytes_(0) {
+    // Nothing to bind to on a single node, first touch already lands there
+    bound_ = hasSeveralNodes();
+    regions_.region_bytes = roundUp(std::max(region_bytes, HUGE_PAGE_BYTES), HUGE_PAGE_BYTES);
+    regions_.largest_carved = pool_.options().largest_required_pool_block;
+    regions_.huge_pages = huge_pages;
+    regions_.node = node_;
+    regions_.bind = bound_;
+    regions_.bound = &bound_;
+}
+
+NumaArena::~NumaArena() = default;
+
+void* NumaArena::do_allocate(size_t bytes, size_t alignment) {
+    void* p = pool_.allocate(bytes, alignment);
+    allocated_bytes_ += bytes;
+    return p;
+}
+
+void NumaArena::do_deallocate(void* p, size_t bytes, size_t alignment) {
+    pool_.deallocate(p, bytes, alignment);
+    allocated_bytes_ -= bytes;
+}
+
+NumaArena::Regions::~Regions() {
+    for (void* region : regions) {
+        munmap(region, region_bytes);
+    }
+    for (const auto& [address, size] : large) {
+        munmap(address, size);
+    }
+}
+
+void* NumaArena::Regions::map(size_t& size) {
+    size = roundUp(size, huge_pages == HugePages::OFF ? PAGE_BYTES : HUGE_PAGE_BYTES);
+    void* address = MAP_FAILED;
+    if (huge_pages == HugePages::EXPLICIT) {
+        // Reserved up front, so an empty pool fails here instead of faulting later
+        address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (address == MAP_FAILED) {
+            std::cerr << "Explicit huge pages unavailable (" << std::strerror(errno)
+                      << "), using transparent huge pages" << std::endl;
+            huge_pages = HugePages::TRANSPARENT;
+        }
+    }
+    if (address == MAP_FAILED) {
+        address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (address == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        if (huge_pages == HugePages::TRANSPARENT) {
+            madvise(address, size, MADV_HUGEPAGE);
+        }
+    }
+    
+    // Preferred rather than strict, a full node spills over instead of failing allocations
+    if (bind) {
+        constexpr size_t BITS = 8 * sizeof(unsigned long);
+        std::vector<unsigned long> mask(static_cast<size_t>(node) / BITS + 1, 0);
+        mask.back() |= 1UL << (static_cast<size_t>(node) % BITS);
+        if (syscall(SYS_mbind, address, size, MPOL_PREFERRED, mask.data(), mask.size() * BITS + 1, 0) != 0) {
+            std::cerr << "Cannot bind arena memory to NUMA node " << node << ": " << std::strerror(errno)
+                      << ", continuing unbound" << std::endl;
+            bind = false;
+            *bound = false;
+        }
+    }
+    
+    mapped_bytes += size;
+    return address;
+}
+
+void* NumaArena::Regions::do_allocate(size_t bytes, size_t alignment) {
+    // Larger than the pool serves, e.g. the buffer of a big packet: the pool hands these
+    // straight back on free, so they get a mapping of their own that can be returned
+    if (bytes > largest_carved) {
+        size_t size = bytes;
+        void* p = map(size);
+        large.emplace(p, size);
+        return p;
+    }
+    
+    size_t padding = (alignment - reinterpret_cast<uintptr_t>(cursor) % alignment) % alignment;
+    if (!cursor || padding + bytes > left) {
+        size_t size = region_bytes;
+        cursor = static_cast<uint8_t*>(map(size));
+        regions.push_back(cursor);
+        left = size;
+        padding = 0;
+    }
+    void* p = cursor + padding;
+    cursor += padding + bytes;
+    left -= padding + bytes;
+    return p;
+}
+
+void NumaArena::Regions::do_deallocate(void* p, size_t, size_t) {
+    // Pool chunks carved from a region stay until the arena goes, only own mappings are returned
+    auto it = large.find(p);
+    if (it == large.end()) {
+        return;
+    }
+    munmap(it->first, it->second);
+    mapped_bytes -= it->second;
+    large.erase(it);
+}
+
+} // namespace mqtt
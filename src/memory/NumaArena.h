@@ -0,0 +1,78 @@
+#ifndef NUMA_ARENA_H
+#define NUMA_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace mqtt {
+
+// How arena memory is backed
+enum class HugePages {
+    OFF,
+    TRANSPARENT,  // madvise(MADV_HUGEPAGE), the kernel collapses pages when it can
+    EXPLICIT      // MAP_HUGETLB from the reserved pool, falls back to TRANSPARENT when it is empty
+};
+
+// "off", "transparent" or "explicit"
+HugePages parseHugePages(const std::string& name);
+
+// Memory for one event loop thread: large anonymous mappings bound to a NUMA node and
+// optionally backed by huge pages, carved into pooled blocks. Not thread-safe, only the
+// owning thread may allocate and free. On a single-node machine, or where mbind() is not
+// permitted, it keeps working unbound.
+class NumaArena : public std::pmr::memory_resource {
+public:
+    // node -1 binds to the node of the CPU the calling thread runs on
+    NumaArena(int node, HugePages huge_pages, size_t region_bytes);
+    ~NumaArena() override;
+    
+    NumaArena(const NumaArena&) = delete;
+    NumaArena& operator=(const NumaArena&) = delete;
+    
+    int getNode() const { return node_; }
+    bool isBound() const { return bound_; }
+    HugePages getHugePages() const { return regions_.huge_pages; }  // After any fallback
+    size_t getMappedBytes() const { return regions_.mapped_bytes; }  // Reserved from the kernel
+    size_t getAllocatedBytes() const { return allocated_bytes_; }    // Handed out, not yet freed
+
+private:
+    // Upstream of the pool: pool chunks are bump-allocated from node-bound regions and kept,
+    // larger requests get a mapping of their own that is returned on free
+    struct Regions : std::pmr::memory_resource {
+        size_t region_bytes = 0;
+        size_t largest_carved = 0;  // Requests above this get a mapping of their own
+        HugePages huge_pages = HugePages::OFF;
+        int node = -1;
+        bool bind = false;
+        bool* bound = nullptr;
+        uint8_t* cursor = nullptr;
+        size_t left = 0;
+        size_t mapped_bytes = 0;
+        std::vector<void*> regions;               // region_bytes each, unmapped on destruction
+        std::unordered_map<void*, size_t> large;  // Oversized requests -> mapping size
+        
+        ~Regions() override;
+        void* map(size_t& size);  // Rounds size up to what was mapped
+        void* do_allocate(size_t bytes, size_t alignment) override;
+        void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+    };
+    
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+    
+    int node_;
+    bool bound_;
+    Regions regions_;
+    std::pmr::unsynchronized_pool_resource pool_;
+    size_t allocated_bytes_;
+};
+
+} // namespace mqtt
+
+#endif // NUMA_ARENA_H
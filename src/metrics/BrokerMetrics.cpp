@@ -4,7 +4,8 @@
 namespace mqtt {
 
 BrokerMetrics::BrokerMetrics() 
-    : registry_(std::make_shared<prometheus::Registry>()) {
+    : registry_(std::make_shared<prometheus::Registry>()),
+      shards_(std::make_shared<MetricShards>()) {
     
     // Initialize gauge families and gauges
     active_connections_family_ = &prometheus::BuildGauge()
@@ -19,6 +20,18 @@ BrokerMetrics::BrokerMetrics()
         .Register(*registry_);
     active_subscriptions_ = &active_subscriptions_family_->Add({});
     
+    topic_bloom_fp_rate_family_ = &prometheus::BuildGauge()
+        .Name("mqtt_topic_bloom_false_positive_rate")
+        .Help("Estimated false-positive rate of the no-subscriber topic prefilter")
+        .Register(*registry_);
+    topic_bloom_fp_rate_ = &topic_bloom_fp_rate_family_->Add({});
+    
+    flow_control_paused_family_ = &prometheus::BuildGauge()
+        .Name("mqtt_flow_control_paused_clients")
+        .Help("Number of publishers whose socket is not read because subscribers are behind")
+        .Register(*registry_);
+    flow_control_paused_ = &flow_control_paused_family_->Add({});
+    
     // Initialize counter families and counters
     total_connections_family_ = &prometheus::BuildCounter()
         .Name("mqtt_total_connections")
@@ -26,49 +39,271 @@ BrokerMetrics::BrokerMetrics()
         .Register(*registry_);
     total_connections_ = &total_connections_family_->Add({});
     
-    messages_published_family_ = &prometheus::BuildCounter()
-        .Name("mqtt_messages_published_total")
-        .Help("Total number of messages published")
+    connection_errors_family_ = &prometheus::BuildCounter()
+        .Name("mqtt_connection_errors_total")
+        .Help("Total number of connection errors")
         .Register(*registry_);
-    messages_published_ = &messages_published_family_->Add({});
+    connection_errors_ = &connection_errors_family_->Add({});
     
-    messages_received_family_ = &prometheus::BuildCounter()
-        .Name("mqtt_messages_received_total")
-        .Help("Total number of messages received")
+    topic_cache_hits_family_ = &prometheus::BuildCounter()
+        .Name("mqtt_topic_cache_hits_total")
+        .Help("Total number of publishes served from the topic match cache")
         .Register(*registry_);
-    messages_received_ = &messages_received_family_->Add({});
+    topic_cache_hits_ = &topic_cache_hits_family_->Add({});
     
-    bytes_received_family_ = &prometheus::BuildCounter()
-        .Name("mqtt_bytes_received_total")
-        .Help("Total number of bytes received")
+    topic_cache_misses_family_ = &prometheus::BuildCounter()
+        .Name("mqtt_topic_cache_misses_total")
+        .Help("Total number of publishes that required a subscription match")
         .Register(*registry_);
-    bytes_received_ = &bytes_received_family_->Add({});
+    topic_cache_misses_ = &topic_cache_misses_family_->Add({});
     
-    bytes_sent_family_ = &prometheus::BuildCounter()
-        .Name("mqtt_bytes_sent_total")
-        .Help("Total number of bytes sent")
+    topic_cache_invalidations_family_ = &prometheus::BuildCounter()
+        .Name("mqtt_topic_cache_invalidations_total")
+        .Help("Total number of topic match cache invalidations")
         .Register(*registry_);
-    bytes_sent_ = &bytes_sent_family_->Add({});
+    topic_cache_invalidations_ = &topic_cache_invalidations_family_->Add({});
     
-    connection_errors_family_ = &prometheus::BuildCounter()
-        .Name("mqtt_connection_errors_total")
-        .Help("Total number of connection errors")
+    topic_bloom_rejects_family_ = &prometheus::BuildCounter()
+        .Name("mqtt_topic_bloom_rejects_total")
+        .Help("Total number of publishes rejected early because no filter can match")
         .Register(*registry_);
-    connection_errors_ = &connection_errors_family_->Add({});
+    topic_bloom_rejects_ = &topic_bloom_rejects_family_->Add({});
+    
+    topic_bloom_false_positives_family_ = &prometheus::BuildCounter()
+        .Name("mqtt_topic_bloom_false_positives_total")
+        .Help("Total number of publishes passing the topic prefilter without any subscriber")
+        .Register(*registry_);
+    topic_bloom_false_positives_ = &topic_bloom_false_positives_family_->Add({});
+    
+    messages_dropped_family_ = &prometheus::BuildCounter()
+        .Name("mqtt_messages_dropped_total")
+        .Help("Total number of outbound messages dropped by the overflow policy")
+        .Register(*registry_);
+    messages_dropped_ = &messages_dropped_family_->Add({});
+    
+    client_messages_dropped_family_ = &prometheus::BuildCounter()
+        .Name("mqtt_client_messages_dropped_total")
+        .Help("Outbound messages dropped by the overflow policy, per connected client")
+        .Register(*registry_);
+    
+    slow_consumer_disconnects_family_ = &prometheus::BuildCounter()
+        .Name("mqtt_slow_consumer_disconnects_total")
+        .Help("Total number of clients disconnected for exceeding their outbound queue")
+        .Register(*registry_);
+    slow_consumer_disconnects_ = &slow_consumer_disconnects_family_->Add({});
+    
+    flow_control_pauses_family_ = &prometheus::BuildCounter()
+        .Name("mqtt_flow_control_pauses_total")
+        .Help("Total number of times a publisher was paused by subscriber backpressure")
+        .Register(*registry_);
+    flow_control_pauses_ = &flow_control_pauses_family_->Add({});
+    
+    receive_maximum_exceeded_family_ = &prometheus::BuildCounter()
+        .Name("mqtt_receive_maximum_exceeded_total")
+        .Help("Total number of clients disconnected for exceeding Receive Maximum")
+        .Register(*registry_);
+    receive_maximum_exceeded_ = &receive_maximum_exceeded_family_->Add({});
+    
+    rate_limited_family_ = &prometheus::BuildCounter()
+        .Name("mqtt_rate_limited_total")
+        .Help("Total number of times a client exceeded its rate limit, by action taken")
+        .Register(*registry_);
+    rate_limit_throttles_ = &rate_limited_family_->Add({{"action", "throttle"}});
+    rate_limit_disconnects_ = &rate_limited_family_->Add({{"action", "disconnect"}});
+    
+    connections_rejected_family_ = &prometheus::BuildCounter()
+        .Name("mqtt_connections_rejected_total")
+        .Help("Total number of connections closed by the connection rate limit")
+        .Register(*registry_);
+    connections_rejected_ = &connections_rejected_family_->Add({});
+    
+    auth_family_ = &prometheus::BuildCounter()
+        .Name("mqtt_auth_total")
+        .Help("Total number of CONNECT credential checks, by result")
+        .Register(*registry_);
+    auth_successes_ = &auth_family_->Add({{"result", "success"}});
+    auth_failures_ = &auth_family_->Add({{"result", "failure"}});
+    auth_cache_hits_ = &auth_family_->Add({{"result", "cache_hit"}});
+    
+    acl_denied_family_ = &prometheus::BuildCounter()
+        .Name("mqtt_acl_denied_total")
+        .Help("Total number of operations refused by the topic ACL, by operation")
+        .Register(*registry_);
+    acl_publish_denied_ = &acl_denied_family_->Add({{"operation", "publish"}});
+    acl_subscribe_denied_ = &acl_denied_family_->Add({{"operation", "subscribe"}});
+    
+    cluster_peers_family_ = &prometheus::BuildGauge()
+        .Name("mqtt_cluster_peers")
+        .Help("Number of cluster nodes with an established link")
+        .Register(*registry_);
+    cluster_peers_ = &cluster_peers_family_->Add({});
+    
+    cluster_messages_family_ = &prometheus::BuildCounter()
+        .Name("mqtt_cluster_messages_total")
+        .Help("Total number of publishes exchanged with other cluster nodes, by direction")
+        .Register(*registry_);
+    cluster_forwarded_ = &cluster_messages_family_->Add({{"direction", "forwarded"}});
+    cluster_received_ = &cluster_messages_family_->Add({{"direction", "received"}});
+    
+    session_takeovers_family_ = &prometheus::BuildCounter()
+        .Name("mqtt_session_takeovers_total")
+        .Help("Total number of clients disconnected because their client id connected again")
+        .Register(*registry_);
+    session_takeovers_ = &session_takeovers_family_->Add({});
+    
+    cut_through_family_ = &prometheus::BuildCounter()
+        .Name("mqtt_cut_through_messages_total")
+        .Help("Total number of publishes forwarded to subscribers while their payload was still arriving")
+        .Register(*registry_);
+    cut_through_messages_ = &cut_through_family_->Add({});
+    
+    packets_too_large_family_ = &prometheus::BuildCounter()
+        .Name("mqtt_packets_too_large_total")
+        .Help("Total number of clients disconnected for exceeding the maximum packet size")
+        .Register(*registry_);
+    packets_too_large_ = &packets_too_large_family_->Add({});
+    
+    transmit_bytes_family_ = &prometheus::BuildCounter()
+        .Name("mqtt_transmit_bytes_total")
+        .Help("Total number of bytes written to client sockets, by transmit path")
+        .Register(*registry_);
+    transmit_copied_bytes_ = &transmit_bytes_family_->Add({{"path", "copy"}});
+    transmit_zerocopy_bytes_ = &transmit_bytes_family_->Add({{"path", "zerocopy"}});
+    
+    zerocopy_completions_family_ = &prometheus::BuildCounter()
+        .Name("mqtt_zerocopy_completions_total")
+        .Help("Total number of zero-copy sends completed, by whether the kernel had to copy after all")
+        .Register(*registry_);
+    zerocopy_completions_ = &zerocopy_completions_family_->Add({{"result", "zerocopy"}});
+    zerocopy_copied_ = &zerocopy_completions_family_->Add({{"result", "copied"}});
     
-    // Initialize histogram family and histogram
-    message_size_family_ = &prometheus::BuildHistogram()
-        .Name("mqtt_message_size_bytes")
-        .Help("Distribution of message sizes in bytes")
+    loop_iterations_family_ = &prometheus::BuildCounter()
+        .Name("mqtt_loop_iterations_total")
+        .Help("Total number of event loop iterations")
         .Register(*registry_);
-    message_size_ = &message_size_family_->Add({}, 
-        prometheus::Histogram::BucketBoundaries{10, 50, 100, 500, 1000, 5000, 10000, 50000});
+    loop_iterations_ = &loop_iterations_family_->Add({});
+    
+    loop_polls_family_ = &prometheus::BuildCounter()
+        .Name("mqtt_loop_polls_total")
+        .Help("Total number of event loop polls, by outcome: spins that found nothing, spins that found events, and waits that blocked")
+        .Register(*registry_);
+    loop_idle_spins_ = &loop_polls_family_->Add({{"result", "idle_spin"}});
+    loop_spin_hits_ = &loop_polls_family_->Add({{"result", "spin_hit"}});
+    loop_blocking_waits_ = &loop_polls_family_->Add({{"result", "blocking"}});
+    
+    loop_spin_seconds_family_ = &prometheus::BuildCounter()
+        .Name("mqtt_loop_spin_seconds_total")
+        .Help("Total time the event loop spent busy-polling in low-latency mode")
+        .Register(*registry_);
+    loop_spin_seconds_ = &loop_spin_seconds_family_->Add({});
+    
+    const struct {
+        TopTalkers kind;
+        const char* name;
+        const char* help;
+    } top_talkers[] = {
+        {TopTalkers::TOPIC_MESSAGES, "mqtt_hot_topic_messages_per_second",
+         "Publish rate of the busiest topic prefixes over the last window"},
+        {TopTalkers::TOPIC_BYTES, "mqtt_hot_topic_bytes_per_second",
+         "Payload bytes per second of the busiest topic prefixes over the last window"},
+        {TopTalkers::CLIENT_MESSAGES, "mqtt_top_client_messages_per_second",
+         "Publish rate of the busiest clients over the last window"},
+        {TopTalkers::CLIENT_BYTES, "mqtt_top_client_bytes_per_second",
+         "Payload bytes per second published by the busiest clients over the last window"},
+    };
+    for (const auto& series : top_talkers) {
+        top_talkers_[static_cast<size_t>(series.kind)].family = &prometheus::BuildGauge()
+            .Name(series.name)
+            .Help(series.help)
+            .Register(*registry_);
+    }
+    
+    listener_connections_family_ = &prometheus::BuildCounter()
+        .Name("mqtt_listener_connections_total")
+        .Help("Total number of connections accepted, by listener")
+        .Register(*registry_);
+    listener_active_connections_family_ = &prometheus::BuildGauge()
+        .Name("mqtt_listener_active_connections")
+        .Help("Number of currently active connections, by listener")
+        .Register(*registry_);
+    
+    arena_mapped_family_ = &prometheus::BuildGauge()
+        .Name("mqtt_arena_mapped_bytes")
+        .Help("Address space mapped by a memory arena, by arena and NUMA node")
+        .Register(*registry_);
+    arena_allocated_family_ = &prometheus::BuildGauge()
+        .Name("mqtt_arena_allocated_bytes")
+        .Help("Bytes handed out by a memory arena and not yet freed, by arena and NUMA node")
+        .Register(*registry_);
+    
+    wal_commits_family_ = &prometheus::BuildCounter()
+        .Name("mqtt_wal_commits_total")
+        .Help("Total number of write-ahead log group commits, by whether they reached the disk")
+        .Register(*registry_);
+    wal_commits_ok_ = &wal_commits_family_->Add({{"result", "ok"}});
+    wal_commits_failed_ = &wal_commits_family_->Add({{"result", "failed"}});
+    
+    wal_records_family_ = &prometheus::BuildCounter()
+        .Name("mqtt_wal_records_total")
+        .Help("Total number of publishes committed to the write-ahead log")
+        .Register(*registry_);
+    wal_records_ = &wal_records_family_->Add({});
+    
+    wal_bytes_family_ = &prometheus::BuildCounter()
+        .Name("mqtt_wal_bytes_total")
+        .Help("Total bytes committed to the write-ahead log")
+        .Register(*registry_);
+    wal_bytes_ = &wal_bytes_family_->Add({});
+    
+    wal_commit_records_family_ = &prometheus::BuildHistogram()
+        .Name("mqtt_wal_commit_records")
+        .Help("Publishes per write-ahead log group commit")
+        .Register(*registry_);
+    wal_commit_records_ = &wal_commit_records_family_->Add({},
+        prometheus::Histogram::BucketBoundaries{1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024, 4096});
+    
+    wal_commit_seconds_family_ = &prometheus::BuildHistogram()
+        .Name("mqtt_wal_commit_seconds")
+        .Help("Time a write-ahead log group commit spent in write and fdatasync")
+        .Register(*registry_);
+    wal_commit_seconds_ = &wal_commit_seconds_family_->Add({},
+        prometheus::Histogram::BucketBoundaries{0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 1});
+    
+    messages_expired_family_ = &prometheus::BuildCounter()
+        .Name("mqtt_messages_expired_total")
+        .Help("Total number of messages discarded when their expiry interval ran out, by where they were held")
+        .Register(*registry_);
+    retained_expired_ = &messages_expired_family_->Add({{"where", "retained"}});
+    queued_expired_ = &messages_expired_family_->Add({{"where", "queued"}});
+    
+    expired_bytes_family_ = &prometheus::BuildCounter()
+        .Name("mqtt_expired_bytes_total")
+        .Help("Total bytes reclaimed from expired messages, by where they were held")
+        .Register(*registry_);
+    retained_expired_bytes_ = &expired_bytes_family_->Add({{"where", "retained"}});
+    queued_expired_bytes_ = &expired_bytes_family_->Add({{"where", "queued"}});
+    
+    tls_handshakes_family_ = &prometheus::BuildCounter()
+        .Name("mqtt_tls_handshakes_total")
+        .Help("Total number of TLS handshakes on client listeners, by whether they were full, resumed or failed")
+        .Register(*registry_);
+    tls_handshakes_full_ = &tls_handshakes_family_->Add({{"result", "full"}});
+    tls_handshakes_resumed_ = &tls_handshakes_family_->Add({{"result", "resumed"}});
+    tls_handshakes_failed_ = &tls_handshakes_family_->Add({{"result", "failed"}});
+    
+    ktls_connections_family_ = &prometheus::BuildCounter()
+        .Name("mqtt_ktls_connections_total")
+        .Help("Total number of TLS connections whose record layer the kernel took over, by direction")
+        .Register(*registry_);
+    ktls_send_ = &ktls_connections_family_->Add({{"direction", "send"}});
+    ktls_receive_ = &ktls_connections_family_->Add({{"direction", "receive"}});
 }
 
 void BrokerMetrics::startExporter(const std::string& bind_address) {
     try {
         exposer_ = std::make_unique<prometheus::Exposer>(bind_address);
         exposer_->RegisterCollectable(registry_);
+        exposer_->RegisterCollectable(shards_);
         std::cout << "Prometheus metrics exporter started on " << bind_address << std::endl;
     } catch (const std::exception& e) {
         std::cerr << "Failed to start Prometheus exporter: " << e.what() << std::endl;
@@ -83,32 +318,288 @@ void BrokerMetrics::setActiveSubscriptions(double value) {
     active_subscriptions_->Set(value);
 }
 
+void BrokerMetrics::setTopicBloomFalsePositiveRate(double value) {
+    topic_bloom_fp_rate_->Set(value);
+}
+
+void BrokerMetrics::setFlowControlPausedClients(double value) {
+    flow_control_paused_->Set(value);
+}
+
 void BrokerMetrics::incrementTotalConnections() {
     total_connections_->Increment();
 }
 
 void BrokerMetrics::incrementMessagesPublished() {
-    messages_published_->Increment();
+    shards_->add(MetricShards::MESSAGES_PUBLISHED, 1);
 }
 
 void BrokerMetrics::incrementMessagesReceived() {
-    messages_received_->Increment();
+    shards_->add(MetricShards::MESSAGES_RECEIVED, 1);
 }
 
 void BrokerMetrics::incrementBytesReceived(double bytes) {
-    bytes_received_->Increment(bytes);
+    shards_->add(MetricShards::BYTES_RECEIVED, static_cast<uint64_t>(bytes));
 }
 
 void BrokerMetrics::incrementBytesSent(double bytes) {
-    bytes_sent_->Increment(bytes);
+    shards_->add(MetricShards::BYTES_SENT, static_cast<uint64_t>(bytes));
 }
 
 void BrokerMetrics::incrementConnectionErrors() {
     connection_errors_->Increment();
 }
 
+void BrokerMetrics::incrementTopicCacheHits() {
+    topic_cache_hits_->Increment();
+}
+
+void BrokerMetrics::incrementTopicCacheMisses() {
+    topic_cache_misses_->Increment();
+}
+
+void BrokerMetrics::incrementTopicCacheInvalidations() {
+    topic_cache_invalidations_->Increment();
+}
+
+void BrokerMetrics::incrementTopicBloomRejects() {
+    topic_bloom_rejects_->Increment();
+}
+
+void BrokerMetrics::incrementTopicBloomFalsePositives() {
+    topic_bloom_false_positives_->Increment();
+}
+
+void BrokerMetrics::incrementMessagesDropped(const std::string& client_id, double count) {
+    messages_dropped_->Increment(count);
+    if (client_id.empty()) {
+        return;  // Any number of clients may connect without one
+    }
+    
+    auto it = client_messages_dropped_.find(client_id);
+    if (it == client_messages_dropped_.end()) {
+        auto* counter = &client_messages_dropped_family_->Add({{"client_id", client_id}});
+        it = client_messages_dropped_.emplace(client_id, counter).first;
+    }
+    it->second->Increment(count);
+}
+
+void BrokerMetrics::incrementSlowConsumerDisconnects() {
+    slow_consumer_disconnects_->Increment();
+}
+
+void BrokerMetrics::incrementFlowControlPauses() {
+    flow_control_pauses_->Increment();
+}
+
+void BrokerMetrics::incrementReceiveMaximumExceeded() {
+    receive_maximum_exceeded_->Increment();
+}
+
+void BrokerMetrics::incrementRateLimitThrottles() {
+    rate_limit_throttles_->Increment();
+}
+
+void BrokerMetrics::incrementRateLimitDisconnects() {
+    rate_limit_disconnects_->Increment();
+}
+
+void BrokerMetrics::incrementConnectionsRejected() {
+    connections_rejected_->Increment();
+}
+
+void BrokerMetrics::incrementAuthSuccesses() {
+    auth_successes_->Increment();
+}
+
+void BrokerMetrics::incrementAuthFailures() {
+    auth_failures_->Increment();
+}
+
+void BrokerMetrics::incrementAuthCacheHits() {
+    auth_cache_hits_->Increment();
+}
+
+void BrokerMetrics::incrementAclPublishDenied() {
+    acl_publish_denied_->Increment();
+}
+
+void BrokerMetrics::incrementAclSubscribeDenied() {
+    acl_subscribe_denied_->Increment();
+}
+
+void BrokerMetrics::incrementClusterForwarded(double count) {
+    cluster_forwarded_->Increment(count);
+}
+
+void BrokerMetrics::incrementClusterReceived() {
+    cluster_received_->Increment();
+}
+
+void BrokerMetrics::incrementSessionTakeovers() {
+    session_takeovers_->Increment();
+}
+
+void BrokerMetrics::setClusterPeers(double value) {
+    cluster_peers_->Set(value);
+}
+
+void BrokerMetrics::incrementCutThroughMessages() {
+    cut_through_messages_->Increment();
+}
+
+void BrokerMetrics::incrementPacketsTooLarge() {
+    packets_too_large_->Increment();
+}
+
+void BrokerMetrics::incrementTransmitCopiedBytes(double bytes) {
+    transmit_copied_bytes_->Increment(bytes);
+}
+
+void BrokerMetrics::incrementTransmitZeroCopyBytes(double bytes) {
+    transmit_zerocopy_bytes_->Increment(bytes);
+}
+
+void BrokerMetrics::incrementZeroCopyCompletions(double count) {
+    zerocopy_completions_->Increment(count);
+}
+
+void BrokerMetrics::incrementZeroCopyCopied(double count) {
+    zerocopy_copied_->Increment(count);
+}
+
+void BrokerMetrics::incrementLoopIterations(double count) {
+    loop_iterations_->Increment(count);
+}
+
+void BrokerMetrics::incrementLoopIdleSpins(double count) {
+    loop_idle_spins_->Increment(count);
+}
+
+void BrokerMetrics::incrementLoopSpinHits(double count) {
+    loop_spin_hits_->Increment(count);
+}
+
+void BrokerMetrics::incrementLoopBlockingWaits(double count) {
+    loop_blocking_waits_->Increment(count);
+}
+
+void BrokerMetrics::incrementLoopSpinSeconds(double seconds) {
+    loop_spin_seconds_->Increment(seconds);
+}
+
+size_t BrokerMetrics::addListener(const std::string& listener) {
+    prometheus::Labels labels{{"listener", listener}};
+    listeners_.push_back(ListenerSeries{
+        &listener_connections_family_->Add(labels),
+        &listener_active_connections_family_->Add(labels)
+    });
+    size_t id = listeners_.size() - 1;
+    if (!shards_->addListener(id, listener)) {
+        std::cerr << "Byte counters for " << listener << " are only included in the totals, more than "
+                  << MetricShards::MAX_LISTENERS << " listeners" << std::endl;
+    }
+    return id;
+}
+
+void BrokerMetrics::incrementListenerConnections(size_t listener) {
+    listeners_[listener].connections->Increment();
+}
+
+void BrokerMetrics::setListenerActiveConnections(size_t listener, double value) {
+    listeners_[listener].active_connections->Set(value);
+}
+
+void BrokerMetrics::incrementListenerBytesReceived(size_t listener, double bytes) {
+    shards_->addListenerBytesReceived(listener, static_cast<uint64_t>(bytes));
+}
+
+void BrokerMetrics::incrementListenerBytesSent(size_t listener, double bytes) {
+    shards_->addListenerBytesSent(listener, static_cast<uint64_t>(bytes));
+}
+
+size_t BrokerMetrics::addArena(const std::string& arena, int node) {
+    prometheus::Labels labels{{"arena", arena}, {"node", std::to_string(node)}};
+    arenas_.push_back(ArenaSeries{
+        &arena_mapped_family_->Add(labels),
+        &arena_allocated_family_->Add(labels)
+    });
+    return arenas_.size() - 1;
+}
+
+void BrokerMetrics::setArenaBytes(size_t arena, double mapped, double allocated) {
+    arenas_[arena].mapped->Set(mapped);
+    arenas_[arena].allocated->Set(allocated);
+}
+
+void BrokerMetrics::observeWalCommit(double records, double bytes, double seconds, bool ok) {
+    if (!ok) {
+        wal_commits_failed_->Increment();
+        return;
+    }
+    wal_commits_ok_->Increment();
+    wal_records_->Increment(records);
+    wal_bytes_->Increment(bytes);
+    wal_commit_records_->Observe(records);
+    wal_commit_seconds_->Observe(seconds);
+}
+
+void BrokerMetrics::incrementRetainedExpired(double messages, double bytes) {
+    retained_expired_->Increment(messages);
+    retained_expired_bytes_->Increment(bytes);
+}
+
+void BrokerMetrics::incrementQueuedExpired(double messages, double bytes) {
+    queued_expired_->Increment(messages);
+    queued_expired_bytes_->Increment(bytes);
+}
+
+void BrokerMetrics::incrementTlsHandshakes(double full, double resumed, double failed) {
+    tls_handshakes_full_->Increment(full);
+    tls_handshakes_resumed_->Increment(resumed);
+    tls_handshakes_failed_->Increment(failed);
+}
+
+void BrokerMetrics::incrementKtlsConnections(double send, double receive) {
+    ktls_send_->Increment(send);
+    ktls_receive_->Increment(receive);
+}
+
+void BrokerMetrics::setTopTalkers(TopTalkers kind, const std::vector<std::pair<std::string, double>>& rates) {
+    TopTalkerSeries& series = top_talkers_[static_cast<size_t>(kind)];
+    const char* label = kind == TopTalkers::TOPIC_MESSAGES || kind == TopTalkers::TOPIC_BYTES ? "topic_prefix" : "client_id";
+    
+    std::unordered_map<std::string, prometheus::Gauge*> ranked;
+    for (const auto& [key, rate] : rates) {
+        auto it = series.gauges.find(key);
+        prometheus::Gauge* gauge;
+        if (it != series.gauges.end()) {
+            gauge = it->second;
+            series.gauges.erase(it);
+        } else {
+            gauge = &series.family->Add({{label, key}});
+        }
+        gauge->Set(rate);
+        ranked.emplace(key, gauge);
+    }
+    
+    // Whatever is left dropped out of the ranking
+    for (const auto& [key, gauge] : series.gauges) {
+        series.family->Remove(gauge);
+    }
+    series.gauges.swap(ranked);
+}
+
+void BrokerMetrics::removeClientMetrics(const std::string& client_id) {
+    auto it = client_messages_dropped_.find(client_id);
+    if (it != client_messages_dropped_.end()) {
+        client_messages_dropped_family_->Remove(it->second);
+        client_messages_dropped_.erase(it);
+    }
+}
+
 void BrokerMetrics::observeMessageSize(double size) {
-    message_size_->Observe(size);
+    shards_->observeMessageSize(static_cast<uint64_t>(size));
 }
 
 } // namespace mqtt
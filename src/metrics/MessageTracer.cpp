@@ -0,0 +1,171 @@
+#include "../../include/metrics/MessageTracer.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <unordered_map>
+
+namespace mqtt {
+
+namespace {
+
+constexpr size_t MESSAGE_SLOTS_DIVISOR = 4;  // Sampled messages produce at least this many events
+
+const char* stageName(TraceStage stage) {
+    switch (stage) {
+        case TraceStage::READ: return "read";
+        case TraceStage::DECODE: return "decode";
+        case TraceStage::MATCH: return "match";
+        case TraceStage::ENQUEUE: return "enqueue";
+        case TraceStage::WRITE: return "write";
+    }
+    return "unknown";
+}
+
+std::string escapeJson(const std::string& text) {
+    std::string escaped;
+    escaped.reserve(text.size());
+    for (unsigned char c : text) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += static_cast<char>(c);
+        } else if (c < 0x20) {
+            char code[8];
+            std::snprintf(code, sizeof(code), "\\u%04x", c);
+            escaped += code;
+        } else {
+            escaped += static_cast<char>(c);
+        }
+    }
+    return escaped;
+}
+
+std::string trackName(int track) {
+    return track < 0 ? "local" : "fd " + std::to_string(track);
+}
+
+// Chrome trace timestamps are microseconds
+void writeEvent(std::ofstream& out, bool& first, uint32_t trace, const std::string& name, char phase,
+                int64_t start_ns, int64_t end_ns) {
+    out << (first ? "\n" : ",\n");
+    first = false;
+    out << "{\"name\":\"" << escapeJson(name) << "\",\"ph\":\"" << phase << "\",\"pid\":1,\"tid\":" << trace
+        << ",\"ts\":" << static_cast<double>(start_ns) / 1000.0;
+    if (phase == 'X') {
+        out << ",\"dur\":" << static_cast<double>(end_ns - start_ns) / 1000.0;
+    } else {
+        out << ",\"s\":\"t\"";
+    }
+    out << "}";
+}
+
+} // namespace
+
+MessageTracer::MessageTracer(size_t sample_rate, size_t capacity)
+    : sampleRate_(sample_rate), sinceSample_(0), nextTrace_(0), epoch_(Clock::now()),
+      next_(0), wrapped_(false), nextMessage_(0) {
+    if (sampleRate_ > 0) {
+        events_.resize(std::max<size_t>(capacity, 1));
+        messages_.resize(std::max<size_t>(capacity / MESSAGE_SLOTS_DIVISOR, 1));
+    }
+}
+
+void MessageTracer::describe(uint32_t trace, const std::string& client_id, const std::string& topic) {
+    Message& message = messages_[nextMessage_];
+    message.trace = trace;
+    message.client_id = client_id;
+    message.topic = topic;
+    nextMessage_ = (nextMessage_ + 1) % messages_.size();
+}
+
+MessageTracer::Snapshot MessageTracer::snapshot() const {
+    Snapshot snapshot;
+    if (wrapped_) {
+        snapshot.events.assign(events_.begin() + static_cast<std::ptrdiff_t>(next_), events_.end());
+    }
+    snapshot.events.insert(snapshot.events.end(), events_.begin(), events_.begin() + static_cast<std::ptrdiff_t>(next_));
+    for (const Message& message : messages_) {
+        if (message.trace != 0) {
+            snapshot.messages.push_back(message);
+        }
+    }
+    return snapshot;
+}
+
+bool MessageTracer::writeChromeTrace(const Snapshot& snapshot, const std::string& path) {
+    std::ofstream out(path, std::ios::trunc);
+    if (!out) {
+        return false;
+    }
+    
+    // Events of one message, in recording order
+    std::map<uint32_t, std::vector<const Event*>> traces;
+    for (const Event& event : snapshot.events) {
+        traces[event.trace].push_back(&event);
+    }
+    std::unordered_map<uint32_t, const Message*> messages;
+    for (const Message& message : snapshot.messages) {
+        messages[message.trace] = &message;
+    }
+    
+    // One row per sampled message, each stage a slice from the stage before it
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    for (const auto& [trace, events] : traces) {
+        std::string label = "publish " + std::to_string(trace);
+        auto described = messages.find(trace);
+        if (described != messages.end()) {
+            label += " " + described->second->client_id + " -> " + described->second->topic;
+        }
+        out << (first ? "\n" : ",\n");
+        first = false;
+        out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << trace
+            << ",\"args\":{\"name\":\"" << escapeJson(label) << "\"}}";
+        
+        const Event* read = nullptr;
+        const Event* decode = nullptr;
+        const Event* match = nullptr;
+        std::unordered_map<int, const Event*> enqueued;
+        for (const Event* event : events) {
+            const Event* previous = nullptr;
+            std::string name = stageName(event->stage);
+            switch (event->stage) {
+                case TraceStage::READ:
+                    read = event;
+                    break;
+                case TraceStage::DECODE:
+                    decode = event;
+                    previous = read;
+                    break;
+                case TraceStage::MATCH:
+                    match = event;
+                    previous = decode;
+                    break;
+                case TraceStage::ENQUEUE:
+                    enqueued[event->track] = event;
+                    previous = match;
+                    name += " " + trackName(event->track);
+                    break;
+                case TraceStage::WRITE: {
+                    auto it = enqueued.find(event->track);
+                    previous = it == enqueued.end() ? nullptr : it->second;
+                    name += " " + trackName(event->track);
+                    break;
+                }
+            }
+            if (event->stage == TraceStage::READ) {
+                continue;  // Starts the first slice
+            }
+            if (previous) {
+                writeEvent(out, first, trace, name, 'X', previous->time_ns, event->time_ns);
+            } else {
+                // The earlier stage was already overwritten in the ring
+                writeEvent(out, first, trace, name, 'i', event->time_ns, event->time_ns);
+            }
+        }
+    }
+    out << "\n]}\n";
+    return static_cast<bool>(out);
+}
+
+} // namespace mqtt
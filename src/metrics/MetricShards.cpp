@@ -0,0 +1,141 @@
+#include "../../include/metrics/MetricShards.h"
+#include <algorithm>
+#include <limits>
+
+namespace mqtt {
+
+namespace {
+    std::atomic<uint64_t> nextInstanceId{1};
+
+    prometheus::MetricFamily makeFamily(const std::string& name, const std::string& help, prometheus::MetricType type) {
+        prometheus::MetricFamily family;
+        family.name = name;
+        family.help = help;
+        family.type = type;
+        return family;
+    }
+
+    prometheus::ClientMetric makeCounter(double value, std::vector<prometheus::ClientMetric::Label> labels = {}) {
+        prometheus::ClientMetric metric;
+        metric.label = std::move(labels);
+        metric.counter.value = value;
+        return metric;
+    }
+}
+
+MetricShards::MetricShards()
+    : id_(nextInstanceId.fetch_add(1)) {
+}
+
+MetricShards::Shard& MetricShards::attach() {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // Shards outlive their thread, counters must never go backwards
+    std::thread::id self = std::this_thread::get_id();
+    for (auto& [thread, shard] : shards_) {
+        if (thread == self) {
+            return *shard;
+        }
+    }
+    shards_.emplace_back(self, std::make_unique<Shard>());
+    return *shards_.back().second;
+}
+
+void MetricShards::addListenerBytesReceived(size_t listener, uint64_t bytes) {
+    if (listener < MAX_LISTENERS) {
+        bump(shard().listener_bytes_received[listener], bytes);
+    }
+}
+
+void MetricShards::addListenerBytesSent(size_t listener, uint64_t bytes) {
+    if (listener < MAX_LISTENERS) {
+        bump(shard().listener_bytes_sent[listener], bytes);
+    }
+}
+
+void MetricShards::observeMessageSize(uint64_t size) {
+    Shard& local = shard();
+    size_t bucket = std::lower_bound(SIZE_BOUNDS.begin(), SIZE_BOUNDS.end(), size) - SIZE_BOUNDS.begin();
+    bump(local.size_buckets[bucket], 1);
+    bump(local.size_sum, size);
+}
+
+bool MetricShards::addListener(size_t listener, const std::string& label) {
+    if (listener >= MAX_LISTENERS) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (listeners_.size() <= listener) {
+        listeners_.resize(listener + 1);
+    }
+    listeners_[listener] = label;
+    return true;
+}
+
+std::vector<prometheus::MetricFamily> MetricShards::Collect() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto total = [this](auto slot) {
+        uint64_t value = 0;
+        for (const auto& entry : shards_) {
+            value += slot(*entry.second).load(std::memory_order_relaxed);
+        }
+        return value;
+    };
+
+    std::vector<prometheus::MetricFamily> families;
+    families.reserve(COUNTER_COUNT + 3);
+
+    struct CounterInfo {
+        Counter counter;
+        const char* name;
+        const char* help;
+    };
+    static const CounterInfo counters[] = {
+        {MESSAGES_PUBLISHED, "mqtt_messages_published_total", "Total number of messages published"},
+        {MESSAGES_RECEIVED, "mqtt_messages_received_total", "Total number of messages received"},
+        {BYTES_RECEIVED, "mqtt_bytes_received_total", "Total number of bytes received"},
+        {BYTES_SENT, "mqtt_bytes_sent_total", "Total number of bytes sent"},
+    };
+    for (const CounterInfo& info : counters) {
+        auto family = makeFamily(info.name, info.help, prometheus::MetricType::Counter);
+        uint64_t value = total([&](const Shard& shard) -> const Slot& { return shard.counters[info.counter]; });
+        family.metric.push_back(makeCounter(static_cast<double>(value)));
+        families.push_back(std::move(family));
+    }
+
+    auto received = makeFamily("mqtt_listener_bytes_received_total", "Total number of bytes received, by listener",
+                               prometheus::MetricType::Counter);
+    auto sent = makeFamily("mqtt_listener_bytes_sent_total", "Total number of bytes sent, by listener",
+                           prometheus::MetricType::Counter);
+    for (size_t i = 0; i < listeners_.size(); ++i) {
+        uint64_t in = total([i](const Shard& shard) -> const Slot& { return shard.listener_bytes_received[i]; });
+        uint64_t out = total([i](const Shard& shard) -> const Slot& { return shard.listener_bytes_sent[i]; });
+        received.metric.push_back(makeCounter(static_cast<double>(in), {{"listener", listeners_[i]}}));
+        sent.metric.push_back(makeCounter(static_cast<double>(out), {{"listener", listeners_[i]}}));
+    }
+    families.push_back(std::move(received));
+    families.push_back(std::move(sent));
+
+    // Histogram buckets are kept per bucket and made cumulative here
+    auto sizes = makeFamily("mqtt_message_size_bytes", "Distribution of message sizes in bytes",
+                            prometheus::MetricType::Histogram);
+    prometheus::ClientMetric histogram;
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i <= SIZE_BOUNDS.size(); ++i) {
+        cumulative += total([i](const Shard& shard) -> const Slot& { return shard.size_buckets[i]; });
+        prometheus::ClientMetric::Bucket bucket;
+        bucket.cumulative_count = cumulative;
+        bucket.upper_bound = i < SIZE_BOUNDS.size() ? static_cast<double>(SIZE_BOUNDS[i])
+                                                    : std::numeric_limits<double>::infinity();
+        histogram.histogram.bucket.push_back(bucket);
+    }
+    histogram.histogram.sample_count = cumulative;
+    histogram.histogram.sample_sum = static_cast<double>(total([](const Shard& shard) -> const Slot& { return shard.size_sum; }));
+    sizes.metric.push_back(std::move(histogram));
+    families.push_back(std::move(sizes));
+
+    return families;
+}
+
+} // namespace mqtt
@@ -0,0 +1,131 @@
+#ifndef CONTROL_FRAMES_H
+#define CONTROL_FRAMES_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include "MqttPacket.h"
+
+namespace mqtt {
+
+// Encoders for the small control packets sent on every ping and acknowledgement.
+// They produce the same bytes as PacketFactory, but into std::array values that are
+// computed at compile time or built on the stack, so sending one needs no heap memory.
+namespace ControlFrames {
+    constexpr uint8_t fixedHeader(PacketType type) {
+        return static_cast<uint8_t>(static_cast<uint8_t>(type) << 4);
+    }
+    
+    // PINGRESP never changes
+    constexpr std::array<uint8_t, 2> PINGRESP = {fixedHeader(PacketType::PINGRESP), 0x00};
+    
+    // Packet identifier, reason code and an empty property list
+    constexpr std::array<uint8_t, 6> puback(uint16_t packet_id, uint8_t reason_code) {
+        return {fixedHeader(PacketType::PUBACK), 0x04,
+                static_cast<uint8_t>(packet_id >> 8), static_cast<uint8_t>(packet_id & 0xFF),
+                reason_code, 0x00};
+    }
+    
+    constexpr std::array<uint8_t, 4> disconnect(uint8_t reason_code) {
+        return {fixedHeader(PacketType::DISCONNECT), 0x02, reason_code, 0x00};
+    }
+    
+    // Frame of bounded size built on the stack
+    template <size_t Capacity>
+    class StackFrame {
+    public:
+        constexpr const uint8_t* data() const { return bytes_.data(); }
+        constexpr size_t size() const { return size_; }
+        constexpr size_t capacity() const { return Capacity; }
+        
+        constexpr void append(uint8_t byte) { bytes_[size_++] = byte; }
+        constexpr void appendUint16(uint16_t value) {
+            append(static_cast<uint8_t>(value >> 8));
+            append(static_cast<uint8_t>(value & 0xFF));
+        }
+        constexpr void appendUint32(uint32_t value) {
+            appendUint16(static_cast<uint16_t>(value >> 16));
+            appendUint16(static_cast<uint16_t>(value & 0xFFFF));
+        }
+        constexpr void appendVariableByteInteger(uint32_t value) {
+            do {
+                uint8_t encoded = value % 128;
+                value /= 128;
+                append(value > 0 ? (encoded | 0x80) : encoded);
+            } while (value > 0);
+        }
+        // Overwrite a byte written earlier, for lengths known only at the end
+        constexpr void patch(size_t index, uint8_t byte) { bytes_[index] = byte; }
+    
+    private:
+        std::array<uint8_t, Capacity> bytes_{};
+        size_t size_ = 0;
+    };
+    
+    // CONNACK with room for the properties the broker advertises. Lengths stay below 128,
+    // so the remaining length and property length are single bytes patched as properties are added.
+    class Connack {
+    public:
+        constexpr Connack(uint8_t session_present, uint8_t reason_code) {
+            frame_.append(fixedHeader(PacketType::CONNACK));
+            frame_.append(0x03);
+            frame_.append(session_present & 0x01);
+            frame_.append(reason_code);
+            frame_.append(0x00);  // Property Length
+        }
+        
+        constexpr void propertyUint16(uint8_t id, uint16_t value) {
+            frame_.append(id);
+            frame_.appendUint16(value);
+            updateLengths();
+        }
+        constexpr void propertyUint32(uint8_t id, uint32_t value) {
+            frame_.append(id);
+            frame_.appendUint32(value);
+            updateLengths();
+        }
+        
+        constexpr const uint8_t* data() const { return frame_.data(); }
+        constexpr size_t size() const { return frame_.size(); }
+    
+    private:
+        static constexpr size_t HEADER = 5;  // Fixed header, flags, reason code, property length
+        
+        constexpr void updateLengths() {
+            frame_.patch(1, static_cast<uint8_t>(frame_.size() - 2));
+            frame_.patch(4, static_cast<uint8_t>(frame_.size() - HEADER));
+        }
+        
+        StackFrame<HEADER + 64> frame_;
+    };
+    
+    // SUBACK or UNSUBACK: packet identifier, empty properties, one reason code per filter.
+    // Returns false when the codes don't fit, the caller then falls back to PacketFactory.
+    template <size_t Capacity>
+    constexpr bool subscriptionAck(PacketType type, uint16_t packet_id, const uint8_t* codes, size_t count,
+                                   StackFrame<Capacity>& frame) {
+        uint32_t remaining = static_cast<uint32_t>(3 + count);
+        size_t lengthBytes = remaining < 128 ? 1 : remaining < 16384 ? 2 : 3;
+        if (1 + lengthBytes + remaining > Capacity) {
+            return false;
+        }
+        frame.append(fixedHeader(type));
+        frame.appendVariableByteInteger(remaining);
+        frame.appendUint16(packet_id);
+        frame.append(0x00);  // Property Length
+        for (size_t i = 0; i < count; ++i) {
+            frame.append(codes[i]);
+        }
+        return true;
+    }
+    
+    // Wire shapes, checked against the protocol at compile time
+    static_assert(PINGRESP[0] == 0xD0 && PINGRESP[1] == 0x00, "PINGRESP is two bytes");
+    static_assert(puback(0x1234, 0)[0] == 0x40 && puback(0x1234, 0)[2] == 0x12 && puback(0x1234, 0)[3] == 0x34,
+                  "PUBACK carries the packet identifier big-endian");
+    static_assert(disconnect(0x8E)[0] == 0xE0 && disconnect(0x8E)[2] == 0x8E, "DISCONNECT carries the reason code");
+}
+
+} // namespace mqtt
+
+#endif // CONTROL_FRAMES_H
@@ -1,4 +1,5 @@
 #include "MqttPacket.h"
+#include "Utf8Validator.h"
 #include <stdexcept>
 #include <cstring>
 
@@ -109,7 +110,9 @@ uint32_t MqttPacket::decode_remaining_length(const std::vector<uint8_t>& buffer,
 }
 
 std::vector<uint8_t> MqttPacket::serialize() const {
+    // Sized once, fixed header plus at most four remaining length bytes
     std::vector<uint8_t> buffer;
+    buffer.reserve(5 + payload.size());
     
     // Encode fixed header (first byte)
     uint8_t first_byte = (static_cast<uint8_t>(header.packet_type) << 4) |
@@ -119,8 +122,7 @@ std::vector<uint8_t> MqttPacket::serialize() const {
     buffer.push_back(first_byte);
     
     // Encode remaining length
-    std::vector<uint8_t> remaining_length_bytes = encode_remaining_length(payload.size());
-    buffer.insert(buffer.end(), remaining_length_bytes.begin(), remaining_length_bytes.end());
+    write_variable_byte_integer(buffer, static_cast<uint32_t>(payload.size()));
     
     // Add payload
     buffer.insert(buffer.end(), payload.begin(), payload.end());
@@ -141,24 +143,46 @@ std::vector<uint8_t> MqttPacket::encode_remaining_length(uint32_t length) {
         
         result.push_back(encoded_byte);
     } while (length > 0 );
-
-
+    
+    
     
     return result;
 }
 
 
 uint16_t MqttPacket::read_uint16(const std::vector<uint8_t>& data, size_t& index) {
-
+    if (index + 2 > data.size()) {
+        throw std::runtime_error("Cannot read uint16: buffer too small");
+    }
     uint16_t value = (static_cast<uint16_t>(data[index]) << 8) | data[index + 1];
     index += 2;
     return value;
 }
 
+uint32_t MqttPacket::read_uint32(const std::vector<uint8_t>& data, size_t& index) {
+    if (index + 4 > data.size()) {
+        throw std::runtime_error("Cannot read uint32: buffer too small");
+    }
+    uint32_t high = read_uint16(data, index);
+    return (high << 16) | read_uint16(data, index);
+}
+
 // Read UTF-8 string, reads length prefix first, then the string data
 std::string MqttPacket::read_utf8_string(const std::vector<uint8_t>& data, size_t& index) {
-    uint16_t length = read_uint16(data, index);
+    size_t start = index + 2;
+    std::string result = read_binary_data(data, index);
+    if (!Utf8::isValid(data.data() + start, result.size())) {
+        throw std::runtime_error("Malformed UTF-8 string");
+    }
+    return result;
+}
 
+std::string MqttPacket::read_binary_data(const std::vector<uint8_t>& data, size_t& index) {
+    uint16_t length = read_uint16(data, index);
+    if (index + length > data.size()) {
+        throw std::runtime_error("String exceeds the packet");
+    }
+    
     std::string result(data.begin() + index, data.begin() + index + length);
     index += length;
     return result;
@@ -199,6 +223,11 @@ void MqttPacket::write_uint16(std::vector<uint8_t>& data, uint16_t value) {
     data.push_back(static_cast<uint8_t>(value & 0xFF));
 }
 
+void MqttPacket::write_uint32(std::vector<uint8_t>& data, uint32_t value) {
+    write_uint16(data, static_cast<uint16_t>(value >> 16));
+    write_uint16(data, static_cast<uint16_t>(value & 0xFFFF));
+}
+
 void MqttPacket::write_utf8_string(std::vector<uint8_t>& data, const std::string& str) {
     write_uint16(data, static_cast<uint16_t>(str.length()));
     data.insert(data.end(), str.begin(), str.end());
@@ -259,7 +288,7 @@ ConnectPacket ConnectPacket::parse(const MqttPacket& packet) {
         }
         
         connect.will_topic = MqttPacket::read_utf8_string(payload, index);
-        connect.will_message = MqttPacket::read_utf8_string(payload, index);
+        connect.will_message = MqttPacket::read_binary_data(payload, index);  // Will payload, any bytes
     }
     
     // Username (if username flag is set)
@@ -269,12 +298,65 @@ ConnectPacket ConnectPacket::parse(const MqttPacket& packet) {
     
     // Password (if password flag is set)
     if (connect.connect_flags & 0x40) { // Password flag - bit 6
-        connect.password = MqttPacket::read_utf8_string(payload, index);
+        connect.password = MqttPacket::read_binary_data(payload, index);  // Binary Data in MQTT 5
     }
     
     return connect;
 }
 
+uint32_t findMessageExpiry(const uint8_t* properties, size_t length) {
+    size_t index = 0;
+    while (index < length) {
+        uint8_t id = properties[index++];
+        size_t size;
+        switch (id) {
+            case 0x02: {  // Message Expiry Interval
+                if (index + 4 > length) {
+                    return 0;
+                }
+                return (static_cast<uint32_t>(properties[index]) << 24) |
+                       (static_cast<uint32_t>(properties[index + 1]) << 16) |
+                       (static_cast<uint32_t>(properties[index + 2]) << 8) | properties[index + 3];
+            }
+            case 0x01:  // Payload Format Indicator
+                size = 1;
+                break;
+            case 0x23:  // Topic Alias
+                size = 2;
+                break;
+            case 0x0B:  // Subscription Identifier, a variable byte integer
+                size = 1;
+                while (index + size <= length && (properties[index + size - 1] & 0x80) && size < 4) {
+                    ++size;
+                }
+                break;
+            case 0x03:  // Content Type
+            case 0x08:  // Response Topic
+            case 0x09:  // Correlation Data
+                if (index + 2 > length) {
+                    return 0;
+                }
+                size = 2 + ((static_cast<size_t>(properties[index]) << 8) | properties[index + 1]);
+                break;
+            case 0x26: {  // User Property, a string pair
+                if (index + 2 > length) {
+                    return 0;
+                }
+                size_t name = 2 + ((static_cast<size_t>(properties[index]) << 8) | properties[index + 1]);
+                if (index + name + 2 > length) {
+                    return 0;
+                }
+                size = name + 2 + ((static_cast<size_t>(properties[index + name]) << 8) | properties[index + name + 1]);
+                break;
+            }
+            default:
+                return 0;
+        }
+        index += size;
+    }
+    return 0;
+}
+
 PublishPacket PublishPacket::parse(const MqttPacket& packet) {
     PublishPacket publish;
     const auto& payload = packet.get_payload();
@@ -301,7 +383,9 @@ PublishPacket PublishPacket::parse(const MqttPacket& packet) {
             index = prop_start;
             prop_length = 0;
         } else {
-            index += prop_length;  // Skip properties for MQTT 5.0
+            // Only the expiry matters for forwarding, the other properties are skipped
+            publish.message_expiry = findMessageExpiry(payload.data() + index, prop_length);
+            index += prop_length;
         }
     }
     
@@ -313,6 +397,85 @@ PublishPacket PublishPacket::parse(const MqttPacket& packet) {
     return publish;
 }
 
+bool PublishHeader::parse(const uint8_t* data, size_t available, PublishHeader& header) {
+    size_t index = 0;
+    
+    // Reads a variable byte integer, false if it is cut off
+    auto readVarint = [&](uint32_t& value) {
+        value = 0;
+        for (uint32_t shift = 0; ; shift += 7) {
+            if (index >= available) {
+                return false;
+            }
+            if (shift > 21) {
+                throw std::runtime_error("Malformed variable byte integer");
+            }
+            uint8_t encoded = data[index++];
+            value |= static_cast<uint32_t>(encoded & 0x7F) << shift;
+            if ((encoded & 0x80) == 0) {
+                return true;
+            }
+        }
+    };
+    
+    if (available < 1) {
+        return false;
+    }
+    uint8_t flags = data[index++];
+    if (static_cast<PacketType>(flags >> 4) != PacketType::PUBLISH) {
+        throw std::runtime_error("Not a PUBLISH packet");
+    }
+    header.qos = static_cast<QoSLevel>((flags >> 1) & 0x03);
+    header.retain = (flags & 0x01) != 0;
+    
+    uint32_t remaining = 0;
+    if (!readVarint(remaining)) {
+        return false;
+    }
+    size_t packet_end = index + remaining;
+    
+    if (available < index + 2) {
+        return false;
+    }
+    size_t topic_length = (static_cast<size_t>(data[index]) << 8) | data[index + 1];
+    index += 2;
+    if (available < index + topic_length) {
+        return false;
+    }
+    if (!Utf8::isValid(data + index, topic_length)) {
+        throw std::runtime_error("Malformed UTF-8 string");
+    }
+    header.topic_name.assign(reinterpret_cast<const char*>(data + index), topic_length);
+    index += topic_length;
+    
+    if (header.qos != QoSLevel::AT_MOST_ONCE) {
+        if (available < index + 2) {
+            return false;
+        }
+        header.packet_identifier = static_cast<uint16_t>((data[index] << 8) | data[index + 1]);
+        index += 2;
+    }
+    
+    // Only the expiry is read from the properties, same as PublishPacket::parse
+    uint32_t prop_length = 0;
+    if (!readVarint(prop_length)) {
+        return false;
+    }
+    size_t prop_start = index;
+    index += prop_length;
+    if (index > packet_end) {
+        throw std::runtime_error("PUBLISH header longer than the packet");
+    }
+    if (available < index) {
+        return false;
+    }
+    header.message_expiry = findMessageExpiry(data + prop_start, prop_length);
+    
+    header.header_length = index;
+    header.payload_length = packet_end - index;
+    return true;
+}
+
 SubscribePacket SubscribePacket::parse(const MqttPacket& packet) {
     SubscribePacket subscribe;
     const auto& payload = packet.get_payload();
@@ -356,7 +519,8 @@ UnsubscribePacket UnsubscribePacket::parse(const MqttPacket& packet) {
 
 namespace PacketFactory {
 
-MqttPacket create_connack(uint8_t session_present, uint8_t reason_code) {
+MqttPacket create_connack(uint8_t session_present, uint8_t reason_code,
+                          const std::vector<uint8_t>& properties) {
     MqttPacket packet;
     
     Header header;
@@ -365,14 +529,15 @@ MqttPacket create_connack(uint8_t session_present, uint8_t reason_code) {
     std::vector<uint8_t> payload;
     payload.push_back(session_present & 0x01);  // Connect Acknowledge Flags
     payload.push_back(reason_code);             // Reason Code
-    payload.push_back(0);                       // Property Length = 0 (no properties)
+    MqttPacket::write_variable_byte_integer(payload, properties.size());  // Property Length
+    payload.insert(payload.end(), properties.begin(), properties.end());
     
     packet.set_header(header).set_payload(payload);
     return packet;
 }
 
 MqttPacket create_publish(const std::string& topic, const std::vector<uint8_t>& message,
-                          QoSLevel qos, bool retain, uint16_t packet_id) {
+                          QoSLevel qos, bool retain, uint16_t packet_id, uint32_t message_expiry) {
     MqttPacket packet;
     
     Header header;
@@ -388,7 +553,13 @@ MqttPacket create_publish(const std::string& topic, const std::vector<uint8_t>&
         MqttPacket::write_uint16(payload, packet_id);
     }
     
-    payload.push_back(0);  // Property Length = 0
+    if (message_expiry > 0) {
+        payload.push_back(5);     // Property Length
+        payload.push_back(0x02);  // Message Expiry Interval
+        MqttPacket::write_uint32(payload, message_expiry);
+    } else {
+        payload.push_back(0);  // Property Length = 0
+    }
     
     payload.insert(payload.end(), message.begin(), message.end()); // 
     
@@ -396,6 +567,31 @@ MqttPacket create_publish(const std::string& topic, const std::vector<uint8_t>&
     return packet;
 }
 
+std::vector<uint8_t> create_publish_header(const std::string& topic, size_t payload_length,
+                                           QoSLevel qos, bool retain, uint16_t packet_id,
+                                           uint32_t message_expiry) {
+    std::vector<uint8_t> variable;
+    MqttPacket::write_utf8_string(variable, topic);
+    if (qos != QoSLevel::AT_MOST_ONCE) {
+        MqttPacket::write_uint16(variable, packet_id);
+    }
+    if (message_expiry > 0) {
+        variable.push_back(5);     // Property Length
+        variable.push_back(0x02);  // Message Expiry Interval
+        MqttPacket::write_uint32(variable, message_expiry);
+    } else {
+        variable.push_back(0);  // Property Length = 0
+    }
+    
+    // Same bytes as create_publish() would put in front of the payload
+    std::vector<uint8_t> buffer;
+    buffer.push_back(static_cast<uint8_t>((static_cast<uint8_t>(PacketType::PUBLISH) << 4) |
+                                          (static_cast<uint8_t>(qos) << 1) | (retain ? 1 : 0)));
+    MqttPacket::write_variable_byte_integer(buffer, static_cast<uint32_t>(variable.size() + payload_length));
+    buffer.insert(buffer.end(), variable.begin(), variable.end());
+    return buffer;
+}
+
 MqttPacket create_puback(uint16_t packet_identifier, uint8_t reason_code) {
     MqttPacket packet;
     
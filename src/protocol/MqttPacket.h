@@ -67,13 +67,19 @@ public:
     static MqttPacket parse(const std::vector<uint8_t>& buffer);
 
     // Helper methods for reading from payload
+    // Integers in network byte order, throw when the data ends first
     static uint16_t read_uint16(const std::vector<uint8_t>& data, size_t& index);
+    static uint32_t read_uint32(const std::vector<uint8_t>& data, size_t& index);
+    // Throws on malformed UTF-8, which MQTT treats as a protocol error
     static std::string read_utf8_string(const std::vector<uint8_t>& data, size_t& index);
+    // Two byte length prefixed bytes without any encoding, e.g. passwords
+    static std::string read_binary_data(const std::vector<uint8_t>& data, size_t& index);
     static uint8_t read_byte(const std::vector<uint8_t>& data, size_t& index);
     static uint32_t read_variable_byte_integer(const std::vector<uint8_t>& data, size_t& index);
     
     // Helper methods for writing to payload
     static void write_uint16(std::vector<uint8_t>& data, uint16_t value);
+    static void write_uint32(std::vector<uint8_t>& data, uint32_t value);
     static void write_utf8_string(std::vector<uint8_t>& data, const std::string& str);
     static void write_byte(std::vector<uint8_t>& data, uint8_t value);
     static void write_variable_byte_integer(std::vector<uint8_t>& data, uint32_t value);
@@ -109,10 +115,29 @@ struct PublishPacket {
     uint16_t packet_identifier;  // Only for QoS > 0
     std::vector<uint8_t> message;
     std::map<uint8_t, std::vector<uint8_t>> properties;
+    uint32_t message_expiry = 0;  // Message Expiry Interval in seconds, 0 = none
     
     static PublishPacket parse(const MqttPacket& packet);
 };
 
+// Everything of a PUBLISH up to the payload, so the payload can be forwarded as it arrives
+struct PublishHeader {
+    QoSLevel qos = QoSLevel::AT_MOST_ONCE;
+    bool retain = false;
+    std::string topic_name;
+    uint16_t packet_identifier = 0;  // Only for QoS > 0
+    size_t header_length = 0;        // Fixed header, variable header and properties
+    size_t payload_length = 0;
+    uint32_t message_expiry = 0;     // Message Expiry Interval in seconds, 0 = none
+    
+    // Parse from the start of the packet. Returns false until the header has fully arrived.
+    static bool parse(const uint8_t* data, size_t available, PublishHeader& header);
+};
+
+// Message Expiry Interval (0x02) in a PUBLISH property list, 0 when absent. Stops at the
+// first property it does not know; a zero interval counts as absent.
+uint32_t findMessageExpiry(const uint8_t* properties, size_t length);
+
 struct SubscribePacket {
     uint16_t packet_identifier;
     std::vector<std::pair<std::string, uint8_t>> topic_filters;  // topic, qos
@@ -131,9 +156,15 @@ struct UnsubscribePacket {
 
 // Helper functions for creating response packets
 namespace PacketFactory {
-    MqttPacket create_connack(uint8_t session_present, uint8_t reason_code);
+    MqttPacket create_connack(uint8_t session_present, uint8_t reason_code,
+                              const std::vector<uint8_t>& properties = {});
+    // A non-zero message_expiry is sent as the Message Expiry Interval property
     MqttPacket create_publish(const std::string& topic, const std::vector<uint8_t>& message, 
-                              QoSLevel qos, bool retain, uint16_t packet_id = 0);
+                              QoSLevel qos, bool retain, uint16_t packet_id = 0, uint32_t message_expiry = 0);
+    // Fixed and variable header of a PUBLISH, the payload_length bytes of payload follow separately
+    std::vector<uint8_t> create_publish_header(const std::string& topic, size_t payload_length,
+                                               QoSLevel qos, bool retain, uint16_t packet_id = 0,
+                                               uint32_t message_expiry = 0);
     MqttPacket create_puback(uint16_t packet_identifier, uint8_t reason_code = 0);
     MqttPacket create_suback(uint16_t packet_identifier, const std::vector<uint8_t>& reason_codes);
     MqttPacket create_unsuback(uint16_t packet_identifier, const std::vector<uint8_t>& reason_codes);
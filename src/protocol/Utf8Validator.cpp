@@ -0,0 +1,273 @@
+#include "Utf8Validator.h"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MQTT_UTF8_X86 1
+#endif
+
+namespace mqtt {
+
+namespace Utf8 {
+
+namespace {
+
+bool validateScalar(const uint8_t* data, size_t length) {
+    size_t i = 0;
+    while (i < length) {
+        uint8_t lead = data[i];
+        if (lead < 0x80) {
+            if (lead == 0) {
+                return false;
+            }
+            ++i;
+            continue;
+        }
+        
+        // Sequence length and the allowed range of the second byte, which rules out
+        // overlong forms, surrogates and code points above U+10FFFF
+        size_t count;
+        uint8_t low = 0x80;
+        uint8_t high = 0xBF;
+        if (lead >= 0xC2 && lead <= 0xDF) {
+            count = 2;
+        } else if (lead >= 0xE0 && lead <= 0xEF) {
+            count = 3;
+            if (lead == 0xE0) {
+                low = 0xA0;
+            } else if (lead == 0xED) {
+                high = 0x9F;
+            }
+        } else if (lead >= 0xF0 && lead <= 0xF4) {
+            count = 4;
+            if (lead == 0xF0) {
+                low = 0x90;
+            } else if (lead == 0xF4) {
+                high = 0x8F;
+            }
+        } else {
+            return false;
+        }
+        
+        if (length - i < count || data[i + 1] < low || data[i + 1] > high) {
+            return false;
+        }
+        for (size_t k = 2; k < count; ++k) {
+            if ((data[i + k] & 0xC0) != 0x80) {
+                return false;
+            }
+        }
+        i += count;
+    }
+    return true;
+}
+
+#ifdef MQTT_UTF8_X86
+
+// Lookup algorithm from Keiser and Lemire, "Validating UTF-8 In Less Than One Instruction
+// Per Byte". Each table maps a nibble to the error classes it can be part of; a byte pair
+// is invalid when the high and low nibble of the first byte and the high nibble of the
+// second byte all agree on a class.
+constexpr uint8_t TOO_SHORT = 1 << 0;       // Lead byte not followed by a continuation
+constexpr uint8_t TOO_LONG = 1 << 1;        // Continuation without a lead byte
+constexpr uint8_t OVERLONG_3 = 1 << 2;
+constexpr uint8_t TOO_LARGE = 1 << 3;       // Above U+10FFFF
+constexpr uint8_t SURROGATE = 1 << 4;
+constexpr uint8_t OVERLONG_2 = 1 << 5;
+constexpr uint8_t TOO_LARGE_1000 = 1 << 6;
+constexpr uint8_t OVERLONG_4 = 1 << 6;
+constexpr uint8_t TWO_CONTS = 1 << 7;       // Two continuations, valid only inside 3 and 4 byte forms
+constexpr uint8_t CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+alignas(16) constexpr uint8_t BYTE_1_HIGH[16] = {
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+    TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+    TOO_SHORT | OVERLONG_2,
+    TOO_SHORT,
+    TOO_SHORT | OVERLONG_3 | SURROGATE,
+    TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4,
+};
+
+alignas(16) constexpr uint8_t BYTE_1_LOW[16] = {
+    CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+    CARRY | OVERLONG_2,
+    CARRY,
+    CARRY,
+    CARRY | TOO_LARGE,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+};
+
+alignas(16) constexpr uint8_t BYTE_2_HIGH[16] = {
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+};
+
+// A block ending in these would need bytes from the next block to be complete
+alignas(32) constexpr uint8_t INCOMPLETE_MAX[32] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xEF, 0xDF, 0xBF,
+};
+
+// Filler for the last partial block, ASCII and not NUL
+constexpr uint8_t PADDING = ' ';
+
+__attribute__((target("sse4.1")))
+inline __m128i checkBlockSse(__m128i input, __m128i previous) {
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    __m128i prev1 = _mm_alignr_epi8(input, previous, 15);
+    __m128i byte1High = _mm_shuffle_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(BYTE_1_HIGH)),
+                                         _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+    __m128i byte1Low = _mm_shuffle_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(BYTE_1_LOW)),
+                                        _mm_and_si128(prev1, nibble));
+    __m128i byte2High = _mm_shuffle_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(BYTE_2_HIGH)),
+                                         _mm_and_si128(_mm_srli_epi16(input, 4), nibble));
+    __m128i special = _mm_and_si128(_mm_and_si128(byte1High, byte1Low), byte2High);
+    
+    // Third and fourth bytes of 3 and 4 byte forms must be continuations
+    __m128i prev2 = _mm_alignr_epi8(input, previous, 14);
+    __m128i prev3 = _mm_alignr_epi8(input, previous, 13);
+    __m128i must23 = _mm_or_si128(_mm_subs_epu8(prev2, _mm_set1_epi8(static_cast<char>(0xE0 - 0x80))),
+                                  _mm_subs_epu8(prev3, _mm_set1_epi8(static_cast<char>(0xF0 - 0x80))));
+    __m128i must23High = _mm_and_si128(must23, _mm_set1_epi8(static_cast<char>(0x80)));
+    return _mm_xor_si128(must23High, special);
+}
+
+__attribute__((target("sse4.1")))
+bool validateSse(const uint8_t* data, size_t length) {
+    const __m128i incompleteMax = _mm_loadu_si128(reinterpret_cast<const __m128i*>(INCOMPLETE_MAX + 16));
+    __m128i error = _mm_setzero_si128();
+    __m128i previous = _mm_setzero_si128();
+    __m128i previousIncomplete = _mm_setzero_si128();
+    
+    auto process = [&](__m128i input) __attribute__((target("sse4.1"))) {
+        error = _mm_or_si128(error, _mm_cmpeq_epi8(input, _mm_setzero_si128()));
+        if (_mm_movemask_epi8(input) == 0) {
+            // ASCII, only a sequence cut off at the end of the previous block can be wrong
+            error = _mm_or_si128(error, previousIncomplete);
+        } else {
+            error = _mm_or_si128(error, checkBlockSse(input, previous));
+            previousIncomplete = _mm_subs_epu8(input, incompleteMax);
+        }
+        previous = input;
+    };
+    
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        process(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)));
+    }
+    
+    // Always one padded block, which also catches a sequence truncated by the end of the data
+    alignas(16) uint8_t tail[16];
+    std::memset(tail, PADDING, sizeof(tail));
+    std::memcpy(tail, data + i, length - i);
+    process(_mm_load_si128(reinterpret_cast<const __m128i*>(tail)));
+    
+    return _mm_testz_si128(error, error) != 0;
+}
+
+__attribute__((target("avx2")))
+inline __m256i checkBlockAvx2(__m256i input, __m256i previous) {
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    // Bytes of the previous block shifted in ahead of this one
+    __m256i carried = _mm256_permute2x128_si256(previous, input, 0x21);
+    __m256i prev1 = _mm256_alignr_epi8(input, carried, 15);
+    __m256i byte1High = _mm256_shuffle_epi8(
+        _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(BYTE_1_HIGH))),
+        _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+    __m256i byte1Low = _mm256_shuffle_epi8(
+        _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(BYTE_1_LOW))),
+        _mm256_and_si256(prev1, nibble));
+    __m256i byte2High = _mm256_shuffle_epi8(
+        _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(BYTE_2_HIGH))),
+        _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble));
+    __m256i special = _mm256_and_si256(_mm256_and_si256(byte1High, byte1Low), byte2High);
+    
+    __m256i prev2 = _mm256_alignr_epi8(input, carried, 14);
+    __m256i prev3 = _mm256_alignr_epi8(input, carried, 13);
+    __m256i must23 = _mm256_or_si256(_mm256_subs_epu8(prev2, _mm256_set1_epi8(static_cast<char>(0xE0 - 0x80))),
+                                     _mm256_subs_epu8(prev3, _mm256_set1_epi8(static_cast<char>(0xF0 - 0x80))));
+    __m256i must23High = _mm256_and_si256(must23, _mm256_set1_epi8(static_cast<char>(0x80)));
+    return _mm256_xor_si256(must23High, special);
+}
+
+__attribute__((target("avx2")))
+bool validateAvx2(const uint8_t* data, size_t length) {
+    const __m256i incompleteMax = _mm256_load_si256(reinterpret_cast<const __m256i*>(INCOMPLETE_MAX));
+    __m256i error = _mm256_setzero_si256();
+    __m256i previous = _mm256_setzero_si256();
+    __m256i previousIncomplete = _mm256_setzero_si256();
+    
+    auto process = [&](__m256i input) __attribute__((target("avx2"))) {
+        error = _mm256_or_si256(error, _mm256_cmpeq_epi8(input, _mm256_setzero_si256()));
+        if (_mm256_movemask_epi8(input) == 0) {
+            error = _mm256_or_si256(error, previousIncomplete);
+        } else {
+            error = _mm256_or_si256(error, checkBlockAvx2(input, previous));
+            previousIncomplete = _mm256_subs_epu8(input, incompleteMax);
+        }
+        previous = input;
+    };
+    
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        process(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i)));
+    }
+    
+    alignas(32) uint8_t tail[32];
+    std::memset(tail, PADDING, sizeof(tail));
+    std::memcpy(tail, data + i, length - i);
+    process(_mm256_load_si256(reinterpret_cast<const __m256i*>(tail)));
+    
+    return _mm256_testz_si256(error, error) != 0;
+}
+
+#endif // MQTT_UTF8_X86
+
+} // namespace
+
+std::vector<Implementation> implementations() {
+    std::vector<Implementation> available;
+#ifdef MQTT_UTF8_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        available.push_back({validateAvx2, "avx2"});
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        available.push_back({validateSse, "sse4.1"});
+    }
+#endif
+    available.push_back({validateScalar, "scalar"});
+    return available;
+}
+
+namespace {
+
+const Implementation selected = implementations().front();
+
+} // namespace
+
+bool isValid(const uint8_t* data, size_t length) {
+    return selected.validate(data, length);
+}
+
+const char* implementation() {
+    return selected.name;
+}
+
+} // namespace Utf8
+
+} // namespace mqtt
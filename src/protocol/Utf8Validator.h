@@ -0,0 +1,30 @@
+#ifndef UTF8_VALIDATOR_H
+#define UTF8_VALIDATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace mqtt {
+
+// Well-formedness check for MQTT UTF-8 strings: no overlong forms, no surrogates,
+// nothing above U+10FFFF, and no U+0000. Vectorized with AVX2 or SSE4.1 when the
+// CPU has it, picked once at startup, with a scalar fallback everywhere else.
+namespace Utf8 {
+    bool isValid(const uint8_t* data, size_t length);
+    
+    // "avx2", "sse4.1" or "scalar"
+    const char* implementation();
+    
+    struct Implementation {
+        bool (*validate)(const uint8_t* data, size_t length);
+        const char* name;
+    };
+    
+    // Every implementation the CPU can run, best first, scalar last; isValid() uses the first
+    std::vector<Implementation> implementations();
+}
+
+} // namespace mqtt
+
+#endif // UTF8_VALIDATOR_H
@@ -0,0 +1,432 @@
+#include "WriteAheadLog.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+
+namespace mqtt {
+
+namespace {
+
+constexpr size_t FRAME_BYTES = 8;    // Length and CRC, ahead of what the CRC covers
+constexpr size_t HEADER_BYTES = 19;  // lsn, flags, expiry and topic length
+constexpr uint8_t FLAG_RETAIN = 0x04;  // Below it the QoS
+
+// CRC-32C (Castagnoli), reflected, table driven
+uint32_t crc32c(const uint8_t* data, size_t length) {
+    static const auto table = []() {
+        std::array<uint32_t, 256> entries{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+            }
+            entries[i] = crc;
+        }
+        return entries;
+    }();
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < length; ++i) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// Encodes a record with its CRC left blank, see sealRecords()
+void appendRecord(std::vector<uint8_t>& out, uint64_t lsn, const std::string& topic, const uint8_t* payload,
+                  size_t payload_length, uint8_t qos, bool retain, uint64_t expires_at) {
+    uint32_t length = static_cast<uint32_t>(HEADER_BYTES + topic.size() + payload_length);
+    uint8_t flags = static_cast<uint8_t>((qos & 0x03) | (retain ? FLAG_RETAIN : 0));
+    uint16_t topic_length = static_cast<uint16_t>(topic.size());
+    
+    size_t offset = out.size();
+    out.resize(offset + FRAME_BYTES + length);
+    uint8_t* p = out.data() + offset;
+    std::memcpy(p, &length, sizeof(length));
+    p += FRAME_BYTES;
+    std::memcpy(p, &lsn, sizeof(lsn));
+    p[8] = flags;
+    std::memcpy(p + 9, &expires_at, sizeof(expires_at));
+    std::memcpy(p + 17, &topic_length, sizeof(topic_length));
+    std::memcpy(p + HEADER_BYTES, topic.data(), topic.size());
+    if (payload_length > 0) {
+        std::memcpy(p + HEADER_BYTES + topic.size(), payload, payload_length);
+    }
+}
+
+// Fills in the CRCs of a run of encoded records
+void sealRecords(std::vector<uint8_t>& records) {
+    for (size_t offset = 0; offset < records.size();) {
+        uint32_t length;
+        std::memcpy(&length, records.data() + offset, sizeof(length));
+        uint32_t crc = crc32c(records.data() + offset + FRAME_BYTES, length);
+        std::memcpy(records.data() + offset + 4, &crc, sizeof(crc));
+        offset += FRAME_BYTES + length;
+    }
+}
+
+bool writeAll(int fd, const uint8_t* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        length -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Sequence number in "<lsn>.wal" or "retained-<lsn>.snapshot", false for anything else
+bool parseName(const std::string& name, const std::string& prefix, const std::string& suffix, uint64_t& lsn) {
+    if (name.size() <= prefix.size() + suffix.size() || name.compare(0, prefix.size(), prefix) != 0 ||
+        name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0) {
+        return false;
+    }
+    std::string digits = name.substr(prefix.size(), name.size() - prefix.size() - suffix.size());
+    if (digits.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+    }
+    lsn = std::stoull(digits);
+    return true;
+}
+
+} // namespace
+
+WalDurability parseWalDurability(const std::string& name) {
+    if (name == "fsync") {
+        return WalDurability::FSYNC;
+    }
+    if (name == "write") {
+        return WalDurability::WRITE;
+    }
+    if (name == "async") {
+        return WalDurability::ASYNC;
+    }
+    throw std::invalid_argument("Unknown WAL durability: " + name);
+}
+
+WriteAheadLog::WriteAheadLog(const Options& options, CommitHandler on_commit)
+    : options_(options), onCommit_(std::move(on_commit)), lastLsn_(0), snapshotWanted_(false), snapshots_(0),
+      segmentFd_(-1), segmentSize_(0), fullSinceSnapshot_(0), failed_(false), pendingFirstLsn_(0),
+      pendingRecords_(0), stopping_(false) {
+    std::error_code error;
+    std::filesystem::create_directories(options_.directory, error);
+    if (error) {
+        throw std::runtime_error("Cannot create WAL directory " + options_.directory + ": " + error.message());
+    }
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    if (thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_one();
+        thread_.join();
+    }
+    if (segmentFd_ >= 0) {
+        if (options_.durability == WalDurability::WRITE) {
+            fdatasync(segmentFd_);
+        }
+        close(segmentFd_);
+    }
+}
+
+std::string WriteAheadLog::segmentPath(uint64_t first_lsn) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%020llu.wal", static_cast<unsigned long long>(first_lsn));
+    return options_.directory + "/" + name;
+}
+
+std::string WriteAheadLog::snapshotPath(uint64_t lsn) const {
+    char name[48];
+    std::snprintf(name, sizeof(name), "retained-%020llu.snapshot", static_cast<unsigned long long>(lsn));
+    return options_.directory + "/" + name;
+}
+
+size_t WriteAheadLog::recover(const std::function<void(const Record&)>& replay) {
+    std::vector<std::pair<uint64_t, std::string>> snapshots;
+    std::vector<std::pair<uint64_t, std::string>> segments;
+    for (const auto& entry : std::filesystem::directory_iterator(options_.directory)) {
+        std::string name = entry.path().filename().string();
+        uint64_t lsn;
+        if (parseName(name, "retained-", ".snapshot", lsn)) {
+            snapshots.emplace_back(lsn, entry.path().string());
+        } else if (parseName(name, "", ".wal", lsn)) {
+            segments.emplace_back(lsn, entry.path().string());
+        } else if (name.size() > 4 && name.compare(name.size() - 4, 4, ".tmp") == 0) {
+            std::filesystem::remove(entry.path());  // Snapshot interrupted before its rename
+        }
+    }
+    std::sort(snapshots.begin(), snapshots.end());
+    std::sort(segments.begin(), segments.end());
+    
+    // The newest snapshot supersedes the others, which only survive a crash right after it was written
+    uint64_t snapshot_lsn = 0;
+    size_t records = 0;
+    if (!snapshots.empty()) {
+        snapshot_lsn = snapshots.back().first;
+        snapshotFile_ = snapshots.back().second;
+        snapshots.pop_back();
+        for (const auto& [lsn, path] : snapshots) {
+            std::filesystem::remove(path);
+        }
+        uint64_t last_lsn = 0;
+        replayFile(snapshotFile_, 0, false, replay, last_lsn, records);
+    }
+    
+    lastLsn_ = snapshot_lsn;
+    for (size_t i = 0; i < segments.size(); ++i) {
+        bool last = i + 1 == segments.size();
+        replayFile(segments[i].second, snapshot_lsn, last, replay, lastLsn_, records);
+        segments_.push_back(Segment{segments[i].first, segments[i].second});
+    }
+    
+    // New records go to a segment of their own, an empty leftover of the same name is reused
+    if (!segments_.empty() && segments_.back().first_lsn == lastLsn_ + 1) {
+        segments_.pop_back();
+    }
+    fullSinceSnapshot_ = segments_.size();
+    if (!openSegment(lastLsn_ + 1)) {
+        throw std::runtime_error("Cannot create WAL segment in " + options_.directory);
+    }
+    if (options_.compact_segments > 0 && fullSinceSnapshot_ >= options_.compact_segments) {
+        snapshotWanted_ = true;
+    }
+    
+    thread_ = std::thread(&WriteAheadLog::flusherLoop, this);
+    return records;
+}
+
+bool WriteAheadLog::replayFile(const std::string& path, uint64_t after_lsn, bool truncate_torn,
+                               const std::function<void(const Record&)>& replay, uint64_t& last_lsn,
+                               size_t& records) {
+    // Segments are read whole, a sequential read is the fast way through them
+    std::ifstream file(path, std::ios::binary);
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    
+    Record record;
+    size_t offset = 0;
+    while (offset < data.size()) {
+        const uint8_t* p = data.data() + offset;
+        uint32_t length = 0;
+        uint32_t crc = 0;
+        bool valid = data.size() - offset >= FRAME_BYTES;
+        if (valid) {
+            std::memcpy(&length, p, sizeof(length));
+            std::memcpy(&crc, p + 4, sizeof(crc));
+            valid = length >= HEADER_BYTES && data.size() - offset - FRAME_BYTES >= length &&
+                    crc32c(p + FRAME_BYTES, length) == crc;
+        }
+        uint16_t topic_length = 0;
+        if (valid) {
+            std::memcpy(&topic_length, p + FRAME_BYTES + 17, sizeof(topic_length));
+            valid = HEADER_BYTES + topic_length <= length;
+        }
+        if (!valid) {
+            if (truncate_torn) {
+                // Written when the broker went down, it was never acknowledged
+                std::cerr << "Cutting off a torn record at offset " << offset << " of " << path << std::endl;
+                if (truncate(path.c_str(), static_cast<off_t>(offset)) != 0) {
+                    std::cerr << "Cannot truncate " << path << ": " << std::strerror(errno) << std::endl;
+                }
+            } else {
+                std::cerr << "Corrupt record at offset " << offset << " of " << path
+                          << ", skipping the rest of the file" << std::endl;
+            }
+            return false;
+        }
+        
+        p += FRAME_BYTES;
+        std::memcpy(&record.lsn, p, sizeof(record.lsn));
+        offset += FRAME_BYTES + length;
+        if (record.lsn <= after_lsn) {
+            continue;  // Already in the snapshot
+        }
+        record.qos = p[8] & 0x03;
+        record.retain = (p[8] & FLAG_RETAIN) != 0;
+        std::memcpy(&record.expires_at, p + 9, sizeof(record.expires_at));
+        record.topic.assign(reinterpret_cast<const char*>(p + HEADER_BYTES), topic_length);
+        record.payload.assign(p + HEADER_BYTES + topic_length, p + length);
+        replay(record);
+        last_lsn = std::max(last_lsn, record.lsn);
+        ++records;
+    }
+    return true;
+}
+
+bool WriteAheadLog::openSegment(uint64_t first_lsn) {
+    std::string path = segmentPath(first_lsn);
+    segmentFd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (segmentFd_ < 0) {
+        std::cerr << "Cannot create WAL segment " << path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    segments_.push_back(Segment{first_lsn, path});
+    segmentSize_ = 0;
+    syncDirectory();  // The new name must survive a crash along with what is written to it
+    return true;
+}
+
+void WriteAheadLog::syncDirectory() {
+    int fd = open(options_.directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+uint64_t WriteAheadLog::append(const std::string& topic, const std::vector<uint8_t>& payload, uint8_t qos,
+                               bool retain, uint64_t expires_at) {
+    uint64_t lsn = ++lastLsn_;
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        wake = pending_.empty();
+        if (wake) {
+            pendingFirstLsn_ = lsn;
+        }
+        appendRecord(pending_, lsn, topic, payload.data(), payload.size(), qos, retain, expires_at);
+        ++pendingRecords_;
+    }
+    // A busy flusher picks the record up after its current commit
+    if (wake) {
+        cv_.notify_one();
+    }
+    return lsn;
+}
+
+void WriteAheadLog::snapshot(std::vector<Record> retained) {
+    snapshotWanted_ = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        snapshotRequest_ = std::make_unique<SnapshotRequest>(SnapshotRequest{lastLsn_, std::move(retained)});
+    }
+    cv_.notify_one();
+}
+
+void WriteAheadLog::flusherLoop() {
+    std::vector<uint8_t> batch;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        cv_.wait(lock, [this]() { return stopping_ || !pending_.empty() || snapshotRequest_; });
+        if (pending_.empty() && !snapshotRequest_) {
+            return;  // Stopping, everything committed
+        }
+        
+        // Trade latency for larger groups: publishes arriving meanwhile share the commit
+        if (!pending_.empty() && options_.commit_delay.count() > 0 && !stopping_) {
+            cv_.wait_for(lock, options_.commit_delay, [this]() { return stopping_; });
+        }
+        
+        batch.clear();
+        batch.swap(pending_);
+        uint64_t first_lsn = pendingFirstLsn_;
+        size_t records = pendingRecords_;
+        pendingRecords_ = 0;
+        std::unique_ptr<SnapshotRequest> request = std::move(snapshotRequest_);
+        lock.unlock();
+        
+        // Records the snapshot covers are committed before it, in the same round
+        if (!batch.empty()) {
+            commit(batch, first_lsn, first_lsn + records - 1, records);
+        }
+        if (request) {
+            writeSnapshot(*request);
+        }
+        
+        lock.lock();
+    }
+}
+
+void WriteAheadLog::commit(std::vector<uint8_t>& batch, uint64_t first_lsn, uint64_t last_lsn, size_t records) {
+    auto start = std::chrono::steady_clock::now();
+    sealRecords(batch);
+    
+    if (!failed_ && segmentSize_ > 0 && segmentSize_ + batch.size() > options_.segment_bytes) {
+        if (options_.durability == WalDurability::WRITE) {
+            fdatasync(segmentFd_);
+        }
+        close(segmentFd_);
+        segmentFd_ = -1;
+        if (!openSegment(first_lsn)) {
+            failed_ = true;
+        } else if (options_.compact_segments > 0 && ++fullSinceSnapshot_ >= options_.compact_segments) {
+            snapshotWanted_ = true;
+        }
+    }
+    
+    if (!failed_) {
+        bool ok = writeAll(segmentFd_, batch.data(), batch.size());
+        if (ok && options_.durability != WalDurability::WRITE) {
+            ok = fdatasync(segmentFd_) == 0;
+        }
+        if (!ok) {
+            // What reached the file is unknown now, no later record may be reported durable
+            std::cerr << "Write-ahead log failed: " << std::strerror(errno)
+                      << ", publishes are no longer acknowledged as durable" << std::endl;
+            failed_ = true;
+        }
+        segmentSize_ += batch.size();
+    }
+    
+    Commit result;
+    result.lsn = last_lsn;
+    result.records = records;
+    result.bytes = batch.size();
+    result.duration = std::chrono::steady_clock::now() - start;
+    result.ok = !failed_;
+    onCommit_(result);
+}
+
+void WriteAheadLog::writeSnapshot(const SnapshotRequest& request) {
+    std::vector<uint8_t> data;
+    for (const Record& record : request.retained) {
+        appendRecord(data, request.lsn, record.topic, record.payload.data(), record.payload.size(), record.qos, true,
+                     record.expires_at);
+    }
+    sealRecords(data);
+    
+    // Written aside and renamed, a crash leaves either the old snapshot or the new one
+    std::string path = snapshotPath(request.lsn);
+    std::string temporary = path + ".tmp";
+    int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool ok = fd >= 0 && writeAll(fd, data.data(), data.size()) && fdatasync(fd) == 0;
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (!ok || rename(temporary.c_str(), path.c_str()) != 0) {
+        std::cerr << "Cannot write WAL snapshot " << path << ": " << std::strerror(errno) << std::endl;
+        unlink(temporary.c_str());
+        return;
+    }
+    syncDirectory();
+    
+    if (!snapshotFile_.empty() && snapshotFile_ != path) {
+        unlink(snapshotFile_.c_str());
+    }
+    snapshotFile_ = path;
+    
+    // Segments whose records are all covered, never the one being written
+    while (segments_.size() > 1 && segments_[1].first_lsn <= request.lsn + 1) {
+        unlink(segments_.front().path.c_str());
+        segments_.erase(segments_.begin());
+    }
+    fullSinceSnapshot_ = segments_.size() - 1;
+    snapshots_.fetch_add(1, std::memory_order_relaxed);
+}
+
+} // namespace mqtt
@@ -0,0 +1,148 @@
+#ifndef WRITE_AHEAD_LOG_H
+#define WRITE_AHEAD_LOG_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace mqtt {
+
+// When a logged QoS 1 publish is acknowledged
+enum class WalDurability {
+    FSYNC,  // After the group commit holding it reached the disk with fdatasync()
+    WRITE,  // After it was written to the file, survives a broker crash but not a power loss
+    ASYNC   // Right away, the log is synced behind the acknowledgement
+};
+
+// "fsync", "write" or "async"
+WalDurability parseWalDurability(const std::string& name);
+
+// Append-only log of the publishes the broker must not lose.
+//
+// Records are appended to an in-memory batch on the event loop; a thread of its own
+// writes everything appended since its last commit with one write() and one
+// fdatasync(), then reports the highest sequence number that is durable, so the
+// publishes of a whole batch are acknowledged together (group commit).
+//
+// The log is a directory of segments named after the sequence number of their first
+// record, "<lsn>.wal", rotated once they grow past the segment size. Retained state is
+// compacted into "retained-<lsn>.snapshot", after which the segments it covers are
+// deleted. Every record is
+//   length (4 bytes), CRC-32C of the rest (4 bytes), lsn (8 bytes), flags (1 byte),
+//   expiry (8 bytes, Unix time in milliseconds, 0 = never), topic length (2 bytes), topic, payload
+// in host byte order; length counts everything after the CRC. A torn record at the end
+// of the last segment, left by a crash mid-write, is cut off on recovery.
+class WriteAheadLog {
+public:
+    struct Options {
+        std::string directory;
+        WalDurability durability = WalDurability::FSYNC;
+        std::chrono::microseconds commit_delay{0};  // Wait this long for more records before committing
+        size_t segment_bytes = 0;
+        size_t compact_segments = 0;  // Full segments that make a snapshot worthwhile
+    };
+    
+    struct Record {
+        uint64_t lsn = 0;
+        std::string topic;
+        std::vector<uint8_t> payload;
+        uint8_t qos = 0;
+        bool retain = false;
+        uint64_t expires_at = 0;  // Unix time in milliseconds, 0 = never
+    };
+    
+    // One group commit, every record up to lsn is durable unless ok is false
+    struct Commit {
+        uint64_t lsn = 0;
+        size_t records = 0;
+        size_t bytes = 0;
+        std::chrono::nanoseconds duration{0};  // write() and fdatasync()
+        bool ok = true;
+    };
+    
+    // Called on the log's thread after every commit
+    using CommitHandler = std::function<void(const Commit&)>;
+    
+    // Throws std::runtime_error when the directory can't be created
+    WriteAheadLog(const Options& options, CommitHandler on_commit);
+    ~WriteAheadLog();  // Commits what is pending and closes the log
+    
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+    
+    // Replays the latest snapshot and the records logged after it, oldest first, then
+    // starts logging into a fresh segment. Call once, before the first append().
+    // Returns the number of records replayed.
+    size_t recover(const std::function<void(const Record&)>& replay);
+    
+    // Returns the record's sequence number, committed in order
+    uint64_t append(const std::string& topic, const std::vector<uint8_t>& payload, uint8_t qos, bool retain,
+                    uint64_t expires_at = 0);
+    
+    // Enough full segments have piled up that a snapshot of the retained state pays off
+    bool wantsSnapshot() const { return snapshotWanted_.load(std::memory_order_relaxed); }
+    
+    // Retained messages as of the last append(), their lsn is ignored. Written on the
+    // log's thread; once durable, the segments holding nothing newer are deleted.
+    void snapshot(std::vector<Record> retained);
+    
+    WalDurability getDurability() const { return options_.durability; }
+    uint64_t getLastLsn() const { return lastLsn_; }
+    uint64_t getSnapshots() const { return snapshots_.load(std::memory_order_relaxed); }
+
+private:
+    struct Segment {
+        uint64_t first_lsn;
+        std::string path;
+    };
+    
+    struct SnapshotRequest {
+        uint64_t lsn;
+        std::vector<Record> retained;
+    };
+    
+    std::string segmentPath(uint64_t first_lsn) const;
+    std::string snapshotPath(uint64_t lsn) const;
+    bool replayFile(const std::string& path, uint64_t after_lsn, bool truncate_torn,
+                    const std::function<void(const Record&)>& replay, uint64_t& last_lsn, size_t& records);
+    bool openSegment(uint64_t first_lsn);
+    void commit(std::vector<uint8_t>& batch, uint64_t first_lsn, uint64_t last_lsn, size_t records);
+    void writeSnapshot(const SnapshotRequest& request);
+    void syncDirectory();
+    void flusherLoop();
+    
+    Options options_;
+    CommitHandler onCommit_;
+    uint64_t lastLsn_;  // Event loop side, last sequence number handed out
+    std::atomic<bool> snapshotWanted_;
+    std::atomic<uint64_t> snapshots_;
+    
+    // Log thread side
+    int segmentFd_;
+    size_t segmentSize_;
+    std::vector<Segment> segments_;  // Oldest first, the last one is being written
+    size_t fullSinceSnapshot_;
+    std::string snapshotFile_;       // Latest snapshot, empty before the first
+    bool failed_;                    // A write or sync failed, nothing is acknowledged as durable any more
+    
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<uint8_t> pending_;   // Encoded records not yet handed to the disk
+    uint64_t pendingFirstLsn_;
+    size_t pendingRecords_;
+    std::unique_ptr<SnapshotRequest> snapshotRequest_;
+    bool stopping_;
+};
+
+} // namespace mqtt
+
+#endif // WRITE_AHEAD_LOG_H
@@ -0,0 +1,170 @@
+#include "TlsContext.h"
+#include <cerrno>
+#include <stdexcept>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+namespace mqtt {
+
+namespace {
+
+const unsigned char SESSION_ID_CONTEXT[] = "mqtt-broker";
+
+// Reason for the most recent OpenSSL failure on this thread
+std::string lastError(const std::string& fallback) {
+    unsigned long code = ERR_peek_last_error();
+    if (code == 0) {
+        return fallback;
+    }
+    char text[256];
+    ERR_error_string_n(code, text, sizeof(text));
+    return text;
+}
+
+} // namespace
+
+TlsSession::TlsSession(SSL* ssl)
+    : ssl_(ssl), established_(false), kernel_send_(false), kernel_receive_(false), write_blocked_(false) {}
+
+TlsSession::~TlsSession() {
+    SSL_free(ssl_);
+}
+
+TlsSession::Handshake TlsSession::handshake() {
+    ERR_clear_error();
+    int rc = SSL_do_handshake(ssl_);
+    if (rc == 1) {
+        established_ = true;
+        kernel_send_ = BIO_get_ktls_send(SSL_get_wbio(ssl_));
+        // Records OpenSSL already took off the socket can only be read through it
+        kernel_receive_ = BIO_get_ktls_recv(SSL_get_rbio(ssl_)) && !SSL_has_pending(ssl_);
+        return Handshake::DONE;
+    }
+    
+    switch (SSL_get_error(ssl_, rc)) {
+        case SSL_ERROR_WANT_READ:
+            return Handshake::WANT_READ;
+        case SSL_ERROR_WANT_WRITE:
+            return Handshake::WANT_WRITE;
+        default:
+            error_ = lastError("connection closed");
+            return Handshake::FAILED;
+    }
+}
+
+bool TlsSession::wasResumed() const {
+    return SSL_session_reused(ssl_) == 1;
+}
+
+ssize_t TlsSession::read(uint8_t* data, size_t length) {
+    ERR_clear_error();
+    size_t done = 0;
+    if (SSL_read_ex(ssl_, data, length, &done) == 1) {
+        return static_cast<ssize_t>(done);
+    }
+    
+    switch (SSL_get_error(ssl_, 0)) {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+            errno = EAGAIN;
+            return -1;
+        case SSL_ERROR_ZERO_RETURN:
+            return 0;  // close_notify, or EOF without one
+        default:
+            errno = ECONNRESET;
+            return -1;
+    }
+}
+
+ssize_t TlsSession::write(const uint8_t* data, size_t length) {
+    // One record per SSL_write_ex() with partial writes enabled
+    size_t total = 0;
+    while (total < length) {
+        ERR_clear_error();
+        size_t done = 0;
+        if (SSL_write_ex(ssl_, data + total, length - total, &done) == 1) {
+            total += done;
+            write_blocked_ = false;
+            continue;
+        }
+        
+        int error = SSL_get_error(ssl_, 0);
+        if (error == SSL_ERROR_WANT_WRITE || error == SSL_ERROR_WANT_READ) {
+            write_blocked_ = true;
+            if (total > 0) {
+                return static_cast<ssize_t>(total);
+            }
+            errno = EAGAIN;
+            return -1;
+        }
+        errno = EPIPE;
+        return -1;
+    }
+    return static_cast<ssize_t>(total);
+}
+
+void TlsSession::shutdown() {
+    if (established_) {
+        ERR_clear_error();
+        SSL_shutdown(ssl_);
+        ERR_clear_error();
+    }
+}
+
+std::string TlsSession::getVersion() const {
+    return SSL_get_version(ssl_);
+}
+
+TlsContext::TlsContext(const Options& options) : ctx_(SSL_CTX_new(TLS_server_method())) {
+    if (!ctx_) {
+        throw std::runtime_error("Cannot create TLS context: " + lastError("out of memory"));
+    }
+    
+    SSL_CTX_set_min_proto_version(ctx_, TLS1_2_VERSION);
+    uint64_t flags = SSL_OP_NO_RENEGOTIATION | SSL_OP_IGNORE_UNEXPECTED_EOF | SSL_OP_CIPHER_SERVER_PREFERENCE;
+    if (options.ktls) {
+        flags |= SSL_OP_ENABLE_KTLS;
+    }
+    SSL_CTX_set_options(ctx_, flags);
+    // Writes resume from the connection's queue, which may have moved the bytes; idle
+    // connections give their record buffers back
+    SSL_CTX_set_mode(ctx_, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                           SSL_MODE_RELEASE_BUFFERS);
+    
+    if (SSL_CTX_use_certificate_chain_file(ctx_, options.cert_file.c_str()) != 1 ||
+        SSL_CTX_use_PrivateKey_file(ctx_, options.key_file.c_str(), SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(ctx_) != 1) {
+        std::string error = lastError("unknown error");
+        SSL_CTX_free(ctx_);
+        throw std::runtime_error("Cannot load TLS certificate " + options.cert_file + " and key " +
+                                 options.key_file + ": " + error);
+    }
+    
+    // Resumption skips the key exchange and the certificate, most of what a handshake
+    // costs. TLS 1.3 clients resume with tickets sealed by a key that lives as long as
+    // the process, TLS 1.2 clients may also resume by session id from the cache.
+    SSL_CTX_set_session_id_context(ctx_, SESSION_ID_CONTEXT, sizeof(SESSION_ID_CONTEXT) - 1);
+    SSL_CTX_set_session_cache_mode(ctx_, options.session_cache > 0 ? SSL_SESS_CACHE_SERVER : SSL_SESS_CACHE_OFF);
+    SSL_CTX_sess_set_cache_size(ctx_, static_cast<long>(options.session_cache));
+    SSL_CTX_set_timeout(ctx_, static_cast<long>(options.session_timeout));
+    SSL_CTX_set_num_tickets(ctx_, 1);  // Enough for the next reconnect
+}
+
+TlsContext::~TlsContext() {
+    SSL_CTX_free(ctx_);
+}
+
+std::unique_ptr<TlsSession> TlsContext::accept(int socket) {
+    SSL* ssl = SSL_new(ctx_);
+    if (!ssl) {
+        return nullptr;
+    }
+    if (SSL_set_fd(ssl, socket) != 1) {
+        SSL_free(ssl);
+        return nullptr;
+    }
+    SSL_set_accept_state(ssl);
+    return std::make_unique<TlsSession>(ssl);
+}
+
+} // namespace mqtt
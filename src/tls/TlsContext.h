@@ -0,0 +1,93 @@
+#ifndef TLS_CONTEXT_H
+#define TLS_CONTEXT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <sys/types.h>
+
+typedef struct ssl_ctx_st SSL_CTX;
+typedef struct ssl_st SSL;
+
+namespace mqtt {
+
+// One TLS connection on a non-blocking socket, server side.
+//
+// Once the handshake is done the record layer is handed to the kernel (kTLS) where
+// the kernel and the negotiated cipher allow it, per direction: the socket then reads
+// and writes plaintext and the connection uses it like any other. Otherwise read()
+// and write() go through OpenSSL.
+class TlsSession {
+public:
+    enum class Handshake {
+        DONE,
+        WANT_READ,
+        WANT_WRITE,
+        FAILED
+    };
+    
+    explicit TlsSession(SSL* ssl);
+    ~TlsSession();
+    
+    TlsSession(const TlsSession&) = delete;
+    TlsSession& operator=(const TlsSession&) = delete;
+    
+    // Call whenever the socket is readable or writable until it returns DONE or FAILED
+    Handshake handshake();
+    bool isEstablished() const { return established_; }
+    bool wasResumed() const;
+    bool kernelSend() const { return kernel_send_; }
+    bool kernelReceive() const { return kernel_receive_; }
+    
+    // Like recv() and send(): bytes transferred, 0 once the peer closed the session,
+    // -1 with errno EAGAIN when the socket is not ready
+    ssize_t read(uint8_t* data, size_t length);
+    ssize_t write(const uint8_t* data, size_t length);
+    // A write stopped inside an encrypted record. The next write() must start with the
+    // same bytes, so they may not be dropped from the queue meanwhile.
+    bool isWriteBlocked() const { return write_blocked_; }
+    
+    // Sends close_notify without waiting for the peer's
+    void shutdown();
+    
+    std::string getVersion() const;  // "TLSv1.3"
+    const std::string& getError() const { return error_; }  // Why the handshake failed
+
+private:
+    SSL* ssl_;
+    bool established_;
+    bool kernel_send_;
+    bool kernel_receive_;
+    bool write_blocked_;
+    std::string error_;
+};
+
+// Certificate, key and session state shared by the TLS listeners
+class TlsContext {
+public:
+    struct Options {
+        std::string cert_file;  // PEM, the chain after the leaf certificate
+        std::string key_file;
+        bool ktls = true;
+        size_t session_cache = 0;  // Sessions kept for resumption by id, 0 = tickets only
+        size_t session_timeout = 0;  // Seconds a session or ticket can be resumed
+    };
+    
+    // Throws std::runtime_error when the certificate or key can't be loaded
+    explicit TlsContext(const Options& options);
+    ~TlsContext();
+    
+    TlsContext(const TlsContext&) = delete;
+    TlsContext& operator=(const TlsContext&) = delete;
+    
+    // Server side session on an accepted socket, nullptr when OpenSSL is out of memory
+    std::unique_ptr<TlsSession> accept(int socket);
+
+private:
+    SSL_CTX* ctx_;
+};
+
+} // namespace mqtt
+
+#endif // TLS_CONTEXT_H
@@ -0,0 +1,158 @@
+#ifndef BROKER_HARNESS_H
+#define BROKER_HARNESS_H
+
+#include "broker/MqttBroker.h"
+#include <gtest/gtest.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace mqtt {
+
+// Raw MQTT 5 client over the harness's unix socket, packets are built by hand
+class TestClient {
+public:
+    explicit TestClient(const std::string& path) {
+        socket_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        struct sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        EXPECT_EQ(::connect(socket_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)), 0);
+    }
+    ~TestClient() { close(socket_); }
+    
+    void send(const std::vector<uint8_t>& bytes) {
+        EXPECT_EQ(::send(socket_, bytes.data(), bytes.size(), MSG_NOSIGNAL), static_cast<ssize_t>(bytes.size()));
+    }
+    
+    // Next whole packet, false once the broker closed the connection or nothing came in time
+    bool read(std::vector<uint8_t>& packet, int timeout_ms = 2000) {
+        while (!takePacket(packet)) {
+            struct pollfd pfd = {socket_, POLLIN, 0};
+            if (poll(&pfd, 1, timeout_ms) <= 0) {
+                return false;
+            }
+            uint8_t chunk[4096];
+            ssize_t n = ::recv(socket_, chunk, sizeof(chunk), 0);
+            if (n <= 0) {
+                return false;
+            }
+            buffer_.insert(buffer_.end(), chunk, chunk + n);
+        }
+        return true;
+    }
+    
+    // CONNECT with a clean start and no properties, returns the CONNACK reason code
+    int connect(const std::string& client_id) {
+        std::vector<uint8_t> body = {0x00, 0x04, 'M', 'Q', 'T', 'T', 0x05, 0x02, 0x00, 0x3C, 0x00};
+        appendString(body, client_id);
+        send(packet(0x10, body));
+        std::vector<uint8_t> connack;
+        if (!read(connack) || connack[0] != 0x20) {
+            return -1;
+        }
+        connack_ = connack;
+        return connack[3];
+    }
+    const std::vector<uint8_t>& getConnack() const { return connack_; }
+    
+    static std::vector<uint8_t> subscribe(uint16_t packet_id, const std::string& filter, uint8_t qos) {
+        std::vector<uint8_t> body = {static_cast<uint8_t>(packet_id >> 8), static_cast<uint8_t>(packet_id), 0x00};
+        appendString(body, filter);
+        body.push_back(qos);
+        return packet(0x82, body);
+    }
+    
+    static std::vector<uint8_t> publish(const std::string& topic, const std::string& payload, uint8_t qos,
+                                        bool retain = false, uint16_t packet_id = 1) {
+        return PacketFactory::create_publish(topic, std::vector<uint8_t>(payload.begin(), payload.end()),
+                                             static_cast<QoSLevel>(qos), retain, packet_id).serialize();
+    }
+
+private:
+    static void appendString(std::vector<uint8_t>& out, const std::string& value) {
+        out.push_back(static_cast<uint8_t>(value.size() >> 8));
+        out.push_back(static_cast<uint8_t>(value.size()));
+        out.insert(out.end(), value.begin(), value.end());
+    }
+    
+    static std::vector<uint8_t> packet(uint8_t type_flags, const std::vector<uint8_t>& body) {
+        std::vector<uint8_t> out = {type_flags};
+        MqttPacket::write_variable_byte_integer(out, static_cast<uint32_t>(body.size()));
+        out.insert(out.end(), body.begin(), body.end());
+        return out;
+    }
+    
+    bool takePacket(std::vector<uint8_t>& packet) {
+        size_t length = 0;
+        size_t index = 1;
+        for (uint32_t shift = 0; ; shift += 7, ++index) {
+            if (index >= buffer_.size()) {
+                return false;
+            }
+            length |= static_cast<size_t>(buffer_[index] & 0x7F) << shift;
+            if (!(buffer_[index] & 0x80)) {
+                break;
+            }
+        }
+        size_t total = index + 1 + length;
+        if (buffer_.size() < total) {
+            return false;
+        }
+        packet.assign(buffer_.begin(), buffer_.begin() + total);
+        buffer_.erase(buffer_.begin(), buffer_.begin() + total);
+        return true;
+    }
+    
+    int socket_;
+    std::vector<uint8_t> buffer_;
+    std::vector<uint8_t> connack_;
+};
+
+// A broker listening on a unix socket in a temporary directory, its event loop on a thread
+class BrokerHarness : public ::testing::Test {
+protected:
+    void SetUp() override {
+        char pattern[] = "/tmp/mqtt-broker-test-XXXXXX";
+        ASSERT_NE(mkdtemp(pattern), nullptr);
+        directory_ = pattern;
+        config_.listeners = {"unix://" + socketPath()};
+        config_.metrics_port = 0;
+        config_.admin_port = 0;
+    }
+    
+    void TearDown() override {
+        if (broker_) {
+            broker_->requestStop();
+        }
+        if (loop_.joinable()) {
+            loop_.join();
+        }
+        broker_.reset();
+        std::filesystem::remove_all(directory_);
+    }
+    
+    void startBroker() {
+        broker_ = std::make_unique<MqttBroker>(config_);
+        ASSERT_TRUE(broker_->start());
+        loop_ = std::thread([this]() { broker_->run(); });
+    }
+    
+    std::string socketPath() const { return directory_ + "/broker.sock"; }
+    
+    BrokerConfig config_;
+    std::string directory_;
+    std::unique_ptr<MqttBroker> broker_;
+    std::thread loop_;
+};
+
+} // namespace mqtt
+
+#endif // BROKER_HARNESS_H
@@ -0,0 +1,123 @@
+#include "cluster/Cluster.h"
+#include <gtest/gtest.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstring>
+#include <functional>
+#include <thread>
+
+namespace mqtt {
+
+namespace {
+
+// A port nothing listens on right now
+int freePort() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+    socklen_t length = sizeof(addr);
+    getsockname(fd, (struct sockaddr*)&addr, &length);
+    close(fd);
+    return ntohs(addr.sin_port);
+}
+
+// Two nodes on loopback, the first dials the second
+class ClusterTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        int port = freePort();
+        Cluster::Handlers handlers;
+        handlers.onPublish = [this](const std::string& topic, const std::vector<uint8_t>&, uint8_t, bool, uint32_t) {
+            received_.push_back(topic);
+        };
+        handlers.onRetained = [](const std::string&, const std::vector<uint8_t>&, uint8_t, uint32_t) {};
+        handlers.onClientConnected = [](const std::string&) {};
+        handlers.onPeerJoined = [](const std::string&) {};
+        
+        first_ = std::make_unique<Cluster>(options("first", freePort(), {"127.0.0.1:" + std::to_string(port)}),
+                                           handlers);
+        second_ = std::make_unique<Cluster>(options("second", port, {}), handlers);
+        ASSERT_TRUE(first_->start());
+        ASSERT_TRUE(second_->start());
+        ASSERT_TRUE(pumpUntil([this]() { return first_->getPeerCount() == 1 && second_->getPeerCount() == 1; }));
+    }
+    
+    static Cluster::Options options(const std::string& node_id, int port, std::vector<std::string> peers) {
+        Cluster::Options options;
+        options.node_id = node_id;
+        options.host = "127.0.0.1";
+        options.port = port;
+        options.peers = std::move(peers);
+        options.secret = "test";
+        options.link_max_bytes = 1 << 20;
+        return options;
+    }
+    
+    // Runs both nodes' event handling until the condition holds, false after two seconds
+    bool pumpUntil(const std::function<bool()>& done) {
+        for (int round = 0; round < 2000; ++round) {
+            auto now = SteadyClock::now();
+            for (Cluster* node : {first_.get(), second_.get()}) {
+                node->maintain(now);
+                node->processEvents();
+                node->flush();
+            }
+            if (done()) {
+                return true;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return false;
+    }
+    
+    // Until the second node's filter changes reached the first one, observed through a marker filter
+    void sync(const std::string& marker) {
+        second_->addLocalFilter(marker);
+        ASSERT_TRUE(pumpUntil([&]() { return first_->publish(marker, {}, 0, false) == 1; }));
+        second_->removeLocalFilter(marker);
+    }
+    
+    std::unique_ptr<Cluster> first_;
+    std::unique_ptr<Cluster> second_;
+    std::vector<std::string> received_;
+};
+
+} // namespace
+
+TEST_F(ClusterTest, ForwardsOnlyWhatPeersSubscribed) {
+    EXPECT_EQ(first_->publish("sensors/kitchen/temp", {}, 0, false), 0u);
+    
+    second_->addLocalFilter("sensors/+/temp");
+    second_->addLocalFilter("exact/topic");
+    sync("marker/1");
+    
+    EXPECT_EQ(first_->publish("sensors/kitchen/temp", {}, 0, false), 1u);
+    EXPECT_EQ(first_->publish("exact/topic", {}, 1, false), 1u);
+    EXPECT_EQ(first_->publish("sensors/kitchen/humidity", {}, 0, false), 0u);
+    EXPECT_EQ(first_->publish("exact", {}, 0, false), 0u);
+    
+    ASSERT_TRUE(pumpUntil([this]() { return received_.size() >= 3; }));
+    EXPECT_EQ(received_[received_.size() - 2], "sensors/kitchen/temp");
+    EXPECT_EQ(received_.back(), "exact/topic");
+}
+
+TEST_F(ClusterTest, StopsForwardingRemovedFilters) {
+    second_->addLocalFilter("alerts/#");
+    sync("marker/1");
+    EXPECT_EQ(first_->publish("alerts/fire", {}, 0, false), 1u);
+    
+    second_->removeLocalFilter("alerts/#");
+    sync("marker/2");
+    EXPECT_EQ(first_->publish("alerts/fire", {}, 0, false), 0u);
+}
+
+TEST_F(ClusterTest, ReplicatesRetainedMessagesEverywhere) {
+    EXPECT_EQ(first_->publish("nobody/subscribed", {}, 0, true), 1u);
+}
+
+} // namespace mqtt
@@ -0,0 +1,151 @@
+#include "connection/Connection.h"
+#include <gtest/gtest.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <string>
+
+namespace mqtt {
+
+namespace {
+
+// A connection whose socket buffer is already full, so everything it sends is queued
+class ConnectionTest : public ::testing::Test {
+protected:
+    void TearDown() override {
+        connection_.reset();
+        if (peer_ >= 0) {
+            close(peer_);
+        }
+    }
+    
+    Connection& connect(size_t max_bytes, size_t max_messages, OverflowPolicy policy) {
+        int sockets[2];
+        EXPECT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+        fcntl(sockets[0], F_SETFL, O_NONBLOCK);
+        fcntl(sockets[1], F_SETFL, O_NONBLOCK);
+        peer_ = sockets[1];
+        connection_ = std::make_shared<Connection>(sockets[0], OutboundLimits{max_bytes, max_messages, policy});
+        fill();
+        return *connection_;
+    }
+    
+    void fill() {
+        char zeros[4096] = {};
+        while (write(connection_->getSocket(), zeros, sizeof(zeros)) > 0) {
+        }
+    }
+    
+    // Reads until the connection has written its whole queue, returns what follows the fill
+    std::string drain() {
+        std::string received;
+        char buffer[4096];
+        while (connection_->hasPendingOutput() && connection_->isConnected()) {
+            ssize_t n;
+            while ((n = read(peer_, buffer, sizeof(buffer))) > 0) {
+                received.append(buffer, static_cast<size_t>(n));
+            }
+            connection_->flush();
+        }
+        ssize_t n;
+        while ((n = read(peer_, buffer, sizeof(buffer))) > 0) {
+            received.append(buffer, static_cast<size_t>(n));
+        }
+        return received.substr(received.find_first_not_of('\0') == std::string::npos
+                                   ? received.size() : received.find_first_not_of('\0'));
+    }
+    
+    std::shared_ptr<Connection> connection_;
+    int peer_ = -1;
+};
+
+std::shared_ptr<const std::vector<uint8_t>> message(char c, size_t size = 10) {
+    return std::make_shared<const std::vector<uint8_t>>(size, static_cast<uint8_t>(c));
+}
+
+} // namespace
+
+TEST_F(ConnectionTest, DropNewestRefusesWhatDoesNotFit) {
+    Connection& connection = connect(1024, 2, OverflowPolicy::DROP_NEWEST);
+    EXPECT_TRUE(connection.sendMessage(message('a'), 0).accepted);
+    EXPECT_TRUE(connection.sendMessage(message('b'), 1).accepted);
+    
+    SendResult result = connection.sendMessage(message('c'), 1);
+    EXPECT_FALSE(result.accepted);
+    EXPECT_EQ(result.dropped, 1u);
+    EXPECT_EQ(connection.getQueuedMessages(), 2u);
+    EXPECT_EQ(connection.getDroppedMessages(), 1u);
+    EXPECT_EQ(drain(), std::string(10, 'a') + std::string(10, 'b'));
+}
+
+TEST_F(ConnectionTest, DropOldestEvictsTheQueueHead) {
+    Connection& connection = connect(25, 100, OverflowPolicy::DROP_OLDEST);
+    EXPECT_TRUE(connection.sendMessage(message('a'), 1).accepted);
+    EXPECT_TRUE(connection.sendMessage(message('b'), 1).accepted);
+    
+    // The byte limit, not the message count, is what is exceeded
+    SendResult result = connection.sendMessage(message('c'), 0);
+    EXPECT_TRUE(result.accepted);
+    EXPECT_EQ(result.dropped, 1u);
+    EXPECT_EQ(connection.getQueuedBytes(), 20u);
+    EXPECT_EQ(drain(), std::string(10, 'b') + std::string(10, 'c'));
+}
+
+TEST_F(ConnectionTest, DropQos0KeepsAcknowledgedMessages) {
+    Connection& connection = connect(1024, 2, OverflowPolicy::DROP_QOS0);
+    EXPECT_TRUE(connection.sendMessage(message('a'), 1).accepted);
+    EXPECT_TRUE(connection.sendMessage(message('b'), 0).accepted);
+    
+    // A QoS 0 message that does not fit is the one dropped
+    SendResult result = connection.sendMessage(message('c'), 0);
+    EXPECT_FALSE(result.accepted);
+    EXPECT_EQ(result.dropped, 1u);
+    
+    // A QoS 1 message makes room by evicting the queued QoS 0 one
+    result = connection.sendMessage(message('d'), 1);
+    EXPECT_TRUE(result.accepted);
+    EXPECT_EQ(result.dropped, 1u);
+    
+    // Only QoS 1 left, the consumer is too slow to keep
+    result = connection.sendMessage(message('e'), 1);
+    EXPECT_FALSE(result.accepted);
+    EXPECT_FALSE(connection.isConnected());
+    EXPECT_TRUE(connection.wasSlowConsumer());
+}
+
+TEST_F(ConnectionTest, DisconnectPolicyDropsTheConsumer) {
+    Connection& connection = connect(1024, 1, OverflowPolicy::DISCONNECT);
+    EXPECT_TRUE(connection.sendMessage(message('a'), 0).accepted);
+    EXPECT_FALSE(connection.sendMessage(message('b'), 0).accepted);
+    EXPECT_FALSE(connection.isConnected());
+    EXPECT_TRUE(connection.wasSlowConsumer());
+    EXPECT_EQ(connection.getQueuedBytes(), 0u);
+}
+
+TEST_F(ConnectionTest, OversizedMessageIsAcceptedAlone) {
+    Connection& connection = connect(16, 10, OverflowPolicy::DROP_NEWEST);
+    EXPECT_TRUE(connection.sendMessage(message('a', 100), 0).accepted);
+    EXPECT_FALSE(connection.sendMessage(message('b'), 0).accepted);
+    EXPECT_EQ(drain(), std::string(100, 'a'));
+}
+
+// Control packets are never dropped, queued ones are bounded by the byte limit instead
+TEST_F(ConnectionTest, QueuedControlPacketsAreBounded) {
+    Connection& connection = connect(100, 10, OverflowPolicy::DROP_OLDEST);
+    std::vector<uint8_t> reply(40, 'p');
+    connection.send(reply);
+    connection.send(reply);
+    EXPECT_TRUE(connection.sendMessage(message('m'), 0).accepted);
+    EXPECT_TRUE(connection.isConnected());
+    EXPECT_EQ(drain(), std::string(80, 'p') + std::string(10, 'm'));
+    
+    // Written replies no longer count
+    fill();
+    connection.send(reply);
+    connection.send(reply);
+    connection.send(reply);
+    EXPECT_FALSE(connection.isConnected());
+    EXPECT_TRUE(connection.wasSlowConsumer());
+}
+
+} // namespace mqtt
@@ -0,0 +1,79 @@
+#include "protocol/ControlFrames.h"
+#include <gtest/gtest.h>
+#include <vector>
+
+namespace mqtt {
+
+namespace {
+
+template <typename Frame>
+std::vector<uint8_t> bytes(const Frame& frame) {
+    return std::vector<uint8_t>(frame.data(), frame.data() + frame.size());
+}
+
+} // namespace
+
+// Every frame must be byte for byte what PacketFactory sends for the same packet
+TEST(ControlFrames, PingrespMatchesPacketFactory) {
+    EXPECT_EQ(bytes(ControlFrames::PINGRESP), PacketFactory::create_pingresp().serialize());
+}
+
+TEST(ControlFrames, PubackMatchesPacketFactory) {
+    for (uint16_t id : {1, 0x00FF, 0x1234, 0xFFFF}) {
+        for (uint8_t reason : {0x00, 0x10, 0x87, 0x97}) {
+            EXPECT_EQ(bytes(ControlFrames::puback(id, reason)), PacketFactory::create_puback(id, reason).serialize())
+                << "id " << id << " reason " << int(reason);
+        }
+    }
+}
+
+TEST(ControlFrames, DisconnectMatchesPacketFactory) {
+    for (uint8_t reason : {0x00, 0x81, 0x8E, 0x93, 0x97}) {
+        EXPECT_EQ(bytes(ControlFrames::disconnect(reason)), PacketFactory::create_disconnect(reason).serialize())
+            << "reason " << int(reason);
+    }
+}
+
+TEST(ControlFrames, ConnackMatchesPacketFactory) {
+    ControlFrames::Connack refused(0, 0x86);
+    EXPECT_EQ(bytes(refused), PacketFactory::create_connack(0, 0x86).serialize());
+    
+    // The properties the broker advertises, lengths patched as each is added
+    ControlFrames::Connack connack(1, 0);
+    connack.propertyUint16(0x21, 0x0102);
+    connack.propertyUint32(0x27, 0x0A0B0C0D);
+    std::vector<uint8_t> properties = {0x21, 0x01, 0x02, 0x27, 0x0A, 0x0B, 0x0C, 0x0D};
+    EXPECT_EQ(bytes(connack), PacketFactory::create_connack(1, 0, properties).serialize());
+}
+
+TEST(ControlFrames, SubscriptionAcksMatchPacketFactory) {
+    std::vector<uint8_t> codes = {0x00, 0x01, 0x87};
+    ControlFrames::StackFrame<32> suback;
+    ASSERT_TRUE(ControlFrames::subscriptionAck(PacketType::SUBACK, 0x4242, codes.data(), codes.size(), suback));
+    EXPECT_EQ(bytes(suback), PacketFactory::create_suback(0x4242, codes).serialize());
+    
+    ControlFrames::StackFrame<32> unsuback;
+    ASSERT_TRUE(ControlFrames::subscriptionAck(PacketType::UNSUBACK, 7, codes.data(), codes.size(), unsuback));
+    EXPECT_EQ(bytes(unsuback), PacketFactory::create_unsuback(7, codes).serialize());
+    
+    // Two byte remaining length
+    std::vector<uint8_t> many(200, 0x02);
+    ControlFrames::StackFrame<256> large;
+    ASSERT_TRUE(ControlFrames::subscriptionAck(PacketType::SUBACK, 9, many.data(), many.size(), large));
+    EXPECT_EQ(bytes(large), PacketFactory::create_suback(9, many).serialize());
+}
+
+TEST(ControlFrames, SubscriptionAckRefusesWhatDoesNotFit) {
+    // Header, length, identifier and property length leave room for exactly 11 codes
+    std::vector<uint8_t> codes(11, 0x00);
+    ControlFrames::StackFrame<16> exact;
+    EXPECT_TRUE(ControlFrames::subscriptionAck(PacketType::SUBACK, 1, codes.data(), codes.size(), exact));
+    EXPECT_EQ(exact.size(), exact.capacity());
+    
+    codes.push_back(0x00);
+    ControlFrames::StackFrame<16> small;
+    EXPECT_FALSE(ControlFrames::subscriptionAck(PacketType::SUBACK, 1, codes.data(), codes.size(), small));
+    EXPECT_EQ(small.size(), 0u);
+}
+
+} // namespace mqtt
@@ -0,0 +1,89 @@
+#include "broker/ExpiryWheel.h"
+#include <gtest/gtest.h>
+#include <set>
+
+namespace mqtt {
+
+namespace {
+
+using std::chrono::milliseconds;
+
+// Keys handed back by one advance()
+std::vector<std::string> advance(ExpiryWheel& wheel, SteadyClock::time_point now, size_t budget = 1000) {
+    std::vector<std::string> expired;
+    wheel.advance(now, budget, [&](const std::string& key, SteadyClock::time_point) { expired.push_back(key); });
+    return expired;
+}
+
+} // namespace
+
+TEST(ExpiryWheel, ExpiresOnlyWhatIsDue) {
+    auto start = SteadyClock::now();
+    ExpiryWheel wheel(8, milliseconds(10));
+    EXPECT_EQ(wheel.nextDeadline(), SteadyClock::time_point::max());
+    
+    wheel.schedule("soon", start + milliseconds(15));
+    wheel.schedule("later", start + milliseconds(45));
+    EXPECT_EQ(wheel.size(), 2u);
+    EXPECT_NE(wheel.nextDeadline(), SteadyClock::time_point::max());
+    
+    EXPECT_TRUE(advance(wheel, start + milliseconds(5)).empty());
+    EXPECT_EQ(advance(wheel, start + milliseconds(35)), std::vector<std::string>{"soon"});
+    EXPECT_EQ(advance(wheel, start + milliseconds(65)), std::vector<std::string>{"later"});
+    EXPECT_EQ(wheel.size(), 0u);
+    EXPECT_EQ(wheel.nextDeadline(), SteadyClock::time_point::max());
+}
+
+// Deadlines a turn or more ahead share a slot with nearer ones and must wait for their turn
+TEST(ExpiryWheel, KeepsEntriesForLaterTurns) {
+    auto start = SteadyClock::now();
+    ExpiryWheel wheel(4, milliseconds(10));
+    wheel.schedule("near", start + milliseconds(15));
+    wheel.schedule("far", start + milliseconds(55));  // Same slot, next turn
+    
+    EXPECT_EQ(advance(wheel, start + milliseconds(25)), std::vector<std::string>{"near"});
+    EXPECT_TRUE(advance(wheel, start + milliseconds(45)).empty());
+    EXPECT_EQ(advance(wheel, start + milliseconds(75)), std::vector<std::string>{"far"});
+}
+
+TEST(ExpiryWheel, PastDeadlinesExpireOnTheNextAdvance) {
+    auto start = SteadyClock::now();
+    ExpiryWheel wheel(8, milliseconds(10));
+    advance(wheel, start + milliseconds(100));
+    wheel.schedule("late", start + milliseconds(20));
+    EXPECT_EQ(advance(wheel, start + milliseconds(120)), std::vector<std::string>{"late"});
+}
+
+TEST(ExpiryWheel, SpreadsBurstsOverTheBudget) {
+    auto start = SteadyClock::now();
+    ExpiryWheel wheel(8, milliseconds(10));
+    for (int i = 0; i < 10; ++i) {
+        wheel.schedule("key" + std::to_string(i), start + milliseconds(5));
+    }
+    
+    std::set<std::string> expired;
+    for (int call = 0; call < 10 && wheel.size() > 0; ++call) {
+        auto batch = advance(wheel, start + milliseconds(25), 3);
+        EXPECT_LE(batch.size(), 3u);
+        expired.insert(batch.begin(), batch.end());
+    }
+    EXPECT_EQ(expired.size(), 10u);
+    EXPECT_EQ(wheel.size(), 0u);
+}
+
+TEST(ExpiryWheel, RescheduleFromTheCallback) {
+    auto start = SteadyClock::now();
+    ExpiryWheel wheel(8, milliseconds(10));
+    wheel.schedule("again", start + milliseconds(5));
+    
+    size_t calls = 0;
+    wheel.advance(start + milliseconds(15), 100, [&](const std::string& key, SteadyClock::time_point) {
+        ++calls;
+        wheel.schedule(key, start + milliseconds(40));
+    });
+    EXPECT_EQ(calls, 1u);
+    EXPECT_EQ(wheel.size(), 1u);
+    EXPECT_EQ(advance(wheel, start + milliseconds(55)), std::vector<std::string>{"again"});
+}
+
+} // namespace mqtt
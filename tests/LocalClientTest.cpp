@@ -0,0 +1,139 @@
+#include "BrokerHarness.h"
+#include "broker/LocalClient.h"
+#include <fstream>
+#include <future>
+#include <mutex>
+
+namespace mqtt {
+
+namespace {
+
+class LocalClientTest : public BrokerHarness {
+protected:
+    // Waits until the event loop ran everything posted so far
+    void settle() {
+        std::promise<void> done;
+        broker_->post([&done]() { done.set_value(); });
+        done.get_future().wait();
+    }
+    
+    std::unique_ptr<LocalClient> client(const std::string& client_id) {
+        return std::make_unique<LocalClient>(*broker_, client_id,
+            [this](const std::string& topic, const std::vector<uint8_t>& payload, uint8_t, bool retained) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                received_.push_back(topic + "=" + std::string(payload.begin(), payload.end()) +
+                                    (retained ? " (retained)" : ""));
+            });
+    }
+    
+    std::vector<std::string> received() {
+        settle();
+        std::lock_guard<std::mutex> lock(mutex_);
+        return received_;
+    }
+    
+    static std::vector<uint8_t> payload(const std::string& text) {
+        return std::vector<uint8_t>(text.begin(), text.end());
+    }
+    
+    std::mutex mutex_;
+    std::vector<std::string> received_;
+};
+
+} // namespace
+
+TEST_F(LocalClientTest, SubscribesAndPublishes) {
+    startBroker();
+    auto subscriber = client("subscriber");
+    auto publisher = client("publisher");
+    subscriber->subscribe("a/+");
+    publisher->publish("a/b", payload("one"));
+    publisher->publish("c/d", payload("two"));
+    EXPECT_EQ(received(), (std::vector<std::string>{"a/b=one"}));
+    
+    subscriber->unsubscribe("a/+");
+    publisher->publish("a/b", payload("three"));
+    EXPECT_EQ(received().size(), 1u);
+}
+
+// Topics and filters are held to the protocol rules, like a network client's
+TEST_F(LocalClientTest, RefusesInvalidTopicsAndFilters) {
+    startBroker();
+    auto subscriber = client("subscriber");
+    auto publisher = client("publisher");
+    subscriber->subscribe("a/#/b");
+    subscriber->subscribe("#");
+    publisher->publish("a/+", payload("wildcard"));
+    publisher->publish("", payload("empty"));
+    publisher->publish("a/#/b", payload("filter"));
+    publisher->publish("a/b", payload("valid"));
+    EXPECT_EQ(received(), (std::vector<std::string>{"a/b=valid"}));
+}
+
+TEST_F(LocalClientTest, IsAuthorizedByClientId) {
+    config_.acl_file = directory_ + "/acl";
+    std::ofstream(config_.acl_file) << "client reader\n"
+                                       "topic read public/#\n"
+                                       "client writer\n"
+                                       "topic write public/news\n";
+    startBroker();
+    auto reader = client("reader");
+    auto writer = client("writer");
+    reader->subscribe("public/#");
+    writer->subscribe("#");  // Not allowed to read anything
+    writer->publish("public/news", payload("allowed"));
+    writer->publish("public/sport", payload("denied"));
+    reader->publish("public/news", payload("denied"));
+    EXPECT_EQ(received(), (std::vector<std::string>{"public/news=allowed"}));
+}
+
+// Subscriptions made under the old rules are checked again once new ones are loaded
+TEST_F(LocalClientTest, AclReloadRevokesSubscriptions) {
+    config_.acl_file = directory_ + "/acl";
+    std::ofstream(config_.acl_file) << "topic readwrite public/#\n"
+                                       "topic readwrite private/#\n";
+    startBroker();
+    auto reader = client("reader");
+    auto writer = client("writer");
+    reader->subscribe("public/#");
+    reader->subscribe("private/#");
+    
+    std::ofstream(config_.acl_file) << "topic readwrite public/#\n"
+                                       "topic write private/#\n";
+    broker_->requestAclReload();
+    
+    // Reloaded on a worker, published until the new rules are in place
+    bool revoked = false;
+    for (int attempt = 0; attempt < 200 && !revoked; ++attempt) {
+        writer->publish("private/probe", payload(std::to_string(attempt)));
+        auto got = received();
+        revoked = got.empty() || got.back() != "private/probe=" + std::to_string(attempt);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_TRUE(revoked);
+    
+    size_t before = received().size();
+    writer->publish("private/x", payload("dropped"));
+    writer->publish("public/x", payload("kept"));
+    auto after = received();
+    ASSERT_EQ(after.size(), before + 1);
+    EXPECT_EQ(after.back(), "public/x=kept");
+}
+
+// Retained publishes are logged, a restarted broker still has them
+TEST_F(LocalClientTest, RetainedPublishesAreDurable) {
+    config_.wal_dir = directory_ + "/wal";
+    startBroker();
+    client("publisher")->publish("state/door", payload("open"), 1, true);
+    settle();
+    broker_->requestStop();
+    loop_.join();
+    broker_->stop();
+    
+    startBroker();
+    auto subscriber = client("subscriber");
+    subscriber->subscribe("state/#");
+    EXPECT_EQ(received(), (std::vector<std::string>{"state/door=open (retained)"}));
+}
+
+} // namespace mqtt
@@ -0,0 +1,127 @@
+#include "BrokerHarness.h"
+
+namespace mqtt {
+
+namespace {
+
+class ReceiveMaximumTest : public BrokerHarness {
+protected:
+    void SetUp() override {
+        BrokerHarness::SetUp();
+        config_.flow_control = true;
+        config_.receive_maximum = 2;
+    }
+};
+
+// Property 0x21 in the CONNACK properties, -1 without one
+int receiveMaximum(const std::vector<uint8_t>& connack) {
+    for (size_t i = 5; i + 2 < connack.size(); ++i) {
+        if (connack[i] == 0x21) {
+            return (connack[i + 1] << 8) | connack[i + 2];
+        }
+    }
+    return -1;
+}
+
+} // namespace
+
+TEST_F(ReceiveMaximumTest, IsAdvertised) {
+    startBroker();
+    TestClient client(socketPath());
+    ASSERT_EQ(client.connect("publisher"), 0);
+    EXPECT_EQ(receiveMaximum(client.getConnack()), 2);
+}
+
+// Each PUBACK hands its credit back, so more publishes than the maximum are fine in total
+TEST_F(ReceiveMaximumTest, AcknowledgementsReleaseCredits) {
+    startBroker();
+    TestClient client(socketPath());
+    ASSERT_EQ(client.connect("publisher"), 0);
+    
+    std::vector<uint8_t> burst;
+    for (uint16_t id = 1; id <= 5; ++id) {
+        auto publish = TestClient::publish("a/b", "x", 1, false, id);
+        burst.insert(burst.end(), publish.begin(), publish.end());
+    }
+    client.send(burst);
+    
+    std::vector<uint8_t> packet;
+    for (uint16_t id = 1; id <= 5; ++id) {
+        ASSERT_TRUE(client.read(packet));
+        EXPECT_EQ(packet[0], 0x40);
+        EXPECT_EQ((packet[2] << 8) | packet[3], id);
+    }
+}
+
+// Acknowledgements held back until the write-ahead log commits: a third publish
+// before then is one more than advertised
+TEST_F(ReceiveMaximumTest, ExceedingItDisconnects) {
+    config_.wal_dir = directory_ + "/wal";
+    config_.wal_durability = WalDurability::FSYNC;
+    config_.wal_commit_delay_us = 500000;
+    startBroker();
+    TestClient client(socketPath());
+    ASSERT_EQ(client.connect("publisher"), 0);
+    
+    std::vector<uint8_t> burst;
+    for (uint16_t id = 1; id <= 3; ++id) {
+        auto publish = TestClient::publish("a/" + std::to_string(id), "x", 1, true, id);
+        burst.insert(burst.end(), publish.begin(), publish.end());
+    }
+    client.send(burst);
+    
+    std::vector<uint8_t> packet;
+    ASSERT_TRUE(client.read(packet));
+    EXPECT_EQ(packet[0], 0xE0);
+    EXPECT_EQ(packet[2], 0x93);  // Receive Maximum exceeded
+    EXPECT_FALSE(client.read(packet));
+}
+
+// A broker missing one of its ports fails instead of running without it
+TEST_F(BrokerHarness, StartFailsWhenAListenerCannotOpen) {
+    config_.listeners.push_back("unix://" + directory_ + "/missing/broker.sock");
+    {
+        MqttBroker broker(config_);
+        EXPECT_FALSE(broker.start());
+    }
+    EXPECT_FALSE(std::filesystem::exists(socketPath()));  // The one that did open is cleaned up
+    
+    config_.listeners = {"tcp://127.0.0.1:notaport"};
+    MqttBroker broker(config_);
+    EXPECT_FALSE(broker.start());
+}
+
+// Only retained publishes are logged, so only their PUBACK waits for the commit
+TEST_F(BrokerHarness, WriteAheadLogHoldsOnlyRetainedAcks) {
+    config_.wal_dir = directory_ + "/wal";
+    config_.wal_durability = WalDurability::FSYNC;
+    config_.wal_commit_delay_us = 300000;
+    startBroker();
+    TestClient client(socketPath());
+    ASSERT_EQ(client.connect("publisher"), 0);
+    
+    std::vector<uint8_t> packet;
+    client.send(TestClient::publish("state/door", "open", 1, true, 1));
+    client.send(TestClient::publish("events/door", "opened", 1, false, 2));
+    ASSERT_TRUE(client.read(packet, 200));
+    EXPECT_EQ(packet[0], 0x40);
+    EXPECT_EQ((packet[2] << 8) | packet[3], 2);
+    
+    // The retained one once the delayed group commit is on disk
+    ASSERT_TRUE(client.read(packet));
+    EXPECT_EQ(packet[0], 0x40);
+    EXPECT_EQ((packet[2] << 8) | packet[3], 1);
+    
+    broker_->requestStop();
+    loop_.join();
+    broker_.reset();
+    
+    std::vector<std::string> logged;
+    WriteAheadLog::Options options;
+    options.directory = config_.wal_dir;
+    WriteAheadLog log(options, [](const WriteAheadLog::Commit&) {});
+    log.recover([&](const WriteAheadLog::Record& record) { logged.push_back(record.topic); });
+    EXPECT_EQ(logged, (std::vector<std::string>{"state/door"}));
+}
+
+} // namespace mqtt
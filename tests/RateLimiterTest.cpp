@@ -0,0 +1,123 @@
+#include "broker/RateLimiter.h"
+#include <gtest/gtest.h>
+
+namespace mqtt {
+
+namespace {
+
+using std::chrono::milliseconds;
+
+// The limiter only uses connections as keys
+const Connection* client(uintptr_t id) {
+    return reinterpret_cast<const Connection*>(id * 64);
+}
+
+} // namespace
+
+TEST(TokenBucket, AllowsTheBurstThenOverdraws) {
+    TokenBucket bucket(10, 3);
+    auto now = SteadyClock::now();
+    EXPECT_TRUE(bucket.consume(1, now));
+    EXPECT_TRUE(bucket.consume(1, now));
+    EXPECT_TRUE(bucket.consume(1, now));
+    EXPECT_EQ(bucket.debtDuration(), SteadyClock::duration::zero());
+    
+    // Two tokens short at ten per second
+    EXPECT_FALSE(bucket.consume(2, now));
+    EXPECT_EQ(std::chrono::duration_cast<milliseconds>(bucket.debtDuration()).count(), 200);
+}
+
+TEST(TokenBucket, RefillsUpToTheBurst) {
+    TokenBucket bucket(10, 2);
+    auto now = SteadyClock::now();
+    EXPECT_FALSE(bucket.consume(3, now));
+    
+    // The debt is paid first, then the balance grows
+    EXPECT_TRUE(bucket.consume(1, now + milliseconds(200)));
+    EXPECT_FALSE(bucket.consume(1, now + milliseconds(200)));
+    
+    // A long pause never saves more than the burst
+    EXPECT_TRUE(bucket.consume(2, now + std::chrono::seconds(60)));
+    EXPECT_FALSE(bucket.consume(1, now + std::chrono::seconds(60)));
+}
+
+TEST(TokenBucket, BurstIsAtLeastOneToken) {
+    TokenBucket bucket(0.5, 0);
+    auto now = SteadyClock::now();
+    EXPECT_TRUE(bucket.consume(1, now));
+    EXPECT_FALSE(bucket.consume(1, now));
+    EXPECT_EQ(std::chrono::duration_cast<milliseconds>(bucket.debtDuration()).count(), 2000);
+}
+
+TEST(TokenBucket, ZeroRateIsUnlimited) {
+    TokenBucket bucket(0, 1);
+    auto now = SteadyClock::now();
+    EXPECT_TRUE(bucket.isUnlimited());
+    for (int i = 0; i < 1000; ++i) {
+        EXPECT_TRUE(bucket.consume(1000, now));
+    }
+    EXPECT_EQ(bucket.debtDuration(), SteadyClock::duration::zero());
+}
+
+TEST(RateLimiter, DisabledWithoutLimits) {
+    RateLimiter limiter({0, 0, 1}, {0, 0, 1});
+    EXPECT_FALSE(limiter.isEnabled());
+    limiter.addClient(client(1), "alice");
+    auto now = SteadyClock::now();
+    for (int i = 0; i < 100; ++i) {
+        EXPECT_EQ(limiter.charge(client(1), "alice", 1 << 20, now), SteadyClock::duration::zero());
+    }
+}
+
+TEST(RateLimiter, LimitsMessagesAndBytesPerClient) {
+    RateLimiter limiter({2, 1000, 1}, {0, 0, 1});
+    ASSERT_TRUE(limiter.isEnabled());
+    limiter.addClient(client(1), "");
+    limiter.addClient(client(2), "");
+    auto now = SteadyClock::now();
+    
+    EXPECT_EQ(limiter.charge(client(1), "", 10, now), SteadyClock::duration::zero());
+    EXPECT_EQ(limiter.charge(client(1), "", 10, now), SteadyClock::duration::zero());
+    EXPECT_EQ(std::chrono::duration_cast<milliseconds>(limiter.charge(client(1), "", 10, now)).count(), 500);
+    
+    // The byte budget applies on its own, the wait is the longer of the two
+    EXPECT_EQ(std::chrono::duration_cast<milliseconds>(limiter.charge(client(2), "", 3000, now)).count(), 2000);
+    
+    // Unknown and removed clients are not charged
+    limiter.removeClient(client(1), "");
+    EXPECT_EQ(limiter.charge(client(1), "", 10, now), SteadyClock::duration::zero());
+    EXPECT_EQ(limiter.charge(client(3), "", 10, now), SteadyClock::duration::zero());
+}
+
+TEST(RateLimiter, SharesTheUserBudgetAcrossClients) {
+    RateLimiter limiter({0, 0, 1}, {2, 0, 1});
+    limiter.addClient(client(1), "alice");
+    limiter.addClient(client(2), "alice");
+    limiter.addClient(client(3), "bob");
+    auto now = SteadyClock::now();
+    
+    EXPECT_EQ(limiter.charge(client(1), "alice", 1, now), SteadyClock::duration::zero());
+    EXPECT_EQ(limiter.charge(client(2), "alice", 1, now), SteadyClock::duration::zero());
+    EXPECT_GT(limiter.charge(client(1), "alice", 1, now), SteadyClock::duration::zero());
+    EXPECT_EQ(limiter.charge(client(3), "bob", 1, now), SteadyClock::duration::zero());
+    
+    // The user budget outlives one of its clients, not the last
+    limiter.removeClient(client(1), "alice");
+    EXPECT_GT(limiter.charge(client(2), "alice", 1, now), SteadyClock::duration::zero());
+    limiter.removeClient(client(2), "alice");
+    limiter.addClient(client(2), "alice");
+    EXPECT_EQ(limiter.charge(client(2), "alice", 1, now), SteadyClock::duration::zero());
+}
+
+TEST(RateLimiter, AnonymousClientsAreLimitedIndividually) {
+    RateLimiter limiter({1, 0, 1}, {1, 0, 1});
+    limiter.addClient(client(1), "");
+    limiter.addClient(client(2), "");
+    auto now = SteadyClock::now();
+    
+    EXPECT_EQ(limiter.charge(client(1), "", 1, now), SteadyClock::duration::zero());
+    EXPECT_EQ(limiter.charge(client(2), "", 1, now), SteadyClock::duration::zero());
+    EXPECT_GT(limiter.charge(client(1), "", 1, now), SteadyClock::duration::zero());
+}
+
+} // namespace mqtt
@@ -0,0 +1,111 @@
+#include "auth/TopicAcl.h"
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <fstream>
+#include <unistd.h>
+
+namespace mqtt {
+
+namespace {
+
+class TopicAclTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        char pattern[] = "/tmp/mqtt-acl-test-XXXXXX";
+        int fd = mkstemp(pattern);
+        ASSERT_GE(fd, 0);
+        close(fd);
+        path_ = pattern;
+    }
+    
+    void TearDown() override {
+        std::remove(path_.c_str());
+    }
+    
+    std::shared_ptr<const TopicAcl> load(const std::string& rules) {
+        std::ofstream(path_) << rules;
+        return TopicAcl::load(path_);
+    }
+    
+    std::string path_;
+};
+
+const char RULES[] =
+    "# Comments and blank lines are skipped\n"
+    "\n"
+    "topic read public/#\n"
+    "topic write inbox/+\n"
+    "pattern readwrite users/%u/#\n"
+    "pattern write devices/%c/status\n"
+    "user alice\n"
+    "topic readwrite alice/#\n"
+    "topic read $SYS/#\n"
+    "client sensor-1\n"
+    "topic write sensors/+/temperature\n";
+
+} // namespace
+
+TEST_F(TopicAclTest, GrantsPerScope) {
+    auto acl = load(RULES);
+    EXPECT_EQ(acl->getRuleCount(), 7u);
+    
+    EXPECT_TRUE(acl->allows("bob", "c1", "public/news", ACL_READ));
+    EXPECT_TRUE(acl->allows("bob", "c1", "public", ACL_READ));  // '#' covers the parent level
+    EXPECT_FALSE(acl->allows("bob", "c1", "public/news", ACL_WRITE));
+    EXPECT_TRUE(acl->allows("bob", "c1", "inbox/bob", ACL_WRITE));
+    EXPECT_FALSE(acl->allows("bob", "c1", "inbox/bob/extra", ACL_WRITE));
+    
+    EXPECT_TRUE(acl->allows("alice", "c1", "alice/notes", ACL_READWRITE));
+    EXPECT_FALSE(acl->allows("bob", "c1", "alice/notes", ACL_READ));
+    EXPECT_TRUE(acl->allows("alice", "c1", "public/news", ACL_READ));  // Rules for everyone still apply
+    
+    EXPECT_TRUE(acl->allows("", "sensor-1", "sensors/kitchen/temperature", ACL_WRITE));
+    EXPECT_FALSE(acl->allows("", "sensor-1", "sensors/kitchen/humidity", ACL_WRITE));
+    EXPECT_FALSE(acl->allows("", "sensor-2", "sensors/kitchen/temperature", ACL_WRITE));
+}
+
+TEST_F(TopicAclTest, PatternsSubstituteIdentity) {
+    auto acl = load(RULES);
+    EXPECT_TRUE(acl->allows("bob", "c1", "users/bob/settings", ACL_READWRITE));
+    EXPECT_FALSE(acl->allows("bob", "c1", "users/alice/settings", ACL_READ));
+    EXPECT_TRUE(acl->allows("bob", "lamp", "devices/lamp/status", ACL_WRITE));
+    EXPECT_FALSE(acl->allows("bob", "lamp", "devices/heater/status", ACL_WRITE));
+    
+    // Identities that would act as wildcards or are missing never match
+    EXPECT_FALSE(acl->allows("+", "c1", "users/+/settings", ACL_READ));
+    EXPECT_FALSE(acl->allows("", "c1", "users//settings", ACL_READ));
+}
+
+TEST_F(TopicAclTest, FiltersNeedCoveringRules) {
+    auto acl = load(RULES);
+    EXPECT_TRUE(acl->allows("bob", "c1", "public/#", ACL_READ, true));
+    EXPECT_TRUE(acl->allows("bob", "c1", "public/+/headlines", ACL_READ, true));
+    EXPECT_TRUE(acl->allows("alice", "c1", "alice/+", ACL_READ, true));
+    EXPECT_FALSE(acl->allows("bob", "c1", "#", ACL_READ, true));
+    EXPECT_FALSE(acl->allows("bob", "c1", "+/news", ACL_READ, true));
+    EXPECT_FALSE(acl->allows("bob", "c1", "inbox/#", ACL_WRITE, true));  // '+' rule is narrower than '#'
+}
+
+TEST_F(TopicAclTest, SystemTopicsNeedExplicitRules) {
+    auto acl = load("topic read #\ntopic read +/uptime\nuser alice\ntopic read $SYS/#\n");
+    EXPECT_TRUE(acl->allows("bob", "c1", "a/b", ACL_READ));
+    EXPECT_FALSE(acl->allows("bob", "c1", "$SYS/broker", ACL_READ));
+    EXPECT_FALSE(acl->allows("bob", "c1", "$SYS/uptime", ACL_READ));
+    EXPECT_TRUE(acl->allows("alice", "c1", "$SYS/broker", ACL_READ));
+}
+
+TEST_F(TopicAclTest, RejectsMalformedRules) {
+    EXPECT_THROW(load("topic read a/#/b\n"), std::runtime_error);
+    EXPECT_THROW(load("topic read a/b+\n"), std::runtime_error);
+    EXPECT_THROW(load("topic\n"), std::runtime_error);
+    EXPECT_THROW(load("group admins\n"), std::runtime_error);
+    EXPECT_THROW(TopicAcl::load(path_ + ".missing"), std::runtime_error);
+}
+
+TEST_F(TopicAclTest, GenerationChangesOnReload) {
+    auto first = load(RULES);
+    auto second = load(RULES);
+    EXPECT_NE(first->getGeneration(), second->getGeneration());
+}
+
+} // namespace mqtt
@@ -0,0 +1,70 @@
+#include "broker/TopicBloomFilter.h"
+#include <gtest/gtest.h>
+
+namespace mqtt {
+
+TEST(TopicBloomFilter, EmptyRejectsEverything) {
+    TopicBloomFilter bloom(1024, 4);
+    EXPECT_FALSE(bloom.mayMatch("a"));
+    EXPECT_FALSE(bloom.mayMatch("a/b/c"));
+    EXPECT_FALSE(bloom.mayMatch(""));
+    EXPECT_EQ(bloom.estimatedFalsePositiveRate(), 0.0);
+}
+
+// No false negatives: every topic a filter matches gets through
+TEST(TopicBloomFilter, PassesWhatFiltersMatch) {
+    TopicBloomFilter bloom(1024, 4);
+    bloom.addFilter("sensors/+/temperature");
+    bloom.addFilter("alerts/#");
+    bloom.addFilter("exact/topic");
+    
+    EXPECT_TRUE(bloom.mayMatch("sensors/kitchen/temperature"));
+    EXPECT_TRUE(bloom.mayMatch("alerts"));  // "alerts/#" matches its parent level
+    EXPECT_TRUE(bloom.mayMatch("alerts/fire/floor1"));
+    EXPECT_TRUE(bloom.mayMatch("exact/topic"));
+}
+
+TEST(TopicBloomFilter, RejectsUnrelatedTopics) {
+    TopicBloomFilter bloom(1 << 16, 4);
+    bloom.addFilter("sensors/+/temperature");
+    bloom.addFilter("exact/topic");
+    
+    // Sparse enough that a false positive on any of these would be a bug
+    EXPECT_FALSE(bloom.mayMatch("telemetry/device1/cpu"));
+    EXPECT_FALSE(bloom.mayMatch("sensorsX/a"));
+    EXPECT_FALSE(bloom.mayMatch("exact"));
+    EXPECT_FALSE(bloom.mayMatch("exacttopic"));
+    EXPECT_GT(bloom.estimatedFalsePositiveRate(), 0.0);
+    EXPECT_LT(bloom.estimatedFalsePositiveRate(), 1e-9);
+}
+
+TEST(TopicBloomFilter, RootWildcardsPassEverything) {
+    TopicBloomFilter bloom(1024, 4);
+    bloom.addFilter("+/status");
+    EXPECT_TRUE(bloom.mayMatch("anything/at/all"));
+    bloom.removeFilter("+/status");
+    EXPECT_FALSE(bloom.mayMatch("anything/at/all"));
+    
+    bloom.addFilter("#");
+    EXPECT_TRUE(bloom.mayMatch("x"));
+}
+
+// Counters make removal exact: a prefix stays while any filter still needs it
+TEST(TopicBloomFilter, RemovesIncrementally) {
+    TopicBloomFilter bloom(1 << 16, 4);
+    bloom.addFilter("a/b/+");
+    bloom.addFilter("a/b/#");  // Same literal prefix "a/b"
+    bloom.addFilter("c");
+    
+    bloom.removeFilter("a/b/+");
+    EXPECT_TRUE(bloom.mayMatch("a/b/x"));
+    bloom.removeFilter("a/b/#");
+    EXPECT_FALSE(bloom.mayMatch("a/b/x"));
+    EXPECT_TRUE(bloom.mayMatch("c"));
+    
+    bloom.removeFilter("c");
+    EXPECT_FALSE(bloom.mayMatch("c"));
+    EXPECT_EQ(bloom.estimatedFalsePositiveRate(), 0.0);
+}
+
+} // namespace mqtt
@@ -0,0 +1,98 @@
+#include "broker/TopicMatchCache.h"
+#include <gtest/gtest.h>
+
+namespace mqtt {
+
+namespace {
+
+std::shared_ptr<Connection> makeSubscriber() {
+    return std::make_shared<Connection>([](const std::string&, const std::vector<uint8_t>&, uint8_t, bool) {});
+}
+
+} // namespace
+
+TEST(TopicMatchCache, StoresAndLooksUp) {
+    TopicMatchCache cache(4);
+    auto subscriber = makeSubscriber();
+    EXPECT_EQ(cache.lookup("a/b"), nullptr);
+    
+    cache.store("a/b", {subscriber});
+    const TopicMatchCache::Subscribers* hit = cache.lookup("a/b");
+    ASSERT_NE(hit, nullptr);
+    ASSERT_EQ(hit->size(), 1u);
+    EXPECT_EQ((*hit)[0], subscriber);
+    
+    // An empty set is a result too, publishes without subscribers skip matching as well
+    cache.store("nobody", {});
+    ASSERT_NE(cache.lookup("nobody"), nullptr);
+    EXPECT_TRUE(cache.lookup("nobody")->empty());
+    
+    // Storing again replaces the set
+    cache.store("a/b", {});
+    EXPECT_TRUE(cache.lookup("a/b")->empty());
+    EXPECT_EQ(cache.size(), 2u);
+}
+
+TEST(TopicMatchCache, EvictsLeastRecentlyUsed) {
+    TopicMatchCache cache(2);
+    cache.store("one", {});
+    cache.store("two", {});
+    EXPECT_NE(cache.lookup("one"), nullptr);  // "two" is now the oldest
+    cache.store("three", {});
+    
+    EXPECT_EQ(cache.size(), 2u);
+    EXPECT_NE(cache.lookup("one"), nullptr);
+    EXPECT_EQ(cache.lookup("two"), nullptr);
+    EXPECT_NE(cache.lookup("three"), nullptr);
+}
+
+TEST(TopicMatchCache, ZeroCapacityCachesNothing) {
+    TopicMatchCache cache(0);
+    cache.store("a", {});
+    EXPECT_EQ(cache.lookup("a"), nullptr);
+    EXPECT_EQ(cache.size(), 0u);
+}
+
+TEST(TopicMatchCache, InvalidatesOneTopic) {
+    TopicMatchCache cache(4);
+    cache.store("a/b", {});
+    cache.store("a/c", {});
+    EXPECT_TRUE(cache.invalidate("a/b"));
+    EXPECT_FALSE(cache.invalidate("a/b"));
+    EXPECT_EQ(cache.lookup("a/b"), nullptr);
+    EXPECT_NE(cache.lookup("a/c"), nullptr);
+}
+
+TEST(TopicMatchCache, InvalidatesWhatAWildcardMatches) {
+    TopicMatchCache cache(8);
+    cache.store("sport/tennis", {});
+    cache.store("sport/golf", {});
+    cache.store("sport", {});
+    cache.store("news/sport", {});
+    cache.store("$SYS/sport", {});
+    
+    EXPECT_EQ(cache.invalidateMatching("sport/+"), 2u);
+    EXPECT_EQ(cache.lookup("sport/tennis"), nullptr);
+    EXPECT_NE(cache.lookup("sport"), nullptr);
+    
+    EXPECT_EQ(cache.invalidateMatching("#"), 2u);  // Never "$SYS/..."
+    EXPECT_EQ(cache.size(), 1u);
+    EXPECT_NE(cache.lookup("$SYS/sport"), nullptr);
+}
+
+// Entries keep their subscribers alive, so a dropped filter must release them at once
+TEST(TopicMatchCache, InvalidationReleasesSubscribers) {
+    TopicMatchCache cache(4);
+    auto subscriber = makeSubscriber();
+    std::weak_ptr<Connection> watch = subscriber;
+    cache.store("a/b", {subscriber});
+    cache.store("a/c", {subscriber});
+    subscriber.reset();
+    EXPECT_FALSE(watch.expired());
+    
+    cache.invalidateMatching("a/#");
+    EXPECT_TRUE(watch.expired());
+    EXPECT_EQ(cache.size(), 0u);
+}
+
+} // namespace mqtt
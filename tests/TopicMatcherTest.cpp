@@ -0,0 +1,139 @@
+#include "broker/TopicMatcher.h"
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+
+namespace mqtt {
+
+namespace {
+
+// Every scan must agree with the scalar one, which is the last
+void expectAgreement(const std::string& topic) {
+    auto implementations = TopicMatcher::scanImplementations();
+    TopicMatcher::TopicLevels expected;
+    implementations.back().scan(topic.data(), topic.size(), expected);
+    for (const auto& implementation : implementations) {
+        TopicMatcher::TopicLevels levels;
+        implementation.scan(topic.data(), topic.size(), levels);
+        EXPECT_EQ(levels.separators, expected.separators) << implementation.name << " on \"" << topic << "\"";
+        EXPECT_EQ(levels.single_wildcard, expected.single_wildcard) << implementation.name;
+        EXPECT_EQ(levels.multi_wildcard, expected.multi_wildcard) << implementation.name;
+        EXPECT_EQ(levels.nul, expected.nul) << implementation.name;
+    }
+}
+
+} // namespace
+
+TEST(TopicScan, FindsSeparatorsAndWildcards) {
+    TopicMatcher::TopicLevels levels;
+    TopicMatcher::scan("a/+/c/#", levels);
+    EXPECT_EQ(levels.separators, (std::vector<uint32_t>{1, 3, 5}));
+    EXPECT_EQ(levels.count(), 4u);
+    EXPECT_TRUE(levels.single_wildcard);
+    EXPECT_TRUE(levels.multi_wildcard);
+    EXPECT_FALSE(levels.nul);
+    
+    // Reused storage starts over
+    TopicMatcher::scan(std::string("x\0y", 3), levels);
+    EXPECT_TRUE(levels.separators.empty());
+    EXPECT_FALSE(levels.single_wildcard);
+    EXPECT_FALSE(levels.multi_wildcard);
+    EXPECT_TRUE(levels.nul);
+}
+
+// One special character at every position, on both sides of the 16 and 32 byte blocks
+TEST(TopicScan, CharactersAcrossBlockBoundaries) {
+    for (size_t length = 0; length <= 64; ++length) {
+        expectAgreement(std::string(length, 'a'));
+        for (size_t position = 0; position < length; ++position) {
+            for (char c : {'/', '+', '#', '\0', ' '}) {
+                std::string topic(length, 'a');
+                topic[position] = c;
+                expectAgreement(topic);
+            }
+        }
+        expectAgreement(std::string(length, '/'));
+    }
+}
+
+TEST(TopicScan, RandomTopicsAgreeWithScalar) {
+    const char alphabet[] = {'a', 'b', '/', '/', '+', '#', '\0', ' ', '$', '\xff'};
+    std::mt19937 random(42);
+    std::uniform_int_distribution<size_t> pick(0, sizeof(alphabet) - 1);
+    for (int round = 0; round < 2000; ++round) {
+        for (size_t length = 0; length <= 64; ++length) {
+            std::string topic;
+            for (size_t i = 0; i < length; ++i) {
+                topic += alphabet[pick(random)];
+            }
+            expectAgreement(topic);
+        }
+    }
+}
+
+TEST(TopicMatcher, SingleLevelWildcard) {
+    EXPECT_TRUE(TopicMatcher::matches("sport/+", "sport/"));  // An empty level is still a level
+    EXPECT_FALSE(TopicMatcher::matches("sport/+", "sport"));
+    EXPECT_TRUE(TopicMatcher::matches("sport/+", "sport/tennis"));
+    EXPECT_FALSE(TopicMatcher::matches("sport/+", "sport/tennis/player1"));
+    EXPECT_TRUE(TopicMatcher::matches("+/+", "/finance"));
+    EXPECT_TRUE(TopicMatcher::matches("/+", "/finance"));
+    EXPECT_FALSE(TopicMatcher::matches("+", "/finance"));
+    EXPECT_TRUE(TopicMatcher::matches("a/+/c", "a/b/c"));
+    EXPECT_FALSE(TopicMatcher::matches("a/+/c", "a/b/d"));
+}
+
+TEST(TopicMatcher, MultiLevelWildcard) {
+    EXPECT_TRUE(TopicMatcher::matches("a/#", "a"));  // Also the parent level
+    EXPECT_TRUE(TopicMatcher::matches("a/#", "a/"));
+    EXPECT_TRUE(TopicMatcher::matches("a/#", "a/b/c"));
+    EXPECT_FALSE(TopicMatcher::matches("a/#", "ab"));
+    EXPECT_FALSE(TopicMatcher::matches("a/#", "b/a"));
+    EXPECT_TRUE(TopicMatcher::matches("#", "a/b/c"));
+    EXPECT_TRUE(TopicMatcher::matches("#", "/"));
+    EXPECT_TRUE(TopicMatcher::matches("a/+/#", "a/b"));
+    EXPECT_FALSE(TopicMatcher::matches("a/b", "a/b/c"));
+    EXPECT_FALSE(TopicMatcher::matches("a/b/c", "a/b"));
+}
+
+TEST(TopicMatcher, SystemTopics) {
+    EXPECT_FALSE(TopicMatcher::matches("#", "$SYS/broker/uptime"));
+    EXPECT_FALSE(TopicMatcher::matches("+/broker/uptime", "$SYS/broker/uptime"));
+    EXPECT_TRUE(TopicMatcher::matches("$SYS/#", "$SYS/broker/uptime"));
+    EXPECT_TRUE(TopicMatcher::matches("$SYS/+/uptime", "$SYS/broker/uptime"));
+    EXPECT_TRUE(TopicMatcher::matches("$SYS/broker/uptime", "$SYS/broker/uptime"));
+    EXPECT_TRUE(TopicMatcher::matches("a/+", "a/$SYS"));  // Only the first level is special
+}
+
+TEST(TopicMatcher, ValidFilters) {
+    TopicMatcher::TopicLevels levels;
+    auto valid = [&](const std::string& filter) {
+        TopicMatcher::scan(filter, levels);
+        return TopicMatcher::isValidFilter(filter, levels);
+    };
+    EXPECT_TRUE(valid("#"));
+    EXPECT_TRUE(valid("+"));
+    EXPECT_TRUE(valid("a/+/b/#"));
+    EXPECT_TRUE(valid("/"));
+    EXPECT_FALSE(valid(""));
+    EXPECT_FALSE(valid("a/#/b"));
+    EXPECT_FALSE(valid("a#"));
+    EXPECT_FALSE(valid("a/b+"));
+    EXPECT_FALSE(valid(std::string("a\0b", 3)));
+}
+
+TEST(TopicMatcher, ValidTopicNames) {
+    TopicMatcher::TopicLevels levels;
+    auto valid = [&](const std::string& topic) {
+        TopicMatcher::scan(topic, levels);
+        return TopicMatcher::isValidTopicName(topic, levels);
+    };
+    EXPECT_TRUE(valid("a/b"));
+    EXPECT_TRUE(valid("/"));
+    EXPECT_FALSE(valid(""));
+    EXPECT_FALSE(valid("a/+"));
+    EXPECT_FALSE(valid("a/#"));
+    EXPECT_FALSE(valid(std::string("a\0b", 3)));
+}
+
+} // namespace mqtt
@@ -0,0 +1,142 @@
+#include "protocol/Utf8Validator.h"
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace mqtt {
+
+namespace {
+
+void appendCodePoint(std::vector<uint8_t>& out, uint32_t cp) {
+    if (cp < 0x80) {
+        out.push_back(static_cast<uint8_t>(cp));
+    } else if (cp < 0x800) {
+        out.push_back(static_cast<uint8_t>(0xC0 | (cp >> 6)));
+        out.push_back(static_cast<uint8_t>(0x80 | (cp & 0x3F)));
+    } else if (cp < 0x10000) {
+        out.push_back(static_cast<uint8_t>(0xE0 | (cp >> 12)));
+        out.push_back(static_cast<uint8_t>(0x80 | ((cp >> 6) & 0x3F)));
+        out.push_back(static_cast<uint8_t>(0x80 | (cp & 0x3F)));
+    } else {
+        out.push_back(static_cast<uint8_t>(0xF0 | (cp >> 18)));
+        out.push_back(static_cast<uint8_t>(0x80 | ((cp >> 12) & 0x3F)));
+        out.push_back(static_cast<uint8_t>(0x80 | ((cp >> 6) & 0x3F)));
+        out.push_back(static_cast<uint8_t>(0x80 | (cp & 0x3F)));
+    }
+}
+
+std::vector<uint8_t> bytes(std::initializer_list<uint8_t> list) {
+    return std::vector<uint8_t>(list);
+}
+
+// Every implementation must agree with the scalar one, which is the last
+void expectAgreement(const std::vector<uint8_t>& data) {
+    auto implementations = Utf8::implementations();
+    bool expected = implementations.back().validate(data.data(), data.size());
+    for (const auto& implementation : implementations) {
+        EXPECT_EQ(implementation.validate(data.data(), data.size()), expected)
+            << implementation.name << " disagrees on " << ::testing::PrintToString(data);
+    }
+}
+
+// Sequences that are invalid on their own, or cut short when they end the input
+const std::vector<std::vector<uint8_t>> INVALID = {
+    bytes({0x00}),                    // U+0000
+    bytes({0xC0, 0x80}),              // Overlong NUL
+    bytes({0xC1, 0xBF}),              // Overlong two byte form
+    bytes({0xE0, 0x9F, 0xBF}),        // Overlong three byte form
+    bytes({0xF0, 0x8F, 0xBF, 0xBF}),  // Overlong four byte form
+    bytes({0xED, 0xA0, 0x80}),        // High surrogate
+    bytes({0xED, 0xBF, 0xBF}),        // Low surrogate
+    bytes({0xF4, 0x90, 0x80, 0x80}),  // Above U+10FFFF
+    bytes({0xF5, 0x80, 0x80, 0x80}),
+    bytes({0xFF}),
+    bytes({0x80}),                    // Lone continuation byte
+    bytes({0xC3}),                    // Truncated
+    bytes({0xE2, 0x82}),
+    bytes({0xF0, 0x9F, 0x98}),
+    bytes({0xE2, 0x28, 0xA1}),        // Bad continuation byte
+};
+
+const std::vector<uint32_t> VALID = {0x41, 0x7F, 0x80, 0xE9, 0x7FF, 0x800, 0x20AC, 0xD7FF, 0xE000, 0xFFFD,
+                                     0xFFFF, 0x10000, 0x1F600, 0x10FFFF};
+
+} // namespace
+
+TEST(Utf8Validator, AcceptsValidCodePoints) {
+    for (uint32_t cp : VALID) {
+        std::vector<uint8_t> data;
+        appendCodePoint(data, cp);
+        for (const auto& implementation : Utf8::implementations()) {
+            EXPECT_TRUE(implementation.validate(data.data(), data.size())) << implementation.name << " U+" << cp;
+        }
+    }
+}
+
+TEST(Utf8Validator, RejectsMalformedSequences) {
+    for (const auto& sequence : INVALID) {
+        for (const auto& implementation : Utf8::implementations()) {
+            EXPECT_FALSE(implementation.validate(sequence.data(), sequence.size()))
+                << implementation.name << " accepts " << ::testing::PrintToString(sequence);
+        }
+    }
+}
+
+TEST(Utf8Validator, EmptyIsValid) {
+    for (const auto& implementation : Utf8::implementations()) {
+        EXPECT_TRUE(implementation.validate(nullptr, 0)) << implementation.name;
+    }
+}
+
+// Each multi-byte code point and each bad sequence at every offset of an ASCII run,
+// so they straddle the 16 and 32 byte blocks of the vector implementations
+TEST(Utf8Validator, SequencesAcrossBlockBoundaries) {
+    for (size_t length = 0; length <= 64; ++length) {
+        for (size_t offset = 0; offset <= length; ++offset) {
+            for (uint32_t cp : VALID) {
+                std::vector<uint8_t> data(offset, 'a');
+                appendCodePoint(data, cp);
+                data.resize(std::max(data.size(), length), 'b');
+                expectAgreement(data);
+                EXPECT_TRUE(Utf8::isValid(data.data(), data.size()));
+            }
+            for (const auto& sequence : INVALID) {
+                std::vector<uint8_t> data(offset, 'a');
+                data.insert(data.end(), sequence.begin(), sequence.end());
+                expectAgreement(data);
+                EXPECT_FALSE(Utf8::isValid(data.data(), data.size()));
+                
+                // Cut short, the truncated prefixes must agree as well
+                data.resize(std::max(data.size(), length), 'b');
+                for (size_t cut = offset; cut < data.size(); ++cut) {
+                    expectAgreement(std::vector<uint8_t>(data.begin(), data.begin() + cut));
+                }
+            }
+        }
+    }
+}
+
+TEST(Utf8Validator, RandomInputsAgreeWithScalar) {
+    std::mt19937 random(1234);
+    std::uniform_int_distribution<int> byte(0, 255);
+    std::uniform_int_distribution<size_t> pick(0, VALID.size() - 1);
+    std::uniform_int_distribution<int> coin(0, 9);
+    for (int round = 0; round < 2000; ++round) {
+        for (size_t length = 0; length <= 64; ++length) {
+            std::vector<uint8_t> data;
+            while (data.size() < length) {
+                // Mostly well formed text, an occasional random byte makes it invalid
+                if (coin(random) == 0) {
+                    data.push_back(static_cast<uint8_t>(byte(random)));
+                } else {
+                    appendCodePoint(data, VALID[pick(random)]);
+                }
+            }
+            data.resize(length);
+            expectAgreement(data);
+        }
+    }
+}
+
+} // namespace mqtt
@@ -0,0 +1,177 @@
+#include "storage/WriteAheadLog.h"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+namespace mqtt {
+
+namespace {
+
+class WriteAheadLogTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        char pattern[] = "/tmp/mqtt-wal-test-XXXXXX";
+        ASSERT_NE(mkdtemp(pattern), nullptr);
+        directory_ = pattern;
+    }
+    
+    void TearDown() override {
+        std::filesystem::remove_all(directory_);
+    }
+    
+    WriteAheadLog::Options options(size_t segment_bytes = 1 << 20, size_t compact_segments = 0) const {
+        WriteAheadLog::Options options;
+        options.directory = directory_;
+        options.durability = WalDurability::WRITE;
+        options.segment_bytes = segment_bytes;
+        options.compact_segments = compact_segments;
+        return options;
+    }
+    
+    std::vector<WriteAheadLog::Record> recover() {
+        std::vector<WriteAheadLog::Record> records;
+        WriteAheadLog log(options(), [](const WriteAheadLog::Commit&) {});
+        log.recover([&](const WriteAheadLog::Record& record) { records.push_back(record); });
+        return records;
+    }
+    
+    std::vector<std::filesystem::path> files(const std::string& extension) const {
+        std::vector<std::filesystem::path> found;
+        for (const auto& entry : std::filesystem::directory_iterator(directory_)) {
+            if (entry.path().extension() == extension) {
+                found.push_back(entry.path());
+            }
+        }
+        std::sort(found.begin(), found.end());
+        return found;
+    }
+    
+    std::string directory_;
+};
+
+std::vector<uint8_t> payload(const std::string& text) {
+    return std::vector<uint8_t>(text.begin(), text.end());
+}
+
+} // namespace
+
+TEST_F(WriteAheadLogTest, ReplaysWhatWasAppended) {
+    {
+        WriteAheadLog log(options(), [](const WriteAheadLog::Commit&) {});
+        EXPECT_EQ(log.recover([](const WriteAheadLog::Record&) {}), 0u);
+        EXPECT_EQ(log.append("a/b", payload("one"), 1, false), 1u);
+        EXPECT_EQ(log.append("a/c", payload(""), 0, true, 1700000000000), 2u);
+        EXPECT_EQ(log.append("a/d", payload("three"), 1, true), 3u);
+    }
+    
+    auto records = recover();
+    ASSERT_EQ(records.size(), 3u);
+    EXPECT_EQ(records[0].lsn, 1u);
+    EXPECT_EQ(records[0].topic, "a/b");
+    EXPECT_EQ(records[0].payload, payload("one"));
+    EXPECT_EQ(records[0].qos, 1);
+    EXPECT_FALSE(records[0].retain);
+    EXPECT_EQ(records[1].topic, "a/c");
+    EXPECT_TRUE(records[1].payload.empty());
+    EXPECT_TRUE(records[1].retain);
+    EXPECT_EQ(records[1].expires_at, 1700000000000u);
+    EXPECT_EQ(records[2].lsn, 3u);
+    
+    // Sequence numbers carry on after a restart
+    WriteAheadLog log(options(), [](const WriteAheadLog::Commit&) {});
+    log.recover([](const WriteAheadLog::Record&) {});
+    EXPECT_EQ(log.append("a/e", payload("four"), 1, false), 4u);
+}
+
+TEST_F(WriteAheadLogTest, CutsOffTornTail) {
+    {
+        WriteAheadLog log(options(), [](const WriteAheadLog::Commit&) {});
+        log.recover([](const WriteAheadLog::Record&) {});
+        log.append("a/b", payload("one"), 1, false);
+        log.append("a/c", payload("two"), 1, false);
+    }
+    auto segments = files(".wal");
+    ASSERT_EQ(segments.size(), 1u);
+    auto intact = std::filesystem::file_size(segments[0]);
+    
+    // Half a record, as a crash in the middle of write() leaves it
+    {
+        std::ofstream file(segments[0], std::ios::binary | std::ios::app);
+        const char torn[] = {40, 0, 0, 0, 1, 2, 3};
+        file.write(torn, sizeof(torn));
+    }
+    
+    auto records = recover();
+    ASSERT_EQ(records.size(), 2u);
+    EXPECT_EQ(records[1].topic, "a/c");
+    EXPECT_EQ(std::filesystem::file_size(segments[0]), intact);
+}
+
+TEST_F(WriteAheadLogTest, CutsOffCorruptTail) {
+    {
+        WriteAheadLog log(options(), [](const WriteAheadLog::Commit&) {});
+        log.recover([](const WriteAheadLog::Record&) {});
+        log.append("a/b", payload("one"), 1, false);
+        log.append("a/c", payload("two"), 1, false);
+    }
+    auto segments = files(".wal");
+    ASSERT_EQ(segments.size(), 1u);
+    
+    // Flip the last payload byte, the CRC no longer matches
+    auto size = std::filesystem::file_size(segments[0]);
+    {
+        std::fstream file(segments[0], std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(static_cast<std::streamoff>(size - 1));
+        file.put('X');
+    }
+    
+    auto records = recover();
+    ASSERT_EQ(records.size(), 1u);
+    EXPECT_EQ(records[0].topic, "a/b");
+    EXPECT_LT(std::filesystem::file_size(segments[0]), size);
+}
+
+TEST_F(WriteAheadLogTest, SnapshotCompactsSegments) {
+    {
+        // Tiny segments, every commit rotates and one full segment asks for a snapshot
+        std::atomic<uint64_t> committed{0};
+        WriteAheadLog log(options(64, 1), [&](const WriteAheadLog::Commit& commit) { committed = commit.lsn; });
+        log.recover([](const WriteAheadLog::Record&) {});
+        for (int i = 0; i < 10; ++i) {
+            log.append("r", payload("v" + std::to_string(i)), 1, true);
+            uint64_t lsn = log.append("t", payload("x"), 1, false);
+            // Committed one round at a time, so the records spread over several segments
+            for (int wait = 0; wait < 2000 && committed < lsn; ++wait) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        ASSERT_TRUE(log.wantsSnapshot());
+        
+        WriteAheadLog::Record retained;
+        retained.topic = "r";
+        retained.payload = payload("v9");
+        retained.qos = 1;
+        log.snapshot({retained});
+        for (int wait = 0; wait < 2000 && log.getSnapshots() == 0; ++wait) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        ASSERT_EQ(log.getSnapshots(), 1u);
+        log.append("after", payload("y"), 1, false);
+    }
+    
+    EXPECT_EQ(files(".snapshot").size(), 1u);
+    EXPECT_LE(files(".wal").size(), 2u);  // Everything the snapshot covers is gone
+    
+    auto records = recover();
+    ASSERT_EQ(records.size(), 2u);
+    EXPECT_EQ(records[0].topic, "r");
+    EXPECT_EQ(records[0].payload, payload("v9"));
+    EXPECT_TRUE(records[0].retain);
+    EXPECT_EQ(records[1].topic, "after");
+    EXPECT_EQ(records[1].lsn, 21u);
+}
+
+} // namespace mqtt
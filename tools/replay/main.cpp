@@ -0,0 +1,442 @@
+// mqtt-replay: re-drive a traffic capture (MQTT_CAPTURE_FILE) against a broker and
+// report throughput and acknowledgement latency, for comparing broker builds on
+// recorded traffic shapes.
+#include "capture/CaptureFile.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace mqtt;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+constexpr size_t MAX_BUFFERED_BYTES = 8 * 1024 * 1024;  // Unsent bytes before records are held back
+constexpr size_t RECORDS_PER_POLL = 64;                 // Records applied between polls when unpaced
+
+struct Options {
+    std::string capture;
+    std::string host = "127.0.0.1";
+    std::string port = "1883";
+    double speed = 1.0;  // 0 = as fast as possible
+    double drain = 2.0;  // Seconds to wait for outstanding acknowledgements at the end
+};
+
+// Request waiting for its acknowledgement
+struct Pending {
+    uint8_t type;  // Packet type of the acknowledgement
+    uint16_t packet_id;
+    Clock::time_point sent;
+};
+
+struct Session {
+    int fd = -1;
+    size_t setupPending = 0;  // CONNECT, SUBSCRIBE or UNSUBSCRIBE not acknowledged yet
+    std::vector<uint8_t> out;
+    size_t outOffset = 0;
+    std::vector<uint8_t> in;
+    std::deque<Pending> pending;
+    bool closing = false;  // Close once everything is written
+};
+
+struct Stats {
+    uint64_t frames = 0;
+    uint64_t bytes = 0;
+    uint64_t deliveries = 0;
+    uint64_t deliveredBytes = 0;
+    uint64_t connectFailures = 0;
+    Clock::time_point last;  // Last record sent or response received, ends the measured interval
+    std::map<std::string, std::vector<double>> latencies;  // Acknowledgement kind -> microseconds
+};
+
+void usage() {
+    std::cerr << "Usage: mqtt-replay [--host HOST] [--port PORT] [--speed FACTOR | --max] [--drain SECONDS] CAPTURE\n"
+              << "  --speed FACTOR  replay FACTOR times faster than recorded (default 1)\n"
+              << "  --max           send every record as fast as the broker takes it, connections\n"
+              << "                  stay in order but may overtake each other\n"
+              << "  --drain SECONDS wait this long for outstanding acknowledgements (default 2)\n";
+}
+
+bool parseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--host" && hasValue) {
+            options.host = argv[++i];
+        } else if (arg == "--port" && hasValue) {
+            options.port = argv[++i];
+        } else if (arg == "--speed" && hasValue) {
+            options.speed = std::atof(argv[++i]);
+            if (options.speed <= 0) {
+                return false;
+            }
+        } else if (arg == "--max") {
+            options.speed = 0;
+        } else if (arg == "--drain" && hasValue) {
+            options.drain = std::atof(argv[++i]);
+        } else if (!arg.empty() && arg[0] != '-' && options.capture.empty()) {
+            options.capture = arg;
+        } else {
+            return false;
+        }
+    }
+    return !options.capture.empty();
+}
+
+int connectTo(const Options& options) {
+    struct addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* result = nullptr;
+    if (getaddrinfo(options.host.c_str(), options.port.c_str(), &hints, &result) != 0) {
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo* ai = result; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+    if (fd >= 0) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    }
+    return fd;
+}
+
+// Fixed header of a complete packet at data, false until all of it is there
+bool framePacket(const uint8_t* data, size_t size, size_t& header, size_t& total) {
+    uint32_t remaining = 0;
+    for (size_t i = 1; i < 5; ++i) {
+        if (i >= size) {
+            return false;
+        }
+        remaining |= static_cast<uint32_t>(data[i] & 0x7F) << (7 * (i - 1));
+        if ((data[i] & 0x80) == 0) {
+            header = i + 1;
+            total = header + remaining;
+            return total <= size;
+        }
+    }
+    throw std::runtime_error("Malformed remaining length from broker");
+}
+
+uint16_t readUint16(const uint8_t* data) {
+    return static_cast<uint16_t>((data[0] << 8) | data[1]);
+}
+
+// Requests that get an acknowledgement are timed until it arrives
+void noteRequest(Session& session, const std::vector<uint8_t>& frame, Clock::time_point now) {
+    size_t header;
+    size_t total;
+    if (frame.empty() || !framePacket(frame.data(), frame.size(), header, total)) {
+        return;
+    }
+    uint8_t type = frame[0] >> 4;
+    const uint8_t* body = frame.data() + header;
+    size_t length = total - header;
+    switch (type) {
+        case 1:  // CONNECT -> CONNACK
+            session.pending.push_back(Pending{2, 0, now});
+            ++session.setupPending;
+            break;
+        case 3: {  // PUBLISH QoS 1 -> PUBACK
+            if (((frame[0] >> 1) & 0x03) == 1 && length >= 2) {
+                size_t topicLength = readUint16(body);
+                if (length >= 4 + topicLength) {
+                    session.pending.push_back(Pending{4, readUint16(body + 2 + topicLength), now});
+                }
+            }
+            break;
+        }
+        case 8:   // SUBSCRIBE -> SUBACK
+        case 10:  // UNSUBSCRIBE -> UNSUBACK
+            if (length >= 2) {
+                session.pending.push_back(Pending{static_cast<uint8_t>(type + 1), readUint16(body), now});
+                ++session.setupPending;
+            }
+            break;
+        case 12:  // PINGREQ -> PINGRESP
+            session.pending.push_back(Pending{13, 0, now});
+            break;
+        default:
+            break;
+    }
+}
+
+const char* ackName(uint8_t type) {
+    switch (type) {
+        case 2: return "connack";
+        case 4: return "puback";
+        case 9: return "suback";
+        case 11: return "unsuback";
+        case 13: return "pingresp";
+    }
+    return "other";
+}
+
+void handleResponse(Session& session, const uint8_t* frame, size_t header, size_t total, Clock::time_point now,
+                    Stats& stats) {
+    uint8_t type = frame[0] >> 4;
+    stats.last = now;
+    if (type == 3) {
+        ++stats.deliveries;
+        stats.deliveredBytes += total;
+        return;
+    }
+    uint16_t packet_id = (type == 4 || type == 9 || type == 11) && total >= header + 2 ? readUint16(frame + header) : 0;
+    for (auto it = session.pending.begin(); it != session.pending.end(); ++it) {
+        if (it->type == type && it->packet_id == packet_id) {
+            stats.latencies[ackName(type)].push_back(
+                std::chrono::duration<double, std::micro>(now - it->sent).count());
+            if (type == 2 || type == 9 || type == 11) {
+                --session.setupPending;
+            }
+            session.pending.erase(it);
+            return;
+        }
+    }
+}
+
+void closeSession(Session& session) {
+    if (session.fd >= 0) {
+        close(session.fd);
+        session.fd = -1;
+    }
+    session.pending.clear();
+    session.setupPending = 0;
+}
+
+void readSession(Session& session, Stats& stats) {
+    uint8_t buffer[65536];
+    bool closed = false;
+    while (true) {
+        ssize_t n = recv(session.fd, buffer, sizeof(buffer), 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (n <= 0) {
+            closed = true;  // Still count what arrived before the broker closed
+            break;
+        }
+        session.in.insert(session.in.end(), buffer, buffer + n);
+    }
+    
+    auto now = Clock::now();
+    size_t offset = 0;
+    size_t header;
+    size_t total;
+    while (framePacket(session.in.data() + offset, session.in.size() - offset, header, total)) {
+        handleResponse(session, session.in.data() + offset, header, total, now, stats);
+        offset += total;
+    }
+    session.in.erase(session.in.begin(), session.in.begin() + static_cast<std::ptrdiff_t>(offset));
+    if (closed) {
+        closeSession(session);
+    }
+}
+
+void writeSession(Session& session) {
+    while (session.fd >= 0 && session.outOffset < session.out.size()) {
+        ssize_t n = send(session.fd, session.out.data() + session.outOffset, session.out.size() - session.outOffset,
+                         MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                closeSession(session);
+            }
+            return;
+        }
+        session.outOffset += static_cast<size_t>(n);
+    }
+    if (session.outOffset == session.out.size()) {
+        session.out.clear();
+        session.outOffset = 0;
+        if (session.closing && session.pending.empty()) {
+            closeSession(session);
+        }
+    }
+}
+
+double percentile(std::vector<double>& samples, double p) {
+    size_t index = static_cast<size_t>(p * static_cast<double>(samples.size() - 1) + 0.5);
+    std::nth_element(samples.begin(), samples.begin() + static_cast<std::ptrdiff_t>(index), samples.end());
+    return samples[index];
+}
+
+void report(Stats& stats, double elapsed, uint64_t capturedUs) {
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "Replayed " << stats.frames << " records, " << stats.bytes << " bytes in " << elapsed << " s"
+              << " (captured over " << static_cast<double>(capturedUs) / 1e6 << " s)\n";
+    std::cout << "  sent:      " << static_cast<double>(stats.frames) / elapsed << " records/s, "
+              << static_cast<double>(stats.bytes) / elapsed / 1e6 << " MB/s\n";
+    std::cout << "  delivered: " << stats.deliveries << " publishes, "
+              << static_cast<double>(stats.deliveries) / elapsed << " msg/s, "
+              << static_cast<double>(stats.deliveredBytes) / elapsed / 1e6 << " MB/s\n";
+    if (stats.connectFailures > 0) {
+        std::cout << "  " << stats.connectFailures << " connections failed\n";
+    }
+    for (auto& [name, samples] : stats.latencies) {
+        if (samples.empty()) {
+            continue;
+        }
+        std::cout << "  " << std::left << std::setw(9) << name << std::right << " n=" << samples.size()
+                  << " p50=" << percentile(samples, 0.50) << "us p90=" << percentile(samples, 0.90)
+                  << "us p99=" << percentile(samples, 0.99) << "us max=" << percentile(samples, 1.0) << "us\n";
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        usage();
+        return 2;
+    }
+    
+    try {
+        CaptureReader reader(options.capture);
+        std::map<uint32_t, Session> sessions;
+        Stats stats;
+        
+        Capture::Record record;
+        bool haveRecord = reader.next(record);
+        uint64_t lastRecordUs = 0;
+        auto start = Clock::now();
+        auto due = [&](const Capture::Record& r) {
+            return start + std::chrono::microseconds(static_cast<int64_t>(static_cast<double>(r.time_us) / options.speed));
+        };
+        Clock::time_point drainDeadline;
+        bool draining = false;
+        
+        while (true) {
+            // Apply every record that is due, up to a batch when unpaced
+            size_t buffered = 0;
+            for (auto& [id, session] : sessions) {
+                buffered += session.out.size() - session.outOffset;
+            }
+            size_t applied = 0;
+            while (haveRecord && buffered < MAX_BUFFERED_BYTES && applied < RECORDS_PER_POLL &&
+                   (options.speed == 0 || due(record) <= Clock::now())) {
+                // Nothing overtakes a connection's session setup, so later traffic finds
+                // the client connected and its subscriptions in place, as it was recorded
+                Session& session = sessions[record.connection];
+                if (session.setupPending > 0) {
+                    break;
+                }
+                switch (record.type) {
+                    case Capture::RecordType::OPEN:
+                        session.fd = connectTo(options);
+                        if (session.fd < 0) {
+                            ++stats.connectFailures;
+                        }
+                        break;
+                    case Capture::RecordType::FRAME:
+                    case Capture::RecordType::DATA:
+                        if (session.fd >= 0) {
+                            if (record.type == Capture::RecordType::FRAME) {
+                                noteRequest(session, record.bytes, Clock::now());
+                            }
+                            session.out.insert(session.out.end(), record.bytes.begin(), record.bytes.end());
+                            buffered += record.bytes.size();
+                            writeSession(session);
+                            ++stats.frames;
+                            stats.bytes += record.bytes.size();
+                            stats.last = Clock::now();
+                        }
+                        break;
+                    case Capture::RecordType::CLOSE:
+                        session.closing = true;
+                        writeSession(session);
+                        break;
+                }
+                lastRecordUs = record.time_us;
+                ++applied;
+                haveRecord = reader.next(record);
+            }
+            
+            if (!haveRecord && !draining) {
+                draining = true;
+                drainDeadline = Clock::now() + std::chrono::microseconds(static_cast<int64_t>(options.drain * 1e6));
+            }
+            
+            // Wait for responses, writable sockets or the next record
+            std::vector<struct pollfd> fds;
+            std::vector<Session*> polled;
+            bool outstanding = false;
+            for (auto& [id, session] : sessions) {
+                if (session.fd < 0) {
+                    continue;
+                }
+                bool unsent = session.outOffset < session.out.size();
+                outstanding = outstanding || unsent || !session.pending.empty();
+                fds.push_back({session.fd, static_cast<short>(POLLIN | (unsent ? POLLOUT : 0)), 0});
+                polled.push_back(&session);
+            }
+            if (draining && (!outstanding || Clock::now() >= drainDeadline)) {
+                break;
+            }
+            
+            auto until = draining ? drainDeadline : haveRecord && options.speed > 0 ? due(record) : Clock::now();
+            if (haveRecord && buffered >= MAX_BUFFERED_BYTES) {
+                until = Clock::now() + std::chrono::milliseconds(10);
+            }
+            // Microsecond timeout, so paced records keep their recorded spacing
+            int64_t waitNs = std::max<int64_t>(0,
+                std::chrono::duration_cast<std::chrono::nanoseconds>(until - Clock::now()).count());
+            struct timespec timeout = {static_cast<time_t>(waitNs / 1000000000), static_cast<long>(waitNs % 1000000000)};
+            if (ppoll(fds.data(), fds.size(), &timeout, nullptr) < 0 && errno != EINTR) {
+                throw std::runtime_error(std::string("ppoll: ") + std::strerror(errno));
+            }
+            for (size_t i = 0; i < fds.size(); ++i) {
+                if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                    readSession(*polled[i], stats);
+                    if (polled[i]->closing && polled[i]->pending.empty() && polled[i]->out.empty()) {
+                        closeSession(*polled[i]);
+                    }
+                }
+                if (fds[i].revents & POLLOUT) {
+                    writeSession(*polled[i]);
+                }
+            }
+        }
+        
+        double elapsed = std::chrono::duration<double>(std::max(stats.last, start) - start).count();
+        elapsed = std::max(elapsed, 1e-6);
+        for (auto& [id, session] : sessions) {
+            closeSession(session);
+        }
+        report(stats, elapsed, lastRecordUs);
+    } catch (const std::exception& e) {
+        std::cerr << "mqtt-replay: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}